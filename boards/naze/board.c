@@ -38,7 +38,18 @@
 extern void SetSysClock(bool overclock);
 serialPort_t *Serial1;
 
+// Cortex-M3 debug registers for the cycle counter
+#define DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA (1 << 24)
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
 static uint8_t _board_revision;
+static uint32_t _cycles_per_us;
+
+static void (*_imu_callback)(void *arg) = NULL;
+static void *_imu_callback_arg = NULL;
 
 void init_board(void)
 {
@@ -46,6 +57,14 @@ void init_board(void)
   SetSysClock(0);
   systemInit();
   _board_revision = 2;
+
+  // Start the cycle counter
+  RCC_ClocksTypeDef clocks;
+  RCC_GetClocksFreq(&clocks);
+  _cycles_per_us = clocks.SYSCLK_Frequency / 1000000;
+  DEMCR |= DEMCR_TRCENA;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA;
 }
 
 void board_reset(bool bootloader)
@@ -69,6 +88,53 @@ void clock_delay(uint32_t milliseconds)
   delay(milliseconds);
 }
 
+uint32_t clock_cycles()
+{
+  return DWT_CYCCNT;
+}
+
+uint32_t clock_cycles_per_us()
+{
+  return _cycles_per_us;
+}
+
+// soft interrupt
+// PendSV at the lowest priority, so every hardware interrupt can preempt it.
+// Disabling it raises BASEPRI just enough to mask that lowest level.
+#define SOFT_INTERRUPT_PRIORITY ((1 << __NVIC_PRIO_BITS) - 1)
+
+static void (*_soft_interrupt_callback)(void *arg) = NULL;
+static void *_soft_interrupt_arg = NULL;
+
+void PendSV_Handler(void)
+{
+  if (_soft_interrupt_callback != NULL)
+    _soft_interrupt_callback(_soft_interrupt_arg);
+}
+
+void soft_interrupt_register(void (*callback)(void *arg), void *arg)
+{
+  NVIC_SetPriority(PendSV_IRQn, SOFT_INTERRUPT_PRIORITY);
+  _soft_interrupt_arg = arg;
+  _soft_interrupt_callback = callback;
+}
+
+void soft_interrupt_trigger(void)
+{
+  SCB->ICSR = SCB_ICSR_PENDSVSET;
+}
+
+void soft_interrupt_disable(void)
+{
+  __set_BASEPRI(SOFT_INTERRUPT_PRIORITY << (8 - __NVIC_PRIO_BITS));
+}
+
+void soft_interrupt_enable(void)
+{
+  // a pending PendSV runs as soon as BASEPRI is cleared
+  __set_BASEPRI(0);
+}
+
 // serial
 
 void serial_init(uint32_t baud_rate)
@@ -120,9 +186,18 @@ void sensors_init()
   _accel_scale = 9.80665f/acc1G;
 }
 
-void imu_register_callback(void (*callback)(void))
+// The driver callback takes no argument, so forward it to the registered one
+static void imu_interrupt(void)
 {
-  mpu6050_register_interrupt_cb(callback);
+  if (_imu_callback != NULL)
+    _imu_callback(_imu_callback_arg);
+}
+
+void imu_register_callback(void (*callback)(void *arg), void *arg)
+{
+  _imu_callback = callback;
+  _imu_callback_arg = arg;
+  mpu6050_register_interrupt_cb(imu_interrupt);
 }
 
 void imu_not_responding_error()
@@ -177,6 +252,180 @@ void imu_read_gyro(float gyro[3])
   gyro[2] = -gyro_raw[2] * _gyro_scale;
 }
 
+// The MPU6050 registers from ACCEL_XOUT_H through GYRO_ZOUT_L, read in one job
+// through the breezystm32 I2C job queue.  The job callbacks run in the I2C interrupt.
+// With the FIFO on, it holds only the 6 gyro bytes of each sample, so the 400 kHz bus
+// can keep up, and the accel and temperature registers are read once per burst.
+#define MPU_ADDRESS 0x68
+#define MPU_RA_SMPLRT_DIV 0x19
+#define MPU_RA_CONFIG 0x1A
+#define MPU_RA_FIFO_EN 0x23
+#define MPU_RA_ACCEL_XOUT_H 0x3B
+#define MPU_RA_USER_CTRL 0x6A
+#define MPU_RA_FIFO_COUNTH 0x72
+#define MPU_RA_FIFO_R_W 0x74
+
+#define MPU_FIFO_EN_GYRO 0x70
+#define MPU_USER_CTRL_FIFO_EN 0x40
+#define MPU_USER_CTRL_FIFO_RESET 0x04
+#define MPU_SAMPLE_BYTES 14
+#define MPU_ACCEL_TEMP_BYTES 8
+#define MPU_FIFO_SAMPLE_BYTES 6
+#define MPU_MAX_FIFO_SAMPLES 16 // so a burst fits in one I2C job
+#define MPU_FIFO_BYTES 1024
+
+static uint8_t _imu_buffer[MPU_FIFO_SAMPLE_BYTES * MPU_MAX_FIFO_SAMPLES]; // also holds one MPU_SAMPLE_BYTES read
+static uint8_t _imu_fifo_count[2];
+static volatile uint8_t _imu_status;
+static uint8_t _imu_fifo_restart = MPU_USER_CTRL_FIFO_RESET | MPU_USER_CTRL_FIFO_EN;
+static volatile uint8_t _imu_restart_status;
+static float *_imu_accel;
+static float (*_imu_gyro)[3];
+static float *_imu_temperature;
+static uint8_t _imu_max_samples;
+static uint8_t *_imu_count;
+static void (*_imu_complete)(bool success, void *arg) = NULL;
+static void *_imu_complete_arg = NULL;
+
+void imu_configure(uint32_t sample_rate_hz, bool fifo)
+{
+  // The gyro runs at 8 kHz with the DLPF off, or at 1 kHz with it on
+  if (sample_rate_hz > 1000)
+  {
+    i2cWrite(MPU_ADDRESS, MPU_RA_CONFIG, 0);
+    i2cWrite(MPU_ADDRESS, MPU_RA_SMPLRT_DIV, 8000 / sample_rate_hz - 1);
+  }
+  else
+  {
+    i2cWrite(MPU_ADDRESS, MPU_RA_SMPLRT_DIV, 1000 / (sample_rate_hz > 0 ? sample_rate_hz : 1000) - 1);
+  }
+
+  i2cWrite(MPU_ADDRESS, MPU_RA_USER_CTRL, MPU_USER_CTRL_FIFO_RESET);
+  i2cWrite(MPU_ADDRESS, MPU_RA_FIFO_EN, fifo ? MPU_FIFO_EN_GYRO : 0);
+  i2cWrite(MPU_ADDRESS, MPU_RA_USER_CTRL, fifo ? MPU_USER_CTRL_FIFO_EN : 0);
+}
+
+// accel then temperature, as in ACCEL_XOUT_H through TEMP_OUT_L
+static void imu_decode_accel(const uint8_t *buffer, float accel[3], float *temperature)
+{
+  // Convert to NED
+  int16_t accel_raw[3];
+  for (int i = 0; i < 3; i++)
+    accel_raw[i] = (int16_t) ((buffer[2*i] << 8) | buffer[2*i + 1]);
+  int16_t temperature_raw = (int16_t) ((buffer[6] << 8) | buffer[7]);
+
+  accel[0] = accel_raw[0] * _accel_scale;
+  accel[1] = -accel_raw[1] * _accel_scale;
+  accel[2] = -accel_raw[2] * _accel_scale;
+
+  (*temperature) = temperature_raw/340.0f + 36.53f;
+}
+
+static void imu_decode_gyro(const uint8_t *buffer, float gyro[3])
+{
+  // Convert to NED
+  int16_t gyro_raw[3];
+  for (int i = 0; i < 3; i++)
+    gyro_raw[i] = (int16_t) ((buffer[2*i] << 8) | buffer[2*i + 1]);
+
+  gyro[0] = gyro_raw[0] * _gyro_scale;
+  gyro[1] = -gyro_raw[1] * _gyro_scale;
+  gyro[2] = -gyro_raw[2] * _gyro_scale;
+}
+
+static void imu_read_all_async_cb(void)
+{
+  imu_decode_accel(_imu_buffer, _imu_accel, _imu_temperature);
+  imu_decode_gyro(&_imu_buffer[MPU_ACCEL_TEMP_BYTES], _imu_gyro[0]);
+
+  bool success = (_imu_status == I2C_JOB_COMPLETE) && !(_imu_accel[0] == 0 && _imu_accel[1] == 0 && _imu_accel[2] == 0);
+  if (_imu_complete != NULL)
+    _imu_complete(success, _imu_complete_arg);
+}
+
+bool imu_read_all_async(float accel[3], float gyro[3], float *temperature,
+                        void (*complete)(bool success, void *arg), void *arg)
+{
+  _imu_accel = accel;
+  _imu_gyro = (float (*)[3]) gyro;
+  _imu_temperature = temperature;
+  _imu_complete = complete;
+  _imu_complete_arg = arg;
+  i2c_queue_job(READ, MPU_ADDRESS, MPU_RA_ACCEL_XOUT_H, _imu_buffer, MPU_SAMPLE_BYTES, &_imu_status, &imu_read_all_async_cb);
+  return true;
+}
+
+static void imu_read_fifo_accel_cb(void)
+{
+  imu_decode_accel(_imu_buffer, _imu_accel, _imu_temperature);
+  if (_imu_complete != NULL)
+    _imu_complete(_imu_status == I2C_JOB_COMPLETE, _imu_complete_arg);
+}
+
+static void imu_read_fifo_data_cb(void)
+{
+  for (int i = 0; i < *_imu_count; i++)
+    imu_decode_gyro(&_imu_buffer[i * MPU_FIFO_SAMPLE_BYTES], _imu_gyro[i]);
+
+  if (_imu_status != I2C_JOB_COMPLETE)
+  {
+    if (_imu_complete != NULL)
+      _imu_complete(false, _imu_complete_arg);
+    return;
+  }
+  i2c_queue_job(READ, MPU_ADDRESS, MPU_RA_ACCEL_XOUT_H, _imu_buffer, MPU_ACCEL_TEMP_BYTES, &_imu_status, &imu_read_fifo_accel_cb);
+}
+
+// Reading the FIFO takes three jobs, the count, the gyro samples and then the accel
+static void imu_read_fifo_count_cb(void)
+{
+  uint16_t bytes = (_imu_fifo_count[0] << 8) | _imu_fifo_count[1];
+  *_imu_count = 0;
+  if (_imu_status != I2C_JOB_COMPLETE)
+  {
+    if (_imu_complete != NULL)
+      _imu_complete(false, _imu_complete_arg);
+    return;
+  }
+
+  // A full FIFO keeps taking bytes, so its frames no longer line up with the samples.
+  // Everything in it is lost, and it starts over empty before the next count is read.
+  if (bytes >= MPU_FIFO_BYTES || bytes % MPU_FIFO_SAMPLE_BYTES != 0)
+  {
+    i2c_queue_job(WRITE, MPU_ADDRESS, MPU_RA_USER_CTRL, &_imu_fifo_restart, 1, &_imu_restart_status, NULL);
+    *_imu_count = bytes / MPU_FIFO_SAMPLE_BYTES;
+    if (_imu_complete != NULL)
+      _imu_complete(false, _imu_complete_arg);
+    return;
+  }
+
+  uint16_t samples = bytes / MPU_FIFO_SAMPLE_BYTES;
+  if (samples > _imu_max_samples)
+    samples = _imu_max_samples;
+  *_imu_count = samples;
+  if (samples == 0)
+  {
+    if (_imu_complete != NULL)
+      _imu_complete(false, _imu_complete_arg);
+    return;
+  }
+  i2c_queue_job(READ, MPU_ADDRESS, MPU_RA_FIFO_R_W, _imu_buffer, samples * MPU_FIFO_SAMPLE_BYTES, &_imu_status, &imu_read_fifo_data_cb);
+}
+
+bool imu_read_fifo_async(float accel[3], float gyro[][3], float *temperature, uint8_t max_samples, uint8_t *count,
+                         void (*complete)(bool success, void *arg), void *arg)
+{
+  _imu_accel = accel;
+  _imu_gyro = gyro;
+  _imu_temperature = temperature;
+  _imu_max_samples = (max_samples < MPU_MAX_FIFO_SAMPLES) ? max_samples : MPU_MAX_FIFO_SAMPLES;
+  _imu_count = count;
+  _imu_complete = complete;
+  _imu_complete_arg = arg;
+  i2c_queue_job(READ, MPU_ADDRESS, MPU_RA_FIFO_COUNTH, _imu_fifo_count, sizeof(_imu_fifo_count), &_imu_status, &imu_read_fifo_count_cb);
+  return true;
+}
+
 float imu_read_temperature(void)
 {
   int16_t temperature_raw;
@@ -31,13 +31,15 @@
 
 #include "rosflight.h"
 
+static rosflight_t rosflight;
+
 int main(void)
 {
-  rosflight_init();
+  rosflight_init(&rosflight);
 
   while(1)
   {
-    rosflight_run();
+    rosflight_run(&rosflight);
   }
   return 0;
 }
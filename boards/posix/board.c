@@ -0,0 +1,731 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "mavlink.h"
+
+#include "posix_board.h"
+#include "trace.h"
+
+#define POSIX_IMU_FIFO_SIZE 64
+
+struct posix_board_t
+{
+  // clock
+  uint64_t time_us;
+
+  // soft interrupt
+  void (*soft_interrupt_callback)(void *arg);
+  void *soft_interrupt_arg;
+  bool soft_interrupt_disabled;
+  bool soft_interrupt_pending;
+  bool soft_interrupt_running;
+
+  // serial
+  int serial_fd;
+  uint8_t serial_rx_buffer[256];
+  uint16_t serial_rx_head;
+  uint16_t serial_rx_tail;
+  mavlink_status_t mavlink_status[MAVLINK_COMM_NUM_BUFFERS];
+  mavlink_message_t mavlink_buffer[MAVLINK_COMM_NUM_BUFFERS];
+
+  // non-volatile memory
+  const char *memory_file;
+  uint8_t *memory_image;  // replaces the file when set
+  size_t memory_image_len;
+
+  // sensors
+  void (*imu_callback)(void *arg);
+  void *imu_callback_arg;
+  bool imu_present;
+  float accel[3];
+  float gyro[3];
+  float imu_temperature;
+  bool imu_fifo_enabled;
+  float imu_fifo[POSIX_IMU_FIFO_SIZE][3]; // gyro only, like the naze
+  uint16_t imu_fifo_head;
+  uint16_t imu_fifo_count;
+  bool imu_fifo_overflow;
+
+  bool baro_present;
+  float baro_pressure;
+  float baro_temperature;
+  float baro_ground_altitude;
+
+  bool mag_present;
+  float mag[3];
+
+  bool sonar_present;
+  float sonar_range;
+
+  bool diff_pressure_present;
+  float diff_pressure;
+  float diff_pressure_temperature;
+  float diff_pressure_offset;
+  float atm_pressure;
+
+  // PWM
+  uint16_t rc[POSIX_PWM_CHANNELS];
+  bool rc_lost;
+  uint16_t pwm_outputs[POSIX_PWM_CHANNELS];
+  uint32_t imu_interrupt_cycles;
+  uint32_t pwm_write_cycles;
+  bool pwm_written_since_imu;
+
+  // LEDs
+  bool led0;
+  bool led1;
+};
+
+#define POSIX_BOARD_DEFAULTS \
+{ \
+  .serial_fd = -1, \
+  .memory_file = "rosflight_memory.bin", \
+  .imu_temperature = 25.0f, \
+  .baro_pressure = 101325.0f, \
+  .baro_temperature = 25.0f, \
+  .diff_pressure_temperature = 25.0f, \
+  .atm_pressure = 101325.0f, \
+  .rc = {1500, 1500, 1000, 1500, 1000, 1000, 1000, 1000} \
+}
+
+// Boards are per thread, so that each thread can run its own firmware instance.
+// Threads that never select a board share the default one.
+static posix_board_t _default_board = POSIX_BOARD_DEFAULTS;
+static __thread posix_board_t *_board = &_default_board;
+
+posix_board_t *posix_board_create(void)
+{
+  static const posix_board_t defaults = POSIX_BOARD_DEFAULTS;
+  posix_board_t *board = malloc(sizeof(posix_board_t));
+  if (board != NULL)
+    *board = defaults;
+  return board;
+}
+
+void posix_board_destroy(posix_board_t *board)
+{
+  if (board == _board)
+    _board = &_default_board;
+  free(board->memory_image);
+  free(board);
+}
+
+void posix_board_select(posix_board_t *board)
+{
+  _board = (board != NULL) ? board : &_default_board;
+}
+
+// setup
+void init_board(void)
+{
+}
+
+void board_reset(bool bootloader)
+{
+  // there is no bootloader, just stop so whoever started us can start us again
+  fprintf(stderr, "board reset requested%s, exiting\n", bootloader ? " (bootloader)" : "");
+  exit(0);
+}
+
+// clock
+uint32_t clock_millis()
+{
+  return _board->time_us / 1000;
+}
+
+uint64_t clock_micros()
+{
+  return _board->time_us;
+}
+
+void clock_delay(uint32_t milliseconds)
+{
+  // time passes instantly on the virtual clock
+  _board->time_us += (uint64_t) milliseconds * 1000;
+}
+
+uint32_t clock_cycles()
+{
+  // use host nanoseconds as cycles, so the profiler measures real execution time
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+uint32_t clock_cycles_per_us()
+{
+  return 1000;
+}
+
+// soft interrupt
+// Nothing here is concurrent, so the callback runs straight away when it is
+// triggered, or as soon as it is enabled again.
+static void soft_interrupt_run(void)
+{
+  while (_board->soft_interrupt_pending && !_board->soft_interrupt_disabled && !_board->soft_interrupt_running)
+  {
+    _board->soft_interrupt_pending = false;
+    if (_board->soft_interrupt_callback != NULL)
+    {
+      _board->soft_interrupt_running = true;
+      _board->soft_interrupt_callback(_board->soft_interrupt_arg);
+      _board->soft_interrupt_running = false;
+    }
+  }
+}
+
+void soft_interrupt_register(void (*callback)(void *arg), void *arg)
+{
+  _board->soft_interrupt_callback = callback;
+  _board->soft_interrupt_arg = arg;
+}
+
+void soft_interrupt_trigger(void)
+{
+  _board->soft_interrupt_pending = true;
+  soft_interrupt_run();
+}
+
+void soft_interrupt_disable(void)
+{
+  _board->soft_interrupt_disabled = true;
+}
+
+void soft_interrupt_enable(void)
+{
+  _board->soft_interrupt_disabled = false;
+  soft_interrupt_run();
+}
+
+void posix_clock_set(uint64_t time_us)
+{
+  if (time_us > _board->time_us)
+    _board->time_us = time_us;
+}
+
+// serial
+bool posix_serial_open_pty(void)
+{
+  _board->serial_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (_board->serial_fd < 0 || grantpt(_board->serial_fd) != 0 || unlockpt(_board->serial_fd) != 0)
+  {
+    perror("pty");
+    _board->serial_fd = -1;
+    return false;
+  }
+
+  // raw bytes, no line discipline
+  struct termios tio;
+  tcgetattr(_board->serial_fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(_board->serial_fd, TCSANOW, &tio);
+
+  fcntl(_board->serial_fd, F_SETFL, fcntl(_board->serial_fd, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+const char *posix_serial_name(void)
+{
+  return (_board->serial_fd < 0) ? NULL : ptsname(_board->serial_fd);
+}
+
+void serial_init(uint32_t baud_rate)
+{
+  (void) baud_rate;
+}
+
+void serial_write(uint8_t byte)
+{
+  // bytes are dropped if nobody is listening, just like an unplugged UART
+  if (_board->serial_fd >= 0)
+  {
+    ssize_t written = write(_board->serial_fd, &byte, 1);
+    (void) written;
+  }
+}
+
+uint16_t serial_bytes_available(void)
+{
+  if (_board->serial_fd >= 0 && _board->serial_rx_head == _board->serial_rx_tail)
+  {
+    ssize_t n = read(_board->serial_fd, _board->serial_rx_buffer, sizeof(_board->serial_rx_buffer));
+    _board->serial_rx_head = 0;
+    _board->serial_rx_tail = (n > 0) ? n : 0;
+    trace_record_serial(_board->serial_rx_buffer, _board->serial_rx_tail);
+  }
+  return _board->serial_rx_tail - _board->serial_rx_head;
+}
+
+void posix_serial_receive(const uint8_t *bytes, size_t len)
+{
+  if (_board->serial_rx_head == _board->serial_rx_tail)
+    _board->serial_rx_head = _board->serial_rx_tail = 0;
+
+  size_t space = sizeof(_board->serial_rx_buffer) - _board->serial_rx_tail;
+  if (len > space)
+  {
+    fprintf(stderr, "serial receive buffer full, dropping %zu bytes\n", len - space);
+    len = space;
+  }
+  memcpy(&_board->serial_rx_buffer[_board->serial_rx_tail], bytes, len);
+  _board->serial_rx_tail += len;
+}
+
+uint8_t serial_read(void)
+{
+  if (serial_bytes_available() == 0)
+    return 0;
+  return _board->serial_rx_buffer[_board->serial_rx_head++];
+}
+
+// The MAVLink library keeps its parser and sequence state per channel.  Keep it
+// per board instead, so that firmware instances on different threads don't share it.
+#ifdef MAVLINK_GET_CHANNEL_STATUS
+mavlink_status_t *mavlink_get_channel_status(uint8_t chan)
+{
+  return &_board->mavlink_status[chan];
+}
+#endif
+
+#ifdef MAVLINK_GET_CHANNEL_BUFFER
+mavlink_message_t *mavlink_get_channel_buffer(uint8_t chan)
+{
+  return &_board->mavlink_buffer[chan];
+}
+#endif
+
+// sensors
+void sensors_init()
+{
+}
+
+void imu_register_callback(void (*callback)(void *arg), void *arg)
+{
+  _board->imu_callback = callback;
+  _board->imu_callback_arg = arg;
+}
+
+void posix_imu_set(const float accel[3], const float gyro[3], float temperature)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    _board->accel[i] = accel[i];
+    _board->gyro[i] = gyro[i];
+  }
+  _board->imu_temperature = temperature;
+  _board->imu_present = true;
+
+  float record[7] = {accel[0], accel[1], accel[2], gyro[0], gyro[1], gyro[2], temperature};
+  trace_record(TRACE_IMU, record, sizeof(record));
+}
+
+void posix_imu_interrupt(void)
+{
+  // like the MPU6050, a full FIFO spoils what it holds until the next read empties it
+  if (_board->imu_fifo_enabled && _board->imu_present && _board->imu_fifo_count == POSIX_IMU_FIFO_SIZE)
+    _board->imu_fifo_overflow = true;
+  else if (_board->imu_fifo_enabled && _board->imu_present)
+  {
+    float *sample = _board->imu_fifo[(_board->imu_fifo_head + _board->imu_fifo_count) % POSIX_IMU_FIFO_SIZE];
+    for (int i = 0; i < 3; i++)
+      sample[i] = _board->gyro[i];
+    _board->imu_fifo_count++;
+  }
+
+  _board->imu_interrupt_cycles = clock_cycles();
+  _board->pwm_written_since_imu = false;
+  trace_record(TRACE_IMU_INTERRUPT, NULL, 0);
+  if (_board->imu_callback != NULL)
+    _board->imu_callback(_board->imu_callback_arg);
+}
+
+void imu_not_responding_error()
+{
+  fprintf(stderr, "imu not responding\n");
+}
+
+bool imu_read_all(float accel[3], float gyro[3], float *temperature)
+{
+  imu_read_accel(accel);
+  imu_read_gyro(gyro);
+  (*temperature) = _board->imu_temperature;
+  return _board->imu_present;
+}
+
+// The transfer finishes immediately, so complete runs before this returns
+bool imu_read_all_async(float accel[3], float gyro[3], float *temperature,
+                        void (*complete)(bool success, void *arg), void *arg)
+{
+  bool success = imu_read_all(accel, gyro, temperature);
+  complete(success, arg);
+  return true;
+}
+
+// The simulation decides when samples arrive, so only the FIFO setting matters here
+void imu_configure(uint32_t sample_rate_hz, bool fifo)
+{
+  (void) sample_rate_hz;
+  _board->imu_fifo_enabled = fifo;
+  _board->imu_fifo_head = 0;
+  _board->imu_fifo_count = 0;
+  _board->imu_fifo_overflow = false;
+}
+
+bool imu_read_fifo_async(float accel[3], float gyro[][3], float *temperature, uint8_t max_samples, uint8_t *count,
+                         void (*complete)(bool success, void *arg), void *arg)
+{
+  if (_board->imu_fifo_overflow)
+  {
+    (*count) = _board->imu_fifo_count;
+    _board->imu_fifo_head = 0;
+    _board->imu_fifo_count = 0;
+    _board->imu_fifo_overflow = false;
+    complete(false, arg);
+    return true;
+  }
+
+  uint8_t n = 0;
+  while (n < max_samples && _board->imu_fifo_count > 0)
+  {
+    const float *sample = _board->imu_fifo[_board->imu_fifo_head];
+    for (int i = 0; i < 3; i++)
+      gyro[n][i] = sample[i];
+    _board->imu_fifo_head = (_board->imu_fifo_head + 1) % POSIX_IMU_FIFO_SIZE;
+    _board->imu_fifo_count--;
+    n++;
+  }
+  (*count) = n;
+  imu_read_accel(accel);
+  (*temperature) = _board->imu_temperature;
+  complete(n > 0, arg);
+  return true;
+}
+
+void imu_read_accel(float accel[3])
+{
+  for (int i = 0; i < 3; i++)
+    accel[i] = _board->accel[i];
+}
+
+void imu_read_gyro(float gyro[3])
+{
+  for (int i = 0; i < 3; i++)
+    gyro[i] = _board->gyro[i];
+}
+
+float imu_read_temperature(void)
+{
+  return _board->imu_temperature;
+}
+
+void posix_mag_set(const float mag[3])
+{
+  for (int i = 0; i < 3; i++)
+    _board->mag[i] = mag[i];
+  _board->mag_present = true;
+  trace_record(TRACE_MAG, _board->mag, sizeof(_board->mag));
+}
+
+bool mag_present(void)
+{
+  return _board->mag_present;
+}
+
+void mag_read(float mag[3])
+{
+  for (int i = 0; i < 3; i++)
+    mag[i] = _board->mag[i];
+}
+
+bool mag_check(void)
+{
+  return _board->mag_present;
+}
+
+void posix_baro_set(float pressure, float temperature)
+{
+  _board->baro_pressure = pressure;
+  _board->baro_temperature = temperature;
+  _board->baro_present = true;
+
+  float record[2] = {pressure, temperature};
+  trace_record(TRACE_BARO, record, sizeof(record));
+}
+
+static float pressure_altitude(float pressure)
+{
+  // standard atmosphere
+  return 44330.0f * (1.0f - powf(pressure / 101325.0f, 0.190295f));
+}
+
+bool baro_present(void)
+{
+  return _board->baro_present;
+}
+
+void baro_read(float *altitude, float *pressure, float *temperature)
+{
+  (*altitude) = -(pressure_altitude(_board->baro_pressure) - _board->baro_ground_altitude); // NED
+  (*pressure) = _board->baro_pressure;
+  (*temperature) = _board->baro_temperature;
+}
+
+void baro_calibrate()
+{
+  _board->baro_ground_altitude = pressure_altitude(_board->baro_pressure);
+}
+
+void posix_diff_pressure_set(float diff_pressure, float temperature)
+{
+  _board->diff_pressure = diff_pressure;
+  _board->diff_pressure_temperature = temperature;
+  _board->diff_pressure_present = true;
+
+  float record[2] = {diff_pressure, temperature};
+  trace_record(TRACE_AIRSPEED, record, sizeof(record));
+}
+
+bool diff_pressure_present(void)
+{
+  return _board->diff_pressure_present;
+}
+
+bool diff_pressure_check(void)
+{
+  return _board->diff_pressure_present;
+}
+
+void diff_pressure_calibrate()
+{
+  _board->diff_pressure_offset = _board->diff_pressure;
+}
+
+void diff_pressure_set_atm(float barometric_pressure)
+{
+  _board->atm_pressure = barometric_pressure;
+}
+
+void diff_pressure_read(float *diff_pressure, float *temperature, float *velocity)
+{
+  (*diff_pressure) = _board->diff_pressure - _board->diff_pressure_offset;
+  (*temperature) = _board->diff_pressure_temperature;
+
+  float rho = _board->atm_pressure / (287.058f * (_board->diff_pressure_temperature + 273.15f));
+  float speed = sqrtf(2.0f * fabsf(*diff_pressure) / rho);
+  (*velocity) = (*diff_pressure < 0.0f) ? -speed : speed;
+}
+
+void posix_sonar_set(float range)
+{
+  _board->sonar_range = range;
+  _board->sonar_present = true;
+  trace_record(TRACE_SONAR, &range, sizeof(range));
+}
+
+bool sonar_present(void)
+{
+  return _board->sonar_present;
+}
+
+bool sonar_check(void)
+{
+  return _board->sonar_present;
+}
+
+float sonar_read(void)
+{
+  return _board->sonar_range;
+}
+
+uint16_t num_sensor_errors(void)
+{
+  return 0;
+}
+
+// PWM
+void posix_rc_set(uint8_t channel, uint16_t value)
+{
+  if (channel < POSIX_PWM_CHANNELS)
+    _board->rc[channel] = value;
+
+  uint8_t record[3] = {channel};
+  memcpy(&record[1], &value, sizeof(value));
+  trace_record(TRACE_RC, record, sizeof(record));
+}
+
+void posix_rc_set_lost(bool lost)
+{
+  _board->rc_lost = lost;
+
+  uint8_t record = lost;
+  trace_record(TRACE_RC_LOST, &record, sizeof(record));
+}
+
+uint16_t posix_pwm_output(uint8_t channel)
+{
+  return (channel < POSIX_PWM_CHANNELS) ? _board->pwm_outputs[channel] : 0;
+}
+
+uint32_t posix_pwm_latency_ns(void)
+{
+  if (!_board->pwm_written_since_imu)
+    return 0;
+  return _board->pwm_write_cycles - _board->imu_interrupt_cycles;
+}
+
+void pwm_init(bool cppm, uint32_t refresh_rate, uint16_t idle_pwm)
+{
+  (void) cppm;
+  (void) refresh_rate;
+  for (int i = 0; i < POSIX_PWM_CHANNELS; i++)
+    _board->pwm_outputs[i] = idle_pwm;
+}
+
+uint16_t pwm_read(uint8_t channel)
+{
+  return (channel < POSIX_PWM_CHANNELS) ? _board->rc[channel] : 0;
+}
+
+void pwm_write(uint8_t channel, uint16_t value)
+{
+  if (channel < POSIX_PWM_CHANNELS)
+    _board->pwm_outputs[channel] = value;
+  _board->pwm_write_cycles = clock_cycles();
+  _board->pwm_written_since_imu = true;
+}
+
+bool pwm_lost()
+{
+  return _board->rc_lost;
+}
+
+// non-volatile memory
+void posix_memory_set_file(const char *filename)
+{
+  _board->memory_file = filename;
+}
+
+void posix_memory_load(const void *data, size_t len)
+{
+  uint8_t *image = realloc(_board->memory_image, len);
+  if (image == NULL && len > 0)
+    return;
+  memcpy(image, data, len);
+  _board->memory_image = image;
+  _board->memory_image_len = len;
+}
+
+void memory_init(void)
+{
+}
+
+bool memory_read(void *dest, size_t len)
+{
+  bool ok = false;
+  if (_board->memory_image != NULL)
+  {
+    ok = (_board->memory_image_len == len);
+    if (ok)
+      memcpy(dest, _board->memory_image, len);
+  }
+  else if (_board->memory_file != NULL)
+  {
+    FILE *file = fopen(_board->memory_file, "rb");
+    if (file == NULL)
+      return false;
+    ok = (fread(dest, 1, len, file) == len);
+    fclose(file);
+  }
+
+  // what the firmware starts from is an input too
+  if (ok)
+    trace_record_memory(dest, len);
+  return ok;
+}
+
+bool memory_write(const void *src, size_t len)
+{
+  if (_board->memory_image != NULL)
+  {
+    posix_memory_load(src, len);
+    return true;
+  }
+  if (_board->memory_file == NULL)
+    return true;
+
+  FILE *file = fopen(_board->memory_file, "wb");
+  if (file == NULL)
+    return false;
+  size_t written = fwrite(src, 1, len, file);
+  fclose(file);
+  return written == len;
+}
+
+// LEDs
+void led0_on(void)
+{
+  _board->led0 = true;
+}
+void led0_off(void)
+{
+  _board->led0 = false;
+}
+void led0_toggle(void)
+{
+  _board->led0 = !_board->led0;
+}
+
+void led1_on(void)
+{
+  _board->led1 = true;
+}
+void led1_off(void)
+{
+  _board->led1 = false;
+}
+void led1_toggle(void)
+{
+  _board->led1 = !_board->led1;
+}
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// Estimator benchmark.  Generates sensor data along a few kinematic trajectories,
+// then feeds the same data straight into run_estimator once for every filter in
+// FILTER_TYPE, and reports the host time per update and the attitude error of
+// each filter against the true attitude.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "estimator.h"
+#include "param.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "posix_board.h"
+
+#define PI 3.14159265358979323846
+#define RAD_TO_DEG (180.0 / PI)
+#define GRAVITY 9.80665
+
+#define IMU_PERIOD_US 1000
+#define MAG_PERIOD_US 13333
+#define SUBSTEPS 4            // the true attitude is integrated this many times per IMU sample
+#define MOTION_START_US 1000000 // the vehicle sits still this long so the estimator can align
+#define SCORE_START_US 2000000
+#define FLIP_DURATION 0.4     // s, each flip is a half sine of roll rate that turns 360 degrees
+
+#define MAX_PARAM_CHANGES 32
+
+typedef struct
+{
+  const char *name;
+  double rate_amplitude;  // rad/s on each axis, as a sum of random sines
+  double spin_rate;       // rad/s added to yaw
+  double flip_period;     // s between roll flips, 0 for none
+  double accel_amplitude; // m/s^2 of horizontal acceleration
+} trajectory_t;
+
+static const trajectory_t trajectories[] =
+{
+  { .name = "hover",    .rate_amplitude = 0.1, .spin_rate = 0.0, .flip_period = 0.0, .accel_amplitude = 0.0 },
+  { .name = "agile",    .rate_amplitude = 3.0, .spin_rate = 0.0, .flip_period = 0.0, .accel_amplitude = 0.0 },
+  { .name = "spin",     .rate_amplitude = 0.5, .spin_rate = 6.0, .flip_period = 0.0, .accel_amplitude = 0.0 },
+  { .name = "flip",     .rate_amplitude = 0.3, .spin_rate = 0.0, .flip_period = 2.0, .accel_amplitude = 0.0 },
+  { .name = "accel",    .rate_amplitude = 1.0, .spin_rate = 0.0, .flip_period = 0.0, .accel_amplitude = 4.0 },
+};
+#define TRAJECTORY_COUNT (sizeof(trajectories) / sizeof(trajectories[0]))
+
+// the earth's field in NED, north is magnetic north
+static const double mag_field[3] = {0.21, 0.0, 0.43};
+
+typedef struct
+{
+  param_id_t id;
+  double value;
+} param_change_t;
+
+typedef struct
+{
+  uint32_t runs;
+  uint64_t seed;
+  uint64_t duration_us;
+  param_change_t params[MAX_PARAM_CHANGES];
+  int num_params;
+} config_t;
+
+// one run of sensor data, shared by every filter
+typedef struct
+{
+  uint32_t samples;
+  float (*accel)[3];
+  float (*gyro)[3];
+  float (*mag)[3];
+  bool *mag_new;
+  double (*truth)[4];   // w, x, y, z
+} run_data_t;
+
+typedef struct
+{
+  double ns;            // host time in run_estimator
+  uint64_t updates;
+  double tilt_sum_sq;
+  double tilt_max;
+  double att_sum_sq;
+  uint64_t scored;
+} score_t;
+
+// splitmix64
+static uint64_t rng_next(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state, double min, double max)
+{
+  return min + (max - min) * ((rng_next(state) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double rng_gauss(uint64_t *state, double stddev)
+{
+  // Box-Muller
+  double u1 = rng_uniform(state, 0.0, 1.0);
+  double u2 = rng_uniform(state, 0.0, 1.0);
+  return stddev * sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * PI * u2);
+}
+
+// q = q * exp(w*dt/2), for body rates
+static void integrate(double q[4], const double w[3], double dt)
+{
+  double norm = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+  double angle = 0.5 * norm * dt;
+  double c = cos(angle);
+  double s = (norm > 1e-12) ? sin(angle) / norm : 0.5 * dt;
+  double r[4] = {c, s*w[0], s*w[1], s*w[2]};
+  double p[4] =
+  {
+    q[0]*r[0] - q[1]*r[1] - q[2]*r[2] - q[3]*r[3],
+    q[0]*r[1] + q[1]*r[0] + q[2]*r[3] - q[3]*r[2],
+    q[0]*r[2] - q[1]*r[3] + q[2]*r[0] + q[3]*r[1],
+    q[0]*r[3] + q[1]*r[2] - q[2]*r[1] + q[3]*r[0]
+  };
+  double n = sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2] + p[3]*p[3]);
+  for (int i = 0; i < 4; i++)
+    q[i] = p[i] / n;
+}
+
+// rotates an NED vector into the body frame
+static void to_body(const double q[4], const double v[3], double out[3])
+{
+  double w = q[0], x = q[1], y = q[2], z = q[3];
+  out[0] = (1 - 2*(y*y + z*z))*v[0] + 2*(x*y + w*z)*v[1] + 2*(x*z - w*y)*v[2];
+  out[1] = 2*(x*y - w*z)*v[0] + (1 - 2*(x*x + z*z))*v[1] + 2*(y*z + w*x)*v[2];
+  out[2] = 2*(x*z + w*y)*v[0] + 2*(y*z - w*x)*v[1] + (1 - 2*(x*x + y*y))*v[2];
+}
+
+typedef struct
+{
+  double freq[3][2];
+  double phase[3][2];
+  double accel_freq[2];
+  double accel_phase[2];
+} motion_t;
+
+static void body_rates(const trajectory_t *traj, const motion_t *motion, double t, double w[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    w[i] = 0.0;
+    for (int k = 0; k < 2; k++)
+      w[i] += 0.5 * traj->rate_amplitude * sin(2.0 * PI * motion->freq[i][k] * t + motion->phase[i][k]);
+  }
+  w[2] += traj->spin_rate;
+
+  if (traj->flip_period > 0.0)
+  {
+    double since = fmod(t, traj->flip_period);
+    if (since < FLIP_DURATION)
+      w[0] += PI * PI / FLIP_DURATION * sin(PI * since / FLIP_DURATION);
+  }
+}
+
+static void generate(const trajectory_t *traj, uint64_t *rng, run_data_t *data)
+{
+  motion_t motion;
+  for (int i = 0; i < 3; i++)
+  {
+    for (int k = 0; k < 2; k++)
+    {
+      motion.freq[i][k] = rng_uniform(rng, 0.2, 2.0);
+      motion.phase[i][k] = rng_uniform(rng, 0.0, 2.0 * PI);
+    }
+  }
+  for (int k = 0; k < 2; k++)
+  {
+    motion.accel_freq[k] = rng_uniform(rng, 0.2, 0.5);
+    motion.accel_phase[k] = rng_uniform(rng, 0.0, 2.0 * PI);
+  }
+
+  double gyro_bias[3];
+  for (int i = 0; i < 3; i++)
+    gyro_bias[i] = rng_gauss(rng, 0.02);
+  double gyro_noise = rng_uniform(rng, 0.001, 0.01);
+  double accel_noise = rng_uniform(rng, 0.02, 0.06);
+  double mag_noise = 0.005;
+
+  double q[4] = {1.0, 0.0, 0.0, 0.0};
+  integrate(q, (double[3]) {0.0, 0.0, 1.0}, rng_uniform(rng, -PI, PI)); // random starting heading
+  uint64_t next_mag_us = 0;
+
+  for (uint32_t n = 0; n < data->samples; n++)
+  {
+    uint64_t t_us = (uint64_t) n * IMU_PERIOD_US;
+    double t = (t_us > MOTION_START_US) ? (t_us - MOTION_START_US) * 1e-6 : 0.0;
+    bool moving = t_us > MOTION_START_US;
+
+    if (n > 0 && moving)
+    {
+      double h = IMU_PERIOD_US * 1e-6 / SUBSTEPS;
+      for (int s = 0; s < SUBSTEPS; s++)
+      {
+        double w[3];
+        body_rates(traj, &motion, t - IMU_PERIOD_US * 1e-6 + (s + 0.5) * h, w);
+        integrate(q, w, h);
+      }
+    }
+    memcpy(data->truth[n], q, sizeof(q));
+
+    double w[3] = {0.0, 0.0, 0.0};
+    double a_ned[3] = {0.0, 0.0, 0.0};
+    if (moving)
+    {
+      body_rates(traj, &motion, t, w);
+      for (int k = 0; k < 2; k++)
+        a_ned[k] = traj->accel_amplitude * sin(2.0 * PI * motion.accel_freq[k] * t + motion.accel_phase[k]);
+    }
+
+    double f_ned[3] = {a_ned[0], a_ned[1], a_ned[2] - GRAVITY};
+    double f_body[3], m_body[3];
+    to_body(q, f_ned, f_body);
+    to_body(q, mag_field, m_body);
+    for (int i = 0; i < 3; i++)
+    {
+      data->accel[n][i] = f_body[i] + rng_gauss(rng, accel_noise);
+      data->gyro[n][i] = w[i] + gyro_bias[i] + rng_gauss(rng, gyro_noise);
+      data->mag[n][i] = m_body[i] + rng_gauss(rng, mag_noise);
+    }
+    data->mag_new[n] = (t_us >= next_mag_us);
+    if (data->mag_new[n])
+      next_mag_us += MAG_PERIOD_US;
+  }
+}
+
+static uint64_t wall_nanos(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void set_param(rosflight_t *rf, param_id_t id, double value)
+{
+  if (get_param_type(rf, id) == PARAM_TYPE_INT32)
+    set_param_int(rf, id, (int32_t) lround(value));
+  else
+    set_param_float(rf, id, (float) value);
+}
+
+static void run_filter(const config_t *config, rosflight_t *rf, int backend, const run_data_t *data,
+                       float (*estimate)[4], score_t *score)
+{
+  rosflight_init(rf);
+  set_param_int(rf, PARAM_FILTER_TYPE, backend);
+  set_param_int(rf, PARAM_FILTER_USE_MAG, 1);
+  set_param_int(rf, PARAM_FILTER_PREDICT, 0); // score the filter's own estimate
+  for (int i = 0; i < config->num_params; i++)
+    set_param(rf, config->params[i].id, config->params[i].value);
+  init_estimator(rf);
+
+  sensors_t *sensors = &rf->sensors;
+  uint64_t start_ns = wall_nanos();
+  for (uint32_t n = 0; n < data->samples; n++)
+  {
+    sensors->accel.x = data->accel[n][0];
+    sensors->accel.y = data->accel[n][1];
+    sensors->accel.z = data->accel[n][2];
+    sensors->gyro.x = data->gyro[n][0];
+    sensors->gyro.y = data->gyro[n][1];
+    sensors->gyro.z = data->gyro[n][2];
+    if (data->mag_new[n])
+    {
+      sensors->mag.x = data->mag[n][0];
+      sensors->mag.y = data->mag[n][1];
+      sensors->mag.z = data->mag[n][2];
+      sensors->mag_count++;
+    }
+    rf->estimator.state.now_us = (uint64_t) n * IMU_PERIOD_US;
+    run_estimator(rf);
+
+    const quaternion_t *q = &rf->estimator.state.q;
+    estimate[n][0] = q->w;
+    estimate[n][1] = q->x;
+    estimate[n][2] = q->y;
+    estimate[n][3] = q->z;
+  }
+  score->ns += wall_nanos() - start_ns;
+  score->updates += data->samples;
+
+  for (uint32_t n = SCORE_START_US / IMU_PERIOD_US; n < data->samples; n++)
+  {
+    const double *t = data->truth[n];
+    const float *e = estimate[n];
+
+    // tilt is the angle between the true and estimated down, which heading doesn't change
+    double down_t[3] = {2*(t[1]*t[3] - t[0]*t[2]), 2*(t[2]*t[3] + t[0]*t[1]), 1 - 2*(t[1]*t[1] + t[2]*t[2])};
+    double down_e[3] = {2*(e[1]*e[3] - e[0]*e[2]), 2*(e[2]*e[3] + e[0]*e[1]), 1 - 2*(e[1]*e[1] + e[2]*e[2])};
+    double cross[3] =
+    {
+      down_t[1]*down_e[2] - down_t[2]*down_e[1],
+      down_t[2]*down_e[0] - down_t[0]*down_e[2],
+      down_t[0]*down_e[1] - down_t[1]*down_e[0]
+    };
+    double dot = down_t[0]*down_e[0] + down_t[1]*down_e[1] + down_t[2]*down_e[2];
+    double tilt = atan2(sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]), dot) * RAD_TO_DEG;
+
+    double inner = fabs(t[0]*e[0] + t[1]*e[1] + t[2]*e[2] + t[3]*e[3]);
+    double att = 2.0 * acos(fmin(inner, 1.0)) * RAD_TO_DEG;
+
+    score->tilt_sum_sq += tilt * tilt;
+    if (tilt > score->tilt_max)
+      score->tilt_max = tilt;
+    score->att_sum_sq += att * att;
+    score->scored++;
+  }
+}
+
+static bool parse_param_change(rosflight_t *rf, const char *arg, config_t *config)
+{
+  if (config->num_params >= MAX_PARAM_CHANGES)
+  {
+    fprintf(stderr, "too many parameter changes\n");
+    return false;
+  }
+
+  char name[PARAMS_NAME_LENGTH + 1];
+  const char *equals = strchr(arg, '=');
+  size_t length = (equals != NULL) ? (size_t) (equals - arg) : 0;
+  if (length == 0 || length > PARAMS_NAME_LENGTH)
+  {
+    fprintf(stderr, "expected NAME=VALUE: %s\n", arg);
+    return false;
+  }
+  memcpy(name, arg, length);
+  name[length] = '\0';
+
+  param_change_t *change = &config->params[config->num_params];
+  change->id = lookup_param_id(rf, name);
+  change->value = atof(equals + 1);
+  if (change->id == PARAMS_COUNT)
+  {
+    fprintf(stderr, "unknown parameter: %s\n", name);
+    return false;
+  }
+  config->num_params++;
+  return true;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n runs] [-s seed] [-d duration_s] [-p NAME=VALUE]...\n", name);
+  fprintf(stderr, "  -n  runs of each trajectory, each with new motion and sensor errors (default: 5)\n");
+  fprintf(stderr, "  -s  random seed (default: 1)\n");
+  fprintf(stderr, "  -d  length of each run in seconds (default: 20)\n");
+  fprintf(stderr, "  -p  set a parameter for every filter, after FILTER_USE_MAG=1 and FILTER_PREDICT=0\n");
+}
+
+int main(int argc, char **argv)
+{
+  config_t config = { .runs = 5, .seed = 1, .duration_us = 20000000 };
+
+  static rosflight_t rf;
+  posix_memory_set_file(NULL);
+  rosflight_init(&rf);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:d:p:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      config.runs = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      config.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      config.duration_us = (uint64_t) (atof(optarg) * 1e6);
+      break;
+    case 'p':
+      if (!parse_param_change(&rf, optarg, &config))
+        return 1;
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+  if (config.duration_us <= SCORE_START_US)
+  {
+    fprintf(stderr, "runs must be longer than %.1f s\n", SCORE_START_US * 1e-6);
+    return 1;
+  }
+
+  run_data_t data;
+  data.samples = config.duration_us / IMU_PERIOD_US;
+  data.accel = malloc(data.samples * sizeof(*data.accel));
+  data.gyro = malloc(data.samples * sizeof(*data.gyro));
+  data.mag = malloc(data.samples * sizeof(*data.mag));
+  data.mag_new = malloc(data.samples * sizeof(*data.mag_new));
+  data.truth = malloc(data.samples * sizeof(*data.truth));
+  float (*estimate)[4] = malloc(data.samples * sizeof(*estimate));
+  if (data.accel == NULL || data.gyro == NULL || data.mag == NULL || data.mag_new == NULL
+      || data.truth == NULL || estimate == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("%-8s %-10s %10s %14s %14s %18s\n", "path", "filter", "ns/update", "tilt rms (deg)",
+         "tilt max (deg)", "attitude rms (deg)");
+  for (size_t t = 0; t < TRAJECTORY_COUNT; t++)
+  {
+    score_t scores[ESTIMATOR_BACKEND_COUNT];
+    memset(scores, 0, sizeof(scores));
+
+    for (uint32_t run = 0; run < config.runs; run++)
+    {
+      uint64_t rng = config.seed ^ ((uint64_t) (t * config.runs + run) * 0xD1B54A32D192ED03ULL);
+      generate(&trajectories[t], &rng, &data);
+
+      for (int b = 0; b < ESTIMATOR_BACKEND_COUNT; b++)
+      {
+        if (estimator_backends[b] != NULL)
+          run_filter(&config, &rf, b, &data, estimate, &scores[b]);
+      }
+    }
+
+    for (int b = 0; b < ESTIMATOR_BACKEND_COUNT; b++)
+    {
+      const score_t *s = &scores[b];
+      if (estimator_backends[b] == NULL || s->scored == 0)
+        continue;
+      printf("%-8s %-10s %10.1f %14.3f %14.3f %18.3f\n", trajectories[t].name, estimator_backends[b]->name,
+             s->ns / s->updates, sqrt(s->tilt_sum_sq / s->scored), s->tilt_max, sqrt(s->att_sum_sq / s->scored));
+    }
+  }
+
+  free(data.accel);
+  free(data.gyro);
+  free(data.mag);
+  free(data.mag_new);
+  free(data.truth);
+  free(estimate);
+  return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "estimator.h"
+#include "latency.h"
+#include "mode.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "posix_board.h"
+#include "sources.h"
+#include "trace.h"
+
+#define DEFAULT_LOCKSTEP_STEP_US 100
+
+static volatile sig_atomic_t _running = 1;
+static FILE *_outputs_file = NULL;
+
+static rosflight_t _rosflight;
+
+static void handle_signal(int sig)
+{
+  (void) sig;
+  _running = 0;
+}
+
+static uint64_t wall_micros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s script | -R trace] [-m memory_file] [-d duration_s] [-r rate | -l [-t step_us]]\n"
+                  "       [-o outputs] [-c cycle_log] [-w trace] [-p]\n"
+                  "       %s [-e tolerance] -D cycle_log_a cycle_log_b\n",
+          name, name);
+  fprintf(stderr, "  -s  sensor and RC script (default: vehicle sitting still)\n");
+  fprintf(stderr, "  -m  file backing the non-volatile memory (default: rosflight_memory.bin)\n");
+  fprintf(stderr, "  -d  stop after this much simulated time\n");
+  fprintf(stderr, "  -r  simulated seconds per wall clock second (default: 1)\n");
+  fprintf(stderr, "  -l  lockstep: step the clock as fast as possible instead of following the wall clock\n");
+  fprintf(stderr, "  -t  longest lockstep clock step (default: %d us)\n", DEFAULT_LOCKSTEP_STEP_US);
+  fprintf(stderr, "  -o  write the PWM outputs after every IMU sample to this file\n");
+  fprintf(stderr, "  -p  open a pseudo-terminal for the serial port\n");
+  fprintf(stderr, "  -w  record every input to the firmware to this trace\n");
+  fprintf(stderr, "  -R  replay a recorded trace as fast as possible (replaces -s, -r, -l and -p)\n");
+  fprintf(stderr, "  -c  write the outputs, state estimate and command after every control update to this cycle log\n");
+  fprintf(stderr, "  -D  compare two cycle logs, e.g. from replaying one trace with two firmware builds\n");
+  fprintf(stderr, "  -e  with -D, ignore differences up to this size (default: 0)\n");
+}
+
+// called after every control update
+static void write_outputs(void)
+{
+  if (_outputs_file != NULL)
+  {
+    fprintf(_outputs_file, "%llu", (unsigned long long) clock_micros());
+    for (int i = 0; i < POSIX_PWM_CHANNELS; i++)
+      fprintf(_outputs_file, " %u", posix_pwm_output(i));
+    fprintf(_outputs_file, "\n");
+  }
+
+  estimator_update_euler(&_rosflight);
+  const state_t *state = &_rosflight.estimator.state;
+  const command_t *command = &_rosflight.mixer.command;
+  trace_cycle_t cycle =
+  {
+    .time_us = clock_micros(),
+    .q = {state->q.w, state->q.x, state->q.y, state->q.z},
+    .omega = {state->omega.x, state->omega.y, state->omega.z},
+    .euler = {state->roll, state->pitch, state->yaw},
+    .command = {command->F, command->x, command->y, command->z}
+  };
+  for (int i = 0; i < 8; i++)
+    cycle.outputs[i] = _rosflight.mixer.outputs[i];
+  trace_cycles_write(&cycle);
+}
+
+// The virtual clock follows the wall clock, scaled by rate
+static void run_realtime(uint64_t end_us, double rate)
+{
+  uint64_t start_us = clock_micros();
+  uint64_t wall_start_us = wall_micros();
+
+  while (_running && !sources_finished() && clock_micros() < end_us)
+  {
+    posix_clock_set(start_us + (uint64_t) ((wall_micros() - wall_start_us) * rate));
+    trace_record_cycle(clock_micros());
+    bool imu = sources_update(&_rosflight, clock_micros());
+    rosflight_run(&_rosflight);
+    if (imu)
+      write_outputs();
+
+    // don't spin flat out
+    struct timespec sleep_time = { 0, 20000 };
+    nanosleep(&sleep_time, NULL);
+  }
+}
+
+// The clock jumps straight to the next sensor sample, or by at most step_us so
+// that the scheduler's periodic tasks still run on time.  Nothing here depends on
+// the wall clock, so the same script always produces the same outputs.
+static void run_lockstep(uint64_t end_us, uint64_t step_us)
+{
+  while (_running && !sources_finished() && clock_micros() < end_us)
+  {
+    uint64_t next_us = clock_micros() + step_us;
+    uint64_t source_us = sources_next_time_us();
+    if (source_us > clock_micros() && source_us < next_us)
+      next_us = source_us;
+    posix_clock_set(next_us);
+    trace_record_cycle(clock_micros());
+
+    bool imu = sources_update(&_rosflight, clock_micros());
+    rosflight_run(&_rosflight);
+
+    // the control chain runs from the IMU interrupt, so it has already used the sample
+    if (imu && !new_imu_data_available(&_rosflight))
+      write_outputs();
+  }
+}
+
+// Feeds a recorded trace back through the firmware, one recorded cycle at a time
+static void run_replay(uint64_t end_us)
+{
+  bool imu;
+  while (_running && clock_micros() < end_us && trace_replay_cycle(&_rosflight, &imu))
+  {
+    rosflight_run(&_rosflight);
+    if (imu && !new_imu_data_available(&_rosflight))
+      write_outputs();
+  }
+}
+
+static void print_summary(void)
+{
+  const latency_stats_t *latency = latency_get_stats(&_rosflight);
+  printf("simulated %.3f s\n", clock_micros() * 1e-6);
+  if (latency->samples > 0)
+  {
+    printf("latency (us, last window): min %u p50 %u p99 %u max %u jitter %u\n",
+           latency->min_us, latency->p50_us, latency->p99_us, latency->max_us, latency->jitter_us);
+  }
+  printf("deadline misses: %u\n", _rosflight.latency.total_deadline_misses);
+  printf("armed state: 0x%x, error state: 0x%x\n", _rosflight.mode.armed_state, _rosflight.mode.error_state);
+}
+
+int main(int argc, char **argv)
+{
+  double duration_s = 0.0;
+  double rate = 1.0;
+  bool lockstep = false;
+  uint64_t step_us = DEFAULT_LOCKSTEP_STEP_US;
+  bool pty = false;
+  const char *replay_filename = NULL;
+  const char *record_filename = NULL;
+  const char *diff_filename = NULL;
+  float diff_tolerance = 0.0f;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:m:d:r:lt:o:pw:R:c:D:e:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      if (!sources_open_script(optarg))
+        return 1;
+      break;
+    case 'm':
+      posix_memory_set_file(optarg);
+      break;
+    case 'd':
+      duration_s = atof(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'l':
+      lockstep = true;
+      break;
+    case 't':
+      step_us = strtoull(optarg, NULL, 10);
+      break;
+    case 'o':
+      _outputs_file = fopen(optarg, "w");
+      if (_outputs_file == NULL)
+      {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'p':
+      pty = true;
+      break;
+    case 'w':
+      record_filename = optarg;
+      break;
+    case 'R':
+      replay_filename = optarg;
+      break;
+    case 'c':
+      if (!trace_cycles_open(optarg))
+        return 1;
+      break;
+    case 'D':
+      diff_filename = optarg;
+      break;
+    case 'e':
+      diff_tolerance = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+
+  if (diff_filename != NULL)
+  {
+    if (optind >= argc)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    return trace_diff(diff_filename, argv[optind], diff_tolerance);
+  }
+
+  if (replay_filename != NULL)
+  {
+    // the trace holds the memory contents the recording started from
+    posix_memory_set_file(NULL);
+    if (!trace_replay_open(replay_filename))
+      return 1;
+    pty = false;
+  }
+  else if (record_filename != NULL && !trace_record_open(record_filename))
+  {
+    return 1;
+  }
+
+  if (pty)
+  {
+    if (!posix_serial_open_pty())
+      return 1;
+    printf("serial port: %s\n", posix_serial_name());
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  rosflight_init(&_rosflight);
+
+  uint64_t end_us = (duration_s > 0.0) ? clock_micros() + (uint64_t) (duration_s * 1e6) : UINT64_MAX;
+  uint64_t wall_start_us = wall_micros();
+
+  if (replay_filename != NULL)
+    run_replay(end_us);
+  else if (lockstep)
+    run_lockstep(end_us, (step_us > 0) ? step_us : 1);
+  else
+    run_realtime(end_us, rate);
+
+  double wall_s = (wall_micros() - wall_start_us) * 1e-6;
+  printf("wall clock %.3f s (%.1f simulated s per wall s)\n", wall_s, clock_micros() * 1e-6 / wall_s);
+
+  if (_outputs_file != NULL)
+    fclose(_outputs_file);
+  trace_cycles_close();
+  trace_record_close();
+  trace_replay_close();
+  print_summary();
+  return 0;
+}
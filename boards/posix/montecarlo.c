@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// Monte-Carlo flight evaluation.  Runs many independent firmware instances,
+// each flying the vehicle model through random stick inputs with randomized
+// sensor noise, gyro bias, motor mismatch, inertia and parameters, spread over
+// a pool of threads.  Every run is seeded from its index, so results don't
+// depend on the number of threads.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "estimator.h"
+#include "mode.h"
+#include "param.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "posix_board.h"
+#include "vehicle.h"
+
+#define RAD_TO_DEG (180.0 / 3.14159265358979323846)
+
+#define IMU_PERIOD_US 1000
+#define STEP_US 100           // the clock steps this far between scheduler passes
+
+// flight script
+#define ARM_START_US 4000000  // after the estimator has initialized
+#define ARM_END_US 6000000
+#define TAKEOFF_US 7000000
+#define SETTLE_US 500000      // not scored after takeoff
+#define MANEUVER_PERIOD_US 1000000
+#define MANEUVER_STICK 250    // largest roll and pitch stick deflection (us)
+#define DIVERGED_ANGLE 60.0   // degrees of roll or pitch
+
+#define MAX_PARAM_CHANGES 32
+
+typedef struct
+{
+  char name[PARAMS_NAME_LENGTH + 1];
+  param_id_t id;
+  double value;
+} param_change_t;
+
+typedef struct
+{
+  uint32_t runs;
+  uint32_t threads;
+  uint64_t seed;
+  uint64_t duration_us;
+  uint64_t uptime_us;     // clock reading at power-up
+
+  param_change_t params[MAX_PARAM_CHANGES];   // -p: set before every run
+  int num_params;
+  param_change_t perturb[MAX_PARAM_CHANGES];  // -P: scaled by 1 +/- a random fraction up to value
+  int num_perturb;
+} config_t;
+
+typedef struct
+{
+  bool armed;
+  bool diverged;
+  double att_rms_deg;      // commanded roll and pitch against the vehicle's
+  double att_max_deg;
+  double est_rms_deg;      // estimated roll and pitch against the vehicle's
+  double saturation_pct;   // time with a motor at full or idle throttle
+  uint32_t latency_p50_ns; // host time from the IMU interrupt to the last PWM write
+  uint32_t latency_p99_ns;
+  uint32_t latency_max_ns;
+} result_t;
+
+typedef struct
+{
+  const config_t *config;
+  result_t *results;
+  pthread_mutex_t lock;
+  uint32_t next_run;
+} pool_t;
+
+// splitmix64
+static uint64_t rng_next(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state, double min, double max)
+{
+  return min + (max - min) * ((rng_next(state) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double rng_gauss(uint64_t *state, double stddev)
+{
+  // Box-Muller
+  double u1 = rng_uniform(state, 0.0, 1.0);
+  double u2 = rng_uniform(state, 0.0, 1.0);
+  return stddev * sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+}
+
+static void set_param(rosflight_t *rf, param_id_t id, double value)
+{
+  if (get_param_type(rf, id) == PARAM_TYPE_INT32)
+    set_param_int(rf, id, (int32_t) lround(value));
+  else
+    set_param_float(rf, id, (float) value);
+}
+
+static double get_param(rosflight_t *rf, param_id_t id)
+{
+  if (get_param_type(rf, id) == PARAM_TYPE_INT32)
+    return get_param_int(rf, id);
+  return get_param_float(rf, id);
+}
+
+static int compare_uint32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void fly(const config_t *config, uint32_t run, rosflight_t *rf, uint32_t *latency, result_t *result)
+{
+  uint64_t rng = config->seed ^ ((uint64_t) run * 0xD1B54A32D192ED03ULL);
+  memset(result, 0, sizeof(*result));
+
+  posix_board_t *board = posix_board_create();
+  posix_board_select(board);
+  posix_memory_set_file(NULL);
+  posix_clock_set(config->uptime_us);
+
+  // randomize the airframe and sensors
+  vehicle_t vehicle;
+  vehicle_init(&vehicle);
+  for (int i = 0; i < 3; i++)
+    vehicle.inertia[i] *= rng_uniform(&rng, 0.8, 1.2);
+  for (int i = 0; i < VEHICLE_MOTORS; i++)
+    vehicle.motor_scale[i] = 1.0 + rng_gauss(&rng, 0.05);
+
+  double gyro_bias[3];
+  for (int i = 0; i < 3; i++)
+    gyro_bias[i] = rng_gauss(&rng, 0.02);
+  double gyro_noise = rng_uniform(&rng, 0.001, 0.01);
+  double accel_noise = rng_uniform(&rng, 0.02, 0.06);
+
+  rosflight_init(rf);
+  set_param_int(rf, PARAM_MIXER, 1);
+  for (int i = 0; i < config->num_params; i++)
+    set_param(rf, config->params[i].id, config->params[i].value);
+  for (int i = 0; i < config->num_perturb; i++)
+  {
+    param_id_t id = config->perturb[i].id;
+    set_param(rf, id, get_param(rf, id) * (1.0 + rng_uniform(&rng, -1.0, 1.0) * config->perturb[i].value));
+  }
+  start_imu_calibration(rf);
+
+  double min_pwm = get_param_int(rf, PARAM_MOTOR_MIN_PWM);
+  double max_pwm = get_param_int(rf, PARAM_MOTOR_MAX_PWM);
+
+  uint32_t latency_count = 0;
+  uint32_t scored = 0;
+  uint32_t saturated = 0;
+  double att_sum_sq = 0.0;
+  uint32_t att_count = 0;
+  double est_sum_sq = 0.0;
+  uint16_t roll_stick = 1500, pitch_stick = 1500, yaw_stick = 1500;
+
+  for (uint64_t t = 0; t <= config->duration_us; t += STEP_US)
+  {
+    posix_clock_set(config->uptime_us + t);
+    bool imu = (t % IMU_PERIOD_US == 0);
+    if (imu)
+    {
+      double throttle[VEHICLE_MOTORS];
+      for (int i = 0; i < VEHICLE_MOTORS; i++)
+        throttle[i] = (posix_pwm_output(i) - min_pwm) / (max_pwm - min_pwm);
+      vehicle_step(&vehicle, throttle, IMU_PERIOD_US * 1e-6);
+
+      // the pilot arms, takes off, then commands a new random attitude every so often
+      if (t >= TAKEOFF_US && (t - TAKEOFF_US) % MANEUVER_PERIOD_US == 0)
+      {
+        roll_stick = 1500 + (int) rng_uniform(&rng, -MANEUVER_STICK, MANEUVER_STICK);
+        pitch_stick = 1500 + (int) rng_uniform(&rng, -MANEUVER_STICK, MANEUVER_STICK);
+        yaw_stick = 1500 + (int) rng_uniform(&rng, -100, 100);
+      }
+      posix_rc_set(0, (t >= TAKEOFF_US) ? roll_stick : 1500);
+      posix_rc_set(1, (t >= TAKEOFF_US) ? pitch_stick : 1500);
+      posix_rc_set(2, (t >= TAKEOFF_US) ? 1500 : 1000);
+      posix_rc_set(3, (t >= ARM_START_US && t < ARM_END_US) ? 2000 : (t >= TAKEOFF_US ? yaw_stick : 1500));
+
+      float accel[3], gyro[3];
+      double specific_force[3];
+      vehicle_accel(&vehicle, specific_force);
+      for (int i = 0; i < 3; i++)
+      {
+        accel[i] = specific_force[i] + rng_gauss(&rng, accel_noise);
+        gyro[i] = vehicle.omega[i] + gyro_bias[i] + rng_gauss(&rng, gyro_noise);
+      }
+      posix_imu_set(accel, gyro, 25.0f);
+      posix_imu_interrupt();
+    }
+
+    rosflight_run(rf);
+
+    if (!imu || t < TAKEOFF_US)
+      continue;
+
+    if (t == TAKEOFF_US)
+    {
+      result->armed = rf->mode.armed_state & ARMED;
+      if (!result->armed)
+        break;
+    }
+
+    uint32_t ns = posix_pwm_latency_ns();
+    if (ns > 0)
+      latency[latency_count++] = ns;
+
+    double roll, pitch, yaw;
+    vehicle_euler(&vehicle, &roll, &pitch, &yaw);
+    if (fabs(roll) * RAD_TO_DEG > DIVERGED_ANGLE || fabs(pitch) * RAD_TO_DEG > DIVERGED_ANGLE)
+    {
+      result->diverged = true;
+      break;
+    }
+
+    if (t < TAKEOFF_US + SETTLE_US)
+      continue;
+    scored++;
+
+    const control_t *command = &rf->mux.combined_control;
+    if (command->x.type == ANGLE && command->y.type == ANGLE)
+    {
+      double err = hypot(command->x.value - roll, command->y.value - pitch) * RAD_TO_DEG;
+      att_sum_sq += err * err;
+      att_count++;
+      if (err > result->att_max_deg)
+        result->att_max_deg = err;
+    }
+
+    estimator_update_euler(rf);
+    double est_err = hypot(rf->estimator.state.roll - roll, rf->estimator.state.pitch - pitch) * RAD_TO_DEG;
+    est_sum_sq += est_err * est_err;
+
+    float idle = get_param_float(rf, PARAM_MOTOR_IDLE_THROTTLE);
+    for (int i = 0; i < VEHICLE_MOTORS; i++)
+    {
+      if (rf->mixer.outputs[i] >= 1.0f || rf->mixer.outputs[i] <= idle)
+      {
+        saturated++;
+        break;
+      }
+    }
+  }
+
+  if (att_count > 0)
+    result->att_rms_deg = sqrt(att_sum_sq / att_count);
+  if (scored > 0)
+  {
+    result->est_rms_deg = sqrt(est_sum_sq / scored);
+    result->saturation_pct = 100.0 * saturated / scored;
+  }
+  if (latency_count > 0)
+  {
+    qsort(latency, latency_count, sizeof(uint32_t), compare_uint32);
+    result->latency_p50_ns = latency[latency_count / 2];
+    result->latency_p99_ns = latency[(uint32_t) (latency_count * 0.99)];
+    result->latency_max_ns = latency[latency_count - 1];
+  }
+
+  posix_board_destroy(board);
+}
+
+static void *worker(void *arg)
+{
+  pool_t *pool = (pool_t *) arg;
+  const config_t *config = pool->config;
+
+  rosflight_t *rf = malloc(sizeof(rosflight_t));
+  uint32_t *latency = malloc((config->duration_us / IMU_PERIOD_US + 1) * sizeof(uint32_t));
+  if (rf == NULL || latency == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+
+  while (true)
+  {
+    pthread_mutex_lock(&pool->lock);
+    uint32_t run = pool->next_run++;
+    pthread_mutex_unlock(&pool->lock);
+    if (run >= config->runs)
+      break;
+
+    fly(config, run, rf, latency, &pool->results[run]);
+  }
+
+  free(latency);
+  free(rf);
+  return NULL;
+}
+
+// parses NAME=VALUE, checking the name against a firmware instance
+static bool parse_param_change(rosflight_t *rf, const char *arg, param_change_t *changes, int *count)
+{
+  if (*count >= MAX_PARAM_CHANGES)
+  {
+    fprintf(stderr, "too many parameter changes\n");
+    return false;
+  }
+
+  param_change_t *change = &changes[*count];
+  const char *equals = strchr(arg, '=');
+  size_t length = (equals != NULL) ? (size_t) (equals - arg) : 0;
+  if (length == 0 || length > PARAMS_NAME_LENGTH)
+  {
+    fprintf(stderr, "expected NAME=VALUE: %s\n", arg);
+    return false;
+  }
+  memcpy(change->name, arg, length);
+  change->name[length] = '\0';
+  change->value = atof(equals + 1);
+
+  change->id = lookup_param_id(rf, change->name);
+  if (change->id == PARAMS_COUNT)
+  {
+    fprintf(stderr, "unknown parameter: %s\n", change->name);
+    return false;
+  }
+  (*count)++;
+  return true;
+}
+
+static void print_stat(const char *name, result_t *results, uint32_t count, size_t offset, bool is_double)
+{
+  if (count == 0)
+    return;
+
+  double *values = malloc(count * sizeof(double));
+  double sum = 0.0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const char *field = (const char *) &results[i] + offset;
+    values[i] = is_double ? *(const double *) field : *(const uint32_t *) field;
+    sum += values[i];
+  }
+  qsort(values, count, sizeof(double), compare_double);
+  printf("%-32s mean %10.3f  p95 %10.3f  worst %10.3f\n", name, sum / count,
+         values[(uint32_t) (count * 0.95)], values[count - 1]);
+  free(values);
+}
+
+static uint64_t wall_micros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n runs] [-j threads] [-s seed] [-d duration_s] [-u uptime_s] [-p NAME=VALUE]... [-P NAME=FRACTION]... [-o results.csv]\n",
+          name);
+  fprintf(stderr, "  -n  number of flights (default: 100)\n");
+  fprintf(stderr, "  -j  worker threads (default: one per core)\n");
+  fprintf(stderr, "  -s  random seed (default: 1)\n");
+  fprintf(stderr, "  -d  length of each flight in simulated seconds (default: 20)\n");
+  fprintf(stderr, "  -u  start the clock this far in, as if the board had been on that long (default: 0)\n");
+  fprintf(stderr, "  -p  set a parameter for every flight\n");
+  fprintf(stderr, "  -P  scale a parameter by a random factor between 1 - FRACTION and 1 + FRACTION\n");
+  fprintf(stderr, "  -o  write the results of each flight to this file\n");
+}
+
+int main(int argc, char **argv)
+{
+  config_t config = { .runs = 100, .seed = 1, .duration_us = 20000000 };
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  config.threads = (cores > 0) ? cores : 1;
+  const char *results_filename = NULL;
+
+  // a firmware instance on the default board, to check parameter names against
+  static rosflight_t reference;
+  posix_memory_set_file(NULL);
+  rosflight_init(&reference);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:j:s:d:u:p:P:o:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      config.runs = strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      config.threads = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      config.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      config.duration_us = (uint64_t) (atof(optarg) * 1e6);
+      break;
+    case 'u':
+      config.uptime_us = (uint64_t) (atof(optarg) * 1e6);
+      break;
+    case 'p':
+      if (!parse_param_change(&reference, optarg, config.params, &config.num_params))
+        return 1;
+      break;
+    case 'P':
+      if (!parse_param_change(&reference, optarg, config.perturb, &config.num_perturb))
+        return 1;
+      break;
+    case 'o':
+      results_filename = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+  if (config.threads < 1)
+    config.threads = 1;
+  if (config.duration_us <= TAKEOFF_US + SETTLE_US)
+  {
+    fprintf(stderr, "flights must be longer than %.1f s\n", (TAKEOFF_US + SETTLE_US) * 1e-6);
+    return 1;
+  }
+
+  pool_t pool = { .config = &config, .next_run = 0 };
+  pool.results = calloc(config.runs, sizeof(result_t));
+  pthread_t *threads = malloc(config.threads * sizeof(pthread_t));
+  if ((pool.results == NULL && config.runs > 0) || threads == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  pthread_mutex_init(&pool.lock, NULL);
+
+  uint64_t wall_start_us = wall_micros();
+  for (uint32_t i = 0; i < config.threads; i++)
+    pthread_create(&threads[i], NULL, worker, &pool);
+  for (uint32_t i = 0; i < config.threads; i++)
+    pthread_join(threads[i], NULL);
+  double wall_s = (wall_micros() - wall_start_us) * 1e-6;
+
+  pthread_mutex_destroy(&pool.lock);
+  free(threads);
+
+  if (results_filename != NULL)
+  {
+    FILE *file = fopen(results_filename, "w");
+    if (file == NULL)
+    {
+      perror(results_filename);
+      return 1;
+    }
+    fprintf(file, "run,armed,diverged,att_rms_deg,att_max_deg,est_rms_deg,saturation_pct,"
+                  "latency_p50_ns,latency_p99_ns,latency_max_ns\n");
+    for (uint32_t i = 0; i < config.runs; i++)
+    {
+      const result_t *r = &pool.results[i];
+      fprintf(file, "%u,%d,%d,%.4f,%.4f,%.4f,%.3f,%u,%u,%u\n", i, r->armed, r->diverged,
+              r->att_rms_deg, r->att_max_deg, r->est_rms_deg, r->saturation_pct,
+              r->latency_p50_ns, r->latency_p99_ns, r->latency_max_ns);
+    }
+    fclose(file);
+  }
+
+  // summarize the flights that completed, failures are only counted
+  uint32_t not_armed = 0, diverged = 0, completed = 0;
+  for (uint32_t i = 0; i < config.runs; i++)
+  {
+    if (!pool.results[i].armed)
+      not_armed++;
+    else if (pool.results[i].diverged)
+      diverged++;
+    else
+      pool.results[completed++] = pool.results[i];
+  }
+
+  printf("flights: %u completed, %u never armed, %u diverged\n", completed, not_armed, diverged);
+  print_stat("attitude error rms (deg)", pool.results, completed, offsetof(result_t, att_rms_deg), true);
+  print_stat("attitude error max (deg)", pool.results, completed, offsetof(result_t, att_max_deg), true);
+  print_stat("estimate error rms (deg)", pool.results, completed, offsetof(result_t, est_rms_deg), true);
+  print_stat("motor saturation (%)", pool.results, completed, offsetof(result_t, saturation_pct), true);
+  print_stat("IMU to PWM latency p50 (ns)", pool.results, completed, offsetof(result_t, latency_p50_ns), false);
+  print_stat("IMU to PWM latency p99 (ns)", pool.results, completed, offsetof(result_t, latency_p99_ns), false);
+
+  double simulated_s = config.runs * (config.duration_us * 1e-6);
+  printf("wall clock %.3f s on %u threads: %.1f flights per s, %.0f simulated s per wall s\n",
+         wall_s, config.threads, config.runs / wall_s, simulated_s / wall_s);
+
+  free(pool.results);
+  return (not_armed + diverged > 0) ? 2 : 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Functions the simulation uses to drive the host board.  The firmware itself
+// only sees include/board.h.
+
+// Each thread drives its own board, so several firmware instances can run in
+// one process.  Until a thread selects a board, it uses a shared default one.
+typedef struct posix_board_t posix_board_t;
+posix_board_t *posix_board_create(void);
+void posix_board_destroy(posix_board_t *board);
+void posix_board_select(posix_board_t *board); // for the calling thread, NULL selects the default board
+
+// clock (the clock never goes backwards, earlier times are ignored)
+void posix_clock_set(uint64_t time_us);
+
+// serial
+bool posix_serial_open_pty(void);
+const char *posix_serial_name(void);
+void posix_serial_receive(const uint8_t *bytes, size_t len); // queue bytes as if they had arrived
+
+// non-volatile memory
+void posix_memory_set_file(const char *filename); // NULL: nothing is stored, and reads fail so params start at their defaults
+void posix_memory_load(const void *data, size_t len); // use this memory image instead of the file
+
+// sensors (setting a sensor's value also makes it present)
+void posix_imu_set(const float accel[3], const float gyro[3], float temperature);
+void posix_imu_interrupt(void); // like the IMU interrupt pin, the control chain runs before this returns
+void posix_baro_set(float pressure, float temperature);
+void posix_mag_set(const float mag[3]);
+void posix_sonar_set(float range);
+void posix_diff_pressure_set(float diff_pressure, float temperature);
+
+// PWM
+#define POSIX_PWM_CHANNELS 8
+void posix_rc_set(uint8_t channel, uint16_t value);
+void posix_rc_set_lost(bool lost);
+uint16_t posix_pwm_output(uint8_t channel);
+uint32_t posix_pwm_latency_ns(void); // host time from the last IMU interrupt to the last PWM write after it, 0 if none
+
+#ifdef __cplusplus
+}
+#endif
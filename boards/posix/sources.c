@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "param.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "posix_board.h"
+#include "trace.h"
+
+#include "sources.h"
+
+#define DEFAULT_IMU_PERIOD_US 1000
+#define DEFAULT_BARO_PERIOD_US 20000
+
+static FILE *_script = NULL;
+static bool _script_finished = false;
+static char _line[256];
+static uint64_t _next_time_us = 0;
+
+static uint64_t _next_imu_us = 0;
+static uint64_t _next_baro_us = 0;
+
+// reads ahead to the next sample in the script
+static void read_next_line(void)
+{
+  while (fgets(_line, sizeof(_line), _script) != NULL)
+  {
+    if (_line[0] == '#' || _line[0] == '\n')
+      continue;
+    if (sscanf(_line, "%" SCNu64, &_next_time_us) == 1)
+      return;
+    fprintf(stderr, "ignoring bad script line: %s", _line);
+  }
+  _script_finished = true;
+}
+
+static bool apply_line(rosflight_t *rf, const char *line)
+{
+  char source[16];
+  int offset;
+  if (sscanf(line, "%*s %15s %n", source, &offset) != 1)
+    return false;
+  const char *values = line + offset;
+
+  float v[8];
+  if (!strcmp(source, "imu")
+      && sscanf(values, "%f %f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 7)
+  {
+    posix_imu_set(&v[0], &v[3], v[6]);
+    posix_imu_interrupt();
+    return true;
+  }
+  else if (!strcmp(source, "baro") && sscanf(values, "%f %f", &v[0], &v[1]) == 2)
+  {
+    posix_baro_set(v[0], v[1]);
+  }
+  else if (!strcmp(source, "mag") && sscanf(values, "%f %f %f", &v[0], &v[1], &v[2]) == 3)
+  {
+    posix_mag_set(v);
+  }
+  else if (!strcmp(source, "sonar") && sscanf(values, "%f", &v[0]) == 1)
+  {
+    posix_sonar_set(v[0]);
+  }
+  else if (!strcmp(source, "airspeed") && sscanf(values, "%f %f", &v[0], &v[1]) == 2)
+  {
+    posix_diff_pressure_set(v[0], v[1]);
+  }
+  else if (!strcmp(source, "rc"))
+  {
+    unsigned int pwm[POSIX_PWM_CHANNELS];
+    int n = sscanf(values, "%u %u %u %u %u %u %u %u",
+                   &pwm[0], &pwm[1], &pwm[2], &pwm[3], &pwm[4], &pwm[5], &pwm[6], &pwm[7]);
+    for (int i = 0; i < n; i++)
+      posix_rc_set(i, pwm[i]);
+  }
+  else if (!strcmp(source, "rc_lost") && sscanf(values, "%f", &v[0]) == 1)
+  {
+    posix_rc_set_lost(v[0] != 0.0f);
+  }
+  else if (!strcmp(source, "param"))
+  {
+    char name[PARAMS_NAME_LENGTH + 1] = { 0 };
+    param_id_t id = PARAMS_COUNT;
+    if (sscanf(values, "%16s %f", name, &v[0]) == 2)
+      id = lookup_param_id(rf, name);
+
+    if (id == PARAMS_COUNT)
+      fprintf(stderr, "ignoring bad script line: %s", line);
+    else if (get_param_type(rf, id) == PARAM_TYPE_INT32)
+      set_param_int(rf, id, (int32_t) v[0]);
+    else
+      set_param_float(rf, id, v[0]);
+
+    if (id != PARAMS_COUNT)
+      trace_record_param(name, v[0]);
+  }
+  else if (!strcmp(source, "calibrate_imu"))
+  {
+    start_imu_calibration(rf);
+    trace_record(TRACE_CALIBRATE_IMU, NULL, 0);
+  }
+  else
+  {
+    fprintf(stderr, "ignoring bad script line: %s", line);
+  }
+  return false;
+}
+
+static bool update_default(uint64_t now_us)
+{
+  if (now_us >= _next_baro_us)
+  {
+    posix_baro_set(101325.0f, 25.0f);
+    _next_baro_us += DEFAULT_BARO_PERIOD_US;
+  }
+
+  if (now_us >= _next_imu_us)
+  {
+    const float accel[3] = {0.0f, 0.0f, -9.80665f};
+    const float gyro[3] = {0.0f, 0.0f, 0.0f};
+    posix_imu_set(accel, gyro, 25.0f);
+    posix_imu_interrupt();
+    _next_imu_us += DEFAULT_IMU_PERIOD_US;
+    return true;
+  }
+  return false;
+}
+
+bool sources_open_script(const char *filename)
+{
+  _script = fopen(filename, "r");
+  if (_script == NULL)
+  {
+    perror(filename);
+    return false;
+  }
+  read_next_line();
+  return true;
+}
+
+bool sources_update(rosflight_t *rf, uint64_t now_us)
+{
+  if (_script == NULL)
+    return update_default(now_us);
+
+  bool imu = false;
+  while (!_script_finished && _next_time_us <= now_us)
+  {
+    imu |= apply_line(rf, _line);
+    read_next_line();
+  }
+  return imu;
+}
+
+uint64_t sources_next_time_us(void)
+{
+  if (_script == NULL)
+    return (_next_imu_us < _next_baro_us) ? _next_imu_us : _next_baro_us;
+  return _next_time_us;
+}
+
+bool sources_finished(void)
+{
+  return _script_finished;
+}
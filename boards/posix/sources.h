@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rosflight.h"
+
+// Simulated sensor and RC sources.  Without a script, the vehicle sits level
+// and still on the ground.
+//
+// A script is a text file with one sample per line, in time order:
+//
+//   <time_us> imu <ax> <ay> <az> <gx> <gy> <gz> <temperature>
+//   <time_us> baro <pressure> <temperature>
+//   <time_us> mag <x> <y> <z>
+//   <time_us> sonar <range>
+//   <time_us> airspeed <diff_pressure> <temperature>
+//   <time_us> rc <ch0> <ch1> ... (up to 8 channels)
+//   <time_us> rc_lost <0|1>
+//   <time_us> param <NAME> <value>
+//   <time_us> calibrate_imu
+//
+// Lines starting with # are ignored.  IMU samples fire the IMU interrupt.
+
+bool sources_open_script(const char *filename);
+bool sources_update(rosflight_t *rf, uint64_t now_us); // returns true if the IMU interrupt fired
+uint64_t sources_next_time_us(void);
+bool sources_finished(void);
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "param.h"
+#include "sensors.h"
+
+#include "posix_board.h"
+
+#include "trace.h"
+
+#define TRACE_VERSION 1
+#define CYCLES_VERSION 1
+
+static const char trace_magic[7] = {'R', 'F', 'T', 'R', 'A', 'C', 'E'};
+static const char cycles_magic[7] = {'R', 'F', 'C', 'Y', 'C', 'L', 'E'};
+
+static FILE *_record_file = NULL;
+static uint64_t _record_time_us = 0;
+
+static FILE *_replay_file = NULL;
+static uint64_t _replay_time_us = 0;
+
+static FILE *_cycles_file = NULL;
+
+// fields of a cycle log record, for comparing them
+typedef struct
+{
+  const char *name;
+  size_t offset;
+  int count;
+  bool angle; // compared modulo 2*pi, so that -pi and pi match
+} cycle_field_t;
+
+static const cycle_field_t cycle_fields[] =
+{
+  { "outputs", offsetof(trace_cycle_t, outputs), 8, false },
+  { "q",       offsetof(trace_cycle_t, q),       4, false },
+  { "omega",   offsetof(trace_cycle_t, omega),   3, false },
+  { "euler",   offsetof(trace_cycle_t, euler),   3, true },
+  { "command", offsetof(trace_cycle_t, command), 4, false }
+};
+#define CYCLE_FIELD_COUNT (sizeof(cycle_fields) / sizeof(cycle_fields[0]))
+
+static bool write_header(FILE *file, const char magic[7], uint8_t version)
+{
+  return fwrite(magic, 1, 7, file) == 7 && fputc(version, file) != EOF;
+}
+
+static bool read_header(FILE *file, const char magic[7], uint8_t version, const char *filename)
+{
+  char header[8];
+  if (fread(header, 1, 8, file) != 8 || memcmp(header, magic, 7) != 0)
+  {
+    fprintf(stderr, "%s: not a %.7s file\n", filename, magic);
+    return false;
+  }
+  if ((uint8_t) header[7] != version)
+  {
+    fprintf(stderr, "%s: unsupported version %u\n", filename, (uint8_t) header[7]);
+    return false;
+  }
+  return true;
+}
+
+static FILE *open_file(const char *filename, const char *mode, const char magic[7], uint8_t version)
+{
+  FILE *file = fopen(filename, mode);
+  if (file == NULL)
+  {
+    perror(filename);
+    return NULL;
+  }
+
+  bool ok = (mode[0] == 'w') ? write_header(file, magic, version) : read_header(file, magic, version, filename);
+  if (!ok)
+  {
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+// recording
+bool trace_record_open(const char *filename)
+{
+  _record_file = open_file(filename, "wb", trace_magic, TRACE_VERSION);
+  _record_time_us = 0;
+  return _record_file != NULL;
+}
+
+void trace_record_close(void)
+{
+  if (_record_file != NULL)
+    fclose(_record_file);
+  _record_file = NULL;
+}
+
+bool trace_recording(void)
+{
+  return _record_file != NULL;
+}
+
+void trace_record_cycle(uint64_t time_us)
+{
+  if (_record_file == NULL)
+    return;
+
+  fputc(TRACE_CYCLE, _record_file);
+
+  // unsigned LEB128, one byte for the usual small steps
+  uint64_t delta = time_us - _record_time_us;
+  _record_time_us = time_us;
+  do
+  {
+    uint8_t byte = delta & 0x7F;
+    delta >>= 7;
+    fputc(byte | (delta ? 0x80 : 0x00), _record_file);
+  } while (delta);
+}
+
+void trace_record(trace_record_type_t type, const void *payload, size_t len)
+{
+  if (_record_file == NULL)
+    return;
+
+  fputc(type, _record_file);
+  if (len > 0)
+    fwrite(payload, 1, len, _record_file);
+}
+
+void trace_record_serial(const uint8_t *bytes, size_t len)
+{
+  while (_record_file != NULL && len > 0)
+  {
+    uint8_t chunk = (len > 255) ? 255 : len;
+    fputc(TRACE_SERIAL, _record_file);
+    fputc(chunk, _record_file);
+    fwrite(bytes, 1, chunk, _record_file);
+    bytes += chunk;
+    len -= chunk;
+  }
+}
+
+void trace_record_memory(const void *data, size_t len)
+{
+  if (_record_file == NULL)
+    return;
+
+  uint32_t length = len;
+  fputc(TRACE_MEMORY, _record_file);
+  fwrite(&length, sizeof(length), 1, _record_file);
+  fwrite(data, 1, len, _record_file);
+}
+
+void trace_record_param(const char *name, float value)
+{
+  // stored by name, so traces still replay when parameters are added
+  char padded[PARAMS_NAME_LENGTH] = { 0 };
+  size_t length = strlen(name);
+  memcpy(padded, name, (length < PARAMS_NAME_LENGTH) ? length : PARAMS_NAME_LENGTH);
+  trace_record(TRACE_PARAM, padded, sizeof(padded));
+  if (_record_file != NULL)
+    fwrite(&value, sizeof(value), 1, _record_file);
+}
+
+// replay
+static bool read_payload(void *dest, size_t len)
+{
+  if (fread(dest, 1, len, _replay_file) == len)
+    return true;
+  fprintf(stderr, "trace ends in the middle of a record\n");
+  return false;
+}
+
+static bool apply_record(rosflight_t *rf, int type, bool *imu)
+{
+  float v[7];
+  switch (type)
+  {
+  case TRACE_MEMORY:
+  {
+    uint32_t length;
+    if (!read_payload(&length, sizeof(length)))
+      return false;
+    uint8_t *data = malloc(length);
+    bool ok = (data != NULL) && read_payload(data, length);
+    if (ok)
+      posix_memory_load(data, length);
+    free(data);
+    return ok;
+  }
+  case TRACE_IMU:
+    if (!read_payload(v, 7 * sizeof(float)))
+      return false;
+    posix_imu_set(&v[0], &v[3], v[6]);
+    return true;
+  case TRACE_IMU_INTERRUPT:
+    posix_imu_interrupt();
+    *imu = true;
+    return true;
+  case TRACE_BARO:
+    if (!read_payload(v, 2 * sizeof(float)))
+      return false;
+    posix_baro_set(v[0], v[1]);
+    return true;
+  case TRACE_MAG:
+    if (!read_payload(v, 3 * sizeof(float)))
+      return false;
+    posix_mag_set(v);
+    return true;
+  case TRACE_SONAR:
+    if (!read_payload(v, sizeof(float)))
+      return false;
+    posix_sonar_set(v[0]);
+    return true;
+  case TRACE_AIRSPEED:
+    if (!read_payload(v, 2 * sizeof(float)))
+      return false;
+    posix_diff_pressure_set(v[0], v[1]);
+    return true;
+  case TRACE_RC:
+  {
+    uint8_t channel;
+    uint16_t pwm;
+    if (!read_payload(&channel, sizeof(channel)) || !read_payload(&pwm, sizeof(pwm)))
+      return false;
+    posix_rc_set(channel, pwm);
+    return true;
+  }
+  case TRACE_RC_LOST:
+  {
+    uint8_t lost;
+    if (!read_payload(&lost, sizeof(lost)))
+      return false;
+    posix_rc_set_lost(lost);
+    return true;
+  }
+  case TRACE_SERIAL:
+  {
+    uint8_t length;
+    uint8_t bytes[255];
+    if (!read_payload(&length, sizeof(length)) || !read_payload(bytes, length))
+      return false;
+    posix_serial_receive(bytes, length);
+    return true;
+  }
+  case TRACE_PARAM:
+  {
+    char name[PARAMS_NAME_LENGTH + 1] = { 0 };
+    if (!read_payload(name, PARAMS_NAME_LENGTH) || !read_payload(v, sizeof(float)))
+      return false;
+
+    param_id_t id = (rf != NULL) ? lookup_param_id(rf, name) : PARAMS_COUNT;
+    if (id == PARAMS_COUNT)
+      fprintf(stderr, "ignoring unknown parameter in trace: %s\n", name);
+    else if (get_param_type(rf, id) == PARAM_TYPE_INT32)
+      set_param_int(rf, id, (int32_t) v[0]);
+    else
+      set_param_float(rf, id, v[0]);
+    return true;
+  }
+  case TRACE_CALIBRATE_IMU:
+    if (rf != NULL)
+      start_imu_calibration(rf);
+    return true;
+  default:
+    fprintf(stderr, "unknown trace record type %d\n", type);
+    return false;
+  }
+}
+
+// applies records up to the next cycle
+static bool apply_records(rosflight_t *rf, bool *imu)
+{
+  int type;
+  while ((type = fgetc(_replay_file)) != EOF)
+  {
+    if (type == TRACE_CYCLE)
+    {
+      ungetc(type, _replay_file);
+      break;
+    }
+    if (!apply_record(rf, type, imu))
+      return false;
+  }
+  return true;
+}
+
+bool trace_replay_open(const char *filename)
+{
+  _replay_file = open_file(filename, "rb", trace_magic, TRACE_VERSION);
+  _replay_time_us = 0;
+  if (_replay_file == NULL)
+    return false;
+
+  bool imu = false;
+  if (!apply_records(NULL, &imu))
+  {
+    trace_replay_close();
+    return false;
+  }
+  return true;
+}
+
+bool trace_replay_cycle(rosflight_t *rf, bool *imu)
+{
+  (*imu) = false;
+  if (_replay_file == NULL || fgetc(_replay_file) != TRACE_CYCLE)
+    return false;
+
+  uint64_t delta = 0;
+  int shift = 0;
+  int byte;
+  do
+  {
+    byte = fgetc(_replay_file);
+    if (byte == EOF || shift > 63)
+    {
+      fprintf(stderr, "trace ends in the middle of a record\n");
+      return false;
+    }
+    delta |= (uint64_t) (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  _replay_time_us += delta;
+  posix_clock_set(_replay_time_us);
+  return apply_records(rf, imu);
+}
+
+void trace_replay_close(void)
+{
+  if (_replay_file != NULL)
+    fclose(_replay_file);
+  _replay_file = NULL;
+}
+
+// cycle logs
+bool trace_cycles_open(const char *filename)
+{
+  _cycles_file = open_file(filename, "wb", cycles_magic, CYCLES_VERSION);
+  return _cycles_file != NULL;
+}
+
+void trace_cycles_write(const trace_cycle_t *cycle)
+{
+  if (_cycles_file != NULL)
+    fwrite(cycle, sizeof(trace_cycle_t), 1, _cycles_file);
+}
+
+void trace_cycles_close(void)
+{
+  if (_cycles_file != NULL)
+    fclose(_cycles_file);
+  _cycles_file = NULL;
+}
+
+int trace_diff(const char *filename_a, const char *filename_b, float tolerance)
+{
+  FILE *a = open_file(filename_a, "rb", cycles_magic, CYCLES_VERSION);
+  FILE *b = open_file(filename_b, "rb", cycles_magic, CYCLES_VERSION);
+  if (a == NULL || b == NULL)
+  {
+    if (a != NULL)
+      fclose(a);
+    if (b != NULL)
+      fclose(b);
+    return 2;
+  }
+
+  float max_diff[CYCLE_FIELD_COUNT] = { 0.0f };
+  uint64_t cycles = 0;
+  uint64_t differing = 0;
+  bool reported = false;
+
+  uint64_t extra_a = 0, extra_b = 0;
+  trace_cycle_t ca, cb;
+  while (true)
+  {
+    bool got_a = (fread(&ca, sizeof(ca), 1, a) == 1);
+    bool got_b = (fread(&cb, sizeof(cb), 1, b) == 1);
+    if (!got_a || !got_b)
+    {
+      // one of the logs might be longer
+      extra_a += got_a;
+      extra_b += got_b;
+      break;
+    }
+
+    bool differs = (ca.time_us != cb.time_us);
+    if (differs && !reported)
+    {
+      printf("first difference at cycle %llu: time %llu us vs %llu us\n", (unsigned long long) cycles,
+             (unsigned long long) ca.time_us, (unsigned long long) cb.time_us);
+      reported = true;
+    }
+
+    for (size_t f = 0; f < CYCLE_FIELD_COUNT; f++)
+    {
+      const float *va = (const float *) ((const char *) &ca + cycle_fields[f].offset);
+      const float *vb = (const float *) ((const char *) &cb + cycle_fields[f].offset);
+      for (int i = 0; i < cycle_fields[f].count; i++)
+      {
+        // compare bits, so that identical NaNs match
+        if (memcmp(&va[i], &vb[i], sizeof(float)) == 0)
+          continue;
+
+        float diff = fabsf(va[i] - vb[i]);
+        if (cycle_fields[f].angle && diff > 3.14159265f)
+          diff = fabsf(diff - 6.28318531f);
+        if (!(diff <= max_diff[f]))
+          max_diff[f] = diff;
+        if (diff <= tolerance)
+          continue;
+
+        differs = true;
+        if (!reported)
+        {
+          printf("first difference at cycle %llu (%llu us): %s[%d] %.9g vs %.9g\n", (unsigned long long) cycles,
+                 (unsigned long long) ca.time_us, cycle_fields[f].name, i, va[i], vb[i]);
+          reported = true;
+        }
+      }
+    }
+
+    if (differs)
+      differing++;
+    cycles++;
+  }
+
+  while (fread(&ca, sizeof(ca), 1, a) == 1)
+    extra_a++;
+  while (fread(&cb, sizeof(cb), 1, b) == 1)
+    extra_b++;
+  fclose(a);
+  fclose(b);
+
+  printf("%llu cycles compared, %llu differ", (unsigned long long) cycles, (unsigned long long) differing);
+  if (extra_a > 0 || extra_b > 0)
+    printf(", %llu more in %s, %llu more in %s", (unsigned long long) extra_a, filename_a,
+           (unsigned long long) extra_b, filename_b);
+  printf("\n");
+
+  // also shown when every difference was within the tolerance
+  bool any_difference = false;
+  for (size_t f = 0; f < CYCLE_FIELD_COUNT; f++)
+    any_difference |= (max_diff[f] > 0.0f);
+  if (any_difference)
+  {
+    printf("largest differences:");
+    for (size_t f = 0; f < CYCLE_FIELD_COUNT; f++)
+      printf(" %s %.3g", cycle_fields[f].name, max_diff[f]);
+    printf("\n");
+  }
+
+  return (differing > 0 || extra_a > 0 || extra_b > 0) ? 1 : 0;
+}
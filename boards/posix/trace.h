@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rosflight.h"
+
+// Binary traces of everything the host board feeds the firmware, so a flight
+// can be replayed through rosflight_run() exactly as it happened.
+//
+// A trace starts with the magic "RFTRACE" and a version byte, followed by
+// records made of a type byte and a payload.  Each CYCLE record marks a call
+// to rosflight_run() and holds the clock as an unsigned LEB128 delta from the
+// previous cycle.  The records after it are the inputs that changed before
+// (or, for serial bytes, during) that call.  Values are stored in host byte
+// order.
+//
+// Replaying a trace produces a cycle log, with the outputs, state estimate and
+// command after every control update.  Cycle logs from two firmware builds can
+// be compared with trace_diff(), e.g. the float and fixed-point estimators.
+
+typedef enum
+{
+  TRACE_CYCLE,          // LEB128 time delta (us)
+  TRACE_MEMORY,         // uint32 length, then the contents of non-volatile memory
+  TRACE_IMU,            // float accel[3], gyro[3], temperature
+  TRACE_IMU_INTERRUPT,
+  TRACE_BARO,           // float pressure, temperature
+  TRACE_MAG,            // float mag[3]
+  TRACE_SONAR,          // float range
+  TRACE_AIRSPEED,       // float diff_pressure, temperature
+  TRACE_RC,             // uint8 channel, uint16 pwm
+  TRACE_RC_LOST,        // uint8 lost
+  TRACE_SERIAL,         // uint8 length, then the bytes received
+  TRACE_PARAM,          // char name[PARAMS_NAME_LENGTH], float value
+  TRACE_CALIBRATE_IMU,
+} trace_record_type_t;
+
+// one record of a cycle log
+typedef struct
+{
+  uint64_t time_us;
+  float outputs[8];
+  float q[4];           // w, x, y, z
+  float omega[3];
+  float euler[3];       // roll, pitch, yaw
+  float command[4];     // F, x, y, z
+} trace_cycle_t;
+
+// recording, called by the host board and the simulated sources
+bool trace_record_open(const char *filename);
+void trace_record_close(void);
+bool trace_recording(void);
+void trace_record_cycle(uint64_t time_us);
+void trace_record(trace_record_type_t type, const void *payload, size_t len);
+void trace_record_serial(const uint8_t *bytes, size_t len);
+void trace_record_memory(const void *data, size_t len);
+void trace_record_param(const char *name, float value);
+
+// replay: open applies everything before the first cycle (i.e. the memory
+// contents), so open the trace before rosflight_init()
+bool trace_replay_open(const char *filename);
+bool trace_replay_cycle(rosflight_t *rf, bool *imu); // sets the clock and applies the next cycle's inputs, false at the end
+void trace_replay_close(void);
+
+// cycle logs
+bool trace_cycles_open(const char *filename);
+void trace_cycles_write(const trace_cycle_t *cycle);
+void trace_cycles_close(void);
+// prints the differences, returns 0 if none is larger than tolerance
+int trace_diff(const char *filename_a, const char *filename_b, float tolerance);
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// Host test of the fixed-point math in lib/turbotrig.  Sweeps the Q15 and Q31 scalar,
+// vector and quaternion operations against double-precision references and against the
+// float versions in turbovec.c, and fails if any error is above its bound.  Bounds are in
+// units of the last place of the result (LSB) unless they say otherwise.  The float
+// normalize uses turboInvSqrt, which is only good to about 5e-6, so comparisons that
+// go through it have a looser bound than the double references.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turbofix.h"
+#include "turbovec.h"
+
+#define SAMPLES 1000000
+#define Q15_STRIDE 7          // operand step of the exhaustive Q15 sweeps
+#define Q31_LSB (1.0 / 2147483648.0)
+
+static int failures = 0;
+
+// splitmix64
+static uint64_t rng_next(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state, double min, double max)
+{
+  return min + (max - min) * ((rng_next(state) >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static q31_t rng_q31(uint64_t *state)
+{
+  return (q31_t) (uint32_t) rng_next(state);
+}
+
+static q31quat_t rng_unit_quat(uint64_t *state)
+{
+  double q[4], n = 0.0;
+  for (int i = 0; i < 4; i++)
+  {
+    q[i] = rng_uniform(state, -1.0, 1.0);
+    n += q[i] * q[i];
+  }
+  n = sqrt(n);
+  q31quat_t out = {q31_from_float(q[0] / n), q31_from_float(q[1] / n), q31_from_float(q[2] / n), q31_from_float(q[3] / n)};
+  return out;
+}
+
+static double clamp(double x, double min, double max)
+{
+  return (x > max) ? max : ((x < min) ? min : x);
+}
+
+static void check(const char *name, double worst, double bound, const char *unit)
+{
+  bool ok = worst <= bound;
+  printf("%-44s worst %11.4g  bound %9.3g %-4s %s\n", name, worst, bound, unit, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+static void test_q15(void)
+{
+  double worst_mul = 0.0, worst_add = 0.0, worst_sub = 0.0;
+  for (int32_t a = Q15_MIN; a <= Q15_MAX; a += Q15_STRIDE)
+  {
+    for (int32_t b = Q15_MIN; b <= Q15_MAX; b += Q15_STRIDE)
+    {
+      double mul = clamp(floor((double) a * b / 32768.0 + 0.5), Q15_MIN, Q15_MAX);
+      worst_mul = fmax(worst_mul, fabs(q15_mul(a, b) - mul));
+      worst_add = fmax(worst_add, fabs(q15_add(a, b) - clamp(a + b, Q15_MIN, Q15_MAX)));
+      worst_sub = fmax(worst_sub, fabs(q15_sub(a, b) - clamp(a - b, Q15_MIN, Q15_MAX)));
+    }
+  }
+  check("q15_mul, all pairs at a stride of 7", worst_mul, 0.0, "LSB");
+  check("q15_add, all pairs at a stride of 7", worst_add, 0.0, "LSB");
+  check("q15_sub, all pairs at a stride of 7", worst_sub, 0.0, "LSB");
+}
+
+static void test_q31_scalar(uint64_t *rng)
+{
+  // q31_sat on both sides of each limit, then across the whole int64 range
+  double worst_sat = 0.0;
+  const int64_t edges[] = {0, Q31_MAX, Q31_MIN, INT64_MAX, INT64_MIN};
+  for (int i = 0; i < 5; i++)
+  {
+    for (int64_t d = -1000; d <= 1000; d++)
+    {
+      int64_t x = edges[i] + d;
+      if ((d > 0 && x < edges[i]) || (d < 0 && x > edges[i]))
+        continue; // past the end of int64
+      worst_sat = fmax(worst_sat, fabs(q31_sat(x) - clamp((double) x, Q31_MIN, Q31_MAX)));
+    }
+  }
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    int64_t x = (int64_t) rng_next(rng) >> (rng_next(rng) % 64);
+    worst_sat = fmax(worst_sat, fabs(q31_sat(x) - clamp((double) x, Q31_MIN, Q31_MAX)));
+  }
+  check("q31_sat", worst_sat, 0.0, "LSB");
+
+  // products are exact in int64, so the rounding is measured exactly
+  double worst_mul = 0.0, worst_add = 0.0, worst_sub = 0.0;
+  const q31_t specials[] = {Q31_MIN, Q31_MIN + 1, -1, 0, 1, Q31_MAX - 1, Q31_MAX};
+  for (int i = 0; i < SAMPLES + 49; i++)
+  {
+    q31_t a = (i < 49) ? specials[i / 7] : rng_q31(rng);
+    q31_t b = (i < 49) ? specials[i % 7] : rng_q31(rng);
+    int64_t product = (int64_t) a * b;
+    q31_t result = q31_mul(a, b);
+    double err = (result == Q31_MAX && product >= ((int64_t) Q31_MAX << 31)) ? 0.0
+                 : fabs((double) (product - ((int64_t) result << 31)) / 2147483648.0);
+    worst_mul = fmax(worst_mul, err);
+    worst_add = fmax(worst_add, fabs(q31_add(a, b) - clamp((double) a + b, Q31_MIN, Q31_MAX)));
+    worst_sub = fmax(worst_sub, fabs(q31_sub(a, b) - clamp((double) a - b, Q31_MIN, Q31_MAX)));
+  }
+  check("q31_mul, rounding", worst_mul, 0.5, "LSB");
+  check("q31_add", worst_add, 0.0, "LSB");
+  check("q31_sub", worst_sub, 0.0, "LSB");
+
+  double worst_conv = 0.0;
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    float x = rng_uniform(rng, -1.5, 1.5);
+    worst_conv = fmax(worst_conv, fabs(q31_to_float(q31_from_float(x)) - clamp(x, -1.0, 1.0)));
+  }
+  check("q31 float round trip", worst_conv, 6e-8, "abs");
+}
+
+static void test_q31_vector(uint64_t *rng)
+{
+  double worst_dot = 0.0, worst_cross = 0.0, worst_scale = 0.0, worst_add = 0.0;
+  double worst_float = 0.0;
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    // components up to 1/sqrt(3), so that no result saturates
+    double u[3], v[3];
+    for (int k = 0; k < 3; k++)
+    {
+      u[k] = rng_uniform(rng, -0.577, 0.577);
+      v[k] = rng_uniform(rng, -0.577, 0.577);
+    }
+    q31vec_t qu = {q31_from_float(u[0]), q31_from_float(u[1]), q31_from_float(u[2])};
+    q31vec_t qv = {q31_from_float(v[0]), q31_from_float(v[1]), q31_from_float(v[2])};
+    double du[3] = {qu.x * Q31_LSB, qu.y * Q31_LSB, qu.z * Q31_LSB};
+    double dv[3] = {qv.x * Q31_LSB, qv.y * Q31_LSB, qv.z * Q31_LSB};
+
+    double dot_ref = du[0]*dv[0] + du[1]*dv[1] + du[2]*dv[2];
+    worst_dot = fmax(worst_dot, fabs(q31_dot(qu, qv) * Q31_LSB - dot_ref) / Q31_LSB);
+
+    double cross_ref[3] = {du[1]*dv[2] - du[2]*dv[1], du[2]*dv[0] - du[0]*dv[2], du[0]*dv[1] - du[1]*dv[0]};
+    q31vec_t c = q31_cross(qu, qv);
+    worst_cross = fmax(worst_cross, fabs(c.x * Q31_LSB - cross_ref[0]) / Q31_LSB);
+    worst_cross = fmax(worst_cross, fabs(c.y * Q31_LSB - cross_ref[1]) / Q31_LSB);
+    worst_cross = fmax(worst_cross, fabs(c.z * Q31_LSB - cross_ref[2]) / Q31_LSB);
+
+    q31vec_t s = q31_scalar_multiply(qu.x, qv);
+    worst_scale = fmax(worst_scale, fabs(s.y * Q31_LSB - du[0]*dv[1]) / Q31_LSB);
+
+    q31vec_t sum = q31_vector_add(qu, qv);
+    q31vec_t diff = q31_vector_sub(qu, qv);
+    worst_add = fmax(worst_add, fabs(sum.z - clamp((double) qu.z + qv.z, Q31_MIN, Q31_MAX)));
+    worst_add = fmax(worst_add, fabs(diff.x - clamp((double) qu.x - qv.x, Q31_MIN, Q31_MAX)));
+
+    // the integer API against the float one in turbovec.c
+    vector_t fu = {u[0], u[1], u[2]};
+    vector_t fv = {v[0], v[1], v[2]};
+    vector_t fc = cross(fu, fv);
+    intvec_t ic = int_cross(qu, qv);
+    worst_float = fmax(worst_float, fabs(int_dot(qu, qv) * Q31_LSB - dot(fu, fv)));
+    worst_float = fmax(worst_float, fabs(ic.x * Q31_LSB - fc.x));
+    worst_float = fmax(worst_float, fabs(ic.y * Q31_LSB - fc.y));
+    worst_float = fmax(worst_float, fabs(ic.z * Q31_LSB - fc.z));
+  }
+  check("q31_dot", worst_dot, 0.5, "LSB");
+  check("q31_cross", worst_cross, 0.5, "LSB");
+  check("q31_scalar_multiply", worst_scale, 0.5, "LSB");
+  check("q31_vector_add and q31_vector_sub", worst_add, 0.0, "LSB");
+  check("int_dot and int_cross against float", worst_float, 2e-7, "abs");
+
+  // saturation instead of wrapping
+  q31vec_t big = {Q31_MIN, Q31_MIN, Q31_MIN};
+  check("q31_dot saturates", fabs((double) q31_dot(big, big) - Q31_MAX), 0.0, "LSB");
+  q31vec_t neg = q31_vector_sub((q31vec_t) {0, 0, 0}, big);
+  check("q31_vector_sub saturates", fabs((double) neg.x - Q31_MAX), 0.0, "LSB");
+}
+
+static void test_normalize(uint64_t *rng)
+{
+  // random directions at every input scale, since normalizing shouldn't care about it
+  double worst_vec = 0.0, worst_quat = 0.0, worst_float = 0.0;
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    int bits = 8 + i % 24;
+    double scale = ldexp(1.0, bits - 1);
+    double d[4], n3 = 0.0, n4 = 0.0;
+    int32_t raw[4];
+    for (int k = 0; k < 4; k++)
+    {
+      raw[k] = (int32_t) (rng_uniform(rng, -1.0, 1.0) * scale);
+      d[k] = raw[k];
+      n4 += d[k] * d[k];
+      if (k < 3)
+        n3 += d[k] * d[k];
+    }
+    if (n3 == 0.0)
+      continue;
+    n3 = sqrt(n3);
+    n4 = sqrt(n4);
+
+    q31vec_t v = q31_vector_normalize((q31vec_t) {raw[0], raw[1], raw[2]});
+    worst_vec = fmax(worst_vec, fabs(v.x * Q31_LSB - d[0] / n3));
+    worst_vec = fmax(worst_vec, fabs(v.y * Q31_LSB - d[1] / n3));
+    worst_vec = fmax(worst_vec, fabs(v.z * Q31_LSB - d[2] / n3));
+
+    q31quat_t q = q31_quaternion_normalize((q31quat_t) {raw[0], raw[1], raw[2], raw[3]});
+    worst_quat = fmax(worst_quat, fabs(q.w * Q31_LSB - d[0] / n4));
+    worst_quat = fmax(worst_quat, fabs(q.x * Q31_LSB - d[1] / n4));
+    worst_quat = fmax(worst_quat, fabs(q.y * Q31_LSB - d[2] / n4));
+    worst_quat = fmax(worst_quat, fabs(q.z * Q31_LSB - d[3] / n4));
+
+    vector_t f = vector_normalize((vector_t) {d[0], d[1], d[2]});
+    worst_float = fmax(worst_float, fabs(v.x * Q31_LSB - f.x));
+    worst_float = fmax(worst_float, fabs(v.y * Q31_LSB - f.y));
+    worst_float = fmax(worst_float, fabs(v.z * Q31_LSB - f.z));
+  }
+  check("q31_vector_normalize, every input scale", worst_vec, 1e-8, "abs");
+  check("q31_quaternion_normalize, every input scale", worst_quat, 1e-8, "abs");
+  check("int_vector_normalize against float", worst_float, 1e-5, "abs");
+
+  q31vec_t zero = q31_vector_normalize((q31vec_t) {0, 0, 0});
+  check("q31_vector_normalize of zero", fabs((double) zero.x) + fabs((double) zero.y) + fabs((double) zero.z), 0.0, "LSB");
+}
+
+static void test_quaternion(uint64_t *rng)
+{
+  double worst_mul = 0.0, worst_inv = 0.0, worst_float = 0.0;
+  for (int i = 0; i < SAMPLES; i++)
+  {
+    q31quat_t a = rng_unit_quat(rng);
+    q31quat_t b = rng_unit_quat(rng);
+    double w1 = a.w * Q31_LSB, x1 = a.x * Q31_LSB, y1 = a.y * Q31_LSB, z1 = a.z * Q31_LSB;
+    double w2 = b.w * Q31_LSB, x2 = b.x * Q31_LSB, y2 = b.y * Q31_LSB, z2 = b.z * Q31_LSB;
+    double ref[4] =
+    {
+      w1*w2 - x1*x2 - y1*y2 - z1*z2,
+      w1*x2 + x1*w2 - y1*z2 + z1*y2,
+      w1*y2 + x1*z2 + y1*w2 - z1*x2,
+      w1*z2 - x1*y2 + y1*x2 + z1*w2
+    };
+    q31quat_t p = q31_quaternion_multiply(a, b);
+    worst_mul = fmax(worst_mul, fabs(p.w * Q31_LSB - ref[0]) / Q31_LSB);
+    worst_mul = fmax(worst_mul, fabs(p.x * Q31_LSB - ref[1]) / Q31_LSB);
+    worst_mul = fmax(worst_mul, fabs(p.y * Q31_LSB - ref[2]) / Q31_LSB);
+    worst_mul = fmax(worst_mul, fabs(p.z * Q31_LSB - ref[3]) / Q31_LSB);
+
+    q31quat_t inv = q31_quaternion_inverse(a);
+    worst_inv = fmax(worst_inv, fabs((double) inv.w - a.w) + fabs((double) inv.x + a.x)
+                     + fabs((double) inv.y + a.y) + fabs((double) inv.z + a.z));
+
+    // the integer API, which normalizes the product, against the float one in turbovec.c
+    quaternion_t fa = {w1, x1, y1, z1};
+    quaternion_t fb = {w2, x2, y2, z2};
+    quaternion_t fp = quaternion_normalize(quaternion_multiply(fa, fb));
+    intquat_t ip = int_quaternion_multiply(a, b);
+    worst_float = fmax(worst_float, fabs(ip.w * Q31_LSB - fp.w));
+    worst_float = fmax(worst_float, fabs(ip.x * Q31_LSB - fp.x));
+    worst_float = fmax(worst_float, fabs(ip.y * Q31_LSB - fp.y));
+    worst_float = fmax(worst_float, fabs(ip.z * Q31_LSB - fp.z));
+  }
+  check("q31_quaternion_multiply, unit quaternions", worst_mul, 0.5, "LSB");
+  check("q31_quaternion_inverse", worst_inv, 0.0, "LSB");
+  check("int_quaternion_multiply against float", worst_float, 1e-5, "abs");
+
+  q31quat_t edge = q31_quaternion_inverse((q31quat_t) {0, Q31_MIN, 0, 0});
+  check("q31_quaternion_inverse saturates", fabs((double) edge.x - Q31_MAX), 0.0, "LSB");
+}
+
+int main(void)
+{
+  uint64_t rng = 1;
+  test_q15();
+  test_q31_scalar(&rng);
+  test_q31_vector(&rng);
+  test_normalize(&rng);
+  test_quaternion(&rng);
+
+  if (failures > 0)
+  {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <math.h>
+
+#include "vehicle.h"
+
+#define GRAVITY 9.80665
+#define SQRT1_2 0.70710678118654752
+
+// motor positions (x, y) in units of arm_length, and reaction torque direction
+static const double motor_x[VEHICLE_MOTORS] = {-SQRT1_2,  SQRT1_2, -SQRT1_2,  SQRT1_2};
+static const double motor_y[VEHICLE_MOTORS] = { SQRT1_2,  SQRT1_2, -SQRT1_2, -SQRT1_2};
+static const double motor_spin[VEHICLE_MOTORS] = {-1.0, 1.0, 1.0, -1.0};
+
+// the model is integrated in steps no longer than this
+#define MAX_STEP_S 0.00025
+
+void vehicle_init(vehicle_t *vehicle)
+{
+  vehicle->inertia[0] = 0.0035;
+  vehicle->inertia[1] = 0.0035;
+  vehicle->inertia[2] = 0.0060;
+  vehicle->arm_length = 0.125;
+  vehicle->max_thrust = 6.0;
+  vehicle->yaw_moment = 0.015;
+  vehicle->motor_tau = 0.03;
+  vehicle->damping = 0.002;
+
+  vehicle->q[0] = 1.0;
+  for (int i = 1; i < 4; i++)
+    vehicle->q[i] = 0.0;
+  for (int i = 0; i < 3; i++)
+    vehicle->omega[i] = 0.0;
+  for (int i = 0; i < VEHICLE_MOTORS; i++)
+  {
+    vehicle->motor_scale[i] = 1.0;
+    vehicle->thrust[i] = 0.0;
+  }
+}
+
+static void integrate(vehicle_t *vehicle, const double throttle[VEHICLE_MOTORS], double dt)
+{
+  double torque[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < VEHICLE_MOTORS; i++)
+  {
+    double u = throttle[i] < 0.0 ? 0.0 : (throttle[i] > 1.0 ? 1.0 : throttle[i]);
+    double target = u * vehicle->max_thrust * vehicle->motor_scale[i];
+    vehicle->thrust[i] += (target - vehicle->thrust[i]) * dt / (vehicle->motor_tau + dt);
+
+    // thrust points along -z, so r x F = (-y T, x T, 0)
+    torque[0] -= motor_y[i] * vehicle->arm_length * vehicle->thrust[i];
+    torque[1] += motor_x[i] * vehicle->arm_length * vehicle->thrust[i];
+    torque[2] += motor_spin[i] * vehicle->yaw_moment * vehicle->thrust[i];
+  }
+
+  // Euler's equations, J w_dot = torque - w x (J w)
+  const double *J = vehicle->inertia;
+  double *w = vehicle->omega;
+  double w_dot[3];
+  w_dot[0] = (torque[0] - (J[2] - J[1]) * w[1] * w[2] - vehicle->damping * w[0]) / J[0];
+  w_dot[1] = (torque[1] - (J[0] - J[2]) * w[2] * w[0] - vehicle->damping * w[1]) / J[1];
+  w_dot[2] = (torque[2] - (J[1] - J[0]) * w[0] * w[1] - vehicle->damping * w[2]) / J[2];
+  for (int i = 0; i < 3; i++)
+    w[i] += w_dot[i] * dt;
+
+  // q_dot = 1/2 q * (0, w)
+  double *q = vehicle->q;
+  double q_dot[4];
+  q_dot[0] = 0.5 * (-q[1] * w[0] - q[2] * w[1] - q[3] * w[2]);
+  q_dot[1] = 0.5 * ( q[0] * w[0] + q[2] * w[2] - q[3] * w[1]);
+  q_dot[2] = 0.5 * ( q[0] * w[1] - q[1] * w[2] + q[3] * w[0]);
+  q_dot[3] = 0.5 * ( q[0] * w[2] + q[1] * w[1] - q[2] * w[0]);
+
+  double norm = 0.0;
+  for (int i = 0; i < 4; i++)
+  {
+    q[i] += q_dot[i] * dt;
+    norm += q[i] * q[i];
+  }
+  norm = sqrt(norm);
+  for (int i = 0; i < 4; i++)
+    q[i] /= norm;
+}
+
+void vehicle_step(vehicle_t *vehicle, const double throttle[VEHICLE_MOTORS], double dt)
+{
+  while (dt > 0.0)
+  {
+    double step = (dt > MAX_STEP_S) ? MAX_STEP_S : dt;
+    integrate(vehicle, throttle, step);
+    dt -= step;
+  }
+}
+
+void vehicle_euler(const vehicle_t *vehicle, double *roll, double *pitch, double *yaw)
+{
+  const double *q = vehicle->q;
+  (*roll) = atan2(2.0 * (q[0] * q[1] + q[2] * q[3]), 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]));
+  double s = 2.0 * (q[0] * q[2] - q[3] * q[1]);
+  (*pitch) = asin(s > 1.0 ? 1.0 : (s < -1.0 ? -1.0 : s));
+  (*yaw) = atan2(2.0 * (q[0] * q[3] + q[1] * q[2]), 1.0 - 2.0 * (q[2] * q[2] + q[3] * q[3]));
+}
+
+void vehicle_accel(const vehicle_t *vehicle, double accel[3])
+{
+  // gravity (0, 0, -g) in NED, rotated into the body frame by R^T
+  const double *q = vehicle->q;
+  accel[0] = -GRAVITY * 2.0 * (q[1] * q[3] - q[0] * q[2]);
+  accel[1] = -GRAVITY * 2.0 * (q[2] * q[3] + q[0] * q[1]);
+  accel[2] = -GRAVITY * (1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]));
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+// Rigid body model of a quadcopter in the X configuration, with motors in the
+// order of the firmware's quadcopter X mixer (MIXER = 1):
+//
+//   3   1      x forward, y right, z down
+//     X
+//   2   0
+//
+// Only the attitude is modeled.  The vehicle holds its position, so the
+// accelerometer only sees gravity.
+
+#define VEHICLE_MOTORS 4
+
+typedef struct
+{
+  // parameters
+  double inertia[3];                 // kg m^2, about the body axes
+  double arm_length;                 // m, from the center to each motor
+  double max_thrust;                 // N, from one motor at full throttle
+  double yaw_moment;                 // m, motor reaction torque per unit of thrust
+  double motor_tau;                  // s, first order time constant of the motors
+  double damping;                    // N m s/rad, rotational drag
+  double motor_scale[VEHICLE_MOTORS]; // thrust of each motor relative to max_thrust
+
+  // state
+  double q[4];                       // attitude from body to NED (w, x, y, z)
+  double omega[3];                   // rad/s, body rates
+  double thrust[VEHICLE_MOTORS];     // N
+} vehicle_t;
+
+void vehicle_init(vehicle_t *vehicle); // nominal 250 size quad, level and at rest
+void vehicle_step(vehicle_t *vehicle, const double throttle[VEHICLE_MOTORS], double dt); // throttle from 0 to 1
+void vehicle_euler(const vehicle_t *vehicle, double *roll, double *pitch, double *yaw);
+void vehicle_accel(const vehicle_t *vehicle, double accel[3]); // specific force in the body frame (m/s^2)
@@ -41,6 +41,14 @@ void board_reset(bool bootloader);
 uint32_t clock_millis();
 uint64_t clock_micros();
 void clock_delay(uint32_t milliseconds);
+uint32_t clock_cycles(); // free-running CPU cycle counter, used for profiling (wraps)
+uint32_t clock_cycles_per_us();
+
+// software interrupt, below the sensor and serial interrupts but above the main loop
+void soft_interrupt_register(void (*callback)(void *arg), void *arg);
+void soft_interrupt_trigger(void); // can be called from any interrupt
+void soft_interrupt_disable(void); // keeps the callback from running while the main loop changes state it uses
+void soft_interrupt_enable(void);  // a trigger that arrived while disabled runs the callback now
 
 // serial
 void serial_init(uint32_t baud_rate);
@@ -51,11 +59,23 @@ uint8_t serial_read(void);
 // sensors
 void sensors_init();
 
-void imu_register_callback(void (*callback)(void));
+void imu_register_callback(void (*callback)(void *arg), void *arg);
 void imu_read_accel(float accel[3]);
 void imu_read_gyro(float gyro[3]);
 float imu_read_temperature(void);
 bool imu_read_all(float accel[3], float gyro[3], float *temperature);
+// starts a non-blocking read, complete is called from interrupt context once accel, gyro and
+// temperature have been filled in.  Returns false if the transfer could not be started.
+bool imu_read_all_async(float accel[3], float gyro[3], float *temperature,
+                        void (*complete)(bool success, void *arg), void *arg);
+// rate of the data-ready interrupt, boards pick the nearest rate they support.  With the FIFO
+// on, every sample is also queued until imu_read_fifo_async() drains it.
+void imu_configure(uint32_t sample_rate_hz, bool fifo);
+// like imu_read_all_async, but drains up to max_samples of gyro from the FIFO in one burst, oldest
+// first, and sets count to the number read.  accel and temperature are read once, after the FIFO.
+// If the FIFO overflowed, it is emptied and complete gets false, with count set to the samples lost.
+bool imu_read_fifo_async(float accel[3], float gyro[][3], float *temperature, uint8_t max_samples, uint8_t *count,
+                         void (*complete)(bool success, void *arg), void *arg);
 void imu_not_responding_error();
 
 bool mag_check(void);
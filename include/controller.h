@@ -37,12 +37,113 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+#include <turbotrig/turbofix.h>
+#include <turbotrig/turbovec.h>
+
 #include "mux.h"
 #include "param.h"
 
-void run_controller();
-void init_controller();
-void calculate_equilbrium_torque_from_rc();
+#ifdef FIXED_POINT_CONTROL
+// Gains and state of a PID loop in the fixed-point build, used in place of the floats below
+typedef struct
+{
+  q16_t kp;
+  q16_t ki;
+  q16_t kd;
+  q16_t max;
+  q16_t min;
+  uint32_t tau_us;
+
+  int64_t integrator;     // Q32, so that error*dt steps aren't lost
+  q16_t prev_x;
+  q16_t differentiator;
+  uint32_t coeff_dt_us;   // time step that the dirty derivative coefficients below are for
+  q31_t decay;            // (2*tau - dt)/(2*tau + dt)
+  q16_t gain;             // 2/(2*tau + dt)
+} pid_fixed_t;
+#endif
+
+typedef struct
+{
+  param_id_t kp_param_id;
+  param_id_t ki_param_id;
+  param_id_t kd_param_id;
+  float kp; // copies of the gain params, refreshed by update_controller_params()
+  float ki;
+  float kd;
+
+  float *current_x;
+  float *current_xdot;
+  float *commanded_x;
+  float *output;
+
+  float max;
+  float min;
+
+  float integrator;
+  float prev_x;
+  float differentiator;
+  float tau;
+
+#ifdef FIXED_POINT_CONTROL
+  pid_fixed_t fixed;
+#endif
+} pid_controller_t;
+
+// Needs to match the ANGLE_CTRL param
+typedef enum
+{
+  ANGLE_CONTROLLER_EULER,
+  ANGLE_CONTROLLER_QUATERNION
+} angle_controller_t;
+
+typedef struct
+{
+  pid_controller_t pid_roll;
+  pid_controller_t pid_roll_rate;
+  pid_controller_t pid_pitch;
+  pid_controller_t pid_pitch_rate;
+  pid_controller_t pid_yaw_rate;
+
+  // Angle mode PIDs of the quaternion controller, with the roll and pitch angle gains
+  pid_controller_t pid_roll_tilt;
+  pid_controller_t pid_pitch_tilt;
+  angle_controller_t angle_controller;
+  vector_t tilt;            // estimated attitude relative to the commanded one, as a body rotation (rad)
+  float error_setpoint;     // always 0, for the PIDs that run on an attitude error
+  float tilt_cmd_roll;      // command that down_cmd was computed for
+  float tilt_cmd_pitch;
+  vector_t down_cmd;        // commanded direction of gravity in the body frame
+
+  // Cascaded angle mode, where an outer angle loop sets the setpoint of the rate PIDs
+  pid_controller_t pid_roll_cascade;
+  pid_controller_t pid_pitch_cascade;
+  bool cascade;
+  uint32_t angle_loop_period_us;
+  uint64_t angle_loop_prev_us;
+  uint64_t angle_loop_next_us;
+  bool roll_cascaded;       // whether each axis ran through the angle loop on the last update
+  bool pitch_cascaded;
+  vector_t angle_error;     // estimate minus command, the input of the angle loop (rad)
+  vector_t rate_setpoint;   // setpoint of the roll and pitch rate PIDs (rad/s)
+
+  float x_eq_torque; // copies of the equilibrium torque params
+  float y_eq_torque;
+  float z_eq_torque;
+
+  uint64_t prev_time_us;
+
+#ifdef FIXED_POINT_CONTROL
+  q16_t eq_torque[3];     // x, y and z
+#endif
+} controller_t;
+
+struct rosflight_t;
+
+void run_controller(struct rosflight_t *rf);
+void init_controller(struct rosflight_t *rf);
+void update_controller_params(struct rosflight_t *rf);
+void calculate_equilbrium_torque_from_rc(struct rosflight_t *rf);
 
 
 #ifdef __cplusplus
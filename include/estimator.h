@@ -40,22 +40,209 @@ extern "C" {
 
 typedef struct
 {
-  quaternion_t q;
-  vector_t omega;
-  float roll;
+  quaternion_t q;     // with FILTER_PREDICT, predicted to when the outputs computed from it reach the motors
+  vector_t omega;     // rad/s, predicted the same way
+  float roll;   // only valid after estimator_update_euler()
   float pitch;
   float yaw;
-  float altitude;
+  float altitude;           // m, up from where the vehicle was armed
+  float vertical_velocity;  // m/s, up
   uint64_t now_us;
 
 } state_t;
 
-extern state_t _current_state;
+struct rosflight_t;
+
+// Needs to match the FILTER_TYPE param
+typedef enum
+{
+  ESTIMATOR_MAHONY,
+  ESTIMATOR_MADGWICK,
+  ESTIMATOR_MEKF,
+
+  ESTIMATOR_BACKEND_COUNT
+} estimator_backend_id_t;
+
+// An attitude filter.  run_estimator() aligns it at startup, schedules the corrections,
+// low-passes the IMU and predicts the published state forward, and calls these for the
+// rest.  Each update runs propagate(), correct() and publish() in that order.
+typedef struct
+{
+  const char *name;
+  void (*init)(struct rosflight_t *rf);       // start from the attitude in state.q and accel_LPF, with no bias
+  void (*reset_bias)(struct rosflight_t *rf); // forget the gyro bias estimate after a gyro calibration
+  void (*propagate)(struct rosflight_t *rf, uint64_t dt_us);
+  void (*correct)(struct rosflight_t *rf, uint64_t acc_dt_us, uint64_t mag_dt_us); // a dt of 0: nothing new from that sensor
+  void (*publish)(struct rosflight_t *rf);    // write the attitude and bias-corrected rates to state.q and state.omega
+} estimator_backend_t;
+
+// Copies of the params used on every update, refreshed by update_estimator_params()
+typedef struct
+{
+  float acc_alpha;
+  float one_minus_acc_alpha;
+  float gyro_alpha;
+  float one_minus_gyro_alpha;
+  uint64_t init_time_us;   // the alignment averages the accelerometer and magnetometer over this long
+  float kp;
+  float ki;
+  float kp_mag;
+  float beta;              // Madgwick gradient step
+  float zeta;              // Madgwick bias gain
+  bool use_acc;
+  bool use_mag;
+  bool use_quad_int;
+  bool use_mat_exp;
+  bool predict;            // predict the state forward by the IMU to PWM latency
+  uint32_t acc_period_us;  // time between accelerometer corrections
+  float alt_baro_gain[3];  // altitude, vertical velocity and accelerometer bias gains of the altitude corrections
+  float alt_sonar_gain[3];
+  const estimator_backend_t *backend; // from FILTER_TYPE, takes over from the running one when disarmed
+#ifndef FIXED_POINT_ESTIMATOR
+  quaternion_t (*integrate)(quaternion_t q, vector_t w, float dt); // Euler or matrix exponential, from FILTER_MAT_EXP
+#endif
+} estimator_params_t;
 
-void reset_state();
-void reset_adaptive_bias();
-void init_estimator();
-void run_estimator();
+#ifdef FIXED_POINT_ESTIMATOR
+// Filter state of the fixed-point build, which replaces the float Mahony filter.  The
+// formats are described in estimator_fixed.c.
+typedef struct
+{
+  q31_t acc_alpha;
+  q31_t one_minus_acc_alpha;
+  q31_t gyro_alpha;
+  q31_t one_minus_gyro_alpha;
+  int32_t kp;              // Q16
+  int64_t ki_per_us;       // ki/1e6, Q48
+  int32_t kp_mag;          // Q16
+
+  q31vec_t accel_LPF;      // m/s^2, Q16
+  q31vec_t gyro_LPF;       // rad/s, Q25
+  q31vec_t w1;
+  q31vec_t w2;
+  q31vec_t w_acc;          // Q31, held between accelerometer corrections
+  q31vec_t w_mag;          // Q31, held between magnetometer corrections
+  q31vec_t omega;          // rad/s, Q25, gyro_LPF less the bias
+  q31vec_t last_omega;     // omega of the previous update, for the prediction
+  int64_t b[3];            // rad/s, Q56 so that the small integrator steps aren't lost
+  q31quat_t q_hat;
+} estimator_fixed_t;
+#else
+// Mahony filter of estimator_mahony.c
+typedef struct
+{
+  vector_t w1;
+  vector_t w2;
+  vector_t wbar;
+  vector_t wfinal;
+  vector_t w_acc;       // held between accelerometer corrections
+  vector_t w_mag;       // held between magnetometer corrections
+  vector_t b;
+  quaternion_t q_hat;
+} mahony_t;
+
+// Madgwick filter of estimator_madgwick.c
+typedef struct
+{
+  vector_t e_acc;       // descent directions of the last corrections, held like Mahony's
+  vector_t e_mag;
+  vector_t b;
+  quaternion_t q;
+} madgwick_t;
+
+// Multiplicative EKF of estimator_mekf.c, with the attitude error and gyro bias as its state
+typedef struct
+{
+  quaternion_t q;
+  vector_t b;
+  float P[6][6];        // covariance, attitude error (rad) then bias (rad/s)
+  uint32_t cov_dt_us;   // time the covariance hasn't been propagated over yet
+} mekf_t;
+#endif
+
+// Altitude observer of reports/altitude.tex, a third-order complementary filter that
+// integrates the vertical acceleration and corrects it with the sonar or barometer
+typedef struct
+{
+  float accel_bias;       // m/s^2, up
+  float baro_ground;      // m, barometer altitude of the ground, which also takes up the barometer's drift
+  bool baro_ground_set;
+  bool valid;             // a correction has tied the estimate to the ground
+} altitude_estimator_t;
+
+// One-shot coarse alignment that seeds the filter, in place of converging from level
+typedef struct
+{
+  bool done;
+  uint64_t start_us;
+  vector_t accel_sum;
+  vector_t mag_sum;
+  uint32_t accel_count;
+  uint32_t mag_count;
+} alignment_t;
+
+typedef struct
+{
+  state_t state;
+  estimator_params_t params;
+  const estimator_backend_t *backend;
+  alignment_t alignment;
+  altitude_estimator_t altitude;
+#ifdef FIXED_POINT_ESTIMATOR
+  estimator_fixed_t fixed;
+#else
+  mahony_t mahony;
+  madgwick_t madgwick;
+  mekf_t mekf;
+#endif
+
+  vector_t last_omega;  // state.omega of the previous update before the prediction
+  bool euler_valid;  // state.roll, pitch and yaw are up to date with state.q
+  uint64_t last_time;
+  uint64_t last_acc_update_us;     // last accelerometer correction that passed the norm check
+  uint64_t last_acc_correction_us; // last time the accelerometer correction ran
+  uint64_t next_acc_correction_us;
+  uint64_t last_mag_correction_us;
+  uint32_t mag_count;              // sensors.mag_count at the last magnetometer correction
+  bool mag_fresh;                  // the last magnetometer measurement is recent enough for held corrections to apply
+
+  vector_t accel_LPF;
+  vector_t gyro_LPF;
+} estimator_t;
+
+// The backends that this build has, indexed by FILTER_TYPE.  The fixed-point build only has
+// Mahony, and NULL in the other entries.
+extern const estimator_backend_t *const estimator_backends[ESTIMATOR_BACKEND_COUNT];
+
+void reset_state(struct rosflight_t *rf);
+void reset_adaptive_bias(struct rosflight_t *rf);
+void init_estimator(struct rosflight_t *rf);
+void update_estimator_params(struct rosflight_t *rf);
+void run_estimator(struct rosflight_t *rf);
+
+/**
+ * @brief Fill in state.roll, pitch and yaw from the current attitude.
+ *
+ * Most cycles don't need the angles, so they're computed on the first call after each
+ * update and cached until the next one.  Anything that changes state.q outside of the
+ * estimator should clear euler_valid.
+ */
+void estimator_update_euler(struct rosflight_t *rf);
+
+// shared by the backends in estimator_*.c
+vector_t estimator_down(const quaternion_t *q);
+vector_t estimator_horizontal_field(const quaternion_t *q, vector_t m);
+
+// estimator_mahony.c, or estimator_fixed.c in the fixed-point build
+extern const estimator_backend_t estimator_mahony;
+#ifdef FIXED_POINT_ESTIMATOR
+void update_estimator_fixed_params(struct rosflight_t *rf);
+void predict_state_fixed(struct rosflight_t *rf, uint64_t dt_us, uint32_t predict_us);
+#else
+extern const estimator_backend_t estimator_madgwick;
+extern const estimator_backend_t estimator_mekf;
+bool estimator_accel_usable(struct rosflight_t *rf);
+#endif
 #ifdef __cplusplus
 }
 #endif
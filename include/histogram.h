@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS 32
+
+// Fixed-width buckets, the last bucket also collects everything past the end
+typedef struct
+{
+  uint32_t bucket_width;
+  uint32_t buckets[HISTOGRAM_BUCKETS];
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+} histogram_t;
+
+/**
+ * @brief Initialize an empty histogram
+ * @param hist The histogram
+ * @param bucket_width The range of values covered by each bucket
+ */
+void histogram_init(histogram_t *hist, uint32_t bucket_width);
+
+/**
+ * @brief Remove all samples from the histogram, keeping the bucket width
+ * @param hist The histogram
+ */
+void histogram_reset(histogram_t *hist);
+
+/**
+ * @brief Add a sample to the histogram
+ * @param hist The histogram
+ * @param value The sample
+ */
+void histogram_add(histogram_t *hist, uint32_t value);
+
+/**
+ * @brief Estimate a percentile of the samples
+ *
+ * The result is the upper edge of the bucket containing the percentile, clamped to the
+ * observed min and max, so it is never low by more than one bucket width.
+ *
+ * @param hist The histogram
+ * @param percent The percentile to find (0 to 100)
+ * @return The estimated percentile, or 0 if the histogram is empty
+ */
+uint32_t histogram_percentile(const histogram_t *hist, uint8_t percent);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Latency statistics over one window of control loop iterations
+typedef struct
+{
+  uint32_t samples;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t mean_us;
+  uint32_t jitter_us;       // standard deviation
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t deadline_misses; // iterations in this window that exceeded PARAM_LATENCY_DEADLINE
+} latency_stats_t;
+
+// Copies of the latency params, refreshed by update_latency_params()
+typedef struct
+{
+  uint32_t deadline_us;
+  uint32_t window;
+  uint32_t bucket_width_us; // from the deadline, so the percentiles stay accurate around it
+} latency_params_t;
+
+typedef struct
+{
+  latency_params_t params;
+  histogram_t hist;
+  uint64_t sum_us;
+  uint64_t sum_sq_us;
+  uint32_t window_misses;
+  latency_stats_t stats;
+
+  uint32_t last_us;                 // latency of the most recent iteration
+  uint32_t average_x16;             // 16 times an exponential average of the latency over about 16 iterations
+  uint32_t total_deadline_misses;   // since boot
+} latency_t;
+
+struct rosflight_t;
+
+void init_latency(struct rosflight_t *rf);
+void update_latency_params(struct rosflight_t *rf);
+
+/**
+ * @brief Record the time from IMU capture to the last PWM write of one control loop iteration
+ * @param latency_us The latency in microseconds
+ */
+void latency_record(struct rosflight_t *rf, uint32_t latency_us);
+
+/**
+ * @brief Get the statistics of the last complete window
+ * @return A pointer to the statistics, with samples == 0 if no window has completed yet
+ */
+const latency_stats_t *latency_get_stats(struct rosflight_t *rf);
+
+/**
+ * @brief Get the latency averaged over the last few iterations, which the estimator predicts the state forward by
+ * @return The average latency in microseconds
+ */
+uint32_t latency_get_average_us(struct rosflight_t *rf);
+
+#ifdef __cplusplus
+}
+#endif
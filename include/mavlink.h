@@ -40,8 +40,35 @@
 extern mavlink_system_t mavlink_system;
 void comm_send_ch(mavlink_channel_t chan, uint8_t ch);
 
+// Boards that run several firmware instances can keep the library's channel state themselves
+#ifdef MAVLINK_GET_CHANNEL_STATUS
+mavlink_status_t *mavlink_get_channel_status(uint8_t chan);
+#endif
+#ifdef MAVLINK_GET_CHANNEL_BUFFER
+mavlink_message_t *mavlink_get_channel_buffer(uint8_t chan);
+#endif
+
 // this needs to be include after the above declarations
 #include <mavlink/v1.0/rosflight/mavlink.h>
 
+#include "mavlink_stream.h"
+
+typedef struct
+{
+  mavlink_stream_t streams[MAVLINK_STREAM_COUNT];
+  uint8_t profile_stream_id;    // next profiled section to report
+  uint8_t scheduler_stream_id;  // next task to report
+
+  uint8_t send_params_index;    // current param to send when sending parameter list with low priority
+
+  mavlink_offboard_control_t offboard_control;
+  uint64_t offboard_control_time;
+
+  mavlink_message_t in_buf;
+  mavlink_status_t status;
+} mavlink_t;
+
+struct rosflight_t;
+
 // function declarations
-void init_mavlink(void);
+void init_mavlink(struct rosflight_t *rf);
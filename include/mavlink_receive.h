@@ -35,9 +35,7 @@
 
 #include "mavlink.h"
 
-// global variable declarations
-//mavlink_offboard_control_t mavlink_offboard_control;
-extern uint64_t _offboard_control_time;
+struct rosflight_t;
 
 // function declarations
-void mavlink_receive(void);
+void mavlink_receive(struct rosflight_t *rf);
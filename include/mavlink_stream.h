@@ -34,29 +34,41 @@
 #include <stdint.h>
 
 // type definitions
-// Needs to match mavlink_streams variable in mavlink_stream.c
+// Needs to match send_functions variable in mavlink_stream.c
 typedef enum
 {
   MAVLINK_STREAM_ID_HEARTBEAT,
   MAVLINK_STREAM_ID_STATUS,
+  MAVLINK_STREAM_ID_PROFILE,
+  MAVLINK_STREAM_ID_LATENCY,
 
   MAVLINK_STREAM_ID_ATTITUDE,
   MAVLINK_STREAM_ID_IMU,
   MAVLINK_STREAM_ID_DIFF_PRESSURE,
   MAVLINK_STREAM_ID_BARO,
   MAVLINK_STREAM_ID_SONAR,
+  MAVLINK_STREAM_ID_ALTITUDE,
   MAVLINK_STREAM_ID_MAG,
   MAVLINK_STREAM_ID_OUTPUT_RAW,
   MAVLINK_STREAM_ID_RC_RAW,
 
+  MAVLINK_STREAM_ID_SCHEDULER,
+
   MAVLINK_STREAM_ID_LOW_PRIORITY,
 
   MAVLINK_STREAM_COUNT
 } mavlink_stream_id_t;
 
-extern uint32_t _loop_time_us;
+typedef struct
+{
+  uint32_t period_us;
+  uint64_t next_time_us;
+} mavlink_stream_t;
+
+struct rosflight_t;
 
 // function declarations
-void mavlink_stream(uint64_t time_us);
-void mavlink_stream_set_rate(mavlink_stream_id_t stream_id, uint32_t rate);
-void mavlink_stream_set_period(mavlink_stream_id_t stream_id, uint32_t period_us);
+void init_mavlink_stream(struct rosflight_t *rf);
+void mavlink_stream(struct rosflight_t *rf, uint64_t time_us);
+void mavlink_stream_set_rate(struct rosflight_t *rf, mavlink_stream_id_t stream_id, uint32_t rate);
+void mavlink_stream_set_period(struct rosflight_t *rf, mavlink_stream_id_t stream_id, uint32_t period_us);
@@ -38,6 +38,8 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+#include <turbotrig/turbofix.h>
+
 
 // This enum needs to match the "array_of_mixers" variable in mixer.c
 typedef enum
@@ -76,16 +78,52 @@ typedef struct
   float z[8];
 } mixer_t;
 
-extern command_t _command;
+#ifdef FIXED_POINT_CONTROL
+// Q16 copies of the mixer and motor params for the fixed-point build
+typedef struct
+{
+  q16_t mix[4][8];          // F, x, y and z rows of the selected mixer
+  q16_t motor_idle_throttle;
+  int32_t motor_pwm_span;
+} mixer_fixed_params_t;
+#endif
+
+// Copies of the params used on every mix, refreshed by update_mixer_params()
+typedef struct
+{
+  bool fixed_wing;
+  float aileron_sign;  // -1 if the channel is reversed
+  float elevator_sign;
+  float rudder_sign;
+  float motor_idle_throttle;
+  bool spin_motors_when_armed;
+  int32_t motor_min_pwm;
+  float motor_pwm_span;  // MOTOR_MAX_PWM - MOTOR_MIN_PWM
+
+#ifdef FIXED_POINT_CONTROL
+  mixer_fixed_params_t fixed;
+#endif
+} mixer_params_t;
 
-extern float _GPIO_outputs[8];
-extern output_type_t _GPIO_output_type[8];
+typedef struct
+{
+  mixer_params_t params;
+  command_t command;
+  float outputs[8];
+#ifdef FIXED_POINT_CONTROL
+  q16_t prescaled_outputs[8];
+#else
+  float prescaled_outputs[8];
+#endif
+  mixer_t *mixer_to_use;
+} mixer_state_t;
 
-extern float _outputs[8];
+struct rosflight_t;
 
-void init_PWM();
-void init_mixing();
-void mix_output();
+void init_PWM(struct rosflight_t *rf);
+void init_mixing(struct rosflight_t *rf);
+void update_mixer_params(struct rosflight_t *rf);
+void mix_output(struct rosflight_t *rf);
 #ifdef __cplusplus
 }
 #endif
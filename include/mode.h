@@ -34,12 +34,14 @@ extern "C" {
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum
 {
   ARMED = 0x01,
   FAILSAFE = 0x2,
 } armed_state_t;
-extern armed_state_t _armed_state;
 
 
 typedef enum
@@ -52,10 +54,22 @@ typedef enum
   ERROR_TIME_GOING_BACKWARDS = 0x10,
   ERROR_UNCALIBRATED_IMU = 0x20,
 } error_state_t;
-extern error_state_t _error_state;
 
-void init_mode(void);
-bool check_mode();
+typedef struct
+{
+  armed_state_t armed_state;
+  error_state_t error_state;
+
+  uint32_t prev_time_ms;
+  uint32_t time_sticks_have_been_in_arming_position_ms;
+  bool started_gyro_calibration;
+  uint8_t failsafe_blink_count;
+} mode_state_t;
+
+struct rosflight_t;
+
+void init_mode(struct rosflight_t *rf);
+bool check_mode(struct rosflight_t *rf);
 
 #ifdef __cplusplus
 }
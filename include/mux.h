@@ -39,6 +39,8 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <turbotrig/turbofix.h>
+
 typedef enum
 {
   RATE,         // Channel is is in rate mode (mrad/s)
@@ -62,35 +64,95 @@ typedef struct
   control_channel_t F;
 } control_t;
 
-extern control_t _rc_control;
-extern control_t _offboard_control;
-extern control_t _combined_control;
-extern control_t _failsafe_control;
+typedef struct
+{
+  control_channel_t *rc;
+  control_channel_t *onboard;
+  control_channel_t *combined;
+} mux_t;
+
+#ifdef FIXED_POINT_CONTROL
+// Q16 copies of the RC scaling params for the fixed-point build
+typedef struct
+{
+  q16_t max_roll;
+  q16_t max_pitch;
+  q16_t max_rollrate;
+  q16_t max_pitchrate;
+  q16_t max_yawrate;
+  q16_t override_deviation;
+} mux_fixed_params_t;
+#endif
+
+// Copies of the params used on every pass, refreshed by update_mux_params()
+typedef struct
+{
+  bool fixed_wing;
+  bool rate_mode;       // RC_ATT_MODE selects rate mode when no switch is mapped
+  float max_roll;
+  float max_pitch;
+  float max_rollrate;
+  float max_pitchrate;
+  float max_yawrate;
+  uint32_t override_lag_time_ms;
+  float override_deviation;
+  bool take_min_throttle;
+  float failsafe_throttle;
 
-extern bool _new_command;
+#ifdef FIXED_POINT_CONTROL
+  mux_fixed_params_t fixed;
+#endif
+} mux_params_t;
 
+typedef struct
+{
+  mux_params_t params;
+
+  control_t rc_control;
+  control_t offboard_control;
+  control_t combined_control;
+  control_t failsafe_control;
+
+  bool new_command;
+  bool rc_override;
+
+  uint32_t rc_stick_override_time[3]; // last time the x, y and z sticks were deflected (ms)
+  mux_t muxes[4];
+} mux_state_t;
+
+struct rosflight_t;
+
+/**
+ * @brief Set up the muxes between the RC, offboard and combined commands
+ */
+void init_mux(struct rosflight_t *rf);
+
+/**
+ * @brief Refresh the copies of the mux params
+ */
+void update_mux_params(struct rosflight_t *rf);
 
 /**
  * @brief Selects a combination of 3 possible control inputs for a single combined control output.
  *
  *  Selects between failsafe, offboard, and rc input control, and based off current state, muxes them into
- *  the #_combined_control extern.
+ *  the combined control of the firmware instance.
  *
  * @return False if no new commands were triggered by the 3 control inputs, otherwise true.
  */
-bool mux_inputs();
+bool mux_inputs(struct rosflight_t *rf);
 
 /**
  * @brief Check if the RC is currently overriding all other commands.
  * @return True if the RC is currently overriding other commands, otherwise false.
  */
-bool rc_override_active();
+bool rc_override_active(struct rosflight_t *rf);
 
 /**
  * @brief Checks if any of the channels are currently controlled by the offboard controller.
  * @return True if one of the muxed offboard channels are active, otherwise false.
  */
-bool offboard_control_active();
+bool offboard_control_active(struct rosflight_t *rf);
 
 #ifdef __cplusplus
 }
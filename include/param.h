@@ -54,6 +54,8 @@ typedef enum
   PARAM_SYSTEM_ID,
   PARAM_STREAM_HEARTBEAT_RATE,
   PARAM_STREAM_STATUS_RATE,
+  PARAM_STREAM_PROFILE_RATE,
+  PARAM_STREAM_LATENCY_RATE,
 
   PARAM_STREAM_ATTITUDE_RATE,
   PARAM_STREAM_IMU_RATE,
@@ -61,9 +63,11 @@ typedef enum
   PARAM_STREAM_BARO_RATE,
   PARAM_STREAM_AIRSPEED_RATE,
   PARAM_STREAM_SONAR_RATE,
+  PARAM_STREAM_ALTITUDE_RATE,
 
   PARAM_STREAM_OUTPUT_RAW_RATE,
   PARAM_STREAM_RC_RAW_RATE,
+  PARAM_STREAM_SCHEDULER_RATE,
 
   /********************************/
   /*** CONTROLLER CONFIGURATION ***/
@@ -100,6 +104,14 @@ typedef enum
   PARAM_Z_EQ_TORQUE,
 
   PARAM_PID_TAU,
+  PARAM_ANGLE_CONTROLLER,
+
+  PARAM_ANGLE_CASCADE,
+  PARAM_ANGLE_LOOP_RATE,
+  PARAM_PID_ROLL_CASCADE_P,
+  PARAM_PID_ROLL_CASCADE_I,
+  PARAM_PID_PITCH_CASCADE_P,
+  PARAM_PID_PITCH_CASCADE_I,
 
   /*************************/
   /*** PWM CONFIGURATION ***/
@@ -114,6 +126,7 @@ typedef enum
   /*******************************/
   /*** ESTIMATOR CONFIGURATION ***/
   /*******************************/
+  PARAM_FILTER_TYPE,
   PARAM_INIT_TIME,
   PARAM_FILTER_KP,
   PARAM_FILTER_KI,
@@ -121,6 +134,15 @@ typedef enum
   PARAM_FILTER_USE_QUAD_INT,
   PARAM_FILTER_USE_MAT_EXP,
   PARAM_FILTER_USE_ACC,
+  PARAM_FILTER_ACC_RATE,
+  PARAM_FILTER_USE_MAG,
+  PARAM_FILTER_KP_MAG,
+  PARAM_FILTER_PREDICT,
+  PARAM_FILTER_BETA,
+  PARAM_FILTER_ZETA,
+
+  PARAM_ALT_BARO_TAU,
+  PARAM_ALT_SONAR_TAU,
 
   PARAM_CALIBRATE_GYRO_ON_ARM,
 
@@ -129,6 +151,9 @@ typedef enum
 
   PARAM_ACCEL_SCALE,
 
+  PARAM_IMU_SAMPLE_RATE,
+  PARAM_CONTROL_RATE_DIV,
+
   PARAM_GYRO_X_BIAS,
   PARAM_GYRO_Y_BIAS,
   PARAM_GYRO_Z_BIAS,
@@ -197,6 +222,12 @@ typedef enum
   /********************/
   PARAM_ARM_THRESHOLD,
 
+  /******************************/
+  /*** PERFORMANCE MONITORING ***/
+  /******************************/
+  PARAM_LATENCY_WINDOW,
+  PARAM_LATENCY_DEADLINE,
+
   // keep track of size of params array
   PARAMS_COUNT
 } param_id_t;
@@ -208,105 +239,136 @@ typedef enum uint8_t
   PARAM_TYPE_INVALID
 } param_type_t;
 
+typedef struct
+{
+  uint32_t version;
+  uint16_t size;
+  uint8_t magic_be;                       // magic number, should be 0xBE
+
+  int32_t values[PARAMS_COUNT];
+  char names[PARAMS_COUNT][PARAMS_NAME_LENGTH];
+  param_type_t types[PARAMS_COUNT];
+
+  uint8_t magic_ef;                       // magic number, should be 0xEF
+  uint8_t chk;                            // XOR checksum
+} params_t;
+
+struct rosflight_t;
+
 // function declarations
 
 /**
  * @brief Initialize parameter values
+ * @param rf The firmware instance
  */
-void init_params(void);
+void init_params(struct rosflight_t *rf);
 
 /**
  * @brief Set all parameters to default values
+ * @param rf The firmware instance
  */
-void set_param_defaults(void);
+void set_param_defaults(struct rosflight_t *rf);
 
 /**
  * @brief Read parameter values from non-volatile memory
+ * @param rf The firmware instance
  * @return True if successful, false otherwise
  */
-bool read_params(void);
+bool read_params(struct rosflight_t *rf);
 
 /**
  * @brief Write current parameter values to non-volatile memory
+ * @param rf The firmware instance
  * @return True if successful, false otherwise
  */
-bool write_params(void);
+bool write_params(struct rosflight_t *rf);
 
 /**
- * @brief Callback for executing actions that need to be taken when a parameter value changes
+ * @brief Callback for executing actions that need to be taken when a parameter value changes.
+ * This also refreshes the copies of params that the modules use in the control loop.
+ * @param rf The firmware instance
  * @param id The ID of the parameter that was changed
  */
-void param_change_callback(param_id_t id);
+void param_change_callback(struct rosflight_t *rf, param_id_t id);
 
 /**
  * @brief Gets the id of a parameter from its name
+ * @param rf The firmware instance
  * @param name The name of the parameter
  * @return The ID of the parameter if the name is valid, PARAMS_COUNT otherwise (invalid ID)
  */
-param_id_t lookup_param_id(const char name[PARAMS_NAME_LENGTH]);
+param_id_t lookup_param_id(struct rosflight_t *rf, const char name[PARAMS_NAME_LENGTH]);
 
 /**
  * @brief Get the value of an integer parameter by id
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @return The value of the parameter
  */
-int get_param_int(param_id_t id);
+int get_param_int(struct rosflight_t *rf, param_id_t id);
 
 /**
  * @brief Get the value of a floating point parameter by id
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @return The value of the parameter
  */
-float get_param_float(param_id_t id);
+float get_param_float(struct rosflight_t *rf, param_id_t id);
 
 /**
  * @brief Get the name of a parameter
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @return The name of the parameter
  */
-char *get_param_name(param_id_t id);
+char *get_param_name(struct rosflight_t *rf, param_id_t id);
 
 /**
  * @brief Get the type of a parameter
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @return The type of the parameter
  * This returns one of three possible types
  * PARAM_TYPE_INT32, PARAM_TYPE_FLOAT, or PARAM_TYPE_INVALID
  * See line 165
  */
-param_type_t get_param_type(param_id_t id);
+param_type_t get_param_type(struct rosflight_t *rf, param_id_t id);
 
 /**
  * @brief Sets the value of a parameter by ID and calls the parameter change callback
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @param value The new value
  * @return True if a parameter value was changed, false otherwise
  */
-bool set_param_int(param_id_t id, int32_t value);
+bool set_param_int(struct rosflight_t *rf, param_id_t id, int32_t value);
 
 /**
  * @brief Sets the value of a floating point parameter by ID and calls the parameter callback
+ * @param rf The firmware instance
  * @param id The ID of the parameter
  * @param value The new value
  * @return  True if a parameter was changed, false otherwise
  */
-bool set_param_float(param_id_t id, float value);
+bool set_param_float(struct rosflight_t *rf, param_id_t id, float value);
 
 /**
  * @brief Sets the value of a parameter by name and calls the parameter change callback
+ * @param rf The firmware instance
  * @param name The name of the parameter
  * @param value The new value
  * @return True if a parameter value was changed, false otherwise
  */
-bool set_param_by_name_int(const char name[PARAMS_NAME_LENGTH], int32_t value);
+bool set_param_by_name_int(struct rosflight_t *rf, const char name[PARAMS_NAME_LENGTH], int32_t value);
 
 /**
  * @brief Sets the value of a floating point parameter by name and calls the parameter change callback
+ * @param rf The firmware instance
  * @param name The name of the parameter
  * @param value The new value
  * @return True if a parameter value was changed, false otherwise
  */
-bool set_param_by_name_float(const char name[PARAMS_NAME_LENGTH], float value);
+bool set_param_by_name_float(struct rosflight_t *rf, const char name[PARAMS_NAME_LENGTH], float value);
 
 #ifdef __cplusplus
 }
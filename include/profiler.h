@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Needs to match the profiles variable in profiler.c
+typedef enum
+{
+  PROFILE_IMU,
+  PROFILE_SENSORS,
+  PROFILE_ESTIMATOR,
+  PROFILE_CONTROLLER,
+  PROFILE_MIXER,
+  PROFILE_MAVLINK_STREAM,
+  PROFILE_MAVLINK_RECEIVE,
+
+  PROFILE_COUNT
+} profile_id_t;
+
+typedef struct
+{
+  uint32_t start_cycles;
+  histogram_t hist;
+} profile_t;
+
+typedef struct
+{
+  profile_t profiles[PROFILE_COUNT];
+} profiler_t;
+
+struct rosflight_t;
+
+void init_profiler(struct rosflight_t *rf);
+
+/**
+ * @brief Mark the start of a profiled section
+ * @param id The section
+ */
+void profiler_start(struct rosflight_t *rf, profile_id_t id);
+
+/**
+ * @brief Mark the end of a profiled section and add its execution time to the histogram
+ * @param id The section
+ */
+void profiler_stop(struct rosflight_t *rf, profile_id_t id);
+
+/**
+ * @brief Get the short name of a profiled section (at most 6 characters)
+ */
+const char *profiler_get_name(profile_id_t id);
+
+/**
+ * @brief Get the execution time histogram of a profiled section, in CPU cycles
+ */
+const histogram_t *profiler_get_histogram(struct rosflight_t *rf, profile_id_t id);
+
+/**
+ * @brief Clear the histogram of a profiled section
+ */
+void profiler_reset(struct rosflight_t *rf, profile_id_t id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -34,6 +34,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include <turbotrig/turbofix.h>
+
 #include "param.h"
 
 #include "mux.h"
@@ -62,42 +64,79 @@ typedef enum
   CPPM,
 } rc_type_t;
 
+typedef struct
+{
+  uint8_t channel;
+  bool one_sided;
+} rc_stick_config_t;
+
+typedef struct
+{
+  uint8_t channel;
+  int8_t direction;
+  bool mapped;
+} rc_switch_config_t;
+
+typedef struct
+{
+  rc_stick_config_t sticks[RC_STICKS_COUNT];
+  rc_switch_config_t switches[RC_SWITCHES_COUNT];
+
+  float stick_values[RC_STICKS_COUNT];
+#ifdef FIXED_POINT_CONTROL
+  q16_t stick_values_fixed[RC_STICKS_COUNT];
+#endif
+  bool switch_values[RC_SWITCHES_COUNT];
+} rc_t;
+
+struct rosflight_t;
+
 /**
  * @brief Initialize the RC sticks and switches.
  *
  * Assign channels and other values to the RC sticks and switches based on input parameters.
  */
-void init_rc(void);
+void init_rc(struct rosflight_t *rf);
 
 /**
  * @brief Get current stick value for the given channel.
+ * @param  rf      The firmware instance
  * @param  channel The stick channel whose value you wish to retrieve.
  * @return         Normalized float of the current stick value of the channel.
  */
-float rc_stick(rc_stick_t channel);
+float rc_stick(struct rosflight_t *rf, rc_stick_t channel);
+
+#ifdef FIXED_POINT_CONTROL
+/**
+ * @brief Get current stick value for the given channel in Q16, computed from the PWM directly.
+ */
+q16_t rc_stick_fixed(struct rosflight_t *rf, rc_stick_t channel);
+#endif
 
 /**
  * @brief Get the current switch value for the given channel.
+ * @param  rf      The firmware instance
  * @param  channel The switch channel whose value you wish to retrieve.
  * @return         True if the switch is mapped and in its on state, otherwise false.
  */
-bool rc_switch(rc_switch_t channel);
+bool rc_switch(struct rosflight_t *rf, rc_switch_t channel);
 
 /**
  * @brief Check if the given switch is mapped to an RC channel
+ * @param  rf      The firmware instance
  * @param  channel The switch type to check.
  * @return         True if this switch type was mapped to a valid RC channel, otherwise false.
  */
-bool rc_switch_mapped(rc_switch_t channel);
+bool rc_switch_mapped(struct rosflight_t *rf, rc_switch_t channel);
 
 /**
  * @brief Receive new RC data and update local data members.
  *
  *  Maps channeled inputs from the RC controller to their proper data member values within this
- *  class every 20ms. Upon update, signals to the mux that a new command is waiting.
+ *  class. Called by the scheduler every 20ms. Upon update, signals to the mux that a new command is waiting.
  *
- * @return False if it hasn't been 20ms since the last update, otherwise true.
+ * @return True once the RC values have been updated.
  */
-bool receive_rc();
+bool receive_rc(struct rosflight_t *rf);
 
 #endif
@@ -32,14 +32,53 @@
 #ifndef ROSFLIGHT_H_
 #define ROSFLIGHT_H_
 
+#include "controller.h"
+#include "estimator.h"
+#include "latency.h"
+#include "mavlink.h"
+#include "mixer.h"
+#include "mode.h"
+#include "mux.h"
+#include "param.h"
+#include "profiler.h"
+#include "rc.h"
+#include "scheduler.h"
+#include "sensors.h"
+
+/**
+ * @brief All of the state of one instance of the flight stack
+ *
+ * Several instances can run side by side in one process (e.g. for simulation), as long as each one
+ * is driven by a single thread. The instance holds pointers into itself, so it must not be copied or
+ * moved after rosflight_init(). The MAVLink system ID and the MAVLink library's per-channel parser
+ * state are still shared by every instance in the process.
+ */
+typedef struct rosflight_t
+{
+  params_t params;
+  mode_state_t mode;
+  sensors_t sensors;
+  estimator_t estimator;
+  rc_t rc;
+  mux_state_t mux;
+  controller_t controller;
+  mixer_state_t mixer;
+  mavlink_t mavlink;
+  profiler_t profiler;
+  latency_t latency;
+  scheduler_t scheduler;
+} rosflight_t;
+
 /**
  * @brief Main initialization routine for the ROSflight autopilot flight stack
+ * @param rf The firmware instance to initialize
  */
-void rosflight_init(void);
+void rosflight_init(rosflight_t *rf);
 
 /**
  * @brief Main loop for the ROSflight autopilot flight stack
+ * @param rf The firmware instance to run
  */
-void rosflight_run(void);
+void rosflight_run(rosflight_t *rf);
 
 #endif // ROSFLIGHT_H_
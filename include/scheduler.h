@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Needs to match the task_table variable in scheduler.c
+typedef enum
+{
+  TASK_CONTROL,
+  TASK_SENSORS,
+  TASK_MAVLINK_RECEIVE,
+  TASK_CHECK_MODE,
+  TASK_RECEIVE_RC,
+  TASK_MUX_INPUTS,
+  TASK_MAVLINK_STREAM,
+
+  TASK_COUNT
+} task_id_t;
+
+// Tasks with this priority run from the soft interrupt instead of the main loop
+#define TASK_PRIORITY_CRITICAL 0
+
+struct rosflight_t;
+
+typedef struct
+{
+  const char *name;           // short name used in telemetry (at most 5 characters)
+  uint8_t priority;           // lower numbers run first
+  uint32_t period_us;         // 0 runs the task on every pass
+  uint32_t budget_us;         // execution time above this counts as an overrun
+  bool atomic;                // runs with the soft interrupt disabled, for tasks that change state the control chain uses
+  bool (*ready)(struct rosflight_t *rf); // if not NULL, the task is event-driven and runs whenever this returns true
+  void (*function)(struct rosflight_t *rf);
+
+  uint64_t next_time_us;
+  uint32_t last_exec_us;
+  uint32_t max_exec_us;       // worst execution time since the last call to scheduler_reset_max()
+  uint32_t runs;
+  uint32_t overruns;
+} task_t;
+
+typedef struct
+{
+  task_t tasks[TASK_COUNT];
+  task_id_t order[TASK_COUNT]; // task indices sorted by priority
+} scheduler_t;
+
+/**
+ * @brief Initialize the task table, sort it by priority and hook the critical tasks up to the soft interrupt
+ */
+void init_scheduler(struct rosflight_t *rf);
+
+/**
+ * @brief Run every non-critical task that is due, in priority order.
+ *
+ * Critical tasks run from the soft interrupt as soon as the IMU sample has been
+ * transferred.  They preempt the housekeeping tasks here, except for atomic ones,
+ * so the control chain waits for at most one atomic task before it runs.
+ */
+void run_scheduler(struct rosflight_t *rf);
+
+/**
+ * @brief Get the configuration and statistics of a task
+ * @param id The ID of the task
+ * @return A pointer to the task
+ */
+const task_t *scheduler_get_task(struct rosflight_t *rf, task_id_t id);
+
+/**
+ * @brief Clear the worst-case execution time of a task
+ * @param id The ID of the task
+ */
+void scheduler_reset_max(struct rosflight_t *rf, task_id_t id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -39,36 +39,101 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
-// global variable declarations
-extern vector_t _accel;
-extern vector_t _gyro;
-extern float _imu_temperature;
-extern uint64_t _imu_time;
-extern bool _imu_sent;
+#define IMU_MAX_SAMPLES 16 // most samples drained from the IMU FIFO in one transfer
+#define IMU_RATE_MAX 2000 // Hz, the most gyro samples the 400 kHz I2C bus can drain with the other sensors on it
+#define IMU_GYRO_RATE 8000 // Hz, the gyro's internal rate, which IMU_RATE must divide
 
-extern bool _diff_pressure_present;
-extern float _diff_pressure_velocity, _diff_pressure, _diff_pressure_temp;
+// Copies of the calibration params, refreshed by update_sensor_params()
+typedef struct
+{
+  float accel_scale;
+  vector_t accel_bias;
+  vector_t accel_temp_comp;
+  vector_t gyro_bias;
+  vector_t mag_bias;
+  float mag_A[3][3]; // soft iron compensation
+} sensors_params_t;
 
-extern bool _baro_present;
-extern float _baro_altitude;
-extern float _baro_pressure;
-extern float _baro_temperature;
+typedef struct
+{
+  sensors_params_t params;
 
-extern bool _sonar_present;
-extern float _sonar_range;
+  // IMU
+  vector_t accel;
+  vector_t gyro;
+  float imu_temperature;
+  uint64_t imu_time;
+  volatile bool new_imu_data;
+  bool imu_sent;
+  uint32_t last_imu_update_ms;
 
-extern bool _mag_present;
-extern vector_t _mag;
+  // The board fills these in from interrupt context, they are only read once new_imu_data is set
+  float imu_accel_raw[3];
+  float imu_gyro_raw[IMU_MAX_SAMPLES][3];
+  float imu_temperature_raw;
+  uint8_t imu_raw_count;
+  volatile bool imu_transfer_pending;
+  uint32_t imu_samples_dropped; // samples that arrived before the last one was used, or were lost to a FIFO overflow
+
+  uint8_t imu_oversample;       // samples averaged per control update, from CTRL_RATE_DIV
+  uint8_t imu_samples_waiting;  // data-ready interrupts since the last transfer started
+
+  // Airspeed
+  float diff_pressure_velocity, diff_pressure, diff_pressure_temp;
+
+  // Barometer
+  float baro_altitude;
+  float baro_pressure;
+  float baro_temperature;
+
+  // Sonar
+  float sonar_range;
+
+  // Magnetometer
+  vector_t mag;
+  uint64_t next_mag_read_us;
+  volatile uint32_t mag_count;  // incremented after each new calibrated measurement is in mag
+
+  uint32_t last_time_look_for_disarmed_sensors;
+
+  // calibration
+  bool calibrating_acc_flag;
+  bool calibrating_gyro_flag;
+  uint16_t gyro_cal_count;
+  vector_t gyro_cal_sum;
+  uint16_t acc_cal_count;
+  vector_t acc_cal_sum;
+  vector_t acc_cal_max;
+  vector_t acc_cal_min;
+  float acc_cal_temp_sum;
+} sensors_t;
+
+struct rosflight_t;
 
 // function declarations
-void init_sensors(void);
-bool update_sensors();
-
-bool start_imu_calibration(void);
-bool start_gyro_calibration(void);
-void start_baro_calibration(void);
-void start_airspeed_calibration(void);
-bool gyro_calibration_complete(void);
+void init_sensors(struct rosflight_t *rf);
+void update_sensor_params(struct rosflight_t *rf);
+
+/**
+ * @brief Check whether a new IMU measurement has been transferred and not yet used
+ */
+bool new_imu_data_available(struct rosflight_t *rf);
+
+/**
+ * @brief Correct the latest IMU measurement.  Runs in the control interrupt.
+ * @return True if there was a new measurement
+ */
+bool update_imu(struct rosflight_t *rf);
+
+/**
+ * @brief Update the barometer, airspeed, sonar and magnetometer, check the IMU watchdog
+ * and finish any IMU calibration that has collected enough samples
+ */
+void update_sensors(struct rosflight_t *rf);
+
+bool start_imu_calibration(struct rosflight_t *rf);
+bool start_gyro_calibration(struct rosflight_t *rf);
+bool gyro_calibration_complete(struct rosflight_t *rf);
 
 #ifdef __cplusplus
 }
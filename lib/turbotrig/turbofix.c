@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "turbofix.h"
+
+// 1/sqrt(m) in Q30 for m in [0.25, 1), in steps of 1/32.  Each entry is picked
+// so that the relative error is balanced across its step, at most 3%.
+static const uint32_t inv_sqrt_table[24] =
+{
+  2084267632, 1971349340, 1875009246, 1791548762, 1718330757, 1653417312,
+  1595348018, 1542998564, 1495487386, 1452112166, 1412305532, 1375603442,
+  1341622182, 1310041324, 1280590906, 1253041652, 1227197411, 1202889249,
+  1179970774, 1158314413, 1137808411, 1118354393, 1099865375, 1082264121,
+};
+
+// Products are accumulated in Q60 so that four of them can be summed without overflow
+static inline int64_t mul_q60(q31_t a, q31_t b)
+{
+  return ((int64_t) a * b) >> 2;
+}
+
+static inline q31_t q31_from_q60(int64_t x)
+{
+  return q31_sat((x + (1 << 28)) >> 29);
+}
+
+// Reciprocal square root of a sum of squares of raw integers (already divided by 4),
+// returned as a Q30 mantissa and the right shift that turns x*mantissa into x/|v| in Q31
+static uint32_t inv_sqrt(uint64_t sum, int *shift)
+{
+  // move the sum into [0.25, 1) in Q60 by an even shift, which halves exactly under the root
+  int msb = 63 - __builtin_clzll(sum);
+  int e = 58 - msb;
+  if (e & 1)
+    e++;
+  uint64_t m = (e >= 0) ? sum << e : sum >> -e;
+  uint32_t m30 = (uint32_t)(m >> 30);
+
+  // Newton iterations, y = y*(3 - m*y^2)/2, take the table error from 3% to 1e-3, 3e-6, then
+  // the rounding error of the Q30 arithmetic
+  uint64_t y = inv_sqrt_table[(m30 >> 25) - 8];
+  for (int i = 0; i < 3; i++)
+  {
+    uint64_t t = (((y * y) >> 30) * m30) >> 30;
+    y = (y * ((3ull << 30) - t)) >> 31;
+  }
+
+  *shift = 30 - e/2;
+  return (uint32_t) y;
+}
+
+// Left shift that brings the largest of the raw components up to 30 bits, which keeps full
+// precision for short vectors.  Normalizing doesn't care about the scale of its input.
+static int headroom(int32_t a, int32_t b, int32_t c, int32_t d)
+{
+  uint32_t bits = (a ^ (a >> 31)) | (b ^ (b >> 31)) | (c ^ (c >> 31)) | (d ^ (d >> 31));
+  return __builtin_clz(bits | 1) - 1;
+}
+
+static inline q31_t scale_by_inv_sqrt(int32_t x, uint32_t recip, int shift)
+{
+  int64_t p = (int64_t) x * recip;
+  return q31_sat((p + (1ll << (shift - 1))) >> shift);
+}
+
+q15_t q15_from_float(float x)
+{
+  if (x >= 1.0f)
+    return Q15_MAX;
+  if (x <= -1.0f)
+    return Q15_MIN;
+  return (q15_t)(x*32768.0f + (x >= 0.0f ? 0.5f : -0.5f));
+}
+
+float q15_to_float(q15_t x)
+{
+  return (float) x / 32768.0f;
+}
+
+q31_t q31_from_float(float x)
+{
+  if (x >= 1.0f)
+    return Q31_MAX;
+  if (x <= -1.0f)
+    return Q31_MIN;
+  return (q31_t)(x*2147483648.0f + (x >= 0.0f ? 0.5f : -0.5f));
+}
+
+float q31_to_float(q31_t x)
+{
+  return (float) x / 2147483648.0f;
+}
+
+q16_t q16_from_float(float x)
+{
+  if (x >= 32768.0f)
+    return Q16_MAX;
+  if (x <= -32768.0f)
+    return Q16_MIN;
+  return (q16_t)(x*65536.0f + (x >= 0.0f ? 0.5f : -0.5f));
+}
+
+float q16_to_float(q16_t x)
+{
+  return (float) x / 65536.0f;
+}
+
+q31_t q31_from_q15(q15_t x)
+{
+  return (q31_t) x << 16;
+}
+
+q15_t q15_from_q31(q31_t x)
+{
+  return q15_sat(((int64_t) x + (1 << 15)) >> 16);
+}
+
+q15_t q15_sat(int32_t x)
+{
+  if (x > Q15_MAX)
+    return Q15_MAX;
+  if (x < Q15_MIN)
+    return Q15_MIN;
+  return (q15_t) x;
+}
+
+q15_t q15_add(q15_t a, q15_t b)
+{
+  return q15_sat((int32_t) a + b);
+}
+
+q15_t q15_sub(q15_t a, q15_t b)
+{
+  return q15_sat((int32_t) a - b);
+}
+
+q15_t q15_mul(q15_t a, q15_t b)
+{
+  return q15_sat(((int32_t) a * b + (1 << 14)) >> 15);
+}
+
+q16_t q16_mul(q16_t a, q16_t b)
+{
+  return q31_sat(((int64_t) a * b + (1 << 15)) >> 16);
+}
+
+q31_t q31_sat(int64_t x)
+{
+  if (x > Q31_MAX)
+    return Q31_MAX;
+  if (x < Q31_MIN)
+    return Q31_MIN;
+  return (q31_t) x;
+}
+
+q31_t q31_add(q31_t a, q31_t b)
+{
+  return q31_sat((int64_t) a + b);
+}
+
+q31_t q31_sub(q31_t a, q31_t b)
+{
+  return q31_sat((int64_t) a - b);
+}
+
+q31_t q31_mul(q31_t a, q31_t b)
+{
+  return q31_sat(((int64_t) a * b + (1 << 30)) >> 31);
+}
+
+q31_t q31_dot(q31vec_t u, q31vec_t v)
+{
+  return q31_from_q60(mul_q60(u.x, v.x) + mul_q60(u.y, v.y) + mul_q60(u.z, v.z));
+}
+
+q31vec_t q31_cross(q31vec_t u, q31vec_t v)
+{
+  q31vec_t out = {q31_from_q60(mul_q60(u.y, v.z) - mul_q60(u.z, v.y)),
+                  q31_from_q60(mul_q60(u.z, v.x) - mul_q60(u.x, v.z)),
+                  q31_from_q60(mul_q60(u.x, v.y) - mul_q60(u.y, v.x))
+                 };
+  return out;
+}
+
+q31vec_t q31_scalar_multiply(q31_t s, q31vec_t v)
+{
+  q31vec_t out = {q31_mul(s, v.x),
+                  q31_mul(s, v.y),
+                  q31_mul(s, v.z)
+                 };
+  return out;
+}
+
+q31vec_t q31_vector_add(q31vec_t u, q31vec_t v)
+{
+  q31vec_t out = {q31_add(u.x, v.x),
+                  q31_add(u.y, v.y),
+                  q31_add(u.z, v.z)
+                 };
+  return out;
+}
+
+q31vec_t q31_vector_sub(q31vec_t u, q31vec_t v)
+{
+  q31vec_t out = {q31_sub(u.x, v.x),
+                  q31_sub(u.y, v.y),
+                  q31_sub(u.z, v.z)
+                 };
+  return out;
+}
+
+q31_t q31_sqrd_norm(q31vec_t v)
+{
+  return q31_dot(v, v);
+}
+
+q31vec_t q31_vector_normalize(q31vec_t v)
+{
+  if (v.x == 0 && v.y == 0 && v.z == 0)
+    return v;
+
+  int32_t k = 1 << headroom(v.x, v.y, v.z, 0);
+  v.x *= k;
+  v.y *= k;
+  v.z *= k;
+
+  uint64_t sum = (uint64_t) mul_q60(v.x, v.x) + mul_q60(v.y, v.y) + mul_q60(v.z, v.z);
+  int shift;
+  uint32_t recip = inv_sqrt(sum, &shift);
+  q31vec_t out = {scale_by_inv_sqrt(v.x, recip, shift),
+                  scale_by_inv_sqrt(v.y, recip, shift),
+                  scale_by_inv_sqrt(v.z, recip, shift)
+                 };
+  return out;
+}
+
+q31quat_t q31_quaternion_normalize(q31quat_t q)
+{
+  if (q.w == 0 && q.x == 0 && q.y == 0 && q.z == 0)
+    return q;
+
+  int32_t k = 1 << headroom(q.w, q.x, q.y, q.z);
+  q.w *= k;
+  q.x *= k;
+  q.y *= k;
+  q.z *= k;
+
+  uint64_t sum = (uint64_t) mul_q60(q.w, q.w) + mul_q60(q.x, q.x) + mul_q60(q.y, q.y) + mul_q60(q.z, q.z);
+  int shift;
+  uint32_t recip = inv_sqrt(sum, &shift);
+  q31quat_t out = {scale_by_inv_sqrt(q.w, recip, shift),
+                   scale_by_inv_sqrt(q.x, recip, shift),
+                   scale_by_inv_sqrt(q.y, recip, shift),
+                   scale_by_inv_sqrt(q.z, recip, shift)
+                  };
+  return out;
+}
+
+q31quat_t q31_quaternion_multiply(q31quat_t q1, q31quat_t q2)
+{
+  q31quat_t q = {q31_from_q60(mul_q60(q1.w, q2.w) - mul_q60(q1.x, q2.x) - mul_q60(q1.y, q2.y) - mul_q60(q1.z, q2.z)),
+                 q31_from_q60(mul_q60(q1.w, q2.x) + mul_q60(q1.x, q2.w) - mul_q60(q1.y, q2.z) + mul_q60(q1.z, q2.y)),
+                 q31_from_q60(mul_q60(q1.w, q2.y) + mul_q60(q1.x, q2.z) + mul_q60(q1.y, q2.w) - mul_q60(q1.z, q2.x)),
+                 q31_from_q60(mul_q60(q1.w, q2.z) - mul_q60(q1.x, q2.y) + mul_q60(q1.y, q2.x) + mul_q60(q1.z, q2.w))
+                };
+  return q;
+}
+
+q31quat_t q31_quaternion_inverse(q31quat_t q)
+{
+  // the conjugate, which saturates rather than wrapping for Q31_MIN
+  q31quat_t out = {q.w, q31_sub(0, q.x), q31_sub(0, q.y), q31_sub(0, q.z)};
+  return out;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Q15 and Q31 are signed fractions in [-1, 1), with 15 and 31 fractional bits.
+// Every operation rounds to nearest and saturates instead of wrapping, so +1.0
+// comes out as the largest representable value just below it.
+typedef int16_t q15_t;
+typedef int32_t q31_t;
+
+#define Q15_MAX INT16_MAX
+#define Q15_MIN INT16_MIN
+#define Q31_MAX INT32_MAX
+#define Q31_MIN INT32_MIN
+
+// Q16.16, for physical quantities that don't fit in [-1, 1)
+typedef int32_t q16_t;
+
+#define Q16_ONE 65536
+#define Q16_MAX INT32_MAX
+#define Q16_MIN INT32_MIN
+
+// compile-time constants, for x in [-1, 1) except Q16
+#define Q16_CONST(x) ((q16_t)((x) * 65536.0 + ((x) >= 0 ? 0.5 : -0.5)))
+#define Q15_CONST(x) ((q15_t)((x) * 32768.0 + ((x) >= 0 ? 0.5 : -0.5)))
+#define Q31_CONST(x) ((q31_t)((x) * 2147483648.0 + ((x) >= 0 ? 0.5 : -0.5)))
+
+typedef struct
+{
+  q31_t x;
+  q31_t y;
+  q31_t z;
+} q31vec_t;
+
+typedef struct
+{
+  q31_t w;
+  q31_t x;
+  q31_t y;
+  q31_t z;
+} q31quat_t;
+
+// conversions, for setup code and telemetry rather than the control loop
+q15_t q15_from_float(float x);
+float q15_to_float(q15_t x);
+q31_t q31_from_float(float x);
+float q31_to_float(q31_t x);
+q16_t q16_from_float(float x);
+float q16_to_float(q16_t x);
+q31_t q31_from_q15(q15_t x);
+q15_t q15_from_q31(q31_t x);
+
+// saturating scalar arithmetic
+q15_t q15_sat(int32_t x);
+q15_t q15_add(q15_t a, q15_t b);
+q15_t q15_sub(q15_t a, q15_t b);
+q15_t q15_mul(q15_t a, q15_t b);
+q16_t q16_mul(q16_t a, q16_t b);
+q31_t q31_sat(int64_t x);
+q31_t q31_add(q31_t a, q31_t b);
+q31_t q31_sub(q31_t a, q31_t b);
+q31_t q31_mul(q31_t a, q31_t b);
+
+q31_t q31_dot(q31vec_t u, q31vec_t v);
+q31vec_t q31_cross(q31vec_t u, q31vec_t v);
+q31vec_t q31_scalar_multiply(q31_t s, q31vec_t v);
+q31vec_t q31_vector_add(q31vec_t u, q31vec_t v);
+q31vec_t q31_vector_sub(q31vec_t u, q31vec_t v);
+q31_t q31_sqrd_norm(q31vec_t v);
+
+/**
+ * @brief Scale a vector to unit length without any floating point
+ * @param v A vector of raw integers in any common scale, so it need not be in Q31 itself
+ * @return The unit vector in Q31, or the zero vector if v is zero
+ */
+q31vec_t q31_vector_normalize(q31vec_t v);
+
+/**
+ * @brief Scale a quaternion to unit length, with the same input rules as q31_vector_normalize
+ */
+q31quat_t q31_quaternion_normalize(q31quat_t q);
+q31quat_t q31_quaternion_multiply(q31quat_t q1, q31quat_t q2);
+q31quat_t q31_quaternion_inverse(q31quat_t q);
+
+#ifdef __cplusplus
+}
+#endif
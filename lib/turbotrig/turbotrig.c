@@ -163,6 +163,33 @@ float asin_approx(float x)
   return out;
 }
 
+// cos(theta) and sin(theta)/theta from theta^2, with the Taylor series through theta^6.
+// The first omitted terms bound the truncation error by theta^8/40320 and theta^8/362880,
+// below 1e-7 for theta <= 0.5.  Larger angles are halved until they're in range and then
+// doubled back up with cos(2a) = 2cos(a)^2 - 1 and sin(2a)/2a = cos(a)*sin(a)/a.
+// The halvings stop at COS_SINC_MAX_HALVINGS, which covers theta up to 32768 rad, so
+// that an infinite input from a bad sample can't hang the caller.
+#define COS_SINC_MAX_HALVINGS 16
+void cos_sinc_approx(float theta2, float *c, float *sinc)
+{
+  int halvings = 0;
+  while (theta2 > 0.25f && halvings < COS_SINC_MAX_HALVINGS)
+  {
+    theta2 *= 0.25f;
+    halvings++;
+  }
+
+  float cos_a = 1.0f - theta2*(1.0f/2.0f - theta2*(1.0f/24.0f - theta2*(1.0f/720.0f)));
+  float sinc_a = 1.0f - theta2*(1.0f/6.0f - theta2*(1.0f/120.0f - theta2*(1.0f/5040.0f)));
+  for (; halvings > 0; halvings--)
+  {
+    sinc_a *= cos_a;
+    cos_a = 2.0f*cos_a*cos_a - 1.0f;
+  }
+  *c = cos_a;
+  *sinc = sinc_a;
+}
+
 
 int32_t turboatan(int32_t x)
 {
@@ -268,7 +295,7 @@ int32_t turboasin(int32_t x)
   }
   else if (x > 999)
   {
-    return 1ul;
+    return 1571;
   }
   return asin_lookup_table[x];
 }
@@ -39,6 +39,8 @@ extern "C" {
 // float-based wrappers
 float atan2_approx(float y, float x);
 float asin_approx(float x);
+// cos(theta) and sin(theta)/theta from theta^2 by series, without tables or libm
+void cos_sinc_approx(float theta2, float *c, float *sinc);
 
 // turbo-speed trig approximation
 int32_t turboatan2(int32_t y, int32_t x);
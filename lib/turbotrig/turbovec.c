@@ -43,103 +43,85 @@ void pfquat() __attribute__((unused));
 
 int32_t int_dot(intvec_t v1, intvec_t v2)
 {
-  return (v1.x*v2.x + v1.y*v2.y + v1.z*v2.z)/1000;
+  return q31_dot(v1, v2);
 }
 
 intvec_t int_cross(intvec_t u, intvec_t v)
 {
-  intvec_t out;
-  out.x = (u.y*v.z - u.z*v.y)/1000;
-  out.y = (u.z*v.x - u.x*v.z)/1000;
-  out.z = (u.x*v.y - u.y*v.x)/1000;
-  return out;
+  return q31_cross(u, v);
 }
 
-intvec_t int_scalar_multiply(int32_t s, intvec_t v)
+intvec_t int_scalar_multiply(q31_t s, intvec_t v)
 {
-  intvec_t out;
-  out.x = (s*v.x)/1000;
-  out.y = (s*v.y)/1000;
-  out.z = (s*v.z)/1000;
-  return out;
+  return q31_scalar_multiply(s, v);
 }
 
 intvec_t int_vector_add(intvec_t u, intvec_t v)
 {
-  intvec_t out;
-  out.x = u.x + v.x;
-  out.y = u.y + v.y;
-  out.z = u.z + v.z;
-  return out;
+  return q31_vector_add(u, v);
 }
 
 intvec_t int_vector_sub(intvec_t u, intvec_t v)
 {
-  intvec_t out;
-  out.x = u.x - v.x;
-  out.y = u.y - v.y;
-  out.z = u.z - v.z;
-  return out;
+  return q31_vector_sub(u, v);
 }
 
 int32_t int_sqrd_norm(intvec_t v)
 {
-  return v.x*v.x + v.y*v.y + v.z*v.z;
+  return q31_sqrd_norm(v);
 }
 
 intvec_t int_vector_normalize(intvec_t v)
 {
-  float recipNorm = turboInvSqrt((v.x*v.x + v.y*v.y + v.z*v.z)/1000000.0);
-  return int_scalar_multiply((int32_t)(1000*recipNorm), v);
+  return q31_vector_normalize(v);
 }
 
 intquat_t int_quaternion_normalize(intquat_t q)
 {
-  float recipNorm = turboInvSqrt((q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z) / 1000000.0);
-  int32_t intRecipNorm = (int32_t)(recipNorm*1000);
-  intquat_t out;
-  out.w = (intRecipNorm*q.w)/1000;
-  out.x = (intRecipNorm*q.x)/1000;
-  out.y = (intRecipNorm*q.y)/1000;
-  out.z = (intRecipNorm*q.z)/1000;
-  return out;
+  return q31_quaternion_normalize(q);
 }
 
 intquat_t int_quaternion_multiply(intquat_t q1, intquat_t q2)
 {
-  int32_t s1 = q1.w;
-  int32_t s2 = q2.w;
-
-  intvec_t v1 = {q1.x, q1.y, q2.z};
-  intvec_t v2 = {q2.x, q2.y, q2.z};
-
-  int32_t w = (s1*s2)/1000 - int_dot(v1, v2);
-  // xyz = s1*v2 + s2*v1 - v1 x v2)
-  intvec_t xyz = int_vector_sub(int_vector_add(int_scalar_multiply(s1, v2), int_scalar_multiply(s2,v1)), int_cross(v1,
-                                v2));
-  intquat_t q = {w, xyz.x, xyz.y, xyz.z};
-  return int_quaternion_normalize(q);
+  return q31_quaternion_normalize(q31_quaternion_multiply(q1, q2));
 }
 
 
 intquat_t int_quaternion_inverse(intquat_t q)
 {
-
-  intquat_t out = {q.w, -1*q.x, -1*q.y, -1*q.z};
-  return out;
+  return q31_quaternion_inverse(q);
 }
 
 intquat_t int_quaternion_from_two_vectors(intvec_t u, intvec_t v)
 {
-  u = int_vector_normalize(u);
-  v = int_vector_normalize(v);
+  u = q31_vector_normalize(u);
+  v = q31_vector_normalize(v);
 
-  intvec_t half = int_vector_normalize(int_vector_add(u,v));
+  // the half-way vector, halved first so that the sum can't saturate
+  intvec_t half = {u.x/2 + v.x/2, u.y/2 + v.y/2, u.z/2 + v.z/2};
+  half = q31_vector_normalize(half);
 
-  int32_t w = int_dot(u, half);
-  intvec_t xyz = int_cross(u,v);
+  // q = [cos(theta/2), sin(theta/2)*axis], already unit length
+  int32_t w = q31_dot(u, half);
+  intvec_t xyz = q31_cross(u, half);
   intquat_t q = {w, xyz.x, xyz.y, xyz.z};
-  return int_quaternion_normalize(q);
+  return q;
+}
+
+// twice a Q62 product sum, in the thousandths that the turbotrig functions take
+static int32_t twice_milli(int64_t q62)
+{
+  return (int32_t)(((q62 >> 31) * 2000) >> 31);
+}
+
+void euler_from_int_quat(intquat_t q, int32_t *phi, int32_t *theta, int32_t *psi)
+{
+  int64_t w = q.w, x = q.x, y = q.y, z = q.z;
+  *phi = turboatan2(twice_milli(w*x + y*z),
+                    1000 - twice_milli(x*x + y*y));
+  *theta = turboasin(twice_milli(w*y - z*x));
+  *psi = turboatan2(twice_milli(w*z + x*y),
+                    1000 - twice_milli(y*y + z*z));
 }
 
 
@@ -246,6 +228,24 @@ quaternion_t quat_from_two_vectors(vector_t u, vector_t v)
   return quaternion_normalize(q);
 }
 
+quaternion_t quaternion_propagate(quaternion_t q, vector_t w, float dt)
+{
+  // half the rotation over the step
+  float hx = 0.5f*dt*w.x;
+  float hy = 0.5f*dt*w.y;
+  float hz = 0.5f*dt*w.z;
+
+  float c, sinc;
+  cos_sinc_approx(hx*hx + hy*hy + hz*hz, &c, &sinc);
+
+  quaternion_t out;
+  out.w = c*q.w + sinc*(- hx*q.x - hy*q.y - hz*q.z);
+  out.x = c*q.x + sinc*(  hx*q.w + hz*q.y - hy*q.z);
+  out.y = c*q.y + sinc*(  hy*q.w - hz*q.x + hx*q.z);
+  out.z = c*q.z + sinc*(  hz*q.w + hy*q.x - hx*q.y);
+  return out;
+}
+
 void euler_from_quat(quaternion_t q, float *phi, float *theta, float *psi)
 {
   *phi = atan2_approx(2.0f * (q.w*q.x + q.y*q.z),
@@ -258,15 +258,19 @@ void euler_from_quat(quaternion_t q, float *phi, float *theta, float *psi)
 
 float turboInvSqrt(float x)
 {
-  long i;
+  // a union rather than pointer casts keeps this correct where long is 64 bits
+  union
+  {
+    float f;
+    int32_t i;
+  } bits;
   float x2, y;
   const float threehalfs = 1.5F;
 
   x2 = x * 0.5F;
-  y  = x;
-  i  = * (long *) &y;                         // evil floating point bit level hacking
-  i  = 0x5f3759df - (i >> 1);
-  y  = * (float *) &i;
+  bits.f = x;                                 // evil floating point bit level hacking
+  bits.i = 0x5f3759df - (bits.i >> 1);
+  y  = bits.f;
   y  = y * (threehalfs - (x2 * y * y));       // 1st iteration
   y  = y * (threehalfs - (x2 * y * y));       // 2nd iteration, this can be removed
 
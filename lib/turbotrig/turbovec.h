@@ -37,6 +37,8 @@ extern "C" {
 #include <stdint.h>
 #include <math.h>
 
+#include "turbofix.h"
+
 typedef struct
 {
   float x;
@@ -52,24 +54,13 @@ typedef struct
   float z;
 } quaternion_t;
 
-typedef struct
-{
-  int32_t x;
-  int32_t y;
-  int32_t z;
-} intvec_t;
-
-typedef struct
-{
-  int32_t w;
-  int32_t x;
-  int32_t y;
-  int32_t z;
-} intquat_t;
+// The integer API works in Q31 (see turbofix.h), so unit vectors and quaternions use the full range
+typedef q31vec_t intvec_t;
+typedef q31quat_t intquat_t;
 
 int32_t int_dot(intvec_t v1, intvec_t v2);
 intvec_t int_cross(intvec_t u, intvec_t v);
-intvec_t int_scalar_multiply(int32_t s, intvec_t v);
+intvec_t int_scalar_multiply(q31_t s, intvec_t v);
 intvec_t int_vector_add(intvec_t u, intvec_t v);
 intvec_t int_vector_sub(intvec_t u, intvec_t v);
 int32_t int_sqrd_norm(intvec_t v);
@@ -91,9 +82,14 @@ quaternion_t quaternion_normalize(quaternion_t q);
 quaternion_t quaternion_multiply(quaternion_t q1, quaternion_t q2);
 quaternion_t quaternion_inverse(quaternion_t q);
 quaternion_t quat_from_two_vectors(vector_t u, vector_t v);
+// Rotates q by the body rate w over dt with the exact quaternion exponential (Eq. 12 of Casey),
+// using series instead of sqrt, sin and cos.  Accurate to float precision for any step;
+// see turbovec.c for the bounds.  The result isn't normalized.
+quaternion_t quaternion_propagate(quaternion_t q, vector_t w, float dt);
 
 void euler_from_quat(quaternion_t q, float *phi, float *theta, float *psi);
-void euler_from_int_quat(intquat_t q, int32_t phi, int32_t theta, int32_t psi);
+// outputs in milliradians, the units of turbotrig.h
+void euler_from_int_quat(intquat_t q, int32_t *phi, int32_t *theta, int32_t *psi);
 
 float turboInvSqrt(float x);
 
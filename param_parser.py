@@ -28,7 +28,7 @@ for line in lines:
             params[i]['type'] = re.split("\(", re.split("_", line)[2])[0]
             params[i]['name'] = name
             # Find default value
-            params[i]['default'] =  re.split("\)", re.split(",", line)[2])[0]
+            params[i]['default'] =  re.split("\)", re.split(",", line.split(name_with_quotes)[1])[1])[0]
             # isolate the comment portion of the line and split it on the "|" characters
             comment = re.split("\|", re.split("//", line)[1])
             # Isolate the Description
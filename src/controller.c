@@ -35,7 +35,9 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
+#include <turbotrig/turbofix.h>
 #include <turbotrig/turbotrig.h>
 
 #include "param.h"
@@ -44,40 +46,18 @@ extern "C" {
 #include "estimator.h"
 #include "sensors.h"
 #include "mode.h"
+#include "rosflight.h"
 
 #include "controller.h"
 
 #include "mavlink_log.h"
 #include "mavlink_util.h"
 
-typedef struct
-{
-  param_id_t kp_param_id;
-  param_id_t ki_param_id;
-  param_id_t kd_param_id;
-
-  float *current_x;
-  float *current_xdot;
-  float *commanded_x;
-  float *output;
-
-  float max;
-  float min;
-
-  float integrator;
-  float prev_time;
-  float prev_x;
-  float differentiator;
-  float tau;
-} pid_t;
-
-static pid_t pid_roll;
-static pid_t pid_roll_rate;
-static pid_t pid_pitch;
-static pid_t pid_pitch_rate;
-static pid_t pid_yaw_rate;
-
-static void init_pid(pid_t *pid, param_id_t kp_param_id, param_id_t ki_param_id, param_id_t kd_param_id,
+// the documented range of ANGLE_LOOP_RATE (Hz), which also keeps a bad value from dividing by zero
+#define ANGLE_LOOP_RATE_MIN 125
+#define ANGLE_LOOP_RATE_MAX 8000
+
+static void init_pid(rosflight_t *rf, pid_controller_t *pid, param_id_t kp_param_id, param_id_t ki_param_id, param_id_t kd_param_id,
                      float *current_x, float *current_xdot, float *commanded_x, float *output, float max, float min)
 {
   pid->kp_param_id = kp_param_id;
@@ -90,16 +70,122 @@ static void init_pid(pid_t *pid, param_id_t kp_param_id, param_id_t ki_param_id,
   pid->max = max;
   pid->min = min;
   pid->integrator = 0.0;
-  pid->prev_time = clock_micros()*1e-6;
   pid->differentiator = 0.0;
   pid->prev_x = 0.0;
-  pid->tau = get_param_float(PARAM_PID_TAU);
+  pid->tau = get_param_float(rf, PARAM_PID_TAU);
+
+#ifdef FIXED_POINT_CONTROL
+  pid->fixed.max = q16_from_float(max);
+  pid->fixed.min = q16_from_float(min);
+  pid->fixed.tau_us = pid->tau * 1e6f;
+  pid->fixed.integrator = 0;
+  pid->fixed.prev_x = 0;
+  pid->fixed.differentiator = 0;
+  pid->fixed.coeff_dt_us = 0;
+#endif
+}
+
+
+static void update_pid_gains(rosflight_t *rf, pid_controller_t *pid)
+{
+  pid->kp = get_param_float(rf, pid->kp_param_id);
+  pid->ki = (pid->ki_param_id < PARAMS_COUNT) ? get_param_float(rf, pid->ki_param_id) : 0.0f;
+  pid->kd = (pid->kd_param_id < PARAMS_COUNT) ? get_param_float(rf, pid->kd_param_id) : 0.0f;
+
+#ifdef FIXED_POINT_CONTROL
+  pid->fixed.kp = q16_from_float(pid->kp);
+  pid->fixed.ki = q16_from_float(pid->ki);
+  pid->fixed.kd = q16_from_float(pid->kd);
+#endif
+}
+
+
+// Limits the output of a PID to +/-limit
+static void set_pid_limit(pid_controller_t *pid, float limit)
+{
+  pid->max = limit;
+  pid->min = -limit;
+
+#ifdef FIXED_POINT_CONTROL
+  pid->fixed.max = q16_from_float(pid->max);
+  pid->fixed.min = q16_from_float(pid->min);
+#endif
 }
 
 
-static void run_pid(pid_t *pid, float dt)
+#ifdef FIXED_POINT_CONTROL
+// Same as the float version below, with every term in Q16 and the time step in microseconds
+static q16_t run_pid(rosflight_t *rf, pid_controller_t *pid, uint32_t dt_us)
 {
-  if (dt > 0.010 || !(_armed_state & ARMED))
+  pid_fixed_t *fixed = &pid->fixed;
+
+  if (dt_us > 10000 || !(rf->mode.armed_state & ARMED))
+  {
+    // stale or disarmed, see the float version
+    dt_us = 0;
+    fixed->differentiator = 0;
+  }
+
+  q16_t x = q16_from_float(*pid->current_x);
+  int64_t error = (int64_t) q16_from_float(*pid->commanded_x) - x;
+
+  int64_t p_term = (error * fixed->kp) >> 16;
+  int64_t i_term = 0;
+  int64_t d_term = 0;
+
+  if (pid->kd_param_id < PARAMS_COUNT)
+  {
+    if (pid->current_xdot == NULL)
+    {
+      if (dt_us > 0)
+      {
+        // the coefficients only change when the loop rate does
+        if (dt_us != fixed->coeff_dt_us)
+        {
+          int64_t den_us = 2*(int64_t) fixed->tau_us + dt_us;
+          fixed->decay = q31_sat((2*(int64_t) fixed->tau_us - dt_us) * 2147483648LL / den_us);
+          fixed->gain = q31_sat((2000000LL << 16) / den_us);
+          fixed->coeff_dt_us = dt_us;
+        }
+        fixed->differentiator = q31_sat((((int64_t) fixed->decay * fixed->differentiator) >> 31)
+                                        + (((int64_t) fixed->gain * (x - fixed->prev_x)) >> 16));
+        fixed->prev_x = x;
+        d_term = ((int64_t) fixed->kd * fixed->differentiator) >> 16;
+      }
+    }
+    else
+    {
+      d_term = ((int64_t) fixed->kd * q16_from_float(*pid->current_xdot)) >> 16;
+    }
+  }
+
+  if ((pid->ki_param_id < PARAMS_COUNT) && (rf->mode.armed_state == ARMED)
+      && (q16_from_float(rf->mux.combined_control.F.value) > Q16_CONST(0.1)))
+  {
+    if (fixed->ki > 0)
+    {
+      // dt in Q32 seconds is dt_us*2^32/1e6, and 281474977 is 2^48/1e6 rounded
+      int64_t dt_q32 = ((uint64_t) dt_us * 281474977) >> 16;
+      fixed->integrator += (error * dt_q32) >> 16;
+      i_term = (fixed->ki * (fixed->integrator >> 16)) >> 16;
+    }
+  }
+
+  int64_t u = p_term + i_term - d_term;
+
+  // Integrator anti-windup
+  int64_t u_sat = (u > fixed->max) ? fixed->max : (u < fixed->min) ? fixed->min : u;
+  if (u != u_sat && llabs(i_term) > llabs(u - p_term + d_term))
+    fixed->integrator = (u_sat - p_term + d_term) * 4294967296LL / fixed->ki;
+
+  return u_sat;
+}
+
+#else
+
+static void run_pid(rosflight_t *rf, pid_controller_t *pid, float dt)
+{
+  if (dt > 0.010 || !(rf->mode.armed_state & ARMED))
   {
     // This means that this is a ''stale'' controller and needs to be reset.
     // This would happen if we have been operating in a different mode for a while
@@ -115,7 +201,7 @@ static void run_pid(pid_t *pid, float dt)
   float error = (*pid->commanded_x) - (*pid->current_x);
 
   // Initialize Terms
-  float p_term = error * get_param_float(pid->kp_param_id);
+  float p_term = error * pid->kp;
   float i_term = 0.0;
   float d_term = 0.0;
 
@@ -132,24 +218,24 @@ static void run_pid(pid_t *pid, float dt)
         pid->differentiator = (2.0f*pid->tau-dt)/(2.0f*pid->tau+dt)*pid->differentiator
                                 + 2.0f/(2.0f*pid->tau+dt)*((*pid->current_x) - pid->prev_x);
         pid->prev_x = *pid->current_x;
-        d_term = get_param_float(pid->kd_param_id)*pid->differentiator;
+        d_term = pid->kd*pid->differentiator;
       }
     }
     else
     {
-      d_term = get_param_float(pid->kd_param_id) * (*pid->current_xdot);
+      d_term = pid->kd * (*pid->current_xdot);
     }
   }
 
   // If there is an integrator, we are armed, and throttle is high
-  if ((pid->ki_param_id < PARAMS_COUNT) && (_armed_state == ARMED) && (_combined_control.F.value > 0.1))
+  if ((pid->ki_param_id < PARAMS_COUNT) && (rf->mode.armed_state == ARMED) && (rf->mux.combined_control.F.value > 0.1))
   {
-    if (get_param_float(pid->ki_param_id) > 0.0)
+    if (pid->ki > 0.0)
     {
       // integrate
       pid->integrator += error*dt;
-      // calculate I term (be sure to de-reference pointer to gain)
-      i_term = get_param_float(pid->ki_param_id) * pid->integrator;
+      // calculate I term
+      i_term = pid->ki * pid->integrator;
     }
   }
 
@@ -159,123 +245,412 @@ static void run_pid(pid_t *pid, float dt)
   // Integrator anti-windup
   float u_sat = (u > pid->max) ? pid->max : (u < pid->min) ? pid->min : u;
   if (u != u_sat && fabs(i_term) > fabs(u - p_term + d_term))
-    pid->integrator = (u_sat - p_term + d_term)/get_param_float(pid->ki_param_id);
+    pid->integrator = (u_sat - p_term + d_term)/pid->ki;
 
   // Set output
   (*pid->output) = u_sat;
 
   return;
 }
+#endif
 
 
-void init_controller()
+void init_controller(rosflight_t *rf)
 {
-  init_pid(&pid_roll,
+  controller_t *ctrl = &rf->controller;
+  state_t *state = &rf->estimator.state;
+  control_t *combined = &rf->mux.combined_control;
+  command_t *command = &rf->mixer.command;
+
+  ctrl->prev_time_us = 0;
+
+  init_pid(rf, &ctrl->pid_roll,
            PARAM_PID_ROLL_ANGLE_P,
            PARAM_PID_ROLL_ANGLE_I,
            PARAM_PID_ROLL_ANGLE_D,
-           &_current_state.roll,
-           &_current_state.omega.x,
-           &_combined_control.x.value,
-           &_command.x,
-           get_param_float(PARAM_MAX_COMMAND),
-           -1.0f*get_param_float(PARAM_MAX_COMMAND));
-
-  init_pid(&pid_pitch,
+           &state->roll,
+           &state->omega.x,
+           &combined->x.value,
+           &command->x,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
+
+  init_pid(rf, &ctrl->pid_pitch,
            PARAM_PID_PITCH_ANGLE_P,
            PARAM_PID_PITCH_ANGLE_I,
            PARAM_PID_PITCH_ANGLE_D,
-           &_current_state.pitch,
-           &_current_state.omega.y,
-           &_combined_control.y.value,
-           &_command.y,
-           get_param_float(PARAM_MAX_COMMAND),
-           -1.0f*get_param_float(PARAM_MAX_COMMAND));
-
-  init_pid(&pid_roll_rate,
+           &state->pitch,
+           &state->omega.y,
+           &combined->y.value,
+           &command->y,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
+
+  init_pid(rf, &ctrl->pid_roll_rate,
            PARAM_PID_ROLL_RATE_P,
            PARAM_PID_ROLL_RATE_I,
            PARAM_PID_ROLL_RATE_D,
-           &_current_state.omega.x,
+           &state->omega.x,
            NULL,
-           &_combined_control.x.value,
-           &_command.x,
-           get_param_float(PARAM_MAX_COMMAND),
-           -1.0f*get_param_float(PARAM_MAX_COMMAND));
+           &ctrl->rate_setpoint.x,
+           &command->x,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
 
-  init_pid(&pid_pitch_rate,
+  init_pid(rf, &ctrl->pid_pitch_rate,
            PARAM_PID_PITCH_RATE_P,
            PARAM_PID_PITCH_RATE_I,
            PARAM_PID_PITCH_RATE_D,
-           &_current_state.omega.y,
+           &state->omega.y,
            NULL,
-           &_combined_control.y.value,
-           &_command.y,
-           get_param_float(PARAM_MAX_COMMAND),
-           -1.0f*get_param_float(PARAM_MAX_COMMAND));
+           &ctrl->rate_setpoint.y,
+           &command->y,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
 
-  init_pid(&pid_yaw_rate,
+  init_pid(rf, &ctrl->pid_yaw_rate,
            PARAM_PID_YAW_RATE_P,
            PARAM_PID_YAW_RATE_I,
            PARAM_PID_YAW_RATE_D,
-           &_current_state.omega.z,
+           &state->omega.z,
+           NULL,
+           &combined->z.value,
+           &command->z,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
+
+  init_pid(rf, &ctrl->pid_roll_tilt,
+           PARAM_PID_ROLL_ANGLE_P,
+           PARAM_PID_ROLL_ANGLE_I,
+           PARAM_PID_ROLL_ANGLE_D,
+           &ctrl->tilt.x,
+           &state->omega.x,
+           &ctrl->error_setpoint,
+           &command->x,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
+
+  init_pid(rf, &ctrl->pid_pitch_tilt,
+           PARAM_PID_PITCH_ANGLE_P,
+           PARAM_PID_PITCH_ANGLE_I,
+           PARAM_PID_PITCH_ANGLE_D,
+           &ctrl->tilt.y,
+           &state->omega.y,
+           &ctrl->error_setpoint,
+           &command->y,
+           get_param_float(rf, PARAM_MAX_COMMAND),
+           -1.0f*get_param_float(rf, PARAM_MAX_COMMAND));
+
+  ctrl->tilt.x = 0.0f;
+  ctrl->tilt.y = 0.0f;
+  ctrl->tilt.z = 0.0f;
+  ctrl->error_setpoint = 0.0f;
+  ctrl->tilt_cmd_roll = 0.0f;
+  ctrl->tilt_cmd_pitch = 0.0f;
+  ctrl->down_cmd.x = 0.0f;
+  ctrl->down_cmd.y = 0.0f;
+  ctrl->down_cmd.z = 1.0f;
+
+  // the limits of the cascaded loops are set from the RC rate limits in update_controller_params()
+  init_pid(rf, &ctrl->pid_roll_cascade,
+           PARAM_PID_ROLL_CASCADE_P,
+           PARAM_PID_ROLL_CASCADE_I,
+           PARAMS_COUNT,
+           &ctrl->angle_error.x,
            NULL,
-           &_combined_control.z.value,
-           &_command.z,
-           get_param_float(PARAM_MAX_COMMAND),
-           -1.0f*get_param_float(PARAM_MAX_COMMAND));
+           &ctrl->error_setpoint,
+           &ctrl->rate_setpoint.x,
+           0.0f,
+           0.0f);
+
+  init_pid(rf, &ctrl->pid_pitch_cascade,
+           PARAM_PID_PITCH_CASCADE_P,
+           PARAM_PID_PITCH_CASCADE_I,
+           PARAMS_COUNT,
+           &ctrl->angle_error.y,
+           NULL,
+           &ctrl->error_setpoint,
+           &ctrl->rate_setpoint.y,
+           0.0f,
+           0.0f);
+
+  ctrl->angle_loop_prev_us = 0;
+  ctrl->angle_loop_next_us = 0;
+  ctrl->roll_cascaded = false;
+  ctrl->pitch_cascaded = false;
+  ctrl->angle_error.x = 0.0f;
+  ctrl->angle_error.y = 0.0f;
+  ctrl->angle_error.z = 0.0f;
+  ctrl->rate_setpoint.x = 0.0f;
+  ctrl->rate_setpoint.y = 0.0f;
+  ctrl->rate_setpoint.z = 0.0f;
+
+  update_controller_params(rf);
+}
+
+
+void update_controller_params(rosflight_t *rf)
+{
+  controller_t *ctrl = &rf->controller;
+  update_pid_gains(rf, &ctrl->pid_roll);
+  update_pid_gains(rf, &ctrl->pid_pitch);
+  update_pid_gains(rf, &ctrl->pid_roll_rate);
+  update_pid_gains(rf, &ctrl->pid_pitch_rate);
+  update_pid_gains(rf, &ctrl->pid_yaw_rate);
+  update_pid_gains(rf, &ctrl->pid_roll_tilt);
+  update_pid_gains(rf, &ctrl->pid_pitch_tilt);
+  ctrl->angle_controller = get_param_int(rf, PARAM_ANGLE_CONTROLLER);
+
+  update_pid_gains(rf, &ctrl->pid_roll_cascade);
+  update_pid_gains(rf, &ctrl->pid_pitch_cascade);
+  set_pid_limit(&ctrl->pid_roll_cascade, get_param_float(rf, PARAM_RC_MAX_ROLLRATE));
+  set_pid_limit(&ctrl->pid_pitch_cascade, get_param_float(rf, PARAM_RC_MAX_PITCHRATE));
+  ctrl->cascade = get_param_int(rf, PARAM_ANGLE_CASCADE);
+  int32_t angle_loop_rate = get_param_int(rf, PARAM_ANGLE_LOOP_RATE);
+  if (angle_loop_rate < ANGLE_LOOP_RATE_MIN)
+    angle_loop_rate = ANGLE_LOOP_RATE_MIN;
+  else if (angle_loop_rate > ANGLE_LOOP_RATE_MAX)
+    angle_loop_rate = ANGLE_LOOP_RATE_MAX;
+  ctrl->angle_loop_period_us = 1000000 / angle_loop_rate;
+
+  ctrl->x_eq_torque = get_param_float(rf, PARAM_X_EQ_TORQUE);
+  ctrl->y_eq_torque = get_param_float(rf, PARAM_Y_EQ_TORQUE);
+  ctrl->z_eq_torque = get_param_float(rf, PARAM_Z_EQ_TORQUE);
+
+#ifdef FIXED_POINT_CONTROL
+  ctrl->eq_torque[0] = q16_from_float(ctrl->x_eq_torque);
+  ctrl->eq_torque[1] = q16_from_float(ctrl->y_eq_torque);
+  ctrl->eq_torque[2] = q16_from_float(ctrl->z_eq_torque);
+#endif
+}
+
+
+// Computes the tilt error for the quaternion angle controller.  The commanded and estimated
+// directions of gravity in the body frame are compared with the shortest-arc quaternion
+// between them, whose vector part is sin(angle/2) times the rotation axis.  Twice that is
+// the rotation vector for small errors, and it keeps growing up to 180 degrees instead of
+// going singular at +/-90 degrees of pitch like the Euler angles.  There's no trig on the
+// way, and the commanded direction is only recomputed when the command changes.
+static void update_tilt(rosflight_t *rf)
+{
+  controller_t *ctrl = &rf->controller;
+  const control_t *combined = &rf->mux.combined_control;
+  const quaternion_t *q = &rf->estimator.state.q;
+
+  if (combined->x.value != ctrl->tilt_cmd_roll || combined->y.value != ctrl->tilt_cmd_pitch)
+  {
+    // third row of the rotation matrix of roll and pitch
+    float roll = combined->x.value;
+    float pitch = combined->y.value;
+    float cos_roll, sinc_roll, cos_pitch, sinc_pitch;
+    cos_sinc_approx(roll*roll, &cos_roll, &sinc_roll);
+    cos_sinc_approx(pitch*pitch, &cos_pitch, &sinc_pitch);
+    ctrl->down_cmd.x = -pitch*sinc_pitch;
+    ctrl->down_cmd.y = roll*sinc_roll*cos_pitch;
+    ctrl->down_cmd.z = cos_roll*cos_pitch;
+    ctrl->tilt_cmd_roll = roll;
+    ctrl->tilt_cmd_pitch = pitch;
+  }
+
+  // the same row from the estimate
+  vector_t down = {2.0f*(q->x*q->z - q->w*q->y),
+                   2.0f*(q->y*q->z + q->w*q->x),
+                   1.0f - 2.0f*(q->x*q->x + q->y*q->y)
+                  };
+
+  quaternion_t q_tilt = quat_from_two_vectors(down, ctrl->down_cmd);
+  ctrl->tilt.x = 2.0f*q_tilt.x;
+  ctrl->tilt.y = 2.0f*q_tilt.y;
+  ctrl->tilt.z = 2.0f*q_tilt.z;
+}
+
+// Gets the attitude that the angle PIDs use ready, and returns true if it's the tilt error
+static bool update_angle_inputs(rosflight_t *rf)
+{
+  const control_t *combined = &rf->mux.combined_control;
+  bool roll_angle = (combined->x.type == ANGLE);
+  bool pitch_angle = (combined->y.type == ANGLE);
+
+  if (!roll_angle && !pitch_angle)
+    return false;
+
+  // the commanded tilt needs both a roll and a pitch angle
+  if (rf->controller.angle_controller == ANGLE_CONTROLLER_QUATERNION && roll_angle && pitch_angle)
+  {
+    update_tilt(rf);
+    return true;
+  }
+
+  estimator_update_euler(rf);
+  return false;
+}
+
+// Sets the setpoints of the roll and pitch rate PIDs.  In rate mode that's the command, and in
+// cascaded angle mode it's the output of the angle loop.  The angle loop runs on its own fixed
+// schedule, slower than the rate PIDs, and holds its output in between.  An axis that has just
+// switched to angle mode doesn't wait for the next slot, so the rate PIDs never see a stale
+// rate command, but that first update doesn't integrate.
+static void update_rate_setpoints(rosflight_t *rf)
+{
+  controller_t *ctrl = &rf->controller;
+  const control_t *combined = &rf->mux.combined_control;
+
+  bool roll_cascaded = ctrl->cascade && combined->x.type == ANGLE;
+  bool pitch_cascaded = ctrl->cascade && combined->y.type == ANGLE;
+  if (!roll_cascaded)
+    ctrl->rate_setpoint.x = combined->x.value;
+  if (!pitch_cascaded)
+    ctrl->rate_setpoint.y = combined->y.value;
+
+  uint64_t now_us = rf->estimator.state.now_us;
+  bool due = (now_us >= ctrl->angle_loop_next_us);
+  bool run_roll = roll_cascaded && (due || !ctrl->roll_cascaded);
+  bool run_pitch = pitch_cascaded && (due || !ctrl->pitch_cascaded);
+  ctrl->roll_cascaded = roll_cascaded;
+  ctrl->pitch_cascaded = pitch_cascaded;
+
+  if (!run_roll && !run_pitch)
+    return;
+
+  uint64_t dt_us = 0;
+  if (due)
+  {
+    dt_us = now_us - ctrl->angle_loop_prev_us;
+    if (dt_us > UINT32_MAX)
+      dt_us = UINT32_MAX;
+    ctrl->angle_loop_prev_us = now_us;
+    ctrl->angle_loop_next_us += ctrl->angle_loop_period_us;
+    if (ctrl->angle_loop_next_us <= now_us)
+      ctrl->angle_loop_next_us = now_us + ctrl->angle_loop_period_us;
+  }
+
+  if (update_angle_inputs(rf))
+  {
+    ctrl->angle_error.x = ctrl->tilt.x;
+    ctrl->angle_error.y = ctrl->tilt.y;
+  }
+  else
+  {
+    ctrl->angle_error.x = rf->estimator.state.roll - combined->x.value;
+    ctrl->angle_error.y = rf->estimator.state.pitch - combined->y.value;
+  }
+
+#ifdef FIXED_POINT_CONTROL
+  if (run_roll)
+    ctrl->rate_setpoint.x = q16_to_float(run_pid(rf, &ctrl->pid_roll_cascade, dt_us));
+  if (run_pitch)
+    ctrl->rate_setpoint.y = q16_to_float(run_pid(rf, &ctrl->pid_pitch_cascade, dt_us));
+#else
+  if (run_roll)
+    run_pid(rf, &ctrl->pid_roll_cascade, dt_us * 1e-6f);
+  if (run_pitch)
+    run_pid(rf, &ctrl->pid_pitch_cascade, dt_us * 1e-6f);
+#endif
 }
 
 
-void run_controller()
+#ifdef FIXED_POINT_CONTROL
+// Runs the PID for the channel's type and adds the equilibrium torque.  angle_pid is NULL for yaw.
+// In cascaded angle mode the rate PID runs instead, following the angle loop.
+static float run_axis(rosflight_t *rf, const control_channel_t *channel, pid_controller_t *rate_pid,
+                      pid_controller_t *angle_pid, bool cascaded, q16_t eq_torque, float eq_torque_float, uint32_t dt_us)
 {
+  q16_t u;
+  if (channel->type == RATE || (channel->type == ANGLE && cascaded))
+    u = run_pid(rf, rate_pid, dt_us);
+  else if (channel->type == ANGLE && angle_pid != NULL)
+    u = run_pid(rf, angle_pid, dt_us);
+  else // PASSTHROUGH
+    return channel->value + eq_torque_float;
+
+  return q16_to_float(q31_sat((int64_t) u + eq_torque));
+}
+
+void run_controller(rosflight_t *rf)
+{
+  controller_t *ctrl = &rf->controller;
+  control_t *combined = &rf->mux.combined_control;
+
   // Time calculation
-  static float prev_time = 0.0f;
+  uint64_t now_us = rf->estimator.state.now_us;
+  if (ctrl->prev_time_us == 0)
+  {
+    ctrl->prev_time_us = now_us;
+    return;
+  }
 
-  if (prev_time < 0.0000001)
+  uint64_t dt_us = now_us - ctrl->prev_time_us;
+  ctrl->prev_time_us = now_us;
+  if (dt_us > UINT32_MAX)
+    dt_us = UINT32_MAX;
+
+  update_rate_setpoints(rf);
+  bool tilt = !ctrl->cascade && update_angle_inputs(rf);
+  rf->mixer.command.x = run_axis(rf, &combined->x, &ctrl->pid_roll_rate, tilt ? &ctrl->pid_roll_tilt : &ctrl->pid_roll,
+                                 ctrl->cascade, ctrl->eq_torque[0], ctrl->x_eq_torque, dt_us);
+  rf->mixer.command.y = run_axis(rf, &combined->y, &ctrl->pid_pitch_rate, tilt ? &ctrl->pid_pitch_tilt : &ctrl->pid_pitch,
+                                 ctrl->cascade, ctrl->eq_torque[1], ctrl->y_eq_torque, dt_us);
+  rf->mixer.command.z = run_axis(rf, &combined->z, &ctrl->pid_yaw_rate, NULL,
+                                 false, ctrl->eq_torque[2], ctrl->z_eq_torque, dt_us);
+  rf->mixer.command.F = combined->F.value;
+}
+
+#else
+
+void run_controller(rosflight_t *rf)
+{
+  controller_t *ctrl = &rf->controller;
+
+  // Time calculation, in integer microseconds so that dt keeps its resolution however long
+  // the board has been on.  Only the difference is converted to seconds.
+  uint64_t now_us = rf->estimator.state.now_us;
+  if (ctrl->prev_time_us == 0)
   {
-    prev_time = _current_state.now_us * 1e-6;
+    ctrl->prev_time_us = now_us;
     return;
   }
 
-  float now = _current_state.now_us * 1e-6;
-  float dt = now - prev_time;
-  prev_time = now;
+  float dt = (now_us - ctrl->prev_time_us) * 1e-6f;
+  ctrl->prev_time_us = now_us;
+
+  update_rate_setpoints(rf);
+  bool tilt = !ctrl->cascade && update_angle_inputs(rf);
 
   // ROLL
-  if (_combined_control.x.type == RATE)
-    run_pid(&pid_roll_rate, dt);
-  else if (_combined_control.x.type == ANGLE)
-    run_pid(&pid_roll, dt);
+  if (rf->mux.combined_control.x.type == RATE || (rf->mux.combined_control.x.type == ANGLE && ctrl->cascade))
+    run_pid(rf, &ctrl->pid_roll_rate, dt);
+  else if (rf->mux.combined_control.x.type == ANGLE)
+    run_pid(rf, tilt ? &ctrl->pid_roll_tilt : &ctrl->pid_roll, dt);
   else // PASSTHROUGH
-    _command.x = _combined_control.x.value;
+    rf->mixer.command.x = rf->mux.combined_control.x.value;
 
   // PITCH
-  if (_combined_control.y.type == RATE)
-    run_pid(&pid_pitch_rate, dt);
-  else if (_combined_control.y.type == ANGLE)
-    run_pid(&pid_pitch, dt);
+  if (rf->mux.combined_control.y.type == RATE || (rf->mux.combined_control.y.type == ANGLE && ctrl->cascade))
+    run_pid(rf, &ctrl->pid_pitch_rate, dt);
+  else if (rf->mux.combined_control.y.type == ANGLE)
+    run_pid(rf, tilt ? &ctrl->pid_pitch_tilt : &ctrl->pid_pitch, dt);
   else // PASSTHROUGH
-    _command.y = _combined_control.y.value;
+    rf->mixer.command.y = rf->mux.combined_control.y.value;
 
   // YAW
-  if (_combined_control.z.type == RATE)
-    run_pid(&pid_yaw_rate, dt);
+  if (rf->mux.combined_control.z.type == RATE)
+    run_pid(rf, &ctrl->pid_yaw_rate, dt);
   else// PASSTHROUGH
-    _command.z = _combined_control.z.value;
+    rf->mixer.command.z = rf->mux.combined_control.z.value;
 
 
   // Add feedforward torques
-  _command.x += get_param_float(PARAM_X_EQ_TORQUE);
-  _command.y += get_param_float(PARAM_Y_EQ_TORQUE);
-  _command.z += get_param_float(PARAM_Z_EQ_TORQUE);
-  _command.F = _combined_control.F.value;
+  rf->mixer.command.x += ctrl->x_eq_torque;
+  rf->mixer.command.y += ctrl->y_eq_torque;
+  rf->mixer.command.z += ctrl->z_eq_torque;
+  rf->mixer.command.F = rf->mux.combined_control.F.value;
 }
+#endif
 
-void calculate_equilbrium_torque_from_rc()
+void calculate_equilbrium_torque_from_rc(rosflight_t *rf)
 {
   // Make sure we are disarmed
-  if (!(_armed_state & ARMED))
+  if (!(rf->mode.armed_state & ARMED))
   {
     // Tell the user that we are doing a equilibrium torque calibration
     mavlink_log_warning("Capturing equilbrium offsets from RC");
@@ -283,29 +658,30 @@ void calculate_equilbrium_torque_from_rc()
     // Prepare for calibration
     // artificially tell the flight controller it is leveled
     // and zero out previously calculate offset torques
-    _current_state.omega.x = 0.0;
-    _current_state.omega.y = 0.0;
-    _current_state.omega.z = 0.0;
-    _current_state.q.w = 1.0;
-    _current_state.q.x = 0.0;
-    _current_state.q.y = 0.0;
-    _current_state.q.z = 0.0;
-
-    set_param_float(PARAM_X_EQ_TORQUE, 0.0);
-    set_param_float(PARAM_Y_EQ_TORQUE, 0.0);
-    set_param_float(PARAM_Z_EQ_TORQUE, 0.0);
+    rf->estimator.state.omega.x = 0.0;
+    rf->estimator.state.omega.y = 0.0;
+    rf->estimator.state.omega.z = 0.0;
+    rf->estimator.state.q.w = 1.0;
+    rf->estimator.state.q.x = 0.0;
+    rf->estimator.state.q.y = 0.0;
+    rf->estimator.state.q.z = 0.0;
+    rf->estimator.euler_valid = false;
+
+    set_param_float(rf, PARAM_X_EQ_TORQUE, 0.0);
+    set_param_float(rf, PARAM_Y_EQ_TORQUE, 0.0);
+    set_param_float(rf, PARAM_Z_EQ_TORQUE, 0.0);
 
     // pass the rc_control through the controller
-    _combined_control.x = _rc_control.x;
-    _combined_control.y = _rc_control.y;
-    _combined_control.z = _rc_control.z;
+    rf->mux.combined_control.x = rf->mux.rc_control.x;
+    rf->mux.combined_control.y = rf->mux.rc_control.y;
+    rf->mux.combined_control.z = rf->mux.rc_control.z;
 
-    run_controller();
+    run_controller(rf);
 
     // the output from the controller is going to be the static offsets
-    set_param_float(PARAM_X_EQ_TORQUE, _command.x);
-    set_param_float(PARAM_Y_EQ_TORQUE, _command.y);
-    set_param_float(PARAM_Z_EQ_TORQUE, _command.z);
+    set_param_float(rf, PARAM_X_EQ_TORQUE, rf->mixer.command.x);
+    set_param_float(rf, PARAM_Y_EQ_TORQUE, rf->mixer.command.y);
+    set_param_float(rf, PARAM_Z_EQ_TORQUE, rf->mixer.command.z);
 
     mavlink_log_warning("Equilibrium torques found and applied.");
     mavlink_log_warning("Please zero out trims on your transmitter");
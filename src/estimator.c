@@ -29,6 +29,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,264 +42,545 @@ extern "C" {
 #include <turbotrig/turbovec.h>
 
 #include "board.h"
+#include "latency.h"
+#include "mavlink_log.h"
 #include "sensors.h"
 #include "param.h"
 #include "mode.h"
+#include "rosflight.h"
 
 #include "estimator.h"
 
-state_t _current_state;
-vector_t _adaptive_gyro_bias;
-
-static vector_t w1;
-static vector_t w2;
-static vector_t wbar;
-static vector_t wfinal;
-static vector_t w_acc;
-static const vector_t g = {0.0f, 0.0f, -1.0f};
-static vector_t b;
-static quaternion_t q_tilde;
-static quaternion_t q_hat;
-static uint64_t last_time;
-static uint64_t last_acc_update_us;
-
-static vector_t _accel_LPF;
-static vector_t _gyro_LPF;
-
-void reset_state()
+#define SONAR_MIN_RANGE 0.25f     // m, the sonar doesn't see closer than this
+#define SONAR_MAX_RANGE 7.0f      // m
+#define SONAR_MIN_COS_TILT 0.94f  // cos(20 deg), more tilt than this and the beam misses the ground under us
+#define BARO_GROUND_TAU 5.0f      // s, for following the barometer's drift while the sonar is in range
+#define MAG_TIMEOUT_US 200000     // held heading corrections stop this long after the last magnetometer measurement
+#define ALT_BARO_TAU_MIN 0.5f     // s, the documented minimum of ALT_BARO_TAU, which also keeps 0 from giving infinite gains
+#define ALT_SONAR_TAU_MIN 0.2f    // s, the same for ALT_SONAR_TAU
+#define ACC_RATE_MIN 20           // Hz, the documented minimum of FILTER_ACC_RATE, which also keeps 0 from dividing by zero
+
+const estimator_backend_t *const estimator_backends[ESTIMATOR_BACKEND_COUNT] =
+{
+  &estimator_mahony,
+#ifdef FIXED_POINT_ESTIMATOR
+  NULL,
+  NULL
+#else
+  &estimator_madgwick,
+  &estimator_mekf
+#endif
+};
+
+void reset_state(rosflight_t *rf)
 {
-  _current_state.q.w = 1.0f;
-  _current_state.q.x = 0.0f;
-  _current_state.q.y = 0.0f;
-  _current_state.q.z = 0.0f;
-  _current_state.omega.x = 0.0f;
-  _current_state.omega.y = 0.0f;
-  _current_state.omega.z = 0.0f;
-  _current_state.roll = 0.0f;
-  _current_state.pitch = 0.0f;
-  _current_state.yaw = 0.0f;
-
-  q_hat.w = 1.0f;
-  q_hat.x = 0.0f;
-  q_hat.y = 0.0f;
-  q_hat.z = 0.0f;
-
-  w1.x = 0.0f;
-  w1.y = 0.0f;
-  w1.z = 0.0f;
-
-  w2.x = 0.0f;
-  w2.y = 0.0f;
-  w2.z = 0.0f;
-
-  b.x = 0.0f;
-  b.y = 0.0f;
-  b.z = 0.0f;
-
-  w_acc.x = 0.0f;
-  w_acc.y = 0.0f;
-  w_acc.z = 0.0f;
-
-  q_tilde.w = 1.0f;
-  q_tilde.x = 0.0f;
-  q_tilde.y = 0.0f;
-  q_tilde.z = 0.0f;
-
-  _accel_LPF.x = 0;
-  _accel_LPF.y = 0;
-  _accel_LPF.z = -9.80665;
-
-  _gyro_LPF.x = 0;
-  _gyro_LPF.y = 0;
-  _gyro_LPF.z = 0;
+  estimator_t *est = &rf->estimator;
+
+  est->state.q.w = 1.0f;
+  est->state.q.x = 0.0f;
+  est->state.q.y = 0.0f;
+  est->state.q.z = 0.0f;
+  est->state.omega.x = 0.0f;
+  est->state.omega.y = 0.0f;
+  est->state.omega.z = 0.0f;
+  est->state.roll = 0.0f;
+  est->state.pitch = 0.0f;
+  est->state.yaw = 0.0f;
+  est->euler_valid = true;
+
+  est->last_omega.x = 0.0f;
+  est->last_omega.y = 0.0f;
+  est->last_omega.z = 0.0f;
+  est->mag_fresh = false;
+
+  est->accel_LPF.x = 0;
+  est->accel_LPF.y = 0;
+  est->accel_LPF.z = -9.80665;
+
+  est->gyro_LPF.x = 0;
+  est->gyro_LPF.y = 0;
+  est->gyro_LPF.z = 0;
+
+  // the filter itself starts over when the alignment is done
+  est->alignment.done = false;
+  est->alignment.accel_sum.x = 0.0f;
+  est->alignment.accel_sum.y = 0.0f;
+  est->alignment.accel_sum.z = 0.0f;
+  est->alignment.mag_sum.x = 0.0f;
+  est->alignment.mag_sum.y = 0.0f;
+  est->alignment.mag_sum.z = 0.0f;
+  est->alignment.accel_count = 0;
+  est->alignment.mag_count = 0;
+
+  est->state.altitude = 0.0f;
+  est->state.vertical_velocity = 0.0f;
+  est->altitude.accel_bias = 0.0f;
+  est->altitude.baro_ground_set = false;
+  est->altitude.valid = false;
 
   // Clear the unhealthy estimator flag
-  _error_state &= ~(ERROR_UNHEALTHY_ESTIMATOR);
+  rf->mode.error_state &= ~(ERROR_UNHEALTHY_ESTIMATOR);
+}
+
+void reset_adaptive_bias(rosflight_t *rf)
+{
+  rf->estimator.backend->reset_bias(rf);
+}
+
+void init_estimator(rosflight_t *rf)
+{
+  rf->estimator.last_time = 0;
+  rf->estimator.backend = NULL;
+  reset_state(rf);
+  update_estimator_params(rf);
+}
+
+// The inertial z axis (down) in the body frame, the last row of the rotation from the body
+// to the inertial frame
+vector_t estimator_down(const quaternion_t *q)
+{
+  vector_t down = {2.0f*(q->x*q->z - q->w*q->y),
+                   2.0f*(q->y*q->z + q->w*q->x),
+                   1.0f - 2.0f*(q->x*q->x + q->y*q->y)
+                  };
+  return down;
+}
+
+// The north and east components of the body frame vector m, with the first two rows of
+// the rotation from the body to the inertial frame
+vector_t estimator_horizontal_field(const quaternion_t *q, vector_t m)
+{
+  vector_t horizontal = {(1.0f - 2.0f*(q->y*q->y + q->z*q->z))*m.x + 2.0f*(q->x*q->y - q->w*q->z)*m.y
+                         + 2.0f*(q->x*q->z + q->w*q->y)*m.z,
+                         2.0f*(q->x*q->y + q->w*q->z)*m.x + (1.0f - 2.0f*(q->x*q->x + q->z*q->z))*m.y
+                         + 2.0f*(q->y*q->z - q->w*q->x)*m.z,
+                         0.0f
+                        };
+  return horizontal;
 }
 
-void reset_adaptive_bias()
+// Places all three poles of the altitude observer at -1/tau, with tau no faster than min_tau
+static void set_altitude_gains(float tau, float min_tau, float gain[3])
 {
-  b.x = 0;
-  b.y = 0;
-  b.z = 0;
+  if (!(tau >= min_tau))
+    tau = min_tau;
+  gain[0] = 3.0f/tau;
+  gain[1] = 3.0f/(tau*tau);
+  gain[2] = 1.0f/(tau*tau*tau);
 }
 
-void init_estimator()
+#ifndef FIXED_POINT_ESTIMATOR
+// Matrix Exponential Approximation (From Attitude Representation and Kinematic
+// Propagation for Low-Cost UAVs by Robert T. Casey)
+// (Eq. 12 Casey Paper), with series in place of sqrt, sin and cos
+static quaternion_t integrate_mat_exp(quaternion_t q_hat, vector_t w, float dt)
 {
-  last_time = 0;
-  reset_state();
+  // only if we've moved
+  if (sqrd_norm(w) == 0.0f)
+    return q_hat;
+  return quaternion_normalize(quaternion_propagate(q_hat, w, dt));
 }
 
-void run_LPF()
+// Euler Integration
+// (Eq. 47a Mahony Paper), but this is pretty straight-forward
+static quaternion_t integrate_euler(quaternion_t q_hat, vector_t w, float dt)
 {
-  float alpha_acc = get_param_float(PARAM_ACC_ALPHA);
-  _accel_LPF.x = (1.0f-alpha_acc)*_accel.x + alpha_acc*_accel_LPF.x;
-  _accel_LPF.y = (1.0f-alpha_acc)*_accel.y + alpha_acc*_accel_LPF.y;
-  _accel_LPF.z = (1.0f-alpha_acc)*_accel.z + alpha_acc*_accel_LPF.z;
-
-  float alpha_gyro = get_param_float(PARAM_GYRO_ALPHA);
-  _gyro_LPF.x = (1.0f-alpha_gyro)*_gyro.x + alpha_gyro*_gyro_LPF.x;
-  _gyro_LPF.y = (1.0f-alpha_gyro)*_gyro.y + alpha_gyro*_gyro_LPF.y;
-  _gyro_LPF.z = (1.0f-alpha_gyro)*_gyro.z + alpha_gyro*_gyro_LPF.z;
+  if (sqrd_norm(w) == 0.0f)
+    return q_hat;
+
+  float p = w.x;
+  float q = w.y;
+  float r = w.z;
+  quaternion_t qdot = {0.5f * (- p*q_hat.x - q*q_hat.y - r*q_hat.z),
+                       0.5f * (p*q_hat.w             + r*q_hat.y - q*q_hat.z),
+                       0.5f * (q*q_hat.w - r*q_hat.x             + p*q_hat.z),
+                       0.5f * (r*q_hat.w + q*q_hat.x - p*q_hat.y)
+                      };
+  q_hat.w += qdot.w*dt;
+  q_hat.x += qdot.x*dt;
+  q_hat.y += qdot.y*dt;
+  q_hat.z += qdot.z*dt;
+  return quaternion_normalize(q_hat);
 }
+#endif
 
+// Hands over to the filter that FILTER_TYPE selects, starting it from the current attitude
+// instead of a new alignment.  It also starts without the old filter's gyro bias estimate,
+// so a change while armed waits until the vehicle is disarmed.
+static void select_backend(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  if (est->backend == est->params.backend)
+    return;
+  if (est->backend != NULL && (rf->mode.armed_state & ARMED))
+    return;
 
-void run_estimator()
+  est->backend = est->params.backend;
+  if (est->alignment.done)
+    est->backend->init(rf);
+}
+
+void update_estimator_params(rosflight_t *rf)
 {
-  static float kp, ki;
-  if (last_time == 0)
+  estimator_params_t *params = &rf->estimator.params;
+  params->acc_alpha = get_param_float(rf, PARAM_ACC_ALPHA);
+  params->one_minus_acc_alpha = 1.0f - params->acc_alpha;
+  params->gyro_alpha = get_param_float(rf, PARAM_GYRO_ALPHA);
+  params->one_minus_gyro_alpha = 1.0f - params->gyro_alpha;
+
+  params->init_time_us = (uint64_t)get_param_int(rf, PARAM_INIT_TIME)*1000;
+  params->kp = get_param_float(rf, PARAM_FILTER_KP);
+  params->ki = get_param_float(rf, PARAM_FILTER_KI);
+  params->kp_mag = get_param_float(rf, PARAM_FILTER_KP_MAG);
+  params->beta = get_param_float(rf, PARAM_FILTER_BETA);
+  params->zeta = get_param_float(rf, PARAM_FILTER_ZETA);
+
+  params->use_acc = get_param_int(rf, PARAM_FILTER_USE_ACC);
+  params->use_mag = get_param_int(rf, PARAM_FILTER_USE_MAG);
+  params->use_quad_int = get_param_int(rf, PARAM_FILTER_USE_QUAD_INT);
+  params->use_mat_exp = get_param_int(rf, PARAM_FILTER_USE_MAT_EXP);
+  params->predict = get_param_int(rf, PARAM_FILTER_PREDICT);
+  int32_t acc_rate = get_param_int(rf, PARAM_FILTER_ACC_RATE);
+  params->acc_period_us = 1000000 / (acc_rate < ACC_RATE_MIN ? ACC_RATE_MIN : acc_rate);
+  set_altitude_gains(get_param_float(rf, PARAM_ALT_BARO_TAU), ALT_BARO_TAU_MIN, params->alt_baro_gain);
+  set_altitude_gains(get_param_float(rf, PARAM_ALT_SONAR_TAU), ALT_SONAR_TAU_MIN, params->alt_sonar_gain);
+
+#ifndef FIXED_POINT_ESTIMATOR
+  params->integrate = params->use_mat_exp ? &integrate_mat_exp : &integrate_euler;
+#endif
+
+  uint8_t filter_choice = get_param_int(rf, PARAM_FILTER_TYPE);
+  const estimator_backend_t *backend = NULL;
+  if (filter_choice < ESTIMATOR_BACKEND_COUNT)
+    backend = estimator_backends[filter_choice];
+  if (backend == NULL)
   {
-    last_time = _current_state.now_us;
-    last_acc_update_us = last_time;
+    mavlink_log_error("Invalid Filter Choice", NULL);
+    backend = &estimator_mahony;
+  }
+
+  params->backend = backend;
+  select_backend(rf);
+  if (rf->estimator.backend != backend)
+    mavlink_log_warning("Filter change waits until disarmed", NULL);
+
+#ifdef FIXED_POINT_ESTIMATOR
+  update_estimator_fixed_params(rf);
+#endif
+}
+
+#ifndef FIXED_POINT_ESTIMATOR
+static void run_LPF(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  float alpha_acc = est->params.acc_alpha;
+  float one_minus_alpha_acc = est->params.one_minus_acc_alpha;
+  est->accel_LPF.x = one_minus_alpha_acc*rf->sensors.accel.x + alpha_acc*est->accel_LPF.x;
+  est->accel_LPF.y = one_minus_alpha_acc*rf->sensors.accel.y + alpha_acc*est->accel_LPF.y;
+  est->accel_LPF.z = one_minus_alpha_acc*rf->sensors.accel.z + alpha_acc*est->accel_LPF.z;
+
+  float alpha_gyro = est->params.gyro_alpha;
+  float one_minus_alpha_gyro = est->params.one_minus_gyro_alpha;
+  est->gyro_LPF.x = one_minus_alpha_gyro*rf->sensors.gyro.x + alpha_gyro*est->gyro_LPF.x;
+  est->gyro_LPF.y = one_minus_alpha_gyro*rf->sensors.gyro.y + alpha_gyro*est->gyro_LPF.y;
+  est->gyro_LPF.z = one_minus_alpha_gyro*rf->sensors.gyro.z + alpha_gyro*est->gyro_LPF.z;
+}
+
+// True if the low-passed accelerometer is close enough to 1 g to be taken as gravity.  It
+// also keeps track of the last time that it was, for the unhealthy estimator check.
+bool estimator_accel_usable(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  float a_sqrd_norm = sqrd_norm(est->accel_LPF);
+  if (!est->params.use_acc || a_sqrd_norm >= 1.15f*1.15f*9.80665f*9.80665f
+      || a_sqrd_norm <= 0.85f*0.85f*9.80665f*9.80665f)
+    return false;
+
+  est->last_acc_update_us = est->state.now_us;
+  return true;
+}
+#endif
+
+// Propagates altitude and vertical velocity with the accelerometer on every update, and
+// pulls them toward the sonar or barometer at the accelerometer correction rate.  The
+// sonar is used whenever it sees the ground, the barometer otherwise, and while disarmed
+// the vehicle is known to be on the ground.
+static void run_altitude(rosflight_t *rf, uint64_t dt_us, uint64_t acc_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  altitude_estimator_t *alt = &est->altitude;
+  float dt = dt_us * 1e-6f;
+
+  // gravity in the body frame, from the attitude estimate
+  vector_t down = estimator_down(&est->state.q);
+
+  // the accelerometer measures -9.8 along down when we aren't accelerating
+  float accel_up = -dot(down, rf->sensors.accel) - 9.80665f - alt->accel_bias;
+  est->state.vertical_velocity += accel_up*dt;
+  est->state.altitude += est->state.vertical_velocity*dt;
+
+  if (acc_dt_us == 0)
     return;
+
+  float baro_up = -rf->sensors.baro_altitude; // NED
+  bool baro = baro_present();
+  if (baro && !alt->baro_ground_set)
+  {
+    alt->baro_ground = baro_up;
+    alt->baro_ground_set = true;
   }
-  else if (_current_state.now_us == last_time)
+
+  float acc_dt = acc_dt_us * 1e-6f;
+  float measurement;
+  const float *gain;
+  if (!(rf->mode.armed_state & ARMED))
   {
-    return;
+    measurement = 0.0f;
+    gain = est->params.alt_sonar_gain;
+    if (baro)
+      alt->baro_ground += (baro_up - alt->baro_ground)*acc_dt/BARO_GROUND_TAU;
   }
-  else if (_current_state.now_us < last_time)
+  else if (sonar_present() && rf->sensors.sonar_range > SONAR_MIN_RANGE
+           && rf->sensors.sonar_range < SONAR_MAX_RANGE && down.z > SONAR_MIN_COS_TILT)
   {
-    _error_state |= ERROR_TIME_GOING_BACKWARDS;
-    last_time = _current_state.now_us;
-    return;
+    measurement = rf->sensors.sonar_range*down.z;
+    gain = est->params.alt_sonar_gain;
+    // keep the barometer lined up so that it takes over without a jump
+    if (baro)
+      alt->baro_ground += (baro_up - est->state.altitude - alt->baro_ground)*acc_dt/BARO_GROUND_TAU;
   }
-  // clear the time going backwards error
-  _error_state &= ~(ERROR_TIME_GOING_BACKWARDS);
-
-  float dt = (_current_state.now_us - last_time) * 1e-6f;
-  last_time = _current_state.now_us;
-
-  // Crank up the gains for the first few seconds for quick convergence
-  if (_imu_time < (uint64_t)get_param_int(PARAM_INIT_TIME)*1000)
+  else if (alt->baro_ground_set)
   {
-    kp = get_param_float(PARAM_FILTER_KP)*10.0f;
-    ki = get_param_float(PARAM_FILTER_KI)*10.0f;
+    measurement = baro_up - alt->baro_ground;
+    gain = est->params.alt_baro_gain;
   }
   else
   {
-    kp = get_param_float(PARAM_FILTER_KP);
-    ki = get_param_float(PARAM_FILTER_KI);
+    return;
   }
 
-  // Run LPF to reject a lot of noise
-  run_LPF();
+  float e = (measurement - est->state.altitude)*acc_dt;
+  est->state.altitude += gain[0]*e;
+  est->state.vertical_velocity += gain[1]*e;
+  alt->accel_bias -= gain[2]*e;
+  alt->valid = true;
+}
+
+// Predicts state.q and state.omega from the IMU sample forward to when the motors take
+// the command the controller builds from them, by the average IMU to PWM latency.  The
+// rate is extrapolated with the angular acceleration over the last update, and the
+// attitude is integrated at the rate halfway through.  The extrapolation gets noisy past
+// one update, so the prediction goes no further than that.
+static void predict_state(rosflight_t *rf, uint64_t dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  uint32_t predict_us = est->params.predict ? latency_get_average_us(rf) : 0;
+  if (predict_us > dt_us)
+    predict_us = dt_us;
+
+#ifdef FIXED_POINT_ESTIMATOR
+  predict_state_fixed(rf, dt_us, predict_us);
+#else
+  vector_t omega = est->state.omega;
+  vector_t last_omega = est->last_omega;
+  est->last_omega = omega;
+  if (predict_us == 0)
+    return;
+
+  vector_t delta = scalar_multiply((float) predict_us/dt_us, vector_sub(omega, last_omega));
+  est->state.q = est->params.integrate(est->state.q, vector_add(omega, scalar_multiply(0.5f, delta)), predict_us*1e-6f);
+  est->state.omega = vector_add(omega, delta);
+#endif
+}
+
+// The rotation that takes the unit vector u to v.  Past a quarter turn it goes by way of
+// half a turn about axis, which has to be perpendicular to v, so that it stays well
+// conditioned all the way to opposite vectors.  quaternion_multiply(a, b) applies a first.
+static quaternion_t rotation_between(vector_t u, vector_t v, vector_t axis)
+{
+  if (dot(u, v) >= 0.0f)
+    return quat_from_two_vectors(u, v);
 
-  // add in accelerometer
-  float a_sqrd_norm = _accel_LPF.x*_accel_LPF.x + _accel_LPF.y*_accel_LPF.y + _accel_LPF.z*_accel_LPF.z;
+  vector_t u_turned = vector_sub(scalar_multiply(2.0f*dot(axis, u), axis), u);
+  quaternion_t half_turn = {0.0f, axis.x, axis.y, axis.z};
+  return quaternion_multiply(half_turn, quat_from_two_vectors(u_turned, v));
+}
 
-  if (get_param_int(PARAM_FILTER_USE_ACC) && a_sqrd_norm < 1.15f*1.15f*9.80665f*9.80665f
-      && a_sqrd_norm > 0.85f*0.85f*9.80665f*9.80665f)
+// Averages the accelerometer, and the magnetometer if it's in use, over init_time_us and
+// then solves for the attitude directly.  Returns true once the filter has been seeded.
+static bool run_alignment(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  alignment_t *align = &est->alignment;
+  if (align->done)
+    return true;
+
+  if (align->accel_count == 0)
+    align->start_us = est->state.now_us;
+  align->accel_sum = vector_add(align->accel_sum, rf->sensors.accel);
+  align->accel_count++;
+  if (est->params.use_mag && rf->sensors.mag_count != est->mag_count)
   {
-    // Keep track of the last time that the acc update ran
-    last_acc_update_us = _current_state.now_us;
-    // Get error estimated by accelerometer measurement
-    vector_t a = vector_normalize(_accel_LPF);
-    // Get the quaternion from accelerometer (low-frequency measure q)
-    // (Not in either paper)
-    quaternion_t q_acc_inv = quaternion_inverse(quat_from_two_vectors(a, g));
-    // Get the error quaternion between observer and low-freq q
-    // Below Eq. 45 Mahony Paper
-    q_tilde = quaternion_multiply(q_acc_inv, q_hat);
-    // Correction Term of Eq. 47a and 47b Mahony Paper
-    // w_acc = 2*s_tilde*v_tilde
-    w_acc.x = -2.0f*q_tilde.w*q_tilde.x;
-    w_acc.y = -2.0f*q_tilde.w*q_tilde.y;
-    w_acc.z = 0.0f; // Don't correct z, because it's unobservable from the accelerometer
-
-    // integrate biases from accelerometer feedback
-    // (eq 47b Mahony Paper, using correction term w_acc found above)
-    b.x -= ki*w_acc.x*dt;
-    b.y -= ki*w_acc.y*dt;
-    b.z = 0.0;  // Don't integrate z bias, because it's unobservable
+    est->mag_count = rf->sensors.mag_count;
+    align->mag_sum = vector_add(align->mag_sum, rf->sensors.mag);
+    align->mag_count++;
   }
-  else
+
+  if (est->state.now_us - align->start_us < est->params.init_time_us)
+    return false;
+
+  // Start over if the vehicle was being moved around
+  vector_t accel = scalar_multiply(1.0f/align->accel_count, align->accel_sum);
+  float a_sqrd_norm = sqrd_norm(accel);
+  if (a_sqrd_norm > 1.15f*1.15f*9.80665f*9.80665f || a_sqrd_norm < 0.85f*0.85f*9.80665f*9.80665f)
   {
-    w_acc.x = 0.0f;
-    w_acc.y = 0.0f;
-    w_acc.z = 0.0f;
+    reset_state(rf);
+    return false;
   }
 
-  // Pull out Gyro measurements
-  if (get_param_int(PARAM_FILTER_USE_QUAD_INT))
+  // Tilt takes the measured down, opposite the accelerometer, to the inertial z axis
+  static const vector_t x_axis = {1.0f, 0.0f, 0.0f};
+  static const vector_t z_axis = {0.0f, 0.0f, 1.0f};
+  vector_t down = scalar_multiply(-1.0f, vector_normalize(accel));
+  quaternion_t q = rotation_between(down, z_axis, x_axis);
+
+  // then heading turns the level field to north, with the same rules as the heading corrections
+  if (align->mag_count > 0)
   {
-    // Quadratic Integration (Eq. 14 Casey Paper)
-    // this integration step adds 12 us on the STM32F10x chips
-    wbar = vector_add(vector_add(scalar_multiply(-1.0f/12.0f,w2), scalar_multiply(8.0f/12.0f,w1)),
-                      scalar_multiply(5.0f/12.0f,_gyro_LPF));
-    w2 = w1;
-    w1 = _gyro_LPF;
+    vector_t m = scalar_multiply(1.0f/align->mag_count, align->mag_sum);
+    vector_t horizontal = estimator_horizontal_field(&q, m);
+    if (sqrd_norm(horizontal) > 0.01f*sqrd_norm(m))
+      q = quaternion_normalize(quaternion_multiply(q, rotation_between(vector_normalize(horizontal), x_axis, z_axis)));
   }
-  else
+
+  // Seed the filter, and the accelerometer low-pass, which would otherwise pull toward level
+  est->state.q = q;
+  est->accel_LPF = accel;
+  est->backend->init(rf);
+
+  // The corrections start from here
+  est->last_acc_update_us = est->state.now_us;
+  est->last_acc_correction_us = est->state.now_us;
+  est->next_acc_correction_us = est->state.now_us;
+  est->last_mag_correction_us = est->state.now_us;
+  est->mag_count = rf->sensors.mag_count;
+  est->mag_fresh = true;
+  align->done = true;
+  return true;
+}
+
+void run_estimator(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  if (est->last_time == 0)
   {
-    wbar = _gyro_LPF;
+    est->last_time = est->state.now_us;
+    est->last_acc_update_us = est->last_time;
+    est->last_acc_correction_us = est->last_time;
+    est->next_acc_correction_us = est->last_time;
+    est->last_mag_correction_us = est->last_time;
+    est->mag_count = rf->sensors.mag_count;
+    return;
+  }
+  else if (est->state.now_us == est->last_time)
+  {
+    return;
+  }
+  else if (est->state.now_us < est->last_time)
+  {
+    rf->mode.error_state |= ERROR_TIME_GOING_BACKWARDS;
+    est->last_time = est->state.now_us;
+    return;
   }
+  // clear the time going backwards error
+  rf->mode.error_state &= ~(ERROR_TIME_GOING_BACKWARDS);
+
+  uint64_t dt_us = est->state.now_us - est->last_time;
+  est->last_time = est->state.now_us;
 
-  // Build the composite omega vector for kinematic propagation
-  // This the stuff inside the p function in eq. 47a - Mahony Paper
-  wfinal = vector_add(vector_sub(wbar, b), scalar_multiply(kp, w_acc));
+  select_backend(rf);
 
-  // Propagate Dynamics (only if we've moved)
-  float sqrd_norm_w = sqrd_norm(wfinal);
-  if (sqrd_norm_w > 0.0f)
+  // Nothing runs until the alignment has seeded the filter, and the vehicle can't arm
+  if (!run_alignment(rf))
   {
-    float p = wfinal.x;
-    float q = wfinal.y;
-    float r = wfinal.z;
-
-    if (get_param_int(PARAM_FILTER_USE_MAT_EXP))
-    {
-      // Matrix Exponential Approximation (From Attitude Representation and Kinematic
-      // Propagation for Low-Cost UAVs by Robert T. Casey)
-      // (Eq. 12 Casey Paper)
-      // This adds 90 us on STM32F10x chips
-      float norm_w = sqrt(sqrd_norm_w);
-      quaternion_t qhat_np1;
-      float t1 = cos((norm_w*dt)/2.0f);
-      float t2 = 1.0f/norm_w * sin((norm_w*dt)/2.0f);
-      qhat_np1.w = t1*q_hat.w   + t2*(- p*q_hat.x - q*q_hat.y - r*q_hat.z);
-      qhat_np1.x = t1*q_hat.x   + t2*(p*q_hat.w             + r*q_hat.y - q*q_hat.z);
-      qhat_np1.y = t1*q_hat.y   + t2*(q*q_hat.w - r*q_hat.x             + p*q_hat.z);
-      qhat_np1.z = t1*q_hat.z   + t2*(r*q_hat.w + q*q_hat.x - p*q_hat.y);
-      q_hat = quaternion_normalize(qhat_np1);
-    }
-    else
-    {
-      // Euler Integration
-      // (Eq. 47a Mahony Paper), but this is pretty straight-forward
-      quaternion_t qdot = {0.5f * (- p*q_hat.x - q*q_hat.y - r*q_hat.z),
-                           0.5f * (p*q_hat.w             + r*q_hat.y - q*q_hat.z),
-                           0.5f * (q*q_hat.w - r*q_hat.x             + p*q_hat.z),
-                           0.5f * (r*q_hat.w + q*q_hat.x - p*q_hat.y)
-                          };
-      q_hat.w += qdot.w*dt;
-      q_hat.x += qdot.x*dt;
-      q_hat.y += qdot.y*dt;
-      q_hat.z += qdot.z*dt;
-      q_hat = quaternion_normalize(q_hat);
-    }
+    rf->mode.error_state |= ERROR_UNHEALTHY_ESTIMATOR;
+    return;
   }
 
-  // Save attitude estimate
-  _current_state.q = q_hat;
+  // The accelerometer correction runs on the first update at or after it's due, on a fixed
+  // schedule so that it doesn't slip by a fraction of an update every time
+  uint64_t acc_dt_us = 0;
+  if (est->state.now_us >= est->next_acc_correction_us)
+  {
+    acc_dt_us = est->state.now_us - est->last_acc_correction_us;
+    est->last_acc_correction_us = est->state.now_us;
+    est->next_acc_correction_us += est->params.acc_period_us;
+    if (est->next_acc_correction_us <= est->state.now_us)
+      est->next_acc_correction_us = est->state.now_us + est->params.acc_period_us;
+  }
 
-  // Extract Euler Angles for controller
-  euler_from_quat(_current_state.q, &_current_state.roll, &_current_state.pitch, &_current_state.yaw);
+  // The heading correction runs on each new magnetometer measurement, at whatever rate
+  // the magnetometer has
+  uint64_t mag_dt_us = 0;
+  if (rf->sensors.mag_count != est->mag_count)
+  {
+    est->mag_count = rf->sensors.mag_count;
+    mag_dt_us = est->state.now_us - est->last_mag_correction_us;
+    if (mag_dt_us > MAG_TIMEOUT_US)
+      mag_dt_us = MAG_TIMEOUT_US;
+    est->last_mag_correction_us = est->state.now_us;
+    est->mag_fresh = true;
+  }
+  else if (est->state.now_us > est->last_mag_correction_us + MAG_TIMEOUT_US)
+  {
+    // the magnetometer has stopped, so the filter stops applying its last correction
+    est->mag_fresh = false;
+  }
 
-  // Save off adjust gyro measurements with estimated biases for control
-  _current_state.omega = vector_sub(_gyro_LPF, b);
+#ifndef FIXED_POINT_ESTIMATOR
+  // Run LPF to reject a lot of noise, the same for every filter (the fixed-point one has its own)
+  run_LPF(rf);
+#endif
+  est->backend->propagate(rf, dt_us);
+  est->backend->correct(rf, acc_dt_us, mag_dt_us);
+  est->backend->publish(rf);
+  est->euler_valid = false;
+  run_altitude(rf, dt_us, acc_dt_us);
+  predict_state(rf, dt_us);
 
   // If it has been more than 0.5 seconds since the acc update ran and we are supposed to be getting them
   // then trigger an unhealthy estimator error
-  if (get_param_int(PARAM_FILTER_USE_ACC) && _current_state.now_us > 500000 + last_acc_update_us)
+  if (est->params.use_acc && est->state.now_us > 500000 + est->last_acc_update_us)
   {
-    _error_state |= ERROR_UNHEALTHY_ESTIMATOR;
+    rf->mode.error_state |= ERROR_UNHEALTHY_ESTIMATOR;
   }
   else
   {
-    _error_state &= ~(ERROR_UNHEALTHY_ESTIMATOR);
+    rf->mode.error_state &= ~(ERROR_UNHEALTHY_ESTIMATOR);
   }
 }
 
+void estimator_update_euler(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  if (est->euler_valid)
+    return;
+
+#ifdef FIXED_POINT_ESTIMATOR
+  // in the same turbotrig units as euler_from_quat()
+  intquat_t q = {q31_from_float(est->state.q.w), q31_from_float(est->state.q.x),
+                 q31_from_float(est->state.q.y), q31_from_float(est->state.q.z)};
+  int32_t roll, pitch, yaw;
+  euler_from_int_quat(q, &roll, &pitch, &yaw);
+  est->state.roll = roll/1000.0f;
+  est->state.pitch = pitch/1000.0f;
+  est->state.yaw = yaw/1000.0f;
+#else
+  euler_from_quat(est->state.q, &est->state.roll, &est->state.pitch, &est->state.yaw);
+#endif
+  est->euler_valid = true;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// Fixed-point version of the Mahony filter in estimator_mahony.c, built with
+// FIXED_POINT_ESTIMATOR in its place.  It runs the same filter with Casey's
+// integration, without any float math inside the filter.  It's the only
+// backend of the fixed-point build.
+//
+// Formats:
+//   quaternions, unit vectors, w_acc    Q31
+//   rotation matrix rows                Q30, so that 1 - 2(y^2 + z^2) can't overflow
+//   accelerations                       m/s^2 in Q16
+//   angular rates                       rad/s in Q25 (+/- 64 rad/s)
+//   bias                                rad/s in Q56 (int64), since ki*w_acc*dt steps are tiny
+//   half rotation per step, w*dt/2      rad in Q31
+//
+// Against the float build replaying the same trace, the attitude agrees to
+// better than 1e-4 in each quaternion component.  Euler angles agree to the
+// 1 mrad resolution of turbotrig, plus the 1.5-4.6 mrad table steps near
+// +/-90 deg pitch that both builds share.  Steps longer than 50 ms are
+// clamped, and so are the times between accelerometer and magnetometer
+// corrections, which keeps the integrator products inside 64 bits.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef FIXED_POINT_ESTIMATOR
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <turbotrig/turbofix.h>
+#include <turbotrig/turbovec.h>
+
+#include "param.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "estimator.h"
+
+#define MAX_DT_US 50000
+
+// (0.85 g)^2 and (1.15 g)^2 in Q32, the accel norm gate of the float build
+#define ACC_SQRD_NORM_MIN ((int64_t)(0.85*0.85*9.80665*9.80665*4294967296.0))
+#define ACC_SQRD_NORM_MAX ((int64_t)(1.15*1.15*9.80665*9.80665*4294967296.0))
+
+// 2^32/31250 turns a Q25 rate times dt in us into half the rotation in Q31, after a shift by 32
+#define HALF_DT_SCALE 137439
+
+// 1 in Q61, the format of rotation matrix terms built from products of Q31 quaternion components
+#define Q61_ONE ((int64_t) 1 << 61)
+
+// (0.1)^2 of the field's squared magnitude has to be horizontal, as in the float build
+#define MAG_MIN_HORIZONTAL_SQRD Q31_CONST(0.01)
+
+static q31vec_t vector_from_float(vector_t v, float scale)
+{
+  q31vec_t out = {(int32_t)(v.x*scale), (int32_t)(v.y*scale), (int32_t)(v.z*scale)};
+  return out;
+}
+
+static void run_LPF_fixed(rosflight_t *rf)
+{
+  estimator_fixed_t *fix = &rf->estimator.fixed;
+
+  // multiplying by a Q31 fraction keeps the format of the other operand
+  q31vec_t accel = vector_from_float(rf->sensors.accel, 65536.0f);
+  fix->accel_LPF.x = q31_mul(fix->one_minus_acc_alpha, accel.x) + q31_mul(fix->acc_alpha, fix->accel_LPF.x);
+  fix->accel_LPF.y = q31_mul(fix->one_minus_acc_alpha, accel.y) + q31_mul(fix->acc_alpha, fix->accel_LPF.y);
+  fix->accel_LPF.z = q31_mul(fix->one_minus_acc_alpha, accel.z) + q31_mul(fix->acc_alpha, fix->accel_LPF.z);
+
+  q31vec_t gyro = vector_from_float(rf->sensors.gyro, 33554432.0f);
+  fix->gyro_LPF.x = q31_mul(fix->one_minus_gyro_alpha, gyro.x) + q31_mul(fix->gyro_alpha, fix->gyro_LPF.x);
+  fix->gyro_LPF.y = q31_mul(fix->one_minus_gyro_alpha, gyro.y) + q31_mul(fix->gyro_alpha, fix->gyro_LPF.y);
+  fix->gyro_LPF.z = q31_mul(fix->one_minus_gyro_alpha, gyro.z) + q31_mul(fix->gyro_alpha, fix->gyro_LPF.z);
+}
+
+// See estimator_down() in estimator.c.  Each term of the rotation matrix has a factor of
+// 2, so the products of two Q31 components give it in Q61.
+static q31vec_t down_from_quat(q31quat_t q)
+{
+  q31vec_t down = {q31_sat(((int64_t) q.x*q.z - (int64_t) q.w*q.y) >> 30),
+                   q31_sat(((int64_t) q.y*q.z + (int64_t) q.w*q.x) >> 30),
+                   q31_sat((Q61_ONE - (int64_t) q.x*q.x - (int64_t) q.y*q.y) >> 30)
+                  };
+  return down;
+}
+
+static void reset_mahony_fixed_bias(rosflight_t *rf)
+{
+  estimator_fixed_t *fix = &rf->estimator.fixed;
+  fix->b[0] = 0;
+  fix->b[1] = 0;
+  fix->b[2] = 0;
+}
+
+// Starts from the attitude and accelerometer low-pass that the alignment left in the float fields
+static void init_mahony_fixed(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  q31quat_t q_hat = {q31_from_float(est->state.q.w), q31_from_float(est->state.q.x),
+                     q31_from_float(est->state.q.y), q31_from_float(est->state.q.z)};
+  fix->q_hat = q31_quaternion_normalize(q_hat);
+
+  fix->w1.x = fix->w1.y = fix->w1.z = 0;
+  fix->w2.x = fix->w2.y = fix->w2.z = 0;
+  fix->w_acc.x = fix->w_acc.y = fix->w_acc.z = 0;
+  fix->w_mag.x = fix->w_mag.y = fix->w_mag.z = 0;
+  fix->omega.x = fix->omega.y = fix->omega.z = 0;
+  fix->last_omega.x = fix->last_omega.y = fix->last_omega.z = 0;
+
+  fix->accel_LPF = vector_from_float(est->accel_LPF, 65536.0f);
+  fix->gyro_LPF.x = fix->gyro_LPF.y = fix->gyro_LPF.z = 0;
+
+  reset_mahony_fixed_bias(rf);
+}
+
+void update_estimator_fixed_params(rosflight_t *rf)
+{
+  const estimator_params_t *params = &rf->estimator.params;
+  estimator_fixed_t *fix = &rf->estimator.fixed;
+
+  fix->acc_alpha = q31_from_float(params->acc_alpha);
+  fix->one_minus_acc_alpha = q31_from_float(params->one_minus_acc_alpha);
+  fix->gyro_alpha = q31_from_float(params->gyro_alpha);
+  fix->one_minus_gyro_alpha = q31_from_float(params->one_minus_gyro_alpha);
+
+  fix->kp = (int32_t)(params->kp*65536.0f);
+  fix->ki_per_us = (int64_t)(params->ki*1e-6*281474976710656.0);
+  fix->kp_mag = (int32_t)(params->kp_mag*65536.0f);
+}
+
+// See correct_attitude() in estimator_mahony.c
+static void correct_attitude_fixed(rosflight_t *rf, int64_t ki_per_us, uint64_t acc_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  int64_t a_sqrd_norm = (int64_t) fix->accel_LPF.x*fix->accel_LPF.x + (int64_t) fix->accel_LPF.y*fix->accel_LPF.y
+                        + (int64_t) fix->accel_LPF.z*fix->accel_LPF.z;
+
+  q31vec_t w_acc = {0, 0, 0};
+  if (est->params.use_acc && a_sqrd_norm < ACC_SQRD_NORM_MAX && a_sqrd_norm > ACC_SQRD_NORM_MIN)
+  {
+    // Keep track of the last time that the acc update ran
+    est->last_acc_update_us = est->state.now_us;
+    q31vec_t a = q31_vector_normalize(fix->accel_LPF);
+
+    // Correction Term of Eq. 47a and 47b Mahony Paper, from the estimated gravity
+    // direction to the measured one
+    w_acc = q31_cross(down_from_quat(fix->q_hat), a);
+
+    // integrate biases from accelerometer feedback (eq 47b Mahony Paper)
+    // ki*dt*2^32 times w_acc in Q31 is Q63, one shift short of 56 bits of headroom
+    int64_t ki_dt = (ki_per_us*(int64_t) acc_dt_us) >> 16;
+    fix->b[0] -= (ki_dt*w_acc.x) >> 7;
+    fix->b[1] -= (ki_dt*w_acc.y) >> 7;
+    fix->b[2] -= (ki_dt*w_acc.z) >> 7;
+  }
+  fix->w_acc = w_acc;
+}
+
+// See correct_heading() in estimator_mahony.c
+static void correct_heading_fixed(rosflight_t *rf, int64_t ki_per_us, uint64_t mag_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+  q31vec_t w_mag = {0, 0, 0};
+  if (!est->params.use_mag)
+  {
+    fix->w_mag = w_mag;
+    return;
+  }
+
+  q31vec_t m = q31_vector_normalize(vector_from_float(rf->sensors.mag, 65536.0f));
+  q31quat_t q = fix->q_hat;
+
+  // products of the quaternion components, which give the matrix terms in Q61
+  int64_t xx = (int64_t) q.x*q.x, yy = (int64_t) q.y*q.y, zz = (int64_t) q.z*q.z;
+  int64_t wx = (int64_t) q.w*q.x, wy = (int64_t) q.w*q.y, wz = (int64_t) q.w*q.z;
+  int64_t xy = (int64_t) q.x*q.y, xz = (int64_t) q.x*q.z, yz = (int64_t) q.y*q.z;
+
+  // first two rows of the rotation from the body to the inertial frame, in Q30, times
+  // the unit field in Q31 gives its north and east components in Q61
+  int64_t north = ((Q61_ONE - yy - zz) >> 31)*m.x + ((xy - wz) >> 31)*m.y + ((xz + wy) >> 31)*m.z;
+  int64_t east = ((xy + wz) >> 31)*m.x + ((Q61_ONE - xx - zz) >> 31)*m.y + ((yz - wx) >> 31)*m.z;
+  q31vec_t horizontal = {q31_sat(north >> 30), q31_sat(east >> 30), 0};
+
+  // a field that's nearly vertical, or missing, doesn't say anything about heading
+  if (q31_sqrd_norm(horizontal) > MAG_MIN_HORIZONTAL_SQRD)
+  {
+    q31_t error = -q31_vector_normalize(horizontal).y;
+
+    w_mag = q31_scalar_multiply(error, down_from_quat(q));
+
+    // the heading error is what makes the z gyro bias observable
+    int64_t ki_dt = (ki_per_us*(int64_t) mag_dt_us) >> 16;
+    fix->b[0] -= (ki_dt*w_mag.x) >> 7;
+    fix->b[1] -= (ki_dt*w_mag.y) >> 7;
+    fix->b[2] -= (ki_dt*w_mag.z) >> 7;
+  }
+  fix->w_mag = w_mag;
+}
+
+// Integrates the attitude q_hat over dt_us at the constant rate w (Q25), with the method
+// FILTER_MAT_EXP picks
+static q31quat_t propagate_fixed(q31quat_t qh, q31vec_t w, uint64_t dt_us, bool use_mat_exp)
+{
+  // only if we've moved
+  if (w.x == 0 && w.y == 0 && w.z == 0)
+    return qh;
+
+  int64_t half_dt = (int64_t) dt_us*HALF_DT_SCALE;
+  q31_t p = q31_sat(((int64_t) w.x*half_dt) >> 32);
+  q31_t q = q31_sat(((int64_t) w.y*half_dt) >> 32);
+  q31_t r = q31_sat(((int64_t) w.z*half_dt) >> 32);
+
+  // Omega(w*dt/2)*q_hat, in Q62
+  int64_t dw = - (int64_t) p*qh.x - (int64_t) q*qh.y - (int64_t) r*qh.z;
+  int64_t dx =   (int64_t) p*qh.w + (int64_t) r*qh.y - (int64_t) q*qh.z;
+  int64_t dy =   (int64_t) q*qh.w - (int64_t) r*qh.x + (int64_t) p*qh.z;
+  int64_t dz =   (int64_t) r*qh.w + (int64_t) q*qh.x - (int64_t) p*qh.y;
+
+  // The new estimate is built in Q30, which leaves room for its norm to grow past 1
+  q31quat_t qhat_np1;
+  if (use_mat_exp)
+  {
+    // Matrix Exponential Approximation (Eq. 12 Casey Paper), with cos(theta) and
+    // sin(theta)/theta as Taylor series in theta^2, theta = |w|*dt/2
+    q31vec_t half_rotation = {p, q, r};
+    q31_t theta2 = q31_dot(half_rotation, half_rotation);
+    q31_t theta4 = q31_mul(theta2, theta2);
+    q31_t t1 = Q31_MAX - theta2/2 + theta4/24;
+    q31_t t2 = Q31_MAX - theta2/6 + theta4/120;
+    qhat_np1.w = (int32_t)(((int64_t) t1*qh.w + (int64_t) t2*(dw >> 31)) >> 32);
+    qhat_np1.x = (int32_t)(((int64_t) t1*qh.x + (int64_t) t2*(dx >> 31)) >> 32);
+    qhat_np1.y = (int32_t)(((int64_t) t1*qh.y + (int64_t) t2*(dy >> 31)) >> 32);
+    qhat_np1.z = (int32_t)(((int64_t) t1*qh.z + (int64_t) t2*(dz >> 31)) >> 32);
+  }
+  else
+  {
+    // Euler Integration (Eq. 47a Mahony Paper)
+    qhat_np1.w = (int32_t)((((int64_t) qh.w << 31) + dw) >> 32);
+    qhat_np1.x = (int32_t)((((int64_t) qh.x << 31) + dx) >> 32);
+    qhat_np1.y = (int32_t)((((int64_t) qh.y << 31) + dy) >> 32);
+    qhat_np1.z = (int32_t)((((int64_t) qh.z << 31) + dz) >> 32);
+  }
+  return q31_quaternion_normalize(qhat_np1);
+}
+
+static void propagate_mahony_fixed(rosflight_t *rf, uint64_t dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  if (dt_us > MAX_DT_US)
+    dt_us = MAX_DT_US;
+
+  int32_t kp = fix->kp;
+  int32_t kp_mag = fix->kp_mag;
+
+  // Run LPF to reject a lot of noise
+  run_LPF_fixed(rf);
+
+  // Pull out Gyro measurements
+  q31vec_t wbar;
+  if (est->params.use_quad_int)
+  {
+    // Quadratic Integration (Eq. 14 Casey Paper)
+    wbar.x = q31_mul(Q31_CONST(-1.0/12.0), fix->w2.x) + q31_mul(Q31_CONST(8.0/12.0), fix->w1.x)
+             + q31_mul(Q31_CONST(5.0/12.0), fix->gyro_LPF.x);
+    wbar.y = q31_mul(Q31_CONST(-1.0/12.0), fix->w2.y) + q31_mul(Q31_CONST(8.0/12.0), fix->w1.y)
+             + q31_mul(Q31_CONST(5.0/12.0), fix->gyro_LPF.y);
+    wbar.z = q31_mul(Q31_CONST(-1.0/12.0), fix->w2.z) + q31_mul(Q31_CONST(8.0/12.0), fix->w1.z)
+             + q31_mul(Q31_CONST(5.0/12.0), fix->gyro_LPF.z);
+    fix->w2 = fix->w1;
+    fix->w1 = fix->gyro_LPF;
+  }
+  else
+  {
+    wbar = fix->gyro_LPF;
+  }
+
+  // Build the composite omega vector for kinematic propagation, wbar - b + kp*w_acc + kp_mag*w_mag in Q25
+  q31vec_t b = {(int32_t)(fix->b[0] >> 31), (int32_t)(fix->b[1] >> 31), (int32_t)(fix->b[2] >> 31)};
+  q31vec_t wfinal = {wbar.x - b.x + (int32_t)(((int64_t) kp*fix->w_acc.x + (int64_t) kp_mag*fix->w_mag.x) >> 22),
+                     wbar.y - b.y + (int32_t)(((int64_t) kp*fix->w_acc.y + (int64_t) kp_mag*fix->w_mag.y) >> 22),
+                     wbar.z - b.z + (int32_t)(((int64_t) kp*fix->w_acc.z + (int64_t) kp_mag*fix->w_mag.z) >> 22)
+                    };
+
+  // Propagate Dynamics
+  fix->q_hat = propagate_fixed(fix->q_hat, wfinal, dt_us, est->params.use_mat_exp);
+}
+
+static void correct_mahony_fixed(rosflight_t *rf, uint64_t acc_dt_us, uint64_t mag_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  if (acc_dt_us > MAX_DT_US)
+    acc_dt_us = MAX_DT_US;
+  if (mag_dt_us > MAX_DT_US)
+    mag_dt_us = MAX_DT_US;
+
+  // add in accelerometer, at its own rate
+  if (acc_dt_us > 0)
+    correct_attitude_fixed(rf, fix->ki_per_us, acc_dt_us);
+
+  // and the magnetometer whenever it has a new measurement, until it stops
+  if (mag_dt_us > 0)
+    correct_heading_fixed(rf, fix->ki_per_us, mag_dt_us);
+  else if (!est->mag_fresh)
+    fix->w_mag.x = fix->w_mag.y = fix->w_mag.z = 0;
+}
+
+static void publish_mahony_fixed(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  // Save attitude estimate
+  est->state.q.w = q31_to_float(fix->q_hat.w);
+  est->state.q.x = q31_to_float(fix->q_hat.x);
+  est->state.q.y = q31_to_float(fix->q_hat.y);
+  est->state.q.z = q31_to_float(fix->q_hat.z);
+
+  // Save off adjust gyro measurements with estimated biases for control
+  fix->omega.x = fix->gyro_LPF.x - (int32_t)(fix->b[0] >> 31);
+  fix->omega.y = fix->gyro_LPF.y - (int32_t)(fix->b[1] >> 31);
+  fix->omega.z = fix->gyro_LPF.z - (int32_t)(fix->b[2] >> 31);
+  est->state.omega.x = fix->omega.x/33554432.0f;
+  est->state.omega.y = fix->omega.y/33554432.0f;
+  est->state.omega.z = fix->omega.z/33554432.0f;
+}
+
+// See predict_state() in estimator.c
+void predict_state_fixed(rosflight_t *rf, uint64_t dt_us, uint32_t predict_us)
+{
+  estimator_t *est = &rf->estimator;
+  estimator_fixed_t *fix = &est->fixed;
+
+  q31vec_t omega = fix->omega;
+  q31vec_t last_omega = fix->last_omega;
+  fix->last_omega = omega;
+  if (predict_us == 0)
+    return;
+
+  if (dt_us > MAX_DT_US)
+    dt_us = MAX_DT_US;
+  if (predict_us > dt_us)
+    predict_us = dt_us;
+
+  // the change in rate over the last update, scaled to the prediction, in Q25
+  int64_t ratio = ((uint32_t) predict_us << 16)/(uint32_t) dt_us; // Q16
+  int64_t delta_x = (((int64_t) omega.x - last_omega.x)*ratio) >> 16;
+  int64_t delta_y = (((int64_t) omega.y - last_omega.y)*ratio) >> 16;
+  int64_t delta_z = (((int64_t) omega.z - last_omega.z)*ratio) >> 16;
+
+  q31vec_t midpoint = {q31_sat(omega.x + delta_x/2), q31_sat(omega.y + delta_y/2), q31_sat(omega.z + delta_z/2)};
+  q31quat_t q = propagate_fixed(fix->q_hat, midpoint, predict_us, est->params.use_mat_exp);
+  est->state.q.w = q31_to_float(q.w);
+  est->state.q.x = q31_to_float(q.x);
+  est->state.q.y = q31_to_float(q.y);
+  est->state.q.z = q31_to_float(q.z);
+
+  est->state.omega.x = q31_sat(omega.x + delta_x)/33554432.0f;
+  est->state.omega.y = q31_sat(omega.y + delta_y)/33554432.0f;
+  est->state.omega.z = q31_sat(omega.z + delta_z)/33554432.0f;
+}
+
+const estimator_backend_t estimator_mahony =
+{
+  .name = "mahony",
+  .init = init_mahony_fixed,
+  .reset_bias = reset_mahony_fixed_bias,
+  .propagate = propagate_mahony_fixed,
+  .correct = correct_mahony_fixed,
+  .publish = publish_mahony_fixed
+};
+
+#endif // FIXED_POINT_ESTIMATOR
+
+#ifdef __cplusplus
+}
+#endif
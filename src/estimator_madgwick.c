@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// Madgwick's gradient descent filter (FILTER_TYPE = 1), from "An efficient orientation
+// filter for inertial and inertial/magnetic sensor arrays" (Madgwick, 2010).
+//
+// Each correction takes a step of fixed size FILTER_BETA down the gradient of the error
+// between the measured and predicted directions of gravity and the magnetic field, and
+// FILTER_ZETA integrates the same normalized error into the gyro bias.  The gradient is
+// taken over rotations of the body rather than over the four quaternion components,
+// which only differs by the part along the quaternion that normalization removes, so the
+// step is a body rate like Mahony's correction.  It's held between corrections in the
+// same way.  Unlike Mahony's heading correction, Madgwick's magnetometer step can also
+// tilt the estimate when the field is disturbed.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FIXED_POINT_ESTIMATOR
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <turbotrig/turbovec.h>
+
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "estimator.h"
+
+static void reset_madgwick_bias(rosflight_t *rf)
+{
+  madgwick_t *madgwick = &rf->estimator.madgwick;
+  madgwick->b.x = 0.0f;
+  madgwick->b.y = 0.0f;
+  madgwick->b.z = 0.0f;
+}
+
+static void init_madgwick(rosflight_t *rf)
+{
+  madgwick_t *madgwick = &rf->estimator.madgwick;
+
+  madgwick->q = rf->estimator.state.q;
+
+  madgwick->e_acc.x = 0.0f;
+  madgwick->e_acc.y = 0.0f;
+  madgwick->e_acc.z = 0.0f;
+
+  madgwick->e_mag.x = 0.0f;
+  madgwick->e_mag.y = 0.0f;
+  madgwick->e_mag.z = 0.0f;
+
+  reset_madgwick_bias(rf);
+}
+
+// The inertial x axis (north) in the body frame, the first row of the rotation from the
+// body to the inertial frame
+static vector_t north_from_quat(const quaternion_t *q)
+{
+  vector_t north = {1.0f - 2.0f*(q->y*q->y + q->z*q->z),
+                    2.0f*(q->x*q->y - q->w*q->z),
+                    2.0f*(q->x*q->z + q->w*q->y)
+                   };
+  return north;
+}
+
+static void propagate_madgwick(rosflight_t *rf, uint64_t dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  madgwick_t *madgwick = &est->madgwick;
+  float dt = dt_us * 1e-6f;
+
+  // one normalized step for both sensors, as in the paper, which is 2 beta as a body rate,
+  // and 2 zeta into the bias
+  vector_t w = vector_sub(est->gyro_LPF, madgwick->b);
+  vector_t error = vector_add(madgwick->e_acc, madgwick->e_mag);
+  if (sqrd_norm(error) > 0.0f)
+  {
+    error = vector_normalize(error);
+    w = vector_add(w, scalar_multiply(2.0f*est->params.beta, error));
+    madgwick->b = vector_sub(madgwick->b, scalar_multiply(2.0f*est->params.zeta*dt, error));
+  }
+
+  madgwick->q = est->params.integrate(madgwick->q, w, dt);
+}
+
+static void correct_madgwick(rosflight_t *rf, uint64_t acc_dt_us, uint64_t mag_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  madgwick_t *madgwick = &est->madgwick;
+  const quaternion_t *q = &madgwick->q;
+
+  // The descent direction of |v - m|^2, for a unit reference v predicted in the body frame
+  // and a measurement m, is m x v over body rotations
+  if (acc_dt_us > 0)
+  {
+    if (estimator_accel_usable(rf))
+    {
+      // the accelerometer sees gravity pointing up
+      vector_t measured_down = scalar_multiply(-1.0f, vector_normalize(est->accel_LPF));
+      madgwick->e_acc = cross(measured_down, estimator_down(q));
+    }
+    else
+    {
+      madgwick->e_acc.x = 0.0f;
+      madgwick->e_acc.y = 0.0f;
+      madgwick->e_acc.z = 0.0f;
+    }
+  }
+
+  if (mag_dt_us > 0 && est->params.use_mag && sqrd_norm(rf->sensors.mag) > 0.0f)
+  {
+    // The reference field has the measured field's inclination and points north, which
+    // takes the unknown local inclination out (eq. 45 and 46 of the paper)
+    vector_t m = vector_normalize(rf->sensors.mag);
+    vector_t down = estimator_down(q);
+    vector_t horizontal = estimator_horizontal_field(q, m);
+    vector_t reference = vector_add(scalar_multiply(norm(horizontal), north_from_quat(q)),
+                                    scalar_multiply(dot(down, m), down));
+    madgwick->e_mag = cross(m, reference);
+  }
+  else if (mag_dt_us > 0 || !est->mag_fresh)
+  {
+    madgwick->e_mag.x = 0.0f;
+    madgwick->e_mag.y = 0.0f;
+    madgwick->e_mag.z = 0.0f;
+  }
+}
+
+static void publish_madgwick(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  est->state.q = est->madgwick.q;
+  est->state.omega = vector_sub(est->gyro_LPF, est->madgwick.b);
+}
+
+const estimator_backend_t estimator_madgwick =
+{
+  .name = "madgwick",
+  .init = init_madgwick,
+  .reset_bias = reset_madgwick_bias,
+  .propagate = propagate_madgwick,
+  .correct = correct_madgwick,
+  .publish = publish_madgwick
+};
+
+#endif // FIXED_POINT_ESTIMATOR
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// The Mahony filter (FILTER_TYPE = 0), with a quadratic approximation of the angular
+// rate and the choice of Euler or matrix exponential integration.  Details can be found
+// in reports/estimator.tex.  The fixed-point build has its own in estimator_fixed.c.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FIXED_POINT_ESTIMATOR
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <turbotrig/turbotrig.h>
+#include <turbotrig/turbovec.h>
+
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "estimator.h"
+
+static void reset_mahony_bias(rosflight_t *rf)
+{
+  mahony_t *mahony = &rf->estimator.mahony;
+  mahony->b.x = 0.0f;
+  mahony->b.y = 0.0f;
+  mahony->b.z = 0.0f;
+}
+
+static void init_mahony(rosflight_t *rf)
+{
+  mahony_t *mahony = &rf->estimator.mahony;
+
+  mahony->q_hat = rf->estimator.state.q;
+
+  mahony->w1.x = 0.0f;
+  mahony->w1.y = 0.0f;
+  mahony->w1.z = 0.0f;
+
+  mahony->w2.x = 0.0f;
+  mahony->w2.y = 0.0f;
+  mahony->w2.z = 0.0f;
+
+  mahony->w_acc.x = 0.0f;
+  mahony->w_acc.y = 0.0f;
+  mahony->w_acc.z = 0.0f;
+
+  mahony->w_mag.x = 0.0f;
+  mahony->w_mag.y = 0.0f;
+  mahony->w_mag.z = 0.0f;
+
+  reset_mahony_bias(rf);
+}
+
+// Updates the correction term w_acc, which the propagation then applies until the next
+// correction.  Holding it keeps kp the same rate gain at any correction rate, and the bias
+// integrates over the whole time since the last correction.
+static void correct_attitude(rosflight_t *rf, float ki, float acc_dt)
+{
+  estimator_t *est = &rf->estimator;
+  mahony_t *mahony = &est->mahony;
+
+  if (estimator_accel_usable(rf))
+  {
+    // Get error estimated by accelerometer measurement
+    vector_t a = vector_normalize(est->accel_LPF);
+    // Correction Term of Eq. 47a and 47b Mahony Paper, the rotation from the estimated
+    // gravity direction to the measured one (which the accelerometer sees pointing up).
+    // It's perpendicular to gravity, so it can't change heading.
+    mahony->w_acc = cross(estimator_down(&mahony->q_hat), a);
+
+    // integrate biases from accelerometer feedback
+    // (eq 47b Mahony Paper, using correction term w_acc found above)
+    mahony->b.x -= ki*mahony->w_acc.x*acc_dt;
+    mahony->b.y -= ki*mahony->w_acc.y*acc_dt;
+    mahony->b.z -= ki*mahony->w_acc.z*acc_dt;
+  }
+  else
+  {
+    mahony->w_acc.x = 0.0f;
+    mahony->w_acc.y = 0.0f;
+    mahony->w_acc.z = 0.0f;
+  }
+}
+
+// Updates the heading correction w_mag from a new magnetometer measurement.  The field is
+// rotated into the inertial frame with the current estimate, which takes out the tilt, and
+// the angle between its horizontal part and north is applied about the inertial z axis
+// only, so that it can't disturb roll and pitch.  Like w_acc, it's held until the next
+// measurement.
+static void correct_heading(rosflight_t *rf, float ki, float mag_dt)
+{
+  estimator_t *est = &rf->estimator;
+  mahony_t *mahony = &est->mahony;
+  const quaternion_t *q = &mahony->q_hat;
+  vector_t m = rf->sensors.mag;
+  vector_t horizontal = estimator_horizontal_field(q, m);
+  float horizontal_sqrd = sqrd_norm(horizontal);
+
+  // a field that's nearly vertical, or missing, doesn't say anything about heading
+  if (!est->params.use_mag || horizontal_sqrd <= 0.01f*sqrd_norm(m))
+  {
+    mahony->w_mag.x = 0.0f;
+    mahony->w_mag.y = 0.0f;
+    mahony->w_mag.z = 0.0f;
+    return;
+  }
+
+  // sine of the heading error, rotating about the inertial z axis expressed in the body frame
+  float error = -horizontal.y*turboInvSqrt(horizontal_sqrd);
+  mahony->w_mag = scalar_multiply(error, estimator_down(q));
+
+  // the heading error is what makes the z gyro bias observable
+  mahony->b.x -= ki*mahony->w_mag.x*mag_dt;
+  mahony->b.y -= ki*mahony->w_mag.y*mag_dt;
+  mahony->b.z -= ki*mahony->w_mag.z*mag_dt;
+}
+
+static void propagate_mahony(rosflight_t *rf, uint64_t dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  mahony_t *mahony = &est->mahony;
+  float kp = est->params.kp;
+  float kp_mag = est->params.kp_mag;
+
+  // Pull out Gyro measurements
+  if (est->params.use_quad_int)
+  {
+    // Quadratic Integration (Eq. 14 Casey Paper)
+    // this integration step adds 12 us on the STM32F10x chips
+    mahony->wbar = vector_add(vector_add(scalar_multiply(-1.0f/12.0f,mahony->w2), scalar_multiply(8.0f/12.0f,mahony->w1)),
+                              scalar_multiply(5.0f/12.0f,est->gyro_LPF));
+    mahony->w2 = mahony->w1;
+    mahony->w1 = est->gyro_LPF;
+  }
+  else
+  {
+    mahony->wbar = est->gyro_LPF;
+  }
+
+  // Build the composite omega vector for kinematic propagation
+  // This the stuff inside the p function in eq. 47a - Mahony Paper
+  mahony->wfinal = vector_add(vector_add(vector_sub(mahony->wbar, mahony->b), scalar_multiply(kp, mahony->w_acc)),
+                              scalar_multiply(kp_mag, mahony->w_mag));
+
+  // Propagate Dynamics
+  mahony->q_hat = est->params.integrate(mahony->q_hat, mahony->wfinal, dt_us * 1e-6f);
+}
+
+static void correct_mahony(rosflight_t *rf, uint64_t acc_dt_us, uint64_t mag_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  mahony_t *mahony = &est->mahony;
+  float ki = est->params.ki;
+
+  // add in accelerometer, at its own rate
+  if (acc_dt_us > 0)
+    correct_attitude(rf, ki, acc_dt_us * 1e-6f);
+
+  // and the magnetometer whenever it has a new measurement, until it stops
+  if (mag_dt_us > 0)
+  {
+    correct_heading(rf, ki, mag_dt_us * 1e-6f);
+  }
+  else if (!est->mag_fresh)
+  {
+    mahony->w_mag.x = 0.0f;
+    mahony->w_mag.y = 0.0f;
+    mahony->w_mag.z = 0.0f;
+  }
+}
+
+static void publish_mahony(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+
+  // Save attitude estimate
+  est->state.q = est->mahony.q_hat;
+
+  // Save off adjust gyro measurements with estimated biases for control
+  est->state.omega = vector_sub(est->gyro_LPF, est->mahony.b);
+}
+
+const estimator_backend_t estimator_mahony =
+{
+  .name = "mahony",
+  .init = init_mahony,
+  .reset_bias = reset_mahony_bias,
+  .propagate = propagate_mahony,
+  .correct = correct_mahony,
+  .publish = publish_mahony
+};
+
+#endif // FIXED_POINT_ESTIMATOR
+
+#ifdef __cplusplus
+}
+#endif
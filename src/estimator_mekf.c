@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// A compact multiplicative EKF (FILTER_TYPE = 2), after "Attitude Error Representations
+// for Kalman Filtering" (Markley, 2003).  The quaternion is kept outside the filter, and
+// the filter's state is the small rotation of the body from it, and the gyro bias.  Each
+// correction moves the quaternion by the estimated rotation and zeros it again.
+//
+// The gyro propagates the quaternion on every update, but to keep the cost per update
+// close to Mahony's, the covariance is only propagated before each correction, and at
+// least every MEKF_COV_PERIOD_US, over the time since it last was.  The accelerometer
+// measures the direction of gravity.  The magnetometer measures heading alone, as a
+// rotation about the vertical, so that a disturbed field can't pull roll and pitch
+// directly.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FIXED_POINT_ESTIMATOR
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <turbotrig/turbotrig.h>
+#include <turbotrig/turbovec.h>
+
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "estimator.h"
+
+#define MEKF_GYRO_NOISE 0.01f       // rad/s/sqrt(Hz), white noise on the rates
+#define MEKF_BIAS_NOISE 0.0005f     // rad/s/sqrt(s), random walk of the gyro bias
+#define MEKF_ACCEL_NOISE 0.05f      // of the unit gravity direction, which also covers vibration and manoeuvres
+#define MEKF_MAG_NOISE 0.05f        // rad of heading
+#define MEKF_INIT_ATTITUDE 0.05f    // rad, left over from the alignment
+#define MEKF_INIT_BIAS 0.01f        // rad/s, left over from the gyro calibration
+#define MEKF_COV_PERIOD_US 10000
+
+static void reset_mekf_bias(rosflight_t *rf)
+{
+  mekf_t *mekf = &rf->estimator.mekf;
+  mekf->b.x = 0.0f;
+  mekf->b.y = 0.0f;
+  mekf->b.z = 0.0f;
+
+  // the bias is now uncorrelated with the attitude error
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = 3; j < 6; j++)
+    {
+      mekf->P[i][j] = 0.0f;
+      mekf->P[j][i] = 0.0f;
+    }
+  }
+  for (int i = 3; i < 6; i++)
+    mekf->P[i][i] = MEKF_INIT_BIAS*MEKF_INIT_BIAS;
+}
+
+static void init_mekf(rosflight_t *rf)
+{
+  mekf_t *mekf = &rf->estimator.mekf;
+
+  mekf->q = rf->estimator.state.q;
+  mekf->cov_dt_us = 0;
+
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = 0; j < 6; j++)
+      mekf->P[i][j] = 0.0f;
+  }
+  for (int i = 0; i < 3; i++)
+    mekf->P[i][i] = MEKF_INIT_ATTITUDE*MEKF_INIT_ATTITUDE;
+
+  reset_mekf_bias(rf);
+}
+
+// P = F P F^T + Q over dt at the rate w, with F = [I - [w x] dt, -I dt; 0, I] for the
+// rotation error of the body and the bias
+static void propagate_covariance(mekf_t *mekf, vector_t w, float dt)
+{
+  float (*P)[6] = mekf->P;
+  float A[3][3] = {{1.0f,     w.z*dt, -w.y*dt},
+                   {-w.z*dt,  1.0f,    w.x*dt},
+                   {w.y*dt,  -w.x*dt,  1.0f}
+                  };
+
+  float FP[6][6];
+  for (int j = 0; j < 6; j++)
+  {
+    for (int i = 0; i < 3; i++)
+      FP[i][j] = A[i][0]*P[0][j] + A[i][1]*P[1][j] + A[i][2]*P[2][j] - dt*P[i+3][j];
+    for (int i = 3; i < 6; i++)
+      FP[i][j] = P[i][j];
+  }
+
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = 0; j < 3; j++)
+      P[i][j] = FP[i][0]*A[j][0] + FP[i][1]*A[j][1] + FP[i][2]*A[j][2] - dt*FP[i][j+3];
+    for (int j = 3; j < 6; j++)
+      P[i][j] = FP[i][j];
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    P[i][i] += MEKF_GYRO_NOISE*MEKF_GYRO_NOISE*dt;
+    P[i+3][i+3] += MEKF_BIAS_NOISE*MEKF_BIAS_NOISE*dt;
+  }
+}
+
+// Kalman update with up to three measurements y of the rotation error alone, each with
+// its row of H and the same variance r, followed by the reset of the rotation error into q
+static void update(rosflight_t *rf, const vector_t H[], const float y[], int rows, float r)
+{
+  estimator_t *est = &rf->estimator;
+  mekf_t *mekf = &est->mekf;
+  float (*P)[6] = mekf->P;
+
+  // P H^T, and S = H P H^T + R
+  float PHt[6][3];
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = 0; j < rows; j++)
+      PHt[i][j] = P[i][0]*H[j].x + P[i][1]*H[j].y + P[i][2]*H[j].z;
+  }
+  float S[3][3];
+  for (int i = 0; i < rows; i++)
+  {
+    for (int j = 0; j < rows; j++)
+      S[i][j] = H[i].x*PHt[0][j] + H[i].y*PHt[1][j] + H[i].z*PHt[2][j] + (i == j ? r : 0.0f);
+  }
+
+  float S_inv[3][3];
+  if (rows == 1)
+  {
+    S_inv[0][0] = 1.0f/S[0][0];
+  }
+  else
+  {
+    // S is symmetric and positive definite, so its adjugate over its determinant
+    S_inv[0][0] = S[1][1]*S[2][2] - S[1][2]*S[2][1];
+    S_inv[0][1] = S[0][2]*S[2][1] - S[0][1]*S[2][2];
+    S_inv[0][2] = S[0][1]*S[1][2] - S[0][2]*S[1][1];
+    S_inv[1][1] = S[0][0]*S[2][2] - S[0][2]*S[2][0];
+    S_inv[1][2] = S[0][2]*S[1][0] - S[0][0]*S[1][2];
+    S_inv[2][2] = S[0][0]*S[1][1] - S[0][1]*S[1][0];
+    float inv_det = 1.0f/(S[0][0]*S_inv[0][0] + S[0][1]*S_inv[0][1] + S[0][2]*S_inv[0][2]);
+    for (int i = 0; i < 3; i++)
+    {
+      for (int j = i; j < 3; j++)
+      {
+        S_inv[i][j] *= inv_det;
+        S_inv[j][i] = S_inv[i][j];
+      }
+    }
+  }
+
+  // K = P H^T S^-1, the correction K y, and P = P - K (P H^T)^T
+  float K[6][3];
+  float dx[6];
+  for (int i = 0; i < 6; i++)
+  {
+    dx[i] = 0.0f;
+    for (int j = 0; j < rows; j++)
+    {
+      K[i][j] = 0.0f;
+      for (int k = 0; k < rows; k++)
+        K[i][j] += PHt[i][k]*S_inv[k][j];
+      dx[i] += K[i][j]*y[j];
+    }
+  }
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = i; j < 6; j++)
+    {
+      float KHP = 0.0f;
+      for (int k = 0; k < rows; k++)
+        KHP += K[i][k]*PHt[j][k];
+      // kept symmetric, since rounding would otherwise build up in the two halves
+      P[i][j] = 0.5f*(P[i][j] + P[j][i]) - KHP;
+      P[j][i] = P[i][j];
+    }
+  }
+
+  vector_t rotation = {dx[0], dx[1], dx[2]};
+  mekf->q = est->params.integrate(mekf->q, rotation, 1.0f);
+  mekf->b.x += dx[3];
+  mekf->b.y += dx[4];
+  mekf->b.z += dx[5];
+}
+
+static void propagate_mekf(rosflight_t *rf, uint64_t dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  mekf_t *mekf = &est->mekf;
+
+  vector_t w = vector_sub(est->gyro_LPF, mekf->b);
+  mekf->q = est->params.integrate(mekf->q, w, dt_us * 1e-6f);
+
+  mekf->cov_dt_us += dt_us;
+  if (mekf->cov_dt_us >= MEKF_COV_PERIOD_US)
+  {
+    propagate_covariance(mekf, w, mekf->cov_dt_us * 1e-6f);
+    mekf->cov_dt_us = 0;
+  }
+}
+
+static void correct_mekf(rosflight_t *rf, uint64_t acc_dt_us, uint64_t mag_dt_us)
+{
+  estimator_t *est = &rf->estimator;
+  mekf_t *mekf = &est->mekf;
+  if (acc_dt_us == 0 && mag_dt_us == 0)
+    return;
+
+  if (mekf->cov_dt_us > 0)
+  {
+    propagate_covariance(mekf, vector_sub(est->gyro_LPF, mekf->b), mekf->cov_dt_us * 1e-6f);
+    mekf->cov_dt_us = 0;
+  }
+
+  if (acc_dt_us > 0 && estimator_accel_usable(rf))
+  {
+    // down in the body frame, opposite the accelerometer, and its sensitivity v x to the
+    // rotation error
+    vector_t v = estimator_down(&mekf->q);
+    vector_t measured = scalar_multiply(-1.0f, vector_normalize(est->accel_LPF));
+    vector_t H[3] = {{0.0f, -v.z, v.y}, {v.z, 0.0f, -v.x}, {-v.y, v.x, 0.0f}};
+    float y[3] = {measured.x - v.x, measured.y - v.y, measured.z - v.z};
+    update(rf, H, y, 3, MEKF_ACCEL_NOISE*MEKF_ACCEL_NOISE);
+  }
+
+  if (mag_dt_us > 0 && est->params.use_mag)
+  {
+    // the heading of the horizontal field is 0 at north, and a rotation about down turns it
+    vector_t horizontal = estimator_horizontal_field(&mekf->q, rf->sensors.mag);
+    float horizontal_sqrd = sqrd_norm(horizontal);
+    if (horizontal_sqrd > 0.01f*sqrd_norm(rf->sensors.mag))
+    {
+      vector_t H[1] = {estimator_down(&mekf->q)};
+      float y[1] = {-horizontal.y*turboInvSqrt(horizontal_sqrd)};
+      update(rf, H, y, 1, MEKF_MAG_NOISE*MEKF_MAG_NOISE);
+    }
+  }
+}
+
+static void publish_mekf(rosflight_t *rf)
+{
+  estimator_t *est = &rf->estimator;
+  est->state.q = est->mekf.q;
+  est->state.omega = vector_sub(est->gyro_LPF, est->mekf.b);
+}
+
+const estimator_backend_t estimator_mekf =
+{
+  .name = "mekf",
+  .init = init_mekf,
+  .reset_bias = reset_mekf_bias,
+  .propagate = propagate_mekf,
+  .correct = correct_mekf,
+  .publish = publish_mekf
+};
+
+#endif // FIXED_POINT_ESTIMATOR
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+void histogram_init(histogram_t *hist, uint32_t bucket_width)
+{
+  hist->bucket_width = (bucket_width > 0) ? bucket_width : 1;
+  histogram_reset(hist);
+}
+
+void histogram_reset(histogram_t *hist)
+{
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    hist->buckets[i] = 0;
+  hist->count = 0;
+  hist->min = UINT32_MAX;
+  hist->max = 0;
+}
+
+void histogram_add(histogram_t *hist, uint32_t value)
+{
+  uint32_t bucket = value / hist->bucket_width;
+  if (bucket >= HISTOGRAM_BUCKETS)
+    bucket = HISTOGRAM_BUCKETS - 1;
+  hist->buckets[bucket]++;
+  hist->count++;
+
+  if (value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+uint32_t histogram_percentile(const histogram_t *hist, uint8_t percent)
+{
+  if (hist->count == 0)
+    return 0;
+
+  // rank of the sample we are looking for, rounded up
+  uint32_t rank = ((uint64_t) hist->count * percent + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+
+  uint32_t sum = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+  {
+    sum += hist->buckets[i];
+    if (sum >= rank)
+    {
+      uint32_t value = (i + 1) * hist->bucket_width;
+      if (value > hist->max)
+        value = hist->max;
+      if (value < hist->min)
+        value = hist->min;
+      return value;
+    }
+  }
+
+  // it's in the overflow bucket, the best we can do is the max
+  return hist->max;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "histogram.h"
+#include "param.h"
+#include "rosflight.h"
+
+#include "latency.h"
+
+// local variable definitions
+#define LATENCY_DEADLINE_BUCKETS (HISTOGRAM_BUCKETS/2) // so latencies up to twice the deadline land in a bucket of their own
+
+// local function definitions
+static void finish_window(latency_t *lat)
+{
+  latency_stats_t *stats = &lat->stats;
+
+  stats->samples = lat->hist.count;
+  stats->min_us = lat->hist.min;
+  stats->max_us = lat->hist.max;
+  stats->mean_us = lat->sum_us / lat->hist.count;
+
+  float mean = (float) lat->sum_us / lat->hist.count;
+  float variance = (float) lat->sum_sq_us / lat->hist.count - mean*mean;
+  stats->jitter_us = (variance > 0.0f) ? (uint32_t) sqrtf(variance) : 0;
+
+  stats->p50_us = histogram_percentile(&lat->hist, 50);
+  stats->p90_us = histogram_percentile(&lat->hist, 90);
+  stats->p99_us = histogram_percentile(&lat->hist, 99);
+  stats->deadline_misses = lat->window_misses;
+
+  // a new bucket width from update_latency_params() takes effect here, between windows
+  histogram_init(&lat->hist, lat->params.bucket_width_us);
+  lat->sum_us = 0;
+  lat->sum_sq_us = 0;
+  lat->window_misses = 0;
+}
+
+// function definitions
+void init_latency(rosflight_t *rf)
+{
+  latency_t *lat = &rf->latency;
+
+  update_latency_params(rf);
+  histogram_init(&lat->hist, lat->params.bucket_width_us);
+  lat->sum_us = 0;
+  lat->sum_sq_us = 0;
+  lat->window_misses = 0;
+  lat->total_deadline_misses = 0;
+  lat->last_us = 0;
+  lat->average_x16 = 0;
+  lat->stats.samples = 0;
+}
+
+void update_latency_params(rosflight_t *rf)
+{
+  latency_params_t *params = &rf->latency.params;
+  params->deadline_us = get_param_int(rf, PARAM_LATENCY_DEADLINE);
+  params->window = get_param_int(rf, PARAM_LATENCY_WINDOW);
+  params->bucket_width_us = params->deadline_us / LATENCY_DEADLINE_BUCKETS;
+}
+
+void latency_record(rosflight_t *rf, uint32_t latency_us)
+{
+  latency_t *lat = &rf->latency;
+  lat->last_us = latency_us;
+  lat->average_x16 += latency_us - lat->average_x16/16;
+
+  histogram_add(&lat->hist, latency_us);
+  lat->sum_us += latency_us;
+  lat->sum_sq_us += (uint64_t) latency_us * latency_us;
+
+  if (latency_us > lat->params.deadline_us)
+  {
+    lat->window_misses++;
+    lat->total_deadline_misses++;
+  }
+
+  if (lat->hist.count >= lat->params.window)
+    finish_window(lat);
+}
+
+const latency_stats_t *latency_get_stats(rosflight_t *rf)
+{
+  return &rf->latency.stats;
+}
+
+uint32_t latency_get_average_us(rosflight_t *rf)
+{
+  return rf->latency.average_x16/16;
+}
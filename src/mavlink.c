@@ -34,23 +34,27 @@
 #include "board.h"
 #include "mavlink_receive.h"
 #include "param.h"
+#include "rosflight.h"
 
 #include "mavlink.h"
 #include "mavlink_log.h"
 
 // global variable definitions
+// The system ID and the MAVLink library's channel state are shared by every firmware instance
+// in the process, since the MAVLink convenience functions have no way to tell them apart
 mavlink_system_t mavlink_system;
 static bool mavlink_initialized = false;
 
 // function definitions
-void init_mavlink(void)
+void init_mavlink(rosflight_t *rf)
 {
-  serial_init(get_param_int(PARAM_BAUD_RATE));
+  serial_init(get_param_int(rf, PARAM_BAUD_RATE));
 
-  mavlink_system.sysid = get_param_int(PARAM_SYSTEM_ID);
+  mavlink_system.sysid = get_param_int(rf, PARAM_SYSTEM_ID);
   mavlink_system.compid = 250;
 
-  _offboard_control_time = 0;
+  rf->mavlink.offboard_control_time = 0;
+  rf->mavlink.send_params_index = PARAMS_COUNT;
 
   mavlink_log_warning("rebooting", NULL);
   mavlink_initialized = true;
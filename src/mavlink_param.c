@@ -35,19 +35,17 @@
 #include <stdint.h>
 
 #include "param.h"
+#include "rosflight.h"
 
 #include "mavlink_param.h"
 
-// local variable definitions
-static uint8_t send_params_index = PARAMS_COUNT; // current param to send when sending parameter list with low priority
-
 // function definitions
-void mavlink_send_param(param_id_t id)
+void mavlink_send_param(rosflight_t *rf, param_id_t id)
 {
   if (id < PARAMS_COUNT)
   {
     MAV_PARAM_TYPE type;
-    switch (get_param_type(id))
+    switch (get_param_type(rf, id))
     {
     case PARAM_TYPE_INT32:
       type = MAV_PARAM_TYPE_INT32;
@@ -60,37 +58,37 @@ void mavlink_send_param(param_id_t id)
     }
 
     mavlink_msg_param_value_send(MAVLINK_COMM_0,
-                                 get_param_name(id), get_param_float(id), type, PARAMS_COUNT, id);
+                                 get_param_name(rf, id), get_param_float(rf, id), type, PARAMS_COUNT, id);
   }
 }
 
-void mavlink_handle_msg_param_request_list(void)
+void mavlink_handle_msg_param_request_list(rosflight_t *rf)
 {
-  send_params_index = 0;
+  rf->mavlink.send_params_index = 0;
 }
 
-void mavlink_handle_msg_param_request_read(const mavlink_message_t *const msg)
+void mavlink_handle_msg_param_request_read(rosflight_t *rf, const mavlink_message_t *const msg)
 {
   mavlink_param_request_read_t read;
   mavlink_msg_param_request_read_decode(msg, &read);
 
-  if (read.target_system == (uint8_t) get_param_int(PARAM_SYSTEM_ID)) // TODO check if component id matches?
+  if (read.target_system == (uint8_t) get_param_int(rf, PARAM_SYSTEM_ID)) // TODO check if component id matches?
   {
-    param_id_t id = (read.param_index < 0) ? lookup_param_id(read.param_id) : (param_id_t) read.param_index;
+    param_id_t id = (read.param_index < 0) ? lookup_param_id(rf, read.param_id) : (param_id_t) read.param_index;
 
     if (id < PARAMS_COUNT)
-      mavlink_send_param(id);
+      mavlink_send_param(rf, id);
   }
 }
 
-void mavlink_handle_msg_param_set(const mavlink_message_t *const msg)
+void mavlink_handle_msg_param_set(rosflight_t *rf, const mavlink_message_t *const msg)
 {
   mavlink_param_set_t set;
   mavlink_msg_param_set_decode(msg, &set);
 
-  if (set.target_system == (uint8_t) get_param_int(PARAM_SYSTEM_ID)) // TODO check if component id matches?
+  if (set.target_system == (uint8_t) get_param_int(rf, PARAM_SYSTEM_ID)) // TODO check if component id matches?
   {
-    param_id_t id = lookup_param_id(set.param_id);
+    param_id_t id = lookup_param_id(rf, set.param_id);
 
     if (id < PARAMS_COUNT)
     {
@@ -108,15 +106,15 @@ void mavlink_handle_msg_param_set(const mavlink_message_t *const msg)
         break;
       }
 
-      if (candidate_type == get_param_type(id))
+      if (candidate_type == get_param_type(rf, id))
       {
         switch (candidate_type)
         {
         case PARAM_TYPE_INT32:
-          set_param_int(id, *(int32_t *) &set.param_value);
+          set_param_int(rf, id, *(int32_t *) &set.param_value);
           break;
         case PARAM_TYPE_FLOAT:
-          set_param_float(id, set.param_value);
+          set_param_float(rf, id, set.param_value);
           break;
         }
       }
@@ -124,11 +122,11 @@ void mavlink_handle_msg_param_set(const mavlink_message_t *const msg)
   }
 }
 
-void mavlink_send_next_param(void)
+void mavlink_send_next_param(rosflight_t *rf)
 {
-  if (send_params_index < PARAMS_COUNT)
+  if (rf->mavlink.send_params_index < PARAMS_COUNT)
   {
-    mavlink_send_param((param_id_t) send_params_index);
-    send_params_index++;
+    mavlink_send_param(rf, (param_id_t) rf->mavlink.send_params_index);
+    rf->mavlink.send_params_index++;
   }
 }
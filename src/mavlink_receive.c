@@ -38,22 +38,15 @@
 #include "sensors.h"
 #include "rc.h"
 #include "controller.h"
+#include "rosflight.h"
 
 #include "mavlink_receive.h"
 #include "mavlink_log.h"
 
 #include "mavlink_util.h"
 
-// global variable definitions
-mavlink_offboard_control_t mavlink_offboard_control;
-uint64_t _offboard_control_time;
-
-// local variable definitions
-static mavlink_message_t in_buf;
-static mavlink_status_t status;
-
 // local function definitions
-static void mavlink_handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
+static void mavlink_handle_msg_rosflight_cmd(rosflight_t *rf, const mavlink_message_t *const msg)
 {
   mavlink_rosflight_cmd_t cmd;
   mavlink_msg_rosflight_cmd_decode(msg, &cmd);
@@ -63,7 +56,7 @@ static void mavlink_handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
   bool reboot_to_bootloader_flag = false;
 
   // None of these actions can be performed if we are armed
-  if (_armed_state == ARMED)
+  if (rf->mode.armed_state == ARMED)
   {
     result = false;
   }
@@ -73,19 +66,19 @@ static void mavlink_handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
     switch (cmd.command)
     {
     case ROSFLIGHT_CMD_READ_PARAMS:
-      result = read_params();
+      result = read_params(rf);
       break;
     case ROSFLIGHT_CMD_WRITE_PARAMS:
-      result = write_params();
+      result = write_params(rf);
       break;
     case ROSFLIGHT_CMD_SET_PARAM_DEFAULTS:
-      set_param_defaults();
+      set_param_defaults(rf);
       break;
     case ROSFLIGHT_CMD_ACCEL_CALIBRATION:
-      result = start_imu_calibration();
+      result = start_imu_calibration(rf);
       break;
     case ROSFLIGHT_CMD_GYRO_CALIBRATION:
-      result = start_gyro_calibration();
+      result = start_gyro_calibration(rf);
       break;
     case ROSFLIGHT_CMD_BARO_CALIBRATION:
       baro_calibrate();
@@ -94,7 +87,7 @@ static void mavlink_handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
       diff_pressure_calibrate();
       break;
     case ROSFLIGHT_CMD_RC_CALIBRATION:
-      calculate_equilbrium_torque_from_rc();
+      calculate_equilbrium_torque_from_rc(rf);
       break;
     case ROSFLIGHT_CMD_REBOOT:
       reboot_flag = true;
@@ -136,76 +129,80 @@ static void mavlink_handle_msg_timesync(const mavlink_message_t *const msg)
   }
 }
 
-static void mavlink_handle_msg_offboard_control(const mavlink_message_t *const msg)
+static void mavlink_handle_msg_offboard_control(rosflight_t *rf, const mavlink_message_t *const msg)
 {
-  _offboard_control_time = clock_micros();
-  mavlink_msg_offboard_control_decode(msg, &mavlink_offboard_control);
+  mavlink_offboard_control_t *mavlink_offboard_control = &rf->mavlink.offboard_control;
+  control_t *offboard_control = &rf->mux.offboard_control;
+
+  rf->mavlink.offboard_control_time = clock_micros();
+  mavlink_msg_offboard_control_decode(msg, mavlink_offboard_control);
 
   // put values into standard message
-  _offboard_control.x.value = mavlink_offboard_control.x;
-  _offboard_control.y.value = mavlink_offboard_control.y;
-  _offboard_control.z.value = mavlink_offboard_control.z;
-  _offboard_control.F.value = mavlink_offboard_control.F;
+  offboard_control->x.value = mavlink_offboard_control->x;
+  offboard_control->y.value = mavlink_offboard_control->y;
+  offboard_control->z.value = mavlink_offboard_control->z;
+  offboard_control->F.value = mavlink_offboard_control->F;
 
   // Move flags into standard message
-  _offboard_control.x.active = !(mavlink_offboard_control.ignore & IGNORE_VALUE1);
-  _offboard_control.y.active = !(mavlink_offboard_control.ignore & IGNORE_VALUE2);
-  _offboard_control.z.active = !(mavlink_offboard_control.ignore & IGNORE_VALUE3);
-  _offboard_control.F.active = !(mavlink_offboard_control.ignore & IGNORE_VALUE4);
+  offboard_control->x.active = !(mavlink_offboard_control->ignore & IGNORE_VALUE1);
+  offboard_control->y.active = !(mavlink_offboard_control->ignore & IGNORE_VALUE2);
+  offboard_control->z.active = !(mavlink_offboard_control->ignore & IGNORE_VALUE3);
+  offboard_control->F.active = !(mavlink_offboard_control->ignore & IGNORE_VALUE4);
 
   // translate modes into standard message
-  switch (mavlink_offboard_control.mode)
+  switch (mavlink_offboard_control->mode)
   {
   case MODE_PASS_THROUGH:
-    _offboard_control.x.type = PASSTHROUGH;
-    _offboard_control.y.type = PASSTHROUGH;
-    _offboard_control.z.type = PASSTHROUGH;
-    _offboard_control.F.type = THROTTLE;
+    offboard_control->x.type = PASSTHROUGH;
+    offboard_control->y.type = PASSTHROUGH;
+    offboard_control->z.type = PASSTHROUGH;
+    offboard_control->F.type = THROTTLE;
     break;
   case MODE_ROLLRATE_PITCHRATE_YAWRATE_THROTTLE:
-    _offboard_control.x.type = RATE;
-    _offboard_control.y.type = RATE;
-    _offboard_control.z.type = RATE;
-    _offboard_control.F.type = THROTTLE;
-    _offboard_control.x.value += get_param_float(PARAM_ROLL_RATE_TRIM);
-    _offboard_control.y.value += get_param_float(PARAM_PITCH_RATE_TRIM);
-    _offboard_control.z.value += get_param_float(PARAM_YAW_RATE_TRIM);
+    offboard_control->x.type = RATE;
+    offboard_control->y.type = RATE;
+    offboard_control->z.type = RATE;
+    offboard_control->F.type = THROTTLE;
+    offboard_control->x.value += get_param_float(rf, PARAM_ROLL_RATE_TRIM);
+    offboard_control->y.value += get_param_float(rf, PARAM_PITCH_RATE_TRIM);
+    offboard_control->z.value += get_param_float(rf, PARAM_YAW_RATE_TRIM);
     break;
   case MODE_ROLL_PITCH_YAWRATE_THROTTLE:
-    _offboard_control.x.type = ANGLE;
-    _offboard_control.y.type = ANGLE;
-    _offboard_control.z.type = RATE;
-    _offboard_control.F.type = THROTTLE;
-    _offboard_control.x.value += get_param_float(PARAM_ROLL_ANGLE_TRIM);
-    _offboard_control.y.value += get_param_float(PARAM_PITCH_ANGLE_TRIM);
-    _offboard_control.z.value += get_param_float(PARAM_YAW_RATE_TRIM);
+    offboard_control->x.type = ANGLE;
+    offboard_control->y.type = ANGLE;
+    offboard_control->z.type = RATE;
+    offboard_control->F.type = THROTTLE;
+    offboard_control->x.value += get_param_float(rf, PARAM_ROLL_ANGLE_TRIM);
+    offboard_control->y.value += get_param_float(rf, PARAM_PITCH_ANGLE_TRIM);
+    offboard_control->z.value += get_param_float(rf, PARAM_YAW_RATE_TRIM);
     break;
     // Handle error state
   }
-  _new_command = true;
+  rf->mux.new_command = true;
 }
 
-static void handle_mavlink_message(void)
+static void handle_mavlink_message(rosflight_t *rf)
 {
-  switch (in_buf.msgid)
+  const mavlink_message_t *in_buf = &rf->mavlink.in_buf;
+  switch (in_buf->msgid)
   {
   case MAVLINK_MSG_ID_OFFBOARD_CONTROL:
-    mavlink_handle_msg_offboard_control(&in_buf);
+    mavlink_handle_msg_offboard_control(rf, in_buf);
     break;
   case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
-    mavlink_handle_msg_param_request_list();
+    mavlink_handle_msg_param_request_list(rf);
     break;
   case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
-    mavlink_handle_msg_param_request_read(&in_buf);
+    mavlink_handle_msg_param_request_read(rf, in_buf);
     break;
   case MAVLINK_MSG_ID_PARAM_SET:
-    mavlink_handle_msg_param_set(&in_buf);
+    mavlink_handle_msg_param_set(rf, in_buf);
     break;
   case MAVLINK_MSG_ID_ROSFLIGHT_CMD:
-    mavlink_handle_msg_rosflight_cmd(&in_buf);
+    mavlink_handle_msg_rosflight_cmd(rf, in_buf);
     break;
   case MAVLINK_MSG_ID_TIMESYNC:
-    mavlink_handle_msg_timesync(&in_buf);
+    mavlink_handle_msg_timesync(in_buf);
     break;
   default:
     break;
@@ -213,11 +210,11 @@ static void handle_mavlink_message(void)
 }
 
 // function definitions
-void mavlink_receive(void)
+void mavlink_receive(rosflight_t *rf)
 {
   while (serial_bytes_available())
   {
-    if (mavlink_parse_char(MAVLINK_COMM_0, serial_read(), &in_buf, &status))
-      handle_mavlink_message();
+    if (mavlink_parse_char(MAVLINK_COMM_0, serial_read(), &rf->mavlink.in_buf, &rf->mavlink.status))
+      handle_mavlink_message(rf);
   }
 }
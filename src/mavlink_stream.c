@@ -30,6 +30,7 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 
 #include "board.h"
 #include "mavlink.h"
@@ -37,75 +38,78 @@
 #include "mixer.h"
 #include "sensors.h"
 #include "estimator.h"
+#include "latency.h"
 #include "param.h"
 #include "mode.h"
 #include "rc.h"
 #include "mode.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "rosflight.h"
 
 #include "mavlink_stream.h"
 #include "mavlink_util.h"
 #include "mavlink_log.h"
 
-uint32_t _loop_time_us;
-
 // Declarations of local function definitions
-static void mavlink_send_heartbeat(void);
-static void mavlink_send_status(void);
-static void mavlink_send_attitude(void);
-static void mavlink_send_imu(void);
-static void mavlink_send_rosflight_output_raw(void);
-static void mavlink_send_rc_raw(void);
-static void mavlink_send_diff_pressure(void);
-static void mavlink_send_baro(void);
-static void mavlink_send_sonar(void);
-static void mavlink_send_mag(void);
-static void mavlink_send_low_priority(void);
-
-// typedefs
-typedef struct
-{
-  uint32_t period_us;
-  uint64_t next_time_us;
-  void (*send_function)(void);
-} mavlink_stream_t;
+static void mavlink_send_heartbeat(rosflight_t *rf);
+static void mavlink_send_status(rosflight_t *rf);
+static void mavlink_send_profile(rosflight_t *rf);
+static void mavlink_send_latency(rosflight_t *rf);
+static void mavlink_send_attitude(rosflight_t *rf);
+static void mavlink_send_imu(rosflight_t *rf);
+static void mavlink_send_rosflight_output_raw(rosflight_t *rf);
+static void mavlink_send_rc_raw(rosflight_t *rf);
+static void mavlink_send_diff_pressure(rosflight_t *rf);
+static void mavlink_send_baro(rosflight_t *rf);
+static void mavlink_send_sonar(rosflight_t *rf);
+static void mavlink_send_altitude(rosflight_t *rf);
+static void mavlink_send_mag(rosflight_t *rf);
+static void mavlink_send_scheduler(rosflight_t *rf);
+static void mavlink_send_low_priority(rosflight_t *rf);
 
 // local variable definitions
-static mavlink_stream_t mavlink_streams[MAVLINK_STREAM_COUNT] =
+// Needs to match mavlink_stream_id_t
+static void (*const send_functions[MAVLINK_STREAM_COUNT])(rosflight_t *rf) =
 {
-  { .period_us = 0, .next_time_us = 0, .send_function = mavlink_send_heartbeat },
-  { .period_us = 0, .next_time_us = 0, .send_function = mavlink_send_status},
+  mavlink_send_heartbeat,
+  mavlink_send_status,
+  mavlink_send_profile,
+  mavlink_send_latency,
 
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_attitude },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_imu },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_diff_pressure },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_baro },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_sonar },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_mag },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_rosflight_output_raw },
-  { .period_us = 0,  .next_time_us = 0, .send_function = mavlink_send_rc_raw },
+  mavlink_send_attitude,
+  mavlink_send_imu,
+  mavlink_send_diff_pressure,
+  mavlink_send_baro,
+  mavlink_send_sonar,
+  mavlink_send_altitude,
+  mavlink_send_mag,
+  mavlink_send_rosflight_output_raw,
+  mavlink_send_rc_raw,
+  mavlink_send_scheduler,
 
-  { .period_us = 5000,   .next_time_us = 0, .send_function = mavlink_send_low_priority }
+  mavlink_send_low_priority
 };
 
 // local function definitions
-static void mavlink_send_heartbeat(void)
+static void mavlink_send_heartbeat(rosflight_t *rf)
 {
   mavlink_msg_heartbeat_send(MAVLINK_COMM_0,
-                             get_param_int(PARAM_FIXED_WING) ? MAV_TYPE_FIXED_WING : MAV_TYPE_QUADROTOR,
+                             get_param_int(rf, PARAM_FIXED_WING) ? MAV_TYPE_FIXED_WING : MAV_TYPE_QUADROTOR,
                              0, 0, 0, 0);
 }
 
 // local function definitions
-static void mavlink_send_status(void)
+static void mavlink_send_status(rosflight_t *rf)
 {
   volatile uint8_t status = 0;
-  status |= (_armed_state & ARMED) ? ROSFLIGHT_STATUS_ARMED : 0x00;
-  status |= (_armed_state & FAILSAFE) ? ROSFLIGHT_STATUS_IN_FAILSAFE : 0x00;
-  status |= (rc_override_active()) ? ROSFLIGHT_STATUS_RC_OVERRIDE : 0x00;
-  status |= (offboard_control_active()) ? ROSFLIGHT_STATUS_OFFBOARD_CONTROL_ACTIVE : 0x00;
+  status |= (rf->mode.armed_state & ARMED) ? ROSFLIGHT_STATUS_ARMED : 0x00;
+  status |= (rf->mode.armed_state & FAILSAFE) ? ROSFLIGHT_STATUS_IN_FAILSAFE : 0x00;
+  status |= (rc_override_active(rf)) ? ROSFLIGHT_STATUS_RC_OVERRIDE : 0x00;
+  status |= (offboard_control_active(rf)) ? ROSFLIGHT_STATUS_OFFBOARD_CONTROL_ACTIVE : 0x00;
 
   uint8_t control_mode = 0;
-  if (get_param_int(PARAM_FIXED_WING))
+  if (get_param_int(rf, PARAM_FIXED_WING))
     control_mode = MODE_PASS_THROUGH;
   else
     // TODO - Support rate mode
@@ -113,57 +117,106 @@ static void mavlink_send_status(void)
 
 
 
+  // report the worst case of the last latency window, rather than whatever the last loop was
+  const latency_stats_t *latency = latency_get_stats(rf);
+  uint32_t loop_time_us = (latency->samples > 0) ? latency->max_us : rf->latency.last_us;
+
   mavlink_msg_rosflight_status_send(MAVLINK_COMM_0,
                                     status,
-                                    _error_state,
+                                    rf->mode.error_state,
                                     control_mode,
                                     num_sensor_errors(),
-                                    _loop_time_us);
+                                    loop_time_us);
 }
 
-static void mavlink_send_attitude(void)
+static void mavlink_send_profile(rosflight_t *rf)
+{
+  // Report one section per call, with times in microseconds
+  profile_id_t profile_id = rf->mavlink.profile_stream_id;
+  const histogram_t *hist = profiler_get_histogram(rf, profile_id);
+  float cycles_per_us = (float) clock_cycles_per_us();
+
+  if (hist->count > 0)
+  {
+    char name[MAVLINK_MSG_NAMED_VALUE_FLOAT_FIELD_NAME_LEN];
+    const char *profile_name = profiler_get_name(profile_id);
+    size_t len = strlen(profile_name);
+    memcpy(name, profile_name, len);
+
+    memcpy(name + len, "_min", 5);
+    mavlink_send_named_value_float(name, hist->min / cycles_per_us);
+    memcpy(name + len, "_max", 5);
+    mavlink_send_named_value_float(name, hist->max / cycles_per_us);
+    memcpy(name + len, "_p50", 5);
+    mavlink_send_named_value_float(name, histogram_percentile(hist, 50) / cycles_per_us);
+    memcpy(name + len, "_p99", 5);
+    mavlink_send_named_value_float(name, histogram_percentile(hist, 99) / cycles_per_us);
+  }
+
+  // Each report covers the time since the last one
+  profiler_reset(rf, profile_id);
+  rf->mavlink.profile_stream_id = (profile_id + 1) % PROFILE_COUNT;
+}
+
+static void mavlink_send_latency(rosflight_t *rf)
+{
+  const latency_stats_t *latency = latency_get_stats(rf);
+  if (latency->samples > 0)
+  {
+    mavlink_send_named_value_int("lat_p50", latency->p50_us);
+    mavlink_send_named_value_int("lat_p90", latency->p90_us);
+    mavlink_send_named_value_int("lat_p99", latency->p99_us);
+    mavlink_send_named_value_int("lat_max", latency->max_us);
+    mavlink_send_named_value_int("lat_jitter", latency->jitter_us);
+    mavlink_send_named_value_int("lat_miss", latency->deadline_misses);
+  }
+  mavlink_send_named_value_int("lat_mtotal", rf->latency.total_deadline_misses);
+}
+
+static void mavlink_send_attitude(rosflight_t *rf)
 {
   mavlink_msg_attitude_quaternion_send(MAVLINK_COMM_0,
                                        clock_millis(),
-                                       _current_state.q.w,
-                                       _current_state.q.x,
-                                       _current_state.q.y,
-                                       _current_state.q.z,
-                                       _current_state.omega.x,
-                                       _current_state.omega.y,
-                                       _current_state.omega.z);
+                                       rf->estimator.state.q.w,
+                                       rf->estimator.state.q.x,
+                                       rf->estimator.state.q.y,
+                                       rf->estimator.state.q.z,
+                                       rf->estimator.state.omega.x,
+                                       rf->estimator.state.omega.y,
+                                       rf->estimator.state.omega.z);
 }
 
-static void mavlink_send_imu(void)
+static void mavlink_send_imu(rosflight_t *rf)
 {
   // If we haven't sent this IMU measurement yet, send it
-  if (!_imu_sent)
+  if (!rf->sensors.imu_sent)
   {
     mavlink_msg_small_imu_send(MAVLINK_COMM_0,
-                               _imu_time,
-                               _accel.x,
-                               _accel.y,
-                               _accel.z,
-                               _gyro.x,
-                               _gyro.y,
-                               _gyro.z,
-                               _imu_temperature);
+                               rf->sensors.imu_time,
+                               rf->sensors.accel.x,
+                               rf->sensors.accel.y,
+                               rf->sensors.accel.z,
+                               rf->sensors.gyro.x,
+                               rf->sensors.gyro.y,
+                               rf->sensors.gyro.z,
+                               rf->sensors.imu_temperature);
   }
   else
   {
     // Otherwise, wait and signal that we still need to send IMU
-    mavlink_streams[MAVLINK_STREAM_ID_IMU].next_time_us -= mavlink_streams[MAVLINK_STREAM_ID_IMU].period_us;
+    mavlink_stream_t *stream = &rf->mavlink.streams[MAVLINK_STREAM_ID_IMU];
+    stream->next_time_us -= stream->period_us;
   }
 }
 
-static void mavlink_send_rosflight_output_raw(void)
+static void mavlink_send_rosflight_output_raw(rosflight_t *rf)
 {
   mavlink_msg_rosflight_output_raw_send(MAVLINK_COMM_0,
                                         clock_millis(),
-                                        _outputs);
+                                        rf->mixer.outputs);
 }
 
-static void mavlink_send_rc_raw(void)
+static void mavlink_send_rc_raw(rosflight_t *rf)
 {
   mavlink_msg_rc_channels_send(MAVLINK_COMM_0,
                                clock_millis(),
@@ -179,68 +232,112 @@ static void mavlink_send_rc_raw(void)
                                0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0);
 }
 
-static void mavlink_send_diff_pressure(void)
+static void mavlink_send_diff_pressure(rosflight_t *rf)
 {
   if (diff_pressure_present())
   {
-    mavlink_msg_diff_pressure_send(MAVLINK_COMM_0, _diff_pressure_velocity, _diff_pressure, _diff_pressure_temp);
+    mavlink_msg_diff_pressure_send(MAVLINK_COMM_0, rf->sensors.diff_pressure_velocity, rf->sensors.diff_pressure, rf->sensors.diff_pressure_temp);
   }
 }
 
-static void mavlink_send_baro(void)
+static void mavlink_send_baro(rosflight_t *rf)
 {
   if (baro_present())
   {
-    mavlink_msg_small_baro_send(MAVLINK_COMM_0, _baro_altitude, _baro_pressure, _baro_temperature);
+    mavlink_msg_small_baro_send(MAVLINK_COMM_0, rf->sensors.baro_altitude, rf->sensors.baro_pressure, rf->sensors.baro_temperature);
   }
 }
 
-static void mavlink_send_sonar(void)
+static void mavlink_send_sonar(rosflight_t *rf)
 {
   if (sonar_present())
   {
     mavlink_msg_small_sonar_send(MAVLINK_COMM_0,
-                                 _sonar_range,
+                                 rf->sensors.sonar_range,
                                  8.0,
                                  0.25);
   }
 }
 
-static void mavlink_send_mag(void)
+static void mavlink_send_altitude(rosflight_t *rf)
+{
+  // up from where the vehicle was armed, so there's no raw baro for the companion computer to fuse
+  if (rf->estimator.altitude.valid)
+  {
+    mavlink_send_named_value_float("alt", rf->estimator.state.altitude);
+    mavlink_send_named_value_float("alt_vz", rf->estimator.state.vertical_velocity);
+  }
+}
+
+static void mavlink_send_mag(rosflight_t *rf)
 {
   if (mag_present())
   {
     mavlink_msg_small_mag_send(MAVLINK_COMM_0,
-                               _mag.x,
-                               _mag.y,
-                               _mag.z);
+                               rf->sensors.mag.x,
+                               rf->sensors.mag.y,
+                               rf->sensors.mag.z);
   }
 }
 
-static void mavlink_send_low_priority(void)
+static void mavlink_send_scheduler(rosflight_t *rf)
+{
+  // Report one task per call so we don't flood the link
+  task_id_t task_id = rf->mavlink.scheduler_stream_id;
+  const task_t *task = scheduler_get_task(rf, task_id);
+
+  char name[MAVLINK_MSG_NAMED_VALUE_INT_FIELD_NAME_LEN];
+  size_t len = strlen(task->name);
+  memcpy(name, task->name, len);
+
+  memcpy(name + len, "_max", 5);
+  mavlink_send_named_value_int(name, task->max_exec_us);
+  memcpy(name + len, "_ovr", 5);
+  mavlink_send_named_value_int(name, task->overruns);
+
+  // The max is the worst case since the last report
+  scheduler_reset_max(rf, task_id);
+  rf->mavlink.scheduler_stream_id = (task_id + 1) % TASK_COUNT;
+}
+
+static void mavlink_send_low_priority(rosflight_t *rf)
 {
-  mavlink_send_next_param();
+  mavlink_send_next_param(rf);
 }
 
 // function definitions
-void mavlink_stream(uint64_t time_us)
+void init_mavlink_stream(rosflight_t *rf)
+{
+  for (int i = 0; i < MAVLINK_STREAM_COUNT; i++)
+  {
+    rf->mavlink.streams[i].period_us = 0;
+    rf->mavlink.streams[i].next_time_us = 0;
+  }
+  rf->mavlink.streams[MAVLINK_STREAM_ID_LOW_PRIORITY].period_us = 5000;
+
+  rf->mavlink.profile_stream_id = 0;
+  rf->mavlink.scheduler_stream_id = 0;
+}
+
+void mavlink_stream(rosflight_t *rf, uint64_t time_us)
 {
   for (int i = 0; i < MAVLINK_STREAM_COUNT; i++)
   {
-    if (time_us >= mavlink_streams[i].next_time_us)
+    mavlink_stream_t *stream = &rf->mavlink.streams[i];
+    if (time_us >= stream->next_time_us)
     {
-      mavlink_streams[i].next_time_us += mavlink_streams[i].period_us;
-      mavlink_streams[i].send_function();
+      stream->next_time_us += stream->period_us;
+      send_functions[i](rf);
     }
   }
 }
 
-void mavlink_stream_set_rate(mavlink_stream_id_t stream_id, uint32_t rate)
+void mavlink_stream_set_rate(rosflight_t *rf, mavlink_stream_id_t stream_id, uint32_t rate)
 {
-  mavlink_streams[stream_id].period_us = (rate == 0 ? 0 : 1000000/rate);
+  rf->mavlink.streams[stream_id].period_us = (rate == 0 ? 0 : 1000000/rate);
 }
 
-void mavlink_stream_set_period(mavlink_stream_id_t stream_id, uint32_t period_us)
+void mavlink_stream_set_period(rosflight_t *rf, mavlink_stream_id_t stream_id, uint32_t period_us)
 {
-  mavlink_streams[stream_id].period_us = period_us;
+  rf->mavlink.streams[stream_id].period_us = period_us;
 }
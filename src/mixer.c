@@ -40,13 +40,10 @@ extern "C" {
 #include "mode.h"
 #include "rc.h"
 #include "estimator.h"
+#include "rosflight.h"
 
 #include "mavlink_log.h"
 
-static float prescaled_outputs[8];
-float _outputs[8];
-command_t _command;
-
 static mixer_t quadcopter_plus_mixing =
 {
   {M, M, M, M, NONE, NONE, NONE, NONE}, // output_type
@@ -96,8 +93,6 @@ static mixer_t X8_mixing =
   { 1.0f,  -1.0f,    1.0f,   -1.0f,    1.0f,   -1.0f,   1.0f, -1.0f}  // Z Mix
 };
 
-static mixer_t *mixer_to_use;
-
 static mixer_t *array_of_mixers[NUM_MIXERS] =
 {
   &quadcopter_plus_mixing,
@@ -109,58 +104,206 @@ static mixer_t *array_of_mixers[NUM_MIXERS] =
 
 
 
-void init_mixing()
+void init_mixing(rosflight_t *rf)
 {
   // clear the invalid mixer flag
-  _error_state &= ~(ERROR_INVALID_MIXER);
+  rf->mode.error_state &= ~(ERROR_INVALID_MIXER);
 
-  uint8_t mixer_choice = get_param_int(PARAM_MIXER);
+  uint8_t mixer_choice = get_param_int(rf, PARAM_MIXER);
 
   if (mixer_choice >= NUM_MIXERS)
   {
     mavlink_log_error("Invalid Mixer Choice", NULL);
     mixer_choice = 0;
     // set the invalid mixer flag
-    _error_state |= ERROR_INVALID_MIXER;
+    rf->mode.error_state |= ERROR_INVALID_MIXER;
   }
 
-  mixer_to_use = array_of_mixers[mixer_choice];
+  rf->mixer.mixer_to_use = array_of_mixers[mixer_choice];
+  update_mixer_params(rf);
 
   for (int8_t i=0; i<8; i++)
   {
-    _outputs[i] = 0.0f;
-    prescaled_outputs[i] = 0.0f;
+    rf->mixer.outputs[i] = 0.0f;
+    rf->mixer.prescaled_outputs[i] = 0.0f;
   }
-  _command.F = 0;
-  _command.x = 0;
-  _command.y = 0;
-  _command.z = 0;
+  rf->mixer.command.F = 0;
+  rf->mixer.command.x = 0;
+  rf->mixer.command.y = 0;
+  rf->mixer.command.z = 0;
 }
 
-void init_PWM()
+void init_PWM(rosflight_t *rf)
 {
   bool useCPPM = false;
-  if (get_param_int(PARAM_RC_TYPE) == 1)
+  if (get_param_int(rf, PARAM_RC_TYPE) == 1)
   {
     useCPPM = true;
   }
-  int16_t motor_refresh_rate = get_param_int(PARAM_MOTOR_PWM_SEND_RATE);
-  int16_t off_pwm = get_param_int(PARAM_MOTOR_MIN_PWM);
+  int16_t motor_refresh_rate = get_param_int(rf, PARAM_MOTOR_PWM_SEND_RATE);
+  int16_t off_pwm = get_param_int(rf, PARAM_MOTOR_MIN_PWM);
   pwm_init(useCPPM, motor_refresh_rate, off_pwm);
 }
 
 
-void write_motor(uint8_t index, float value)
+void update_mixer_params(rosflight_t *rf)
+{
+  mixer_params_t *params = &rf->mixer.params;
+  params->fixed_wing = get_param_int(rf, PARAM_FIXED_WING);
+  params->aileron_sign = get_param_int(rf, PARAM_AILERON_REVERSE) ? -1 : 1;
+  params->elevator_sign = get_param_int(rf, PARAM_ELEVATOR_REVERSE) ? -1 : 1;
+  params->rudder_sign = get_param_int(rf, PARAM_RUDDER_REVERSE) ? -1 : 1;
+
+  params->motor_idle_throttle = get_param_float(rf, PARAM_MOTOR_IDLE_THROTTLE);
+  params->spin_motors_when_armed = get_param_int(rf, PARAM_SPIN_MOTORS_WHEN_ARMED);
+  params->motor_min_pwm = get_param_int(rf, PARAM_MOTOR_MIN_PWM);
+  params->motor_pwm_span = get_param_int(rf, PARAM_MOTOR_MAX_PWM) - get_param_int(rf, PARAM_MOTOR_MIN_PWM);
+
+#ifdef FIXED_POINT_CONTROL
+  // rounded down, so that motors held at idle don't read above MOTOR_IDLE_THROTTLE
+  params->fixed.motor_idle_throttle = params->motor_idle_throttle * Q16_ONE;
+  params->fixed.motor_pwm_span = params->motor_pwm_span;
+
+  // PARAM_MOTOR_MIN_PWM can change before init_mixing has picked a mixer
+  const mixer_t *mixer = rf->mixer.mixer_to_use;
+  if (mixer != NULL)
+  {
+    for (int8_t i=0; i<8; i++)
+    {
+      params->fixed.mix[0][i] = q16_from_float(mixer->F[i]);
+      params->fixed.mix[1][i] = q16_from_float(mixer->x[i]);
+      params->fixed.mix[2][i] = q16_from_float(mixer->y[i]);
+      params->fixed.mix[3][i] = q16_from_float(mixer->z[i]);
+    }
+  }
+#endif
+}
+
+
+#ifdef FIXED_POINT_CONTROL
+// Same as the float versions below, with values in Q16
+static void write_motor(rosflight_t *rf, uint8_t index, q16_t value)
+{
+  const mixer_params_t *params = &rf->mixer.params;
+  if (rf->mode.armed_state & ARMED)
+  {
+    if (value > Q16_ONE)
+    {
+      value = Q16_ONE;
+    }
+    else if (value < params->fixed.motor_idle_throttle && params->spin_motors_when_armed)
+    {
+      value = params->fixed.motor_idle_throttle;
+    }
+    else if (value < 0)
+    {
+      value = 0;
+    }
+  }
+  else
+  {
+    value = 0;
+  }
+  rf->mixer.outputs[index] = q16_to_float(value);
+  int32_t pwm_us = (((int64_t) value * params->fixed.motor_pwm_span) >> 16) + params->motor_min_pwm;
+  pwm_write(index, pwm_us);
+}
+
+
+static void write_servo(rosflight_t *rf, uint8_t index, q16_t value)
 {
-  if (_armed_state & ARMED)
+  if (value > Q16_ONE)
+  {
+    value = Q16_ONE;
+  }
+  else if (value < -Q16_ONE)
+  {
+    value = -Q16_ONE;
+  }
+  rf->mixer.outputs[index] = q16_to_float(value);
+  pwm_write(index, ((value * 500) >> 16) + 1500);
+}
+
+
+void mix_output(rosflight_t *rf)
+{
+  const mixer_t *mixer_to_use = rf->mixer.mixer_to_use;
+  const mixer_fixed_params_t *fixed = &rf->mixer.params.fixed;
+  command_t *command = &rf->mixer.command;
+  q16_t *prescaled_outputs = rf->mixer.prescaled_outputs;
+
+  // Reverse Fixedwing channels just before mixing if we need to
+  if (rf->mixer.params.fixed_wing)
+  {
+    command->x *= rf->mixer.params.aileron_sign;
+    command->y *= rf->mixer.params.elevator_sign;
+    command->z *= rf->mixer.params.rudder_sign;
+  }
+
+  const q16_t cmd[4] =
+  {
+    q16_from_float(command->F),
+    q16_from_float(command->x),
+    q16_from_float(command->y),
+    q16_from_float(command->z)
+  };
+
+  q16_t max_output = Q16_ONE;
+  for (int8_t i=0; i<8; i++)
+  {
+    if (mixer_to_use->output_type[i] != NONE)
+    {
+      int64_t sum = (int64_t) cmd[0]*fixed->mix[0][i] + (int64_t) cmd[1]*fixed->mix[1][i]
+                    + (int64_t) cmd[2]*fixed->mix[2][i] + (int64_t) cmd[3]*fixed->mix[3][i];
+      prescaled_outputs[i] = q31_sat(sum >> 16);
+
+      if (prescaled_outputs[i] > max_output)
+      {
+        max_output = prescaled_outputs[i];
+      }
+    }
+  }
+
+  // 2^32/max_output is 1/max_output in Q16.  Rounding it up puts the largest output at 1.0 exactly
+  // after write_motor() saturates it, as in the float version.
+  uint32_t scale_factor = 0;
+  if (max_output > Q16_ONE)
+  {
+    scale_factor = 0xFFFFFFFFu / (uint32_t) max_output + 1;
+  }
+
+  for (int8_t i=0; i<8; i++)
+  {
+    if (mixer_to_use->output_type[i] == S)
+    {
+      write_servo(rf, i, prescaled_outputs[i]);
+    }
+    else if (mixer_to_use->output_type[i] == M)
+    {
+      if (scale_factor != 0)
+      {
+        prescaled_outputs[i] = ((int64_t) prescaled_outputs[i] * scale_factor) >> 16;
+      }
+      write_motor(rf, i, prescaled_outputs[i]);
+    }
+  }
+}
+
+#else
+
+
+static void write_motor(rosflight_t *rf, uint8_t index, float value)
+{
+  const mixer_params_t *params = &rf->mixer.params;
+  if (rf->mode.armed_state & ARMED)
   {
     if (value > 1.0)
     {
       value = 1.0;
     }
-    else if (value < get_param_float(PARAM_MOTOR_IDLE_THROTTLE) && get_param_int(PARAM_SPIN_MOTORS_WHEN_ARMED))
+    else if (value < params->motor_idle_throttle && params->spin_motors_when_armed)
     {
-      value = get_param_float(PARAM_MOTOR_IDLE_THROTTLE);
+      value = params->motor_idle_throttle;
     }
     else if (value < 0.0)
     {
@@ -171,14 +314,13 @@ void write_motor(uint8_t index, float value)
   {
     value = 0.0;
   }
-  _outputs[index] = value;
-  int32_t pwm_us = value * (get_param_int(PARAM_MOTOR_MAX_PWM) - get_param_int(PARAM_MOTOR_MIN_PWM))
-                     + get_param_int(PARAM_MOTOR_MIN_PWM);
+  rf->mixer.outputs[index] = value;
+  int32_t pwm_us = value * params->motor_pwm_span + params->motor_min_pwm;
   pwm_write(index, pwm_us);
 }
 
 
-void write_servo(uint8_t index, float value)
+static void write_servo(rosflight_t *rf, uint8_t index, float value)
 {
   if (value > 1.0)
   {
@@ -188,21 +330,25 @@ void write_servo(uint8_t index, float value)
   {
     value = -1.0;
   }
-  _outputs[index] = value;
-  pwm_write(index, _outputs[index] * 500 + 1500);
+  rf->mixer.outputs[index] = value;
+  pwm_write(index, rf->mixer.outputs[index] * 500 + 1500);
 }
 
 
-void mix_output()
+void mix_output(rosflight_t *rf)
 {
+  mixer_t *mixer_to_use = rf->mixer.mixer_to_use;
+  command_t *command = &rf->mixer.command;
+  float *prescaled_outputs = rf->mixer.prescaled_outputs;
+
   float max_output = 1.0f;
 
   // Reverse Fixedwing channels just before mixing if we need to
-  if (get_param_int(PARAM_FIXED_WING))
+  if (rf->mixer.params.fixed_wing)
   {
-    _command.x *= get_param_int(PARAM_AILERON_REVERSE) ? -1 : 1;
-    _command.y *= get_param_int(PARAM_ELEVATOR_REVERSE) ? -1 : 1;
-    _command.z *= get_param_int(PARAM_RUDDER_REVERSE) ? -1 : 1;
+    command->x *= rf->mixer.params.aileron_sign;
+    command->y *= rf->mixer.params.elevator_sign;
+    command->z *= rf->mixer.params.rudder_sign;
   }
 
   for (int8_t i=0; i<8; i++)
@@ -210,8 +356,8 @@ void mix_output()
     if (mixer_to_use->output_type[i] != NONE)
     {
       // Matrix multiply to mix outputs
-      prescaled_outputs[i] = (_command.F*mixer_to_use->F[i] + _command.x*mixer_to_use->x[i] +
-                              _command.y*mixer_to_use->y[i] + _command.z*mixer_to_use->z[i]);
+      prescaled_outputs[i] = (command->F*mixer_to_use->F[i] + command->x*mixer_to_use->x[i] +
+                              command->y*mixer_to_use->y[i] + command->z*mixer_to_use->z[i]);
 
       // Save off the largest control output if it is greater than 1.0 for future scaling
       if (prescaled_outputs[i] > max_output)
@@ -234,16 +380,17 @@ void mix_output()
     // Write output to motors
     if (mixer_to_use->output_type[i] == S)
     {
-      write_servo(i, prescaled_outputs[i]);
+      write_servo(rf, i, prescaled_outputs[i]);
     }
     else if (mixer_to_use->output_type[i] == M)
     {
       // scale all motor outputs by scale factor (this is usually 1.0, unless we saturated)
       prescaled_outputs[i] *= scale_factor;
-      write_motor(i, prescaled_outputs[i]);
+      write_motor(rf, i, prescaled_outputs[i]);
     }
   }
 }
+#endif
 
 
 #ifdef __cplusplus
@@ -40,41 +40,41 @@
 #include "sensors.h"
 
 #include "mode.h"
+#include "rosflight.h"
 
 #include "mavlink_log.h"
 
 
-armed_state_t _armed_state;
-error_state_t _error_state;
-
-
-void init_mode(void)
+void init_mode(rosflight_t *rf)
 {
-  _armed_state = 0x00;
-  _error_state = ERROR_NONE;
+  rf->mode.armed_state = 0x00;
+  rf->mode.error_state = ERROR_NONE;
+  rf->mode.prev_time_ms = 0;
+  rf->mode.time_sticks_have_been_in_arming_position_ms = 0;
+  rf->mode.started_gyro_calibration = false;
+  rf->mode.failsafe_blink_count = 0;
 }
 
-bool arm(void)
+bool arm(rosflight_t *rf)
 {
-  if (_error_state)
+  if (rf->mode.error_state)
   {
-    mavlink_log_error("Unable to arm due to error code %d", _error_state);
+    mavlink_log_error("Unable to arm due to error code %d", rf->mode.error_state);
     return false;
   }
 
-  else if (get_param_int(PARAM_CALIBRATE_GYRO_ON_ARM))
+  else if (get_param_int(rf, PARAM_CALIBRATE_GYRO_ON_ARM))
   {
-    static bool started_gyro_calibration = false;
-    if (!started_gyro_calibration && !(_armed_state & ARMED))
+    if (!rf->mode.started_gyro_calibration && !(rf->mode.armed_state & ARMED))
     {
-      start_gyro_calibration();
-      started_gyro_calibration = true;
+      start_gyro_calibration(rf);
+      rf->mode.started_gyro_calibration = true;
       return false;
     }
-    else if (gyro_calibration_complete())
+    else if (gyro_calibration_complete(rf))
     {
-      started_gyro_calibration = false;
-      _armed_state |= ARMED;
+      rf->mode.started_gyro_calibration = false;
+      rf->mode.armed_state |= ARMED;
       led1_on();
       return true;
     }
@@ -83,9 +83,9 @@ bool arm(void)
 
   else
   {
-    if (!(_armed_state & ARMED))
+    if (!(rf->mode.armed_state & ARMED))
     {
-      _armed_state |= ARMED;
+      rf->mode.armed_state |= ARMED;
       led1_on();
       return true;
     }
@@ -94,13 +94,13 @@ bool arm(void)
   return false;
 }
 
-void disarm(void)
+void disarm(rosflight_t *rf)
 {
-  _armed_state &= ~(ARMED);
+  rf->mode.armed_state &= ~(ARMED);
   led1_off();
 }
 
-bool check_failsafe(void)
+bool check_failsafe(rosflight_t *rf)
 {
 
   bool failsafe = false;
@@ -111,12 +111,12 @@ bool check_failsafe(void)
     failsafe = true;
 
     // Set the RC Lost error flag
-    _error_state |= ERROR_RC_LOST;
+    rf->mode.error_state |= ERROR_RC_LOST;
   }
   else
   {
     // go into failsafe if we get an invalid RC command for any channel
-    for (int8_t i = 0; i<get_param_int(PARAM_RC_NUM_CHANNELS); i++)
+    for (int8_t i = 0; i<get_param_int(rf, PARAM_RC_NUM_CHANNELS); i++)
     {
       if (pwm_read(i) < 900 || pwm_read(i) > 2100)
       {
@@ -128,26 +128,25 @@ bool check_failsafe(void)
   if (failsafe)
   {
     // blink LED to let the user know we are in failsafe
-    static uint8_t count = 0;
-    if (count > 25)
+    if (rf->mode.failsafe_blink_count > 25)
     {
       led1_toggle();
-      count = 0;
+      rf->mode.failsafe_blink_count = 0;
     }
-    count++;
+    rf->mode.failsafe_blink_count++;
 
     // Set the FAILSAFE bit
-    _armed_state |= FAILSAFE;
+    rf->mode.armed_state |= FAILSAFE;
   }
   else
   {
     // we got a valid RC measurement for all channels and pwm is active
     // Clear the FAILSAFE bit
-    _armed_state &= ~(FAILSAFE);
+    rf->mode.armed_state &= ~(FAILSAFE);
 
     // clear the RC Lost error
-    _error_state &= ~(ERROR_RC_LOST);
-    if (_armed_state & ARMED)
+    rf->mode.error_state &= ~(ERROR_RC_LOST);
+    if (rf->mode.armed_state & ARMED)
       led1_on();
     else
       led1_off();
@@ -157,80 +156,71 @@ bool check_failsafe(void)
 }
 
 
-bool check_mode()
+bool check_mode(rosflight_t *rf)
 {
-  static uint32_t prev_time_ms = 0;
-  static uint32_t time_sticks_have_been_in_arming_position_ms = 0;
-
   uint32_t now_ms = clock_millis();
 
-  // see it has been at least 20 ms
-  uint32_t dt = now_ms-prev_time_ms;
-  if (dt < 20)
-  {
-    return false;
-  }
-
-  // if it has, then do stuff
-  prev_time_ms = now_ms;
+  // the scheduler runs us every 20 ms, but keep track of the actual interval for the arming timer
+  uint32_t dt = now_ms-rf->mode.prev_time_ms;
+  rf->mode.prev_time_ms = now_ms;
 
   // check for failsafe mode
-  if (check_failsafe())
+  if (check_failsafe(rf))
   {
     return true;
   }
   else
   {
     // check for arming switch
-    if (!rc_switch_mapped(RC_SWITCH_ARM))
+    if (!rc_switch_mapped(rf, RC_SWITCH_ARM))
     {
-      if (!(_armed_state & ARMED))
+      if (!(rf->mode.armed_state & ARMED))
       {
         // if left stick is down and to the right
-        if (rc_stick(RC_STICK_F) < get_param_float(PARAM_ARM_THRESHOLD)
-            && rc_stick(RC_STICK_Z) > (1.0f - get_param_float(PARAM_ARM_THRESHOLD)))
+        if (rc_stick(rf, RC_STICK_F) < get_param_float(rf, PARAM_ARM_THRESHOLD)
+            && rc_stick(rf, RC_STICK_Z) > (1.0f - get_param_float(rf, PARAM_ARM_THRESHOLD)))
         {
-          time_sticks_have_been_in_arming_position_ms += dt;
+          rf->mode.time_sticks_have_been_in_arming_position_ms += dt;
         }
         else
         {
-          time_sticks_have_been_in_arming_position_ms = 0;
+          rf->mode.time_sticks_have_been_in_arming_position_ms = 0;
         }
-        if (time_sticks_have_been_in_arming_position_ms > 500)
+        if (rf->mode.time_sticks_have_been_in_arming_position_ms > 500)
         {
-          if (arm())
-            time_sticks_have_been_in_arming_position_ms = 0;
+          if (arm(rf))
+            rf->mode.time_sticks_have_been_in_arming_position_ms = 0;
         }
       }
-      else // _armed_state is ARMED
+      else // armed_state is ARMED
       {
         // if left stick is down and to the left
-        if (rc_stick(RC_STICK_F) < get_param_float(PARAM_ARM_THRESHOLD)
-            && rc_stick(RC_STICK_Z) < -(1.0f - get_param_float(PARAM_ARM_THRESHOLD)))
+        if (rc_stick(rf, RC_STICK_F) < get_param_float(rf, PARAM_ARM_THRESHOLD)
+            && rc_stick(rf, RC_STICK_Z) < -(1.0f - get_param_float(rf, PARAM_ARM_THRESHOLD)))
         {
-          time_sticks_have_been_in_arming_position_ms += dt;
+          rf->mode.time_sticks_have_been_in_arming_position_ms += dt;
         }
         else
         {
-          time_sticks_have_been_in_arming_position_ms = 0;
+          rf->mode.time_sticks_have_been_in_arming_position_ms = 0;
         }
-        if (time_sticks_have_been_in_arming_position_ms > 500)
+        if (rf->mode.time_sticks_have_been_in_arming_position_ms > 500)
         {
-          disarm();
-          time_sticks_have_been_in_arming_position_ms = 0;
+          disarm(rf);
+          rf->mode.time_sticks_have_been_in_arming_position_ms = 0;
         }
       }
     }
     else
     {
-      if (rc_switch(RC_SWITCH_ARM))
+      if (rc_switch(rf, RC_SWITCH_ARM))
       {
-        if (!(_armed_state & ARMED))
-          arm();
+        if (!(rf->mode.armed_state & ARMED))
+          arm(rf);
       }
       else
       {
-        disarm();
+        disarm(rf);
       }
     }
   }
@@ -40,23 +40,7 @@
 #include "param.h"
 #include "mode.h"
 #include "mavlink_receive.h"
-
-control_t _rc_control;
-control_t _offboard_control;
-control_t _combined_control;
-bool _new_command;
-
-static bool rc_override;
-static bool offboard_control_is_active;
-
-
-control_t _failsafe_control =
-{
-  {true, ANGLE, 0.0},
-  {true, ANGLE, 0.0},
-  {true, RATE, 0.0},
-  {true, THROTTLE, 0.0}
-};
+#include "rosflight.h"
 
 typedef enum
 {
@@ -72,148 +56,242 @@ typedef enum
   MUX_F,
 } mux_channel_t;
 
-typedef struct
+// RC stick that overrides each of the x, y and z channels when deflected
+static const rc_stick_t rc_stick_override[] =
 {
-  rc_stick_t rc_channel;
-  uint32_t last_override_time;
-} rc_stick_override_t;
+  RC_STICK_X,
+  RC_STICK_Y,
+  RC_STICK_Z
+};
 
-rc_stick_override_t rc_stick_override[] =
+void init_mux(rosflight_t *rf)
 {
-  { RC_STICK_X, 0 },
-  { RC_STICK_Y, 0 },
-  { RC_STICK_Z, 0 }
-};
+  mux_state_t *mux = &rf->mux;
+
+  control_t failsafe_control =
+  {
+    {true, ANGLE, 0.0},
+    {true, ANGLE, 0.0},
+    {true, RATE, 0.0},
+    {true, THROTTLE, 0.0}
+  };
+  mux->failsafe_control = failsafe_control;
+
+  mux->new_command = false;
+  mux->rc_override = false;
+
+  for (int i = 0; i < 3; i++)
+    mux->rc_stick_override_time[i] = 0;
 
-typedef struct
+  mux->muxes[MUX_X] = (mux_t) {&mux->rc_control.x, &mux->offboard_control.x, &mux->combined_control.x};
+  mux->muxes[MUX_Y] = (mux_t) {&mux->rc_control.y, &mux->offboard_control.y, &mux->combined_control.y};
+  mux->muxes[MUX_Z] = (mux_t) {&mux->rc_control.z, &mux->offboard_control.z, &mux->combined_control.z};
+  mux->muxes[MUX_F] = (mux_t) {&mux->rc_control.F, &mux->offboard_control.F, &mux->combined_control.F};
+
+  update_mux_params(rf);
+}
+
+void update_mux_params(rosflight_t *rf)
 {
-  control_channel_t *rc;
-  control_channel_t *onboard;
-  control_channel_t *combined;
-} mux_t;
+  mux_params_t *params = &rf->mux.params;
+  params->fixed_wing = get_param_int(rf, PARAM_FIXED_WING);
+  params->rate_mode = (get_param_int(rf, PARAM_RC_ATTITUDE_MODE) == ATT_MODE_RATE);
+  params->max_roll = get_param_float(rf, PARAM_RC_MAX_ROLL);
+  params->max_pitch = get_param_float(rf, PARAM_RC_MAX_PITCH);
+  params->max_rollrate = get_param_float(rf, PARAM_RC_MAX_ROLLRATE);
+  params->max_pitchrate = get_param_float(rf, PARAM_RC_MAX_PITCHRATE);
+  params->max_yawrate = get_param_float(rf, PARAM_RC_MAX_YAWRATE);
+  params->override_lag_time_ms = get_param_int(rf, PARAM_OVERRIDE_LAG_TIME);
+  params->override_deviation = get_param_float(rf, PARAM_RC_OVERRIDE_DEVIATION);
+  params->take_min_throttle = get_param_int(rf, PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE);
+  params->failsafe_throttle = get_param_float(rf, PARAM_FAILSAFE_THROTTLE);
+
+#ifdef FIXED_POINT_CONTROL
+  params->fixed.max_roll = q16_from_float(params->max_roll);
+  params->fixed.max_pitch = q16_from_float(params->max_pitch);
+  params->fixed.max_rollrate = q16_from_float(params->max_rollrate);
+  params->fixed.max_pitchrate = q16_from_float(params->max_pitchrate);
+  params->fixed.max_yawrate = q16_from_float(params->max_yawrate);
+  params->fixed.override_deviation = q16_from_float(params->override_deviation);
+#endif
+}
 
-mux_t muxes[4] =
+#ifdef FIXED_POINT_CONTROL
+// Same as the float version below, scaling the Q16 stick values
+static void interpret_rc(rosflight_t *rf)
 {
-  {&_rc_control.x, &_offboard_control.x, &_combined_control.x},
-  {&_rc_control.y, &_offboard_control.y, &_combined_control.y},
-  {&_rc_control.z, &_offboard_control.z, &_combined_control.z},
-  {&_rc_control.F, &_offboard_control.F, &_combined_control.F}
-};
+  control_t *rc_control = &rf->mux.rc_control;
+  const mux_fixed_params_t *fixed = &rf->mux.params.fixed;
+
+  q16_t x = rc_stick_fixed(rf, RC_STICK_X);
+  q16_t y = rc_stick_fixed(rf, RC_STICK_Y);
+  q16_t z = rc_stick_fixed(rf, RC_STICK_Z);
+  rc_control->F.value = rc_stick(rf, RC_STICK_F);
 
-static void interpret_rc(void)
+  if (rf->mux.params.fixed_wing)
+  {
+    rc_control->x.type = PASSTHROUGH;
+    rc_control->y.type = PASSTHROUGH;
+    rc_control->z.type = PASSTHROUGH;
+  }
+  else
+  {
+    control_type_t roll_pitch_type;
+    if (rc_switch_mapped(rf, RC_SWITCH_ATT_TYPE))
+    {
+      roll_pitch_type = rc_switch(rf, RC_SWITCH_ATT_TYPE) ? ANGLE : RATE;
+    }
+    else
+    {
+      roll_pitch_type = rf->mux.params.rate_mode ? RATE: ANGLE;
+    }
+
+    rc_control->x.type = roll_pitch_type;
+    rc_control->y.type = roll_pitch_type;
+
+    switch (roll_pitch_type)
+    {
+    case RATE:
+      x = q16_mul(x, fixed->max_rollrate);
+      y = q16_mul(y, fixed->max_pitchrate);
+      break;
+    case ANGLE:
+      x = q16_mul(x, fixed->max_roll);
+      y = q16_mul(y, fixed->max_pitch);
+    }
+
+    rc_control->z.type = RATE;
+    z = q16_mul(z, fixed->max_yawrate);
+
+    rc_control->F.type = THROTTLE;
+  }
+
+  rc_control->x.value = q16_to_float(x);
+  rc_control->y.value = q16_to_float(y);
+  rc_control->z.value = q16_to_float(z);
+}
+
+#else
+
+static void interpret_rc(rosflight_t *rf)
 {
   // get initial, unscaled RC values
-  _rc_control.x.value = rc_stick(RC_STICK_X);
-  _rc_control.y.value = rc_stick(RC_STICK_Y);
-  _rc_control.z.value = rc_stick(RC_STICK_Z);
-  _rc_control.F.value = rc_stick(RC_STICK_F);
+  rf->mux.rc_control.x.value = rc_stick(rf, RC_STICK_X);
+  rf->mux.rc_control.y.value = rc_stick(rf, RC_STICK_Y);
+  rf->mux.rc_control.z.value = rc_stick(rf, RC_STICK_Z);
+  rf->mux.rc_control.F.value = rc_stick(rf, RC_STICK_F);
 
   // determine control mode for each channel and scale command values accordingly
-  if (get_param_int(PARAM_FIXED_WING)) //Fixed wing aircraft have no command scaling or PID control
+  if (rf->mux.params.fixed_wing) //Fixed wing aircraft have no command scaling or PID control
   {
-    _rc_control.x.type = PASSTHROUGH;
-    _rc_control.y.type = PASSTHROUGH;
-    _rc_control.z.type = PASSTHROUGH;
+    rf->mux.rc_control.x.type = PASSTHROUGH;
+    rf->mux.rc_control.y.type = PASSTHROUGH;
+    rf->mux.rc_control.z.type = PASSTHROUGH;
   }
   else
   {
     // roll and pitch
     control_type_t roll_pitch_type;
-    if (rc_switch_mapped(RC_SWITCH_ATT_TYPE))
+    if (rc_switch_mapped(rf, RC_SWITCH_ATT_TYPE))
     {
-      roll_pitch_type = rc_switch(RC_SWITCH_ATT_TYPE) ? ANGLE : RATE;
+      roll_pitch_type = rc_switch(rf, RC_SWITCH_ATT_TYPE) ? ANGLE : RATE;
     }
     else
     {
-      roll_pitch_type = (get_param_int(PARAM_RC_ATTITUDE_MODE) == ATT_MODE_RATE) ? RATE: ANGLE;
+      roll_pitch_type = rf->mux.params.rate_mode ? RATE: ANGLE;
     }
 
-    _rc_control.x.type = roll_pitch_type;
-    _rc_control.y.type = roll_pitch_type;
+    rf->mux.rc_control.x.type = roll_pitch_type;
+    rf->mux.rc_control.y.type = roll_pitch_type;
 
     // Scale command to appropriate units
     switch (roll_pitch_type)
     {
     case RATE:
-      _rc_control.x.value *= get_param_float(PARAM_RC_MAX_ROLLRATE);
-      _rc_control.y.value *= get_param_float(PARAM_RC_MAX_PITCHRATE);
+      rf->mux.rc_control.x.value *= rf->mux.params.max_rollrate;
+      rf->mux.rc_control.y.value *= rf->mux.params.max_pitchrate;
       break;
     case ANGLE:
-      _rc_control.x.value *= get_param_float(PARAM_RC_MAX_ROLL);
-      _rc_control.y.value *= get_param_float(PARAM_RC_MAX_PITCH);
+      rf->mux.rc_control.x.value *= rf->mux.params.max_roll;
+      rf->mux.rc_control.y.value *= rf->mux.params.max_pitch;
     }
 
     // yaw
-    _rc_control.z.type = RATE;
-    _rc_control.z.value *= get_param_float(PARAM_RC_MAX_YAWRATE);
+    rf->mux.rc_control.z.type = RATE;
+    rf->mux.rc_control.z.value *= rf->mux.params.max_yawrate;
 
     // throttle
-    _rc_control.F.type = THROTTLE;
+    rf->mux.rc_control.F.type = THROTTLE;
   }
 }
+#endif
 
-static bool stick_deviated(mux_channel_t channel)
+static bool stick_deviated(rosflight_t *rf, mux_channel_t channel)
 {
   uint32_t now = clock_millis();
 
   // if we are still in the lag time, return true
-  if (now - rc_stick_override[channel].last_override_time < (uint32_t)get_param_int(PARAM_OVERRIDE_LAG_TIME))
+  if (now - rf->mux.rc_stick_override_time[channel] < rf->mux.params.override_lag_time_ms)
   {
     return true;
   }
   else
   {
     //check if the RC value for this channel has moved from center enough to trigger a RC override
-    if (fabs(rc_stick(rc_stick_override[channel].rc_channel)) > get_param_float(PARAM_RC_OVERRIDE_DEVIATION))
+#ifdef FIXED_POINT_CONTROL
+    if (abs(rc_stick_fixed(rf, rc_stick_override[channel])) > rf->mux.params.fixed.override_deviation)
+#else
+    if (fabs(rc_stick(rf, rc_stick_override[channel])) > rf->mux.params.override_deviation)
+#endif
     {
-      rc_stick_override[channel].last_override_time = now;
+      rf->mux.rc_stick_override_time[channel] = now;
       return true;
     }
     return false;
   }
 }
 
-static bool do_roll_pitch_yaw_muxing(mux_channel_t channel)
+static bool do_roll_pitch_yaw_muxing(rosflight_t *rf, mux_channel_t channel)
 {
   //Check if the override switch exists and is triggered, or if the sticks have deviated enough to trigger an override
-  if ((rc_switch_mapped(RC_SWITCH_ATT_OVERRIDE) && rc_switch(RC_SWITCH_ATT_OVERRIDE)) || stick_deviated(channel))
+  if ((rc_switch_mapped(rf, RC_SWITCH_ATT_OVERRIDE) && rc_switch(rf, RC_SWITCH_ATT_OVERRIDE)) || stick_deviated(rf, channel))
   {
-    rc_override = true;
+    rf->mux.rc_override = true;
   }
   else //Otherwise only have RC override if the offboard channel is inactive
   {
-    if (muxes[channel].onboard->active)
+    if (rf->mux.muxes[channel].onboard->active)
     {
-      rc_override = false;
+      rf->mux.rc_override = false;
     }
     else
     {
-      rc_override = true;
+      rf->mux.rc_override = true;
     }
   }
 
   //set the combined channel output depending on whether RC is overriding for this channel or not
-  *muxes[channel].combined = rc_override ? *muxes[channel].rc : *muxes[channel].onboard;
-  return rc_override;
+  *rf->mux.muxes[channel].combined = rf->mux.rc_override ? *rf->mux.muxes[channel].rc : *rf->mux.muxes[channel].onboard;
+  return rf->mux.rc_override;
 }
 
-static bool do_throttle_muxing(void)
+static bool do_throttle_muxing(rosflight_t *rf)
 {
   bool rc_override;
 
   //Check if the override switch exists and is triggered
-  if (rc_switch_mapped(RC_SWITCH_THROTTLE_OVERRIDE) && rc_switch(RC_SWITCH_THROTTLE_OVERRIDE))
+  if (rc_switch_mapped(rf, RC_SWITCH_THROTTLE_OVERRIDE) && rc_switch(rf, RC_SWITCH_THROTTLE_OVERRIDE))
   {
     rc_override = true;
   }
   else //Otherwise check if the offboard throttle channel is active, if it isn't, have RC override
   {
-    if (muxes[MUX_F].onboard->active)
+    if (rf->mux.muxes[MUX_F].onboard->active)
     {
       //Check if the parameter flag is set to have us always take the smaller throttle
-      if (get_param_int(PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE))
+      if (rf->mux.params.take_min_throttle)
       {
-        rc_override = (muxes[MUX_F].rc->value < muxes[MUX_F].onboard->value);
+        rc_override = (rf->mux.muxes[MUX_F].rc->value < rf->mux.muxes[MUX_F].onboard->value);
       }
       else
       {
@@ -227,37 +305,37 @@ static bool do_throttle_muxing(void)
   }
 
   //set the combined channel output depending on whether RC is overriding for this channel or not
-  *muxes[MUX_F].combined = rc_override ? *muxes[MUX_F].rc : *muxes[MUX_F].onboard;
+  *rf->mux.muxes[MUX_F].combined = rc_override ? *rf->mux.muxes[MUX_F].rc : *rf->mux.muxes[MUX_F].onboard;
   return rc_override;
 }
 
 
-bool rc_override_active()
+bool rc_override_active(rosflight_t *rf)
 {
-  return rc_override;
+  return rf->mux.rc_override;
 }
 
-bool offboard_control_active()
+bool offboard_control_active(rosflight_t *rf)
 {
   for (int i = 0; i < 4; i++)
   {
-    if (muxes[i].onboard->active)
+    if (rf->mux.muxes[i].onboard->active)
       return true;
   }
   return false;
 }
 
 
-bool mux_inputs()
+bool mux_inputs(rosflight_t *rf)
 {
   // Check for and apply failsafe command
-  if (_armed_state & FAILSAFE)
+  if (rf->mode.armed_state & FAILSAFE)
   {
-    _failsafe_control.F.value = get_param_float(PARAM_FAILSAFE_THROTTLE);
-    _combined_control = _failsafe_control;
+    rf->mux.failsafe_control.F.value = rf->mux.params.failsafe_throttle;
+    rf->mux.combined_control = rf->mux.failsafe_control;
   }
 
-  else if (!_new_command)
+  else if (!rf->mux.new_command)
   {
     // we haven't received any new commands, so we shouldn't do anything
     return false;
@@ -267,25 +345,25 @@ bool mux_inputs()
   else
   {
     // Read RC
-    interpret_rc();
+    interpret_rc(rf);
 
     // Check for offboard control timeout (100 ms)
-    if (clock_micros() > _offboard_control_time + 100000)
+    if (clock_micros() > rf->mavlink.offboard_control_time + 100000)
     {
       // If it has been longer than 100 ms, then disable the offboard control
-      _offboard_control.F.active = false;
-      _offboard_control.x.active = false;
-      _offboard_control.y.active = false;
-      _offboard_control.z.active = false;
+      rf->mux.offboard_control.F.active = false;
+      rf->mux.offboard_control.x.active = false;
+      rf->mux.offboard_control.y.active = false;
+      rf->mux.offboard_control.z.active = false;
     }
 
     // Perform muxing
     bool rc_override = false;
     for (mux_channel_t i = MUX_X; i <= MUX_Z; i++)
     {
-      rc_override |= do_roll_pitch_yaw_muxing(i);
+      rc_override |= do_roll_pitch_yaw_muxing(rf, i);
     }
-    rc_override |= do_throttle_muxing();
+    rc_override |= do_throttle_muxing(rf);
 
     // Light to indicate override
     if (rc_override)
@@ -299,6 +377,6 @@ bool mux_inputs()
   }
 
   // reset the new command flag
-  _new_command = false;
+  rf->mux.new_command = false;
   return true;
 }
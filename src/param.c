@@ -41,306 +41,449 @@
 #include "mavlink_stream.h"
 
 #include "param.h"
+#include "controller.h"
+#include "estimator.h"
+#include "latency.h"
 #include "mixer.h"
+#include "mux.h"
 #include "rc.h"
-
-// type definitions
-typedef struct
-{
-  uint32_t version;
-  uint16_t size;
-  uint8_t magic_be;                       // magic number, should be 0xBE
-
-  int32_t values[PARAMS_COUNT];
-  char names[PARAMS_COUNT][PARAMS_NAME_LENGTH];
-  param_type_t types[PARAMS_COUNT];
-
-  uint8_t magic_ef;                       // magic number, should be 0xEF
-  uint8_t chk;                            // XOR checksum
-} params_t;
-
-// global variable definitions
-static params_t params;
+#include "sensors.h"
+#include "rosflight.h"
 
 // local function definitions
-static void init_param_int(param_id_t id, char name[PARAMS_NAME_LENGTH], int32_t value)
+static void init_param_int(rosflight_t *rf, param_id_t id, char name[PARAMS_NAME_LENGTH], int32_t value)
 {
-  memcpy(params.names[id], name, PARAMS_NAME_LENGTH);
-  params.values[id] = value;
-  params.types[id] = PARAM_TYPE_INT32;
+  memcpy(rf->params.names[id], name, PARAMS_NAME_LENGTH);
+  rf->params.values[id] = value;
+  rf->params.types[id] = PARAM_TYPE_INT32;
 }
 
-static void init_param_float(param_id_t id, char name[PARAMS_NAME_LENGTH], float value)
+static void init_param_float(rosflight_t *rf, param_id_t id, char name[PARAMS_NAME_LENGTH], float value)
 {
-  memcpy(params.names[id], name, PARAMS_NAME_LENGTH);
-  params.values[id] = *((int32_t *) &value);
-  params.types[id] = PARAM_TYPE_FLOAT;
+  memcpy(rf->params.names[id], name, PARAMS_NAME_LENGTH);
+  rf->params.values[id] = *((int32_t *) &value);
+  rf->params.types[id] = PARAM_TYPE_FLOAT;
 }
 
-static uint8_t compute_checksum(void)
+static uint8_t compute_checksum(params_t *params)
 {
   uint8_t chk = 0;
   const uint8_t *p;
 
-  for (p = (const uint8_t *)&params.values; p < ((const uint8_t *)&params.values + 4*PARAMS_COUNT); p++)
+  for (p = (const uint8_t *)&params->values; p < ((const uint8_t *)&params->values + 4*PARAMS_COUNT); p++)
     chk ^= *p;
-  for (p = (const uint8_t *)&params.names; p < ((const uint8_t *)&params.names + PARAMS_COUNT*PARAMS_NAME_LENGTH); p++)
+  for (p = (const uint8_t *)&params->names; p < ((const uint8_t *)&params->names + PARAMS_COUNT*PARAMS_NAME_LENGTH); p++)
     chk ^= *p;
-  for (p = (const uint8_t *)&params.types; p < ((const uint8_t *)&params.types + PARAMS_COUNT); p++)
+  for (p = (const uint8_t *)&params->types; p < ((const uint8_t *)&params->types + PARAMS_COUNT); p++)
     chk ^= *p;
 
   return chk;
 }
 
+// The modules keep copies of some params, so they need to hear about every value that changed
+static void all_params_changed(rosflight_t *rf)
+{
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+    param_change_callback(rf, (param_id_t) id);
+}
+
 // function definitions
-void init_params(void)
+void init_params(rosflight_t *rf)
 {
   memory_init();
-  if (!read_params())
+  if (!read_params(rf))
   {
-    set_param_defaults();
-    write_params();
+    set_param_defaults(rf);
+    write_params(rf);
   }
-
-  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
-    param_change_callback((param_id_t) id);
 }
 
-void set_param_defaults(void)
+void set_param_defaults(rosflight_t *rf)
 {
   /******************************/
   /*** HARDWARE CONFIGURATION ***/
   /******************************/
-  init_param_int(PARAM_BAUD_RATE, "BAUD_RATE", 921600); // Baud rate of MAVlink communication with onboard computer | 9600 | 921600
+  init_param_int(rf, PARAM_BAUD_RATE, "BAUD_RATE", 921600); // Baud rate of MAVlink communication with onboard computer | 9600 | 921600
 
   /*****************************/
   /*** MAVLINK CONFIGURATION ***/
   /*****************************/
-  init_param_int(PARAM_SYSTEM_ID, "SYS_ID", 1); // Mavlink System ID  | 1 | 255
-  init_param_int(PARAM_STREAM_HEARTBEAT_RATE, "STRM_HRTBT", 1); // Rate of heartbeat streaming (Hz) | 0 | 1000
-  init_param_int(PARAM_STREAM_STATUS_RATE, "STRM_STATUS", 10); // Rate of status streaming (Hz) | 0 | 1000
-
-  init_param_int(PARAM_STREAM_ATTITUDE_RATE, "STRM_ATTITUDE", 100); // Rate of attitude stream (Hz) | 0 | 1000
-  init_param_int(PARAM_STREAM_IMU_RATE, "STRM_IMU", 500); // Rate of IMU stream (Hz) | 0 | 1000
-  init_param_int(PARAM_STREAM_MAG_RATE, "STRM_MAG", 75); // Rate of magnetometer stream (Hz) | 0 | 75
-  init_param_int(PARAM_STREAM_BARO_RATE, "STRM_BARO", 100); // Rate of barometer stream (Hz) | 0 | 100
-  init_param_int(PARAM_STREAM_AIRSPEED_RATE, "STRM_AIRSPEED", 20); // Rate of airspeed stream (Hz) | 0 |  50
-  init_param_int(PARAM_STREAM_SONAR_RATE, "STRM_SONAR", 40); // Rate of sonar stream (Hz) | 0 | 40
-
-  init_param_int(PARAM_STREAM_OUTPUT_RAW_RATE, "STRM_OUTPUT", 50); // Rate of raw output stream | 0 |  490
-  init_param_int(PARAM_STREAM_RC_RAW_RATE, "STRM_RC", 50); // Rate of raw RC input stream | 0 | 50
+  init_param_int(rf, PARAM_SYSTEM_ID, "SYS_ID", 1); // Mavlink System ID  | 1 | 255
+  init_param_int(rf, PARAM_STREAM_HEARTBEAT_RATE, "STRM_HRTBT", 1); // Rate of heartbeat streaming (Hz) | 0 | 1000
+  init_param_int(rf, PARAM_STREAM_STATUS_RATE, "STRM_STATUS", 10); // Rate of status streaming (Hz) | 0 | 1000
+  init_param_int(rf, PARAM_STREAM_PROFILE_RATE, "STRM_PROFILE", 5); // Rate of execution time profile stream, one code section per message (Hz) | 0 | 100
+  init_param_int(rf, PARAM_STREAM_LATENCY_RATE, "STRM_LATENCY", 1); // Rate of control loop latency statistics stream (Hz) | 0 | 100
+
+  init_param_int(rf, PARAM_STREAM_ATTITUDE_RATE, "STRM_ATTITUDE", 100); // Rate of attitude stream (Hz) | 0 | 1000
+  init_param_int(rf, PARAM_STREAM_IMU_RATE, "STRM_IMU", 500); // Rate of IMU stream (Hz) | 0 | 1000
+  init_param_int(rf, PARAM_STREAM_MAG_RATE, "STRM_MAG", 75); // Rate of magnetometer stream (Hz) | 0 | 75
+  init_param_int(rf, PARAM_STREAM_BARO_RATE, "STRM_BARO", 100); // Rate of barometer stream (Hz) | 0 | 100
+  init_param_int(rf, PARAM_STREAM_AIRSPEED_RATE, "STRM_AIRSPEED", 20); // Rate of airspeed stream (Hz) | 0 |  50
+  init_param_int(rf, PARAM_STREAM_SONAR_RATE, "STRM_SONAR", 40); // Rate of sonar stream (Hz) | 0 | 40
+  init_param_int(rf, PARAM_STREAM_ALTITUDE_RATE, "STRM_ALTITUDE", 50); // Rate of altitude and vertical velocity estimate stream (Hz) | 0 | 500
+
+  init_param_int(rf, PARAM_STREAM_OUTPUT_RAW_RATE, "STRM_OUTPUT", 50); // Rate of raw output stream | 0 |  490
+  init_param_int(rf, PARAM_STREAM_RC_RAW_RATE, "STRM_RC", 50); // Rate of raw RC input stream | 0 | 50
+  init_param_int(rf, PARAM_STREAM_SCHEDULER_RATE, "STRM_SCHED", 10); // Rate of scheduler task statistics stream, one task per message (Hz) | 0 | 100
 
   /********************************/
   /*** CONTROLLER CONFIGURATION ***/
   /********************************/
-  init_param_float(PARAM_MAX_COMMAND, "PARAM_MAX_CMD", 1.0); // saturation point for PID controller output | 0.0 | 1.0
-
-  init_param_float(PARAM_PID_ROLL_RATE_P, "PID_ROLL_RATE_P", 0.070f); // Roll Rate Proportional Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_ROLL_RATE_I, "PID_ROLL_RATE_I", 0.000f); // Roll Rate Integral Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_ROLL_RATE_D, "PID_ROLL_RATE_D", 0.000f); // Rall Rate Derivative Gain | 0.0 | 1000.0
-  init_param_float(PARAM_ROLL_RATE_TRIM, "ROLL_RATE_TRIM", 0.0f); // Roll Rate Trim - See RC calibration | -1000.0 | 1000.0
-
-  init_param_float(PARAM_PID_PITCH_RATE_P, "PID_PITCH_RATE_P", 0.070f);  // Pitch Rate Proporitional Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_PITCH_RATE_I, "PID_PITCH_RATE_I", 0.0000f); // Pitch Rate Integral Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_PITCH_RATE_D, "PID_PITCH_RATE_D", 0.0000f); // Pitch Rate Derivative Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PITCH_RATE_TRIM, "PITCH_RATE_TRIM", 0.0f); // Pitch Rate Trim - See RC calibration | -1000.0 | 1000.0
-
-  init_param_float(PARAM_PID_YAW_RATE_P, "PID_YAW_RATE_P", 0.25f);   // Yaw Rate Proporitional Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_YAW_RATE_I, "PID_YAW_RATE_I", 0.0f);  // Yaw Rate Integral Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_YAW_RATE_D, "PID_YAW_RATE_D", 0.0f);  // Yaw Rate Derivative Gain | 0.0 | 1000.0
-  init_param_float(PARAM_YAW_RATE_TRIM, "YAW_RATE_TRIM", 0.0f);  // Yaw Rate Trim - See RC calibration | -1000.0 | 1000.0
-
-  init_param_float(PARAM_PID_ROLL_ANGLE_P, "PID_ROLL_ANG_P", 0.15f);   // Roll Angle Proporitional Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_ROLL_ANGLE_I, "PID_ROLL_ANG_I", 0.0f);   // Roll Angle Integral Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_ROLL_ANGLE_D, "PID_ROLL_ANG_D", 0.07f);  // Roll Angle Derivative Gain | 0.0 | 1000.0
-  init_param_float(PARAM_ROLL_ANGLE_TRIM, "ROLL_TRIM", 0.0f);  // Roll Angle Trim - See RC calibration | -1000.0 | 1000.0
-  init_param_float(PARAM_PID_PITCH_ANGLE_P, "PID_PITCH_ANG_P", 0.15f);  // Pitch Angle Proporitional Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_PITCH_ANGLE_I, "PID_PITCH_ANG_I", 0.0f);  // Pitch Angle Integral Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PID_PITCH_ANGLE_D, "PID_PITCH_ANG_D", 0.07f); // Pitch Angle Derivative Gain | 0.0 | 1000.0
-  init_param_float(PARAM_PITCH_ANGLE_TRIM, "PITCH_TRIM", 0.0f);  // Pitch Angle Trim - See RC calibration | -1000.0 | 1000.0
-
-  init_param_float(PARAM_X_EQ_TORQUE, "X_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on x axis | -1.0 | 1.0
-  init_param_float(PARAM_Y_EQ_TORQUE, "Y_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on y axis | -1.0 | 1.0
-  init_param_float(PARAM_Z_EQ_TORQUE, "Z_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on z axis | -1.0 | 1.0
-
-  init_param_float(PARAM_PID_TAU, "PID_TAU", 0.05f); // Dirty Derivative time constant - See controller documentation | 0.0 | 1.0
+  init_param_float(rf, PARAM_MAX_COMMAND, "PARAM_MAX_CMD", 1.0); // saturation point for PID controller output | 0.0 | 1.0
+
+  init_param_float(rf, PARAM_PID_ROLL_RATE_P, "PID_ROLL_RATE_P", 0.070f); // Roll Rate Proportional Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_ROLL_RATE_I, "PID_ROLL_RATE_I", 0.000f); // Roll Rate Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_ROLL_RATE_D, "PID_ROLL_RATE_D", 0.000f); // Rall Rate Derivative Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_ROLL_RATE_TRIM, "ROLL_RATE_TRIM", 0.0f); // Roll Rate Trim - See RC calibration | -1000.0 | 1000.0
+
+  init_param_float(rf, PARAM_PID_PITCH_RATE_P, "PID_PITCH_RATE_P", 0.070f);  // Pitch Rate Proporitional Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_RATE_I, "PID_PITCH_RATE_I", 0.0000f); // Pitch Rate Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_RATE_D, "PID_PITCH_RATE_D", 0.0000f); // Pitch Rate Derivative Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PITCH_RATE_TRIM, "PITCH_RATE_TRIM", 0.0f); // Pitch Rate Trim - See RC calibration | -1000.0 | 1000.0
+
+  init_param_float(rf, PARAM_PID_YAW_RATE_P, "PID_YAW_RATE_P", 0.25f);   // Yaw Rate Proporitional Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_YAW_RATE_I, "PID_YAW_RATE_I", 0.0f);  // Yaw Rate Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_YAW_RATE_D, "PID_YAW_RATE_D", 0.0f);  // Yaw Rate Derivative Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_YAW_RATE_TRIM, "YAW_RATE_TRIM", 0.0f);  // Yaw Rate Trim - See RC calibration | -1000.0 | 1000.0
+
+  init_param_float(rf, PARAM_PID_ROLL_ANGLE_P, "PID_ROLL_ANG_P", 0.15f);   // Roll Angle Proporitional Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_ROLL_ANGLE_I, "PID_ROLL_ANG_I", 0.0f);   // Roll Angle Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_ROLL_ANGLE_D, "PID_ROLL_ANG_D", 0.07f);  // Roll Angle Derivative Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_ROLL_ANGLE_TRIM, "ROLL_TRIM", 0.0f);  // Roll Angle Trim - See RC calibration | -1000.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_ANGLE_P, "PID_PITCH_ANG_P", 0.15f);  // Pitch Angle Proporitional Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_ANGLE_I, "PID_PITCH_ANG_I", 0.0f);  // Pitch Angle Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_ANGLE_D, "PID_PITCH_ANG_D", 0.07f); // Pitch Angle Derivative Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PITCH_ANGLE_TRIM, "PITCH_TRIM", 0.0f);  // Pitch Angle Trim - See RC calibration | -1000.0 | 1000.0
+
+  init_param_float(rf, PARAM_X_EQ_TORQUE, "X_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on x axis | -1.0 | 1.0
+  init_param_float(rf, PARAM_Y_EQ_TORQUE, "Y_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on y axis | -1.0 | 1.0
+  init_param_float(rf, PARAM_Z_EQ_TORQUE, "Z_EQ_TORQUE", 0.0f); // Equilibrium torque added to output of controller on z axis | -1.0 | 1.0
+
+  init_param_float(rf, PARAM_PID_TAU, "PID_TAU", 0.05f); // Dirty Derivative time constant - See controller documentation | 0.0 | 1.0
+  init_param_int(rf, PARAM_ANGLE_CONTROLLER, "ANGLE_CTRL", 0); // Angle mode controller: 0 - roll and pitch PIDs on Euler angles, 1 - the same PIDs on the quaternion tilt error (no trig, well-behaved at large tilts) | 0 | 1
+
+  init_param_int(rf, PARAM_ANGLE_CASCADE, "ANGLE_CASCADE", 1); // Angle mode structure: 0 - angle PIDs output torque, 1 - angle loop outputs a rate setpoint for the rate PIDs | 0 | 1
+  init_param_int(rf, PARAM_ANGLE_LOOP_RATE, "ANGLE_LOOP_RATE", 250); // Rate in Hz of the cascaded angle loop, the rate PIDs run on every IMU sample | 125 | 8000
+  init_param_float(rf, PARAM_PID_ROLL_CASCADE_P, "PID_ROLL_CASC_P", 4.0f); // Cascaded Roll Angle Proportional Gain (rad/s per rad) | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_ROLL_CASCADE_I, "PID_ROLL_CASC_I", 0.0f); // Cascaded Roll Angle Integral Gain | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_CASCADE_P, "PID_PITCH_CASC_P", 4.0f); // Cascaded Pitch Angle Proportional Gain (rad/s per rad) | 0.0 | 1000.0
+  init_param_float(rf, PARAM_PID_PITCH_CASCADE_I, "PID_PITCH_CASC_I", 0.0f); // Cascaded Pitch Angle Integral Gain | 0.0 | 1000.0
 
 
   /*************************/
   /*** PWM CONFIGURATION ***/
   /*************************/
-  init_param_int(PARAM_MOTOR_PWM_SEND_RATE, "MOTOR_PWM_UPDATE", 490); // Refresh rate of motor commands to motors - See motor documentation | 0 | 1000
-  init_param_float(PARAM_MOTOR_IDLE_THROTTLE, "MOTOR_IDLE_THR", 0.1); // min throttle command sent to motors when armed (Set above 0.1 to spin when armed) | 0.0 | 1.0
-  init_param_float(PARAM_FAILSAFE_THROTTLE, "FAILSAFE_THR", 0.3); // Throttle sent to motors in failsafe condition (set just below hover throttle) | 0.0 | 1.0
-  init_param_int(PARAM_MOTOR_MIN_PWM, "MOTOR_MIN_PWM", 1000); // PWM value sent to motor ESCs at zero throttle | 1000 | 2000
-  init_param_int(PARAM_MOTOR_MAX_PWM, "MOTOR_MAX_PWM", 2000); // PWM value sent to motor ESCs at full throttle | 1000 | 2000
-  init_param_int(PARAM_SPIN_MOTORS_WHEN_ARMED, "ARM_SPIN_MOTORS", true); // Enforce MOTOR_IDLE_THR | 0 | 1
+  init_param_int(rf, PARAM_MOTOR_PWM_SEND_RATE, "MOTOR_PWM_UPDATE", 490); // Refresh rate of motor commands to motors - See motor documentation | 0 | 1000
+  init_param_float(rf, PARAM_MOTOR_IDLE_THROTTLE, "MOTOR_IDLE_THR", 0.1); // min throttle command sent to motors when armed (Set above 0.1 to spin when armed) | 0.0 | 1.0
+  init_param_float(rf, PARAM_FAILSAFE_THROTTLE, "FAILSAFE_THR", 0.3); // Throttle sent to motors in failsafe condition (set just below hover throttle) | 0.0 | 1.0
+  init_param_int(rf, PARAM_MOTOR_MIN_PWM, "MOTOR_MIN_PWM", 1000); // PWM value sent to motor ESCs at zero throttle | 1000 | 2000
+  init_param_int(rf, PARAM_MOTOR_MAX_PWM, "MOTOR_MAX_PWM", 2000); // PWM value sent to motor ESCs at full throttle | 1000 | 2000
+  init_param_int(rf, PARAM_SPIN_MOTORS_WHEN_ARMED, "ARM_SPIN_MOTORS", true); // Enforce MOTOR_IDLE_THR | 0 | 1
 
   /*******************************/
   /*** ESTIMATOR CONFIGURATION ***/
   /*******************************/
-  init_param_int(PARAM_INIT_TIME, "FILTER_INIT_T", 3000); // Time in ms to initialize estimator | 0 | 100000
-  init_param_float(PARAM_FILTER_KP, "FILTER_KP", 1.0f); // estimator proportional gain - See estimator documentation | 0 | 10.0
-  init_param_float(PARAM_FILTER_KI, "FILTER_KI", 0.1f); // estimator integral gain - See estimator documentation | 0 | 1.0
-
-  init_param_int(PARAM_FILTER_USE_QUAD_INT, "FILTER_QUAD_INT", 0); // Perform a quadratic averaging of LPF gyro data prior to integration (adds ~20 us to estimation loop on F1 processors) | 0 | 1
-  init_param_int(PARAM_FILTER_USE_MAT_EXP, "FILTER_MAT_EXP", 0); // 1 - Use matrix exponential to improve gyro integration (adds ~90 us to estimation loop in F1 processors) 0 - use euler integration | 0 | 1
-  init_param_int(PARAM_FILTER_USE_ACC, "FILTER_USE_ACC", 1);  // Use accelerometer to correct gyro integration drift (adds ~70 us to estimation loop) | 0 | 1
-
-  init_param_float(PARAM_GYRO_ALPHA, "GYRO_LPF_ALPHA", 0.888f); // Low-pass filter constant - See estimator documentation | 0 | 1.0
-  init_param_float(PARAM_ACC_ALPHA, "ACC_LPF_ALPHA", 0.888f); // Low-pass filter constant - See estimator documentation | 0 | 1.0
-
-  init_param_float(PARAM_ACCEL_SCALE, "ACCEL_SCALE", 1.0f); // Scale factor to apply to IMU measurements - Read-Only | 0.5 | 2.0
-
-  init_param_int(PARAM_CALIBRATE_GYRO_ON_ARM, "GYRO_CAL_ON_ARM", false); // Calibrate gyros when arming - generally only for multirotors | 0 | 1
-
-  init_param_float(PARAM_GYRO_X_BIAS, "GYRO_X_BIAS", 0.0f); // Constant x-bias of gyroscope readings | -1.0 | 1.0
-  init_param_float(PARAM_GYRO_Y_BIAS, "GYRO_Y_BIAS", 0.0f); // Constant y-bias of gyroscope readings | -1.0 | 1.0
-  init_param_float(PARAM_GYRO_Z_BIAS, "GYRO_Z_BIAS", 0.0f); // Constant z-bias of gyroscope readings | -1.0 | 1.0
-  init_param_float(PARAM_ACC_X_BIAS,  "ACC_X_BIAS", 0.0f); // Constant x-bias of accelerometer readings | -2.0 | 2.0
-  init_param_float(PARAM_ACC_Y_BIAS,  "ACC_Y_BIAS", 0.0f); // Constant y-bias of accelerometer readings | -2.0 | 2.0
-  init_param_float(PARAM_ACC_Z_BIAS,  "ACC_Z_BIAS", 0.0f); // Constant z-bias of accelerometer readings | -2.0 | 2.0
-  init_param_float(PARAM_ACC_X_TEMP_COMP,  "ACC_X_TEMP_COMP", 0.0f); // Linear x-axis temperature compensation constant | -2.0 | 2.0
-  init_param_float(PARAM_ACC_Y_TEMP_COMP,  "ACC_Y_TEMP_COMP", 0.0f); // Linear y-axis temperature compensation constant | -2.0 | 2.0
-  init_param_float(PARAM_ACC_Z_TEMP_COMP,  "ACC_Z_TEMP_COMP", 0.0f); // Linear z-axis temperature compensation constant | -2.0 | 2.0
-
-  init_param_float(PARAM_MAG_A11_COMP,  "MAG_A11_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A12_COMP,  "MAG_A12_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A13_COMP,  "MAG_A13_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A21_COMP,  "MAG_A21_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A22_COMP,  "MAG_A22_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A23_COMP,  "MAG_A23_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A31_COMP,  "MAG_A31_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A32_COMP,  "MAG_A32_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_A33_COMP,  "MAG_A33_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_X_BIAS,  "MAG_X_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_Y_BIAS,  "MAG_Y_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
-  init_param_float(PARAM_MAG_Z_BIAS,  "MAG_Z_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
+  init_param_int(rf, PARAM_FILTER_TYPE, "FILTER_TYPE", 0); // Attitude filter: 0 - Mahony, 1 - Madgwick, 2 - multiplicative EKF (the fixed-point build only has Mahony, changes wait until disarmed) | 0 | 2
+  init_param_int(rf, PARAM_INIT_TIME, "FILTER_INIT_T", 50); // Time in ms that the accelerometer and magnetometer are averaged over to align the estimator at startup | 0 | 10000
+  init_param_float(rf, PARAM_FILTER_KP, "FILTER_KP", 1.0f); // estimator proportional gain - See estimator documentation | 0 | 10.0
+  init_param_float(rf, PARAM_FILTER_KI, "FILTER_KI", 0.1f); // estimator integral gain - See estimator documentation | 0 | 1.0
+
+  init_param_int(rf, PARAM_FILTER_USE_QUAD_INT, "FILTER_QUAD_INT", 0); // Perform a quadratic averaging of LPF gyro data prior to integration (adds ~20 us to estimation loop on F1 processors) | 0 | 1
+  init_param_int(rf, PARAM_FILTER_USE_MAT_EXP, "FILTER_MAT_EXP", 1); // 1 - Use matrix exponential to improve gyro integration (series expansion, a few us more than euler integration on F1 processors) 0 - use euler integration | 0 | 1
+  init_param_int(rf, PARAM_FILTER_USE_ACC, "FILTER_USE_ACC", 1);  // Use accelerometer to correct gyro integration drift (adds ~70 us to each estimator update that runs it) | 0 | 1
+  init_param_int(rf, PARAM_FILTER_ACC_RATE, "FILTER_ACC_RATE", 100); // Rate in Hz of the accelerometer correction, which runs on every update at or above the control rate | 20 | 8000
+  init_param_int(rf, PARAM_FILTER_USE_MAG, "FILTER_USE_MAG", 0); // Use the calibrated magnetometer to correct heading and the z gyro bias, at the magnetometer's rate | 0 | 1
+  init_param_float(rf, PARAM_FILTER_KP_MAG, "FILTER_KP_MAG", 0.5f); // estimator proportional gain of the magnetometer heading correction | 0 | 10.0
+  init_param_int(rf, PARAM_FILTER_PREDICT, "FILTER_PREDICT", 1); // Predict the attitude and rates given to the controller forward by the measured IMU to PWM latency | 0 | 1
+  init_param_float(rf, PARAM_FILTER_BETA, "FILTER_BETA", 0.05f); // Madgwick filter gradient step (rad/s) | 0 | 1.0
+  init_param_float(rf, PARAM_FILTER_ZETA, "FILTER_ZETA", 0.005f); // Madgwick filter gyro bias gain (rad/s) | 0 | 0.1
+
+  init_param_float(rf, PARAM_ALT_BARO_TAU, "ALT_BARO_TAU", 1.0f); // Time constant of the barometer correction of the altitude estimate (s) | 0.5 | 100.0
+  init_param_float(rf, PARAM_ALT_SONAR_TAU, "ALT_SONAR_TAU", 0.3f); // Time constant of the sonar correction of the altitude estimate (s) | 0.2 | 100.0
+
+  init_param_float(rf, PARAM_GYRO_ALPHA, "GYRO_LPF_ALPHA", 0.888f); // Low-pass filter constant - See estimator documentation | 0 | 1.0
+  init_param_float(rf, PARAM_ACC_ALPHA, "ACC_LPF_ALPHA", 0.888f); // Low-pass filter constant - See estimator documentation | 0 | 1.0
+
+  init_param_float(rf, PARAM_ACCEL_SCALE, "ACCEL_SCALE", 1.0f); // Scale factor to apply to IMU measurements - Read-Only | 0.5 | 2.0
+
+  init_param_int(rf, PARAM_IMU_SAMPLE_RATE, "IMU_RATE", 1000); // Rate in Hz at which the gyro is sampled: 1000, 1600 or 2000, the most the I2C bus can drain, and others round to the nearest (takes effect after a reboot) | 1000 | 2000
+  init_param_int(rf, PARAM_CONTROL_RATE_DIV, "CTRL_RATE_DIV", 1); // Number of gyro samples averaged for each estimator and controller update, so the control loop runs at IMU_RATE/CTRL_RATE_DIV (takes effect after a reboot) | 1 | 8
+
+  init_param_int(rf, PARAM_CALIBRATE_GYRO_ON_ARM, "GYRO_CAL_ON_ARM", false); // Calibrate gyros when arming - generally only for multirotors | 0 | 1
+
+  init_param_float(rf, PARAM_GYRO_X_BIAS, "GYRO_X_BIAS", 0.0f); // Constant x-bias of gyroscope readings | -1.0 | 1.0
+  init_param_float(rf, PARAM_GYRO_Y_BIAS, "GYRO_Y_BIAS", 0.0f); // Constant y-bias of gyroscope readings | -1.0 | 1.0
+  init_param_float(rf, PARAM_GYRO_Z_BIAS, "GYRO_Z_BIAS", 0.0f); // Constant z-bias of gyroscope readings | -1.0 | 1.0
+  init_param_float(rf, PARAM_ACC_X_BIAS,  "ACC_X_BIAS", 0.0f); // Constant x-bias of accelerometer readings | -2.0 | 2.0
+  init_param_float(rf, PARAM_ACC_Y_BIAS,  "ACC_Y_BIAS", 0.0f); // Constant y-bias of accelerometer readings | -2.0 | 2.0
+  init_param_float(rf, PARAM_ACC_Z_BIAS,  "ACC_Z_BIAS", 0.0f); // Constant z-bias of accelerometer readings | -2.0 | 2.0
+  init_param_float(rf, PARAM_ACC_X_TEMP_COMP,  "ACC_X_TEMP_COMP", 0.0f); // Linear x-axis temperature compensation constant | -2.0 | 2.0
+  init_param_float(rf, PARAM_ACC_Y_TEMP_COMP,  "ACC_Y_TEMP_COMP", 0.0f); // Linear y-axis temperature compensation constant | -2.0 | 2.0
+  init_param_float(rf, PARAM_ACC_Z_TEMP_COMP,  "ACC_Z_TEMP_COMP", 0.0f); // Linear z-axis temperature compensation constant | -2.0 | 2.0
+
+  init_param_float(rf, PARAM_MAG_A11_COMP,  "MAG_A11_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A12_COMP,  "MAG_A12_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A13_COMP,  "MAG_A13_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A21_COMP,  "MAG_A21_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A22_COMP,  "MAG_A22_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A23_COMP,  "MAG_A23_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A31_COMP,  "MAG_A31_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A32_COMP,  "MAG_A32_COMP", 0.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_A33_COMP,  "MAG_A33_COMP", 1.0f); // Soft iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_X_BIAS,  "MAG_X_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_Y_BIAS,  "MAG_Y_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
+  init_param_float(rf, PARAM_MAG_Z_BIAS,  "MAG_Z_BIAS", 0.0f); // Hard iron compensation constant | -999.0 | 999.0
 
   /************************/
   /*** RC CONFIGURATION ***/
   /************************/
-  init_param_int(PARAM_RC_TYPE, "RC_TYPE", 1); // Type of RC input 0 - Parallel PWM (PWM), 1 - Pulse-Position Modulation (PPM) | 0 | 1
-  init_param_int(PARAM_RC_X_CHANNEL, "RC_X_CHN", 0); // RC input channel mapped to x-axis commands [0 - indexed] | 0 | 3
-  init_param_int(PARAM_RC_Y_CHANNEL, "RC_Y_CHN", 1); // RC input channel mapped to y-axis commands [0 - indexed] | 0 | 3
-  init_param_int(PARAM_RC_Z_CHANNEL, "RC_Z_CHN", 3); // RC input channel mapped to z-axis commands [0 - indexed] | 0 | 3
-  init_param_int(PARAM_RC_F_CHANNEL, "RC_F_CHN", 2); // RC input channel mapped to F-axis commands [0 - indexed] | 0 | 3
-  init_param_int(PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL, "RC_ATT_OVRD_CHN", 4); // RC switch mapped to attitude override [0 indexed, -1 to disable] | 4 | 7
-  init_param_int(PARAM_RC_THROTTLE_OVERRIDE_CHANNEL, "RC_THR_OVRD_CHN", 4); // RC switch channel mapped to throttle override [0 indexed, -1 to disable] | 4 | 7
-  init_param_int(PARAM_RC_ATT_CONTROL_TYPE_CHANNEL,  "RC_ATT_CTRL_CHN", -1); // RC switch channel mapped to attitude control type [0 indexed, -1 to disable] | 4 | 7
-  init_param_int(PARAM_RC_ARM_CHANNEL, "ARM_CHANNEL", -1); // RC switch channel mapped to arming (only if PARAM_ARM_STICKS is false) [0 indexed, -1 to disable] | 4 | 7
-  init_param_int(PARAM_RC_NUM_CHANNELS, "RC_NUM_CHN", 6); // number of RC input channels | 1 | 8
-
-  init_param_int(PARAM_RC_SWITCH_5_DIRECTION, "SWITCH_5_DIR", 1); // RC switch 5 toggle direction | -1 | 1
-  init_param_int(PARAM_RC_SWITCH_6_DIRECTION, "SWITCH_6_DIR", 1); // RC switch 6 toggle direction | -1 | 1
-  init_param_int(PARAM_RC_SWITCH_7_DIRECTION, "SWITCH_7_DIR", 1); // RC switch 7 toggle direction | -1 | 1
-  init_param_int(PARAM_RC_SWITCH_8_DIRECTION, "SWITCH_8_DIR", 1); // RC switch 8 toggle direction | -1 | 1
-
-  init_param_float(PARAM_RC_OVERRIDE_DEVIATION, "RC_OVRD_DEV", 0.1); // RC stick deviation from center for overrride | 0.0 | 1.0
-  init_param_int(PARAM_OVERRIDE_LAG_TIME, "OVRD_LAG_TIME", 1000); // RC stick deviation lag time before returning control (ms) | 0 | 100000
-  init_param_int(PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE, "MIN_THROTTLE", false); // Take minimum throttle between RC and computer at all times | 0 | 1
-
-  init_param_int(PARAM_RC_ATTITUDE_MODE, "RC_ATT_MODE", 1); // Attitude mode for RC sticks (0: rate, 1: angle). Overridden if RC_ATT_CTRL_CHN is set. | 0 | 1
-  init_param_float(PARAM_RC_MAX_ROLL, "RC_MAX_ROLL", 0.786f); // Maximum roll angle command sent by full deflection of RC sticks | 0.0 | 3.14159
-  init_param_float(PARAM_RC_MAX_PITCH, "RC_MAX_PITCH", 0.786f); // Maximum pitch angle command sent by full stick deflection of RC sticks | 0.0 | 3.14159
-  init_param_float(PARAM_RC_MAX_ROLLRATE, "RC_MAX_ROLLRATE", 3.14159f); // Maximum roll rate command sent by full stick deflection of RC sticks | 0.0 | 9.42477796077
-  init_param_float(PARAM_RC_MAX_PITCHRATE, "RC_MAX_PITCHRATE", 3.14159f); // Maximum pitch command sent by full stick deflection of RC sticks | 0.0 | 3.14159
-  init_param_float(PARAM_RC_MAX_YAWRATE, "RC_MAX_YAWRATE", 1.507f); // Maximum pitch command sent by full stick deflection of RC sticks | 0.0 | 3.14159
+  init_param_int(rf, PARAM_RC_TYPE, "RC_TYPE", 1); // Type of RC input 0 - Parallel PWM (PWM), 1 - Pulse-Position Modulation (PPM) | 0 | 1
+  init_param_int(rf, PARAM_RC_X_CHANNEL, "RC_X_CHN", 0); // RC input channel mapped to x-axis commands [0 - indexed] | 0 | 3
+  init_param_int(rf, PARAM_RC_Y_CHANNEL, "RC_Y_CHN", 1); // RC input channel mapped to y-axis commands [0 - indexed] | 0 | 3
+  init_param_int(rf, PARAM_RC_Z_CHANNEL, "RC_Z_CHN", 3); // RC input channel mapped to z-axis commands [0 - indexed] | 0 | 3
+  init_param_int(rf, PARAM_RC_F_CHANNEL, "RC_F_CHN", 2); // RC input channel mapped to F-axis commands [0 - indexed] | 0 | 3
+  init_param_int(rf, PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL, "RC_ATT_OVRD_CHN", 4); // RC switch mapped to attitude override [0 indexed, -1 to disable] | 4 | 7
+  init_param_int(rf, PARAM_RC_THROTTLE_OVERRIDE_CHANNEL, "RC_THR_OVRD_CHN", 4); // RC switch channel mapped to throttle override [0 indexed, -1 to disable] | 4 | 7
+  init_param_int(rf, PARAM_RC_ATT_CONTROL_TYPE_CHANNEL,  "RC_ATT_CTRL_CHN", -1); // RC switch channel mapped to attitude control type [0 indexed, -1 to disable] | 4 | 7
+  init_param_int(rf, PARAM_RC_ARM_CHANNEL, "ARM_CHANNEL", -1); // RC switch channel mapped to arming (only if PARAM_ARM_STICKS is false) [0 indexed, -1 to disable] | 4 | 7
+  init_param_int(rf, PARAM_RC_NUM_CHANNELS, "RC_NUM_CHN", 6); // number of RC input channels | 1 | 8
+
+  init_param_int(rf, PARAM_RC_SWITCH_5_DIRECTION, "SWITCH_5_DIR", 1); // RC switch 5 toggle direction | -1 | 1
+  init_param_int(rf, PARAM_RC_SWITCH_6_DIRECTION, "SWITCH_6_DIR", 1); // RC switch 6 toggle direction | -1 | 1
+  init_param_int(rf, PARAM_RC_SWITCH_7_DIRECTION, "SWITCH_7_DIR", 1); // RC switch 7 toggle direction | -1 | 1
+  init_param_int(rf, PARAM_RC_SWITCH_8_DIRECTION, "SWITCH_8_DIR", 1); // RC switch 8 toggle direction | -1 | 1
+
+  init_param_float(rf, PARAM_RC_OVERRIDE_DEVIATION, "RC_OVRD_DEV", 0.1); // RC stick deviation from center for overrride | 0.0 | 1.0
+  init_param_int(rf, PARAM_OVERRIDE_LAG_TIME, "OVRD_LAG_TIME", 1000); // RC stick deviation lag time before returning control (ms) | 0 | 100000
+  init_param_int(rf, PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE, "MIN_THROTTLE", false); // Take minimum throttle between RC and computer at all times | 0 | 1
+
+  init_param_int(rf, PARAM_RC_ATTITUDE_MODE, "RC_ATT_MODE", 1); // Attitude mode for RC sticks (0: rate, 1: angle). Overridden if RC_ATT_CTRL_CHN is set. | 0 | 1
+  init_param_float(rf, PARAM_RC_MAX_ROLL, "RC_MAX_ROLL", 0.786f); // Maximum roll angle command sent by full deflection of RC sticks | 0.0 | 3.14159
+  init_param_float(rf, PARAM_RC_MAX_PITCH, "RC_MAX_PITCH", 0.786f); // Maximum pitch angle command sent by full stick deflection of RC sticks | 0.0 | 3.14159
+  init_param_float(rf, PARAM_RC_MAX_ROLLRATE, "RC_MAX_ROLLRATE", 3.14159f); // Maximum roll rate command sent by full stick deflection of RC sticks | 0.0 | 9.42477796077
+  init_param_float(rf, PARAM_RC_MAX_PITCHRATE, "RC_MAX_PITCHRATE", 3.14159f); // Maximum pitch command sent by full stick deflection of RC sticks | 0.0 | 3.14159
+  init_param_float(rf, PARAM_RC_MAX_YAWRATE, "RC_MAX_YAWRATE", 1.507f); // Maximum pitch command sent by full stick deflection of RC sticks | 0.0 | 3.14159
 
   /***************************/
   /*** FRAME CONFIGURATION ***/
   /***************************/
-  init_param_int(PARAM_MIXER, "MIXER", INVALID_MIXER); // Which mixer to choose - See Mixer documentation | 0 | 5
+  init_param_int(rf, PARAM_MIXER, "MIXER", INVALID_MIXER); // Which mixer to choose - See Mixer documentation | 0 | 5
 
-  init_param_int(PARAM_FIXED_WING, "FIXED_WING", false); // switches on passthrough commands for fixedwing operation | 0 | 1
-  init_param_int(PARAM_ELEVATOR_REVERSE, "ELEVATOR_REV", 0); // reverses elevator servo output | 0 | 1
-  init_param_int(PARAM_AILERON_REVERSE, "AIL_REV", 0); // reverses aileron servo output | 0 | 1
-  init_param_int(PARAM_RUDDER_REVERSE, "RUDDER_REV", 0); // reverses rudder servo output | 0 | 1
+  init_param_int(rf, PARAM_FIXED_WING, "FIXED_WING", false); // switches on passthrough commands for fixedwing operation | 0 | 1
+  init_param_int(rf, PARAM_ELEVATOR_REVERSE, "ELEVATOR_REV", 0); // reverses elevator servo output | 0 | 1
+  init_param_int(rf, PARAM_AILERON_REVERSE, "AIL_REV", 0); // reverses aileron servo output | 0 | 1
+  init_param_int(rf, PARAM_RUDDER_REVERSE, "RUDDER_REV", 0); // reverses rudder servo output | 0 | 1
 
   /********************/
   /*** ARMING SETUP ***/
   /********************/
-  init_param_float(PARAM_ARM_THRESHOLD, "ARM_THRESHOLD", 0.15); // RC deviation from max/min in yaw and throttle for arming and disarming check | 0 | 0.5
+  init_param_float(rf, PARAM_ARM_THRESHOLD, "ARM_THRESHOLD", 0.15); // RC deviation from max/min in yaw and throttle for arming and disarming check | 0 | 0.5
+
+  /******************************/
+  /*** PERFORMANCE MONITORING ***/
+  /******************************/
+  init_param_int(rf, PARAM_LATENCY_WINDOW, "LAT_WINDOW", 1000); // Number of control loop iterations in each latency statistics window | 1 | 100000
+  init_param_int(rf, PARAM_LATENCY_DEADLINE, "LAT_DEADLINE", 1000); // IMU capture to PWM write latency above which an iteration counts as a deadline miss; latency percentiles are resolved to 1/16 of it (us) | 0 | 100000
+
+  all_params_changed(rf);
 }
 
-bool read_params(void)
+bool read_params(rosflight_t *rf)
 {
-  if (!memory_read(&params, sizeof(params_t)))
+  if (!memory_read(&rf->params, sizeof(params_t)))
     return false;
 
-  if (params.version != GIT_VERSION_HASH)
+  if (rf->params.version != GIT_VERSION_HASH)
     return false;
 
-  if (params.size != sizeof(params_t) || params.magic_be != 0xBE || params.magic_ef != 0xEF)
+  if (rf->params.size != sizeof(params_t) || rf->params.magic_be != 0xBE || rf->params.magic_ef != 0xEF)
     return false;
 
-  if (compute_checksum() != params.chk)
+  if (compute_checksum(&rf->params) != rf->params.chk)
     return false;
 
+  all_params_changed(rf);
   return true;
 }
 
-bool write_params(void)
+bool write_params(rosflight_t *rf)
 {
-  params.version = GIT_VERSION_HASH;
-  params.size = sizeof(params_t);
-  params.magic_be = 0xBE;
-  params.magic_ef = 0xEF;
-  params.chk = compute_checksum();
+  rf->params.version = GIT_VERSION_HASH;
+  rf->params.size = sizeof(params_t);
+  rf->params.magic_be = 0xBE;
+  rf->params.magic_ef = 0xEF;
+  rf->params.chk = compute_checksum(&rf->params);
 
-  if (!memory_write(&params, sizeof(params_t)))
+  if (!memory_write(&rf->params, sizeof(params_t)))
     return false;
   return true;
 }
 
-void param_change_callback(param_id_t id)
+void param_change_callback(rosflight_t *rf, param_id_t id)
 {
   switch (id)
   {
   case PARAM_SYSTEM_ID:
-    mavlink_system.sysid = get_param_int(PARAM_SYSTEM_ID);
+    mavlink_system.sysid = get_param_int(rf, PARAM_SYSTEM_ID);
     break;
   case PARAM_STREAM_HEARTBEAT_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_HEARTBEAT, get_param_int(PARAM_STREAM_HEARTBEAT_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_HEARTBEAT, get_param_int(rf, PARAM_STREAM_HEARTBEAT_RATE));
     break;
   case PARAM_STREAM_STATUS_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_STATUS, get_param_int(PARAM_STREAM_STATUS_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_STATUS, get_param_int(rf, PARAM_STREAM_STATUS_RATE));
+    break;
+  case PARAM_STREAM_PROFILE_RATE:
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_PROFILE, get_param_int(rf, PARAM_STREAM_PROFILE_RATE));
+    break;
+  case PARAM_STREAM_LATENCY_RATE:
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_LATENCY, get_param_int(rf, PARAM_STREAM_LATENCY_RATE));
     break;
 
   case PARAM_STREAM_ATTITUDE_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_ATTITUDE, get_param_int(PARAM_STREAM_ATTITUDE_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_ATTITUDE, get_param_int(rf, PARAM_STREAM_ATTITUDE_RATE));
     break;
 
   case PARAM_STREAM_IMU_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_IMU, get_param_int(PARAM_STREAM_IMU_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_IMU, get_param_int(rf, PARAM_STREAM_IMU_RATE));
     break;
   case PARAM_STREAM_AIRSPEED_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_DIFF_PRESSURE, get_param_int(PARAM_STREAM_AIRSPEED_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_DIFF_PRESSURE, get_param_int(rf, PARAM_STREAM_AIRSPEED_RATE));
     break;
   case PARAM_STREAM_SONAR_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_SONAR, get_param_int(PARAM_STREAM_SONAR_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_SONAR, get_param_int(rf, PARAM_STREAM_SONAR_RATE));
+    break;
+  case PARAM_STREAM_ALTITUDE_RATE:
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_ALTITUDE, get_param_int(rf, PARAM_STREAM_ALTITUDE_RATE));
     break;
   case  PARAM_STREAM_BARO_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_BARO, get_param_int(PARAM_STREAM_BARO_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_BARO, get_param_int(rf, PARAM_STREAM_BARO_RATE));
     break;
   case  PARAM_STREAM_MAG_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_MAG, get_param_int(PARAM_STREAM_MAG_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_MAG, get_param_int(rf, PARAM_STREAM_MAG_RATE));
     break;
 
   case PARAM_STREAM_OUTPUT_RAW_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_OUTPUT_RAW, get_param_int(PARAM_STREAM_OUTPUT_RAW_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_OUTPUT_RAW, get_param_int(rf, PARAM_STREAM_OUTPUT_RAW_RATE));
     break;
   case PARAM_STREAM_RC_RAW_RATE:
-    mavlink_stream_set_rate(MAVLINK_STREAM_ID_RC_RAW, get_param_int(PARAM_STREAM_RC_RAW_RATE));
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_RC_RAW, get_param_int(rf, PARAM_STREAM_RC_RAW_RATE));
+    break;
+  case PARAM_STREAM_SCHEDULER_RATE:
+    mavlink_stream_set_rate(rf, MAVLINK_STREAM_ID_SCHEDULER, get_param_int(rf, PARAM_STREAM_SCHEDULER_RATE));
     break;
 
   case PARAM_RC_TYPE:
   case PARAM_MOTOR_PWM_SEND_RATE:
+    init_PWM(rf);
+    break;
   case PARAM_MOTOR_MIN_PWM:
-    init_PWM();
+    init_PWM(rf);
+    update_mixer_params(rf);
     break;
   case PARAM_MIXER:
-    init_mixing();
+    init_mixing(rf);
+    break;
+
+  case PARAM_MOTOR_IDLE_THROTTLE:
+  case PARAM_MOTOR_MAX_PWM:
+  case PARAM_SPIN_MOTORS_WHEN_ARMED:
+  case PARAM_AILERON_REVERSE:
+  case PARAM_ELEVATOR_REVERSE:
+  case PARAM_RUDDER_REVERSE:
+    update_mixer_params(rf);
+    break;
+  case PARAM_FIXED_WING:
+    update_mixer_params(rf);
+    update_mux_params(rf);
+    break;
+
+  case PARAM_FAILSAFE_THROTTLE:
+  case PARAM_RC_OVERRIDE_DEVIATION:
+  case PARAM_OVERRIDE_LAG_TIME:
+  case PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE:
+  case PARAM_RC_ATTITUDE_MODE:
+  case PARAM_RC_MAX_ROLL:
+  case PARAM_RC_MAX_PITCH:
+  case PARAM_RC_MAX_YAWRATE:
+    update_mux_params(rf);
+    break;
+  case PARAM_RC_MAX_ROLLRATE:
+  case PARAM_RC_MAX_PITCHRATE:
+    update_mux_params(rf);
+    update_controller_params(rf);
+    break;
+
+  case PARAM_PID_ROLL_RATE_P:
+  case PARAM_PID_ROLL_RATE_I:
+  case PARAM_PID_ROLL_RATE_D:
+  case PARAM_PID_PITCH_RATE_P:
+  case PARAM_PID_PITCH_RATE_I:
+  case PARAM_PID_PITCH_RATE_D:
+  case PARAM_PID_YAW_RATE_P:
+  case PARAM_PID_YAW_RATE_I:
+  case PARAM_PID_YAW_RATE_D:
+  case PARAM_PID_ROLL_ANGLE_P:
+  case PARAM_PID_ROLL_ANGLE_I:
+  case PARAM_PID_ROLL_ANGLE_D:
+  case PARAM_PID_PITCH_ANGLE_P:
+  case PARAM_PID_PITCH_ANGLE_I:
+  case PARAM_PID_PITCH_ANGLE_D:
+  case PARAM_X_EQ_TORQUE:
+  case PARAM_Y_EQ_TORQUE:
+  case PARAM_Z_EQ_TORQUE:
+  case PARAM_ANGLE_CONTROLLER:
+  case PARAM_ANGLE_CASCADE:
+  case PARAM_ANGLE_LOOP_RATE:
+  case PARAM_PID_ROLL_CASCADE_P:
+  case PARAM_PID_ROLL_CASCADE_I:
+  case PARAM_PID_PITCH_CASCADE_P:
+  case PARAM_PID_PITCH_CASCADE_I:
+    update_controller_params(rf);
+    break;
+
+  case PARAM_FILTER_TYPE:
+  case PARAM_INIT_TIME:
+  case PARAM_FILTER_KP:
+  case PARAM_FILTER_KI:
+  case PARAM_FILTER_USE_QUAD_INT:
+  case PARAM_FILTER_USE_MAT_EXP:
+  case PARAM_FILTER_USE_ACC:
+  case PARAM_FILTER_ACC_RATE:
+  case PARAM_FILTER_USE_MAG:
+  case PARAM_FILTER_KP_MAG:
+  case PARAM_FILTER_PREDICT:
+  case PARAM_FILTER_BETA:
+  case PARAM_FILTER_ZETA:
+  case PARAM_ALT_BARO_TAU:
+  case PARAM_ALT_SONAR_TAU:
+  case PARAM_GYRO_ALPHA:
+  case PARAM_ACC_ALPHA:
+    update_estimator_params(rf);
+    break;
+
+  case PARAM_ACCEL_SCALE:
+  case PARAM_GYRO_X_BIAS:
+  case PARAM_GYRO_Y_BIAS:
+  case PARAM_GYRO_Z_BIAS:
+  case PARAM_ACC_X_BIAS:
+  case PARAM_ACC_Y_BIAS:
+  case PARAM_ACC_Z_BIAS:
+  case PARAM_ACC_X_TEMP_COMP:
+  case PARAM_ACC_Y_TEMP_COMP:
+  case PARAM_ACC_Z_TEMP_COMP:
+  case PARAM_MAG_A11_COMP:
+  case PARAM_MAG_A12_COMP:
+  case PARAM_MAG_A13_COMP:
+  case PARAM_MAG_A21_COMP:
+  case PARAM_MAG_A22_COMP:
+  case PARAM_MAG_A23_COMP:
+  case PARAM_MAG_A31_COMP:
+  case PARAM_MAG_A32_COMP:
+  case PARAM_MAG_A33_COMP:
+  case PARAM_MAG_X_BIAS:
+  case PARAM_MAG_Y_BIAS:
+  case PARAM_MAG_Z_BIAS:
+    update_sensor_params(rf);
     break;
 
   case PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL:
@@ -355,7 +498,12 @@ void param_change_callback(param_id_t id)
   case PARAM_RC_SWITCH_6_DIRECTION:
   case PARAM_RC_SWITCH_7_DIRECTION:
   case PARAM_RC_SWITCH_8_DIRECTION:
-    init_rc();
+    init_rc(rf);
+    break;
+
+  case PARAM_LATENCY_WINDOW:
+  case PARAM_LATENCY_DEADLINE:
+    update_latency_params(rf);
     break;
 
   default:
@@ -364,7 +512,7 @@ void param_change_callback(param_id_t id)
   }
 }
 
-param_id_t lookup_param_id(const char name[PARAMS_NAME_LENGTH])
+param_id_t lookup_param_id(rosflight_t *rf, const char name[PARAMS_NAME_LENGTH])
 {
   for (uint16_t id = 0; id < PARAMS_COUNT; id++)
   {
@@ -372,14 +520,14 @@ param_id_t lookup_param_id(const char name[PARAMS_NAME_LENGTH])
     for (uint8_t i = 0; i < PARAMS_NAME_LENGTH; i++)
     {
       // compare each character
-      if (name[i] != params.names[id][i])
+      if (name[i] != rf->params.names[id][i])
       {
         match = false;
         break;
       }
 
       // stop comparing if end of string is reached
-      if (params.names[id][i] == '\0')
+      if (rf->params.names[id][i] == '\0')
         break;
     }
 
@@ -390,50 +538,50 @@ param_id_t lookup_param_id(const char name[PARAMS_NAME_LENGTH])
   return PARAMS_COUNT;
 }
 
-int get_param_int(param_id_t id)
+int get_param_int(rosflight_t *rf, param_id_t id)
 {
-  return params.values[id];
+  return rf->params.values[id];
 }
 
-float get_param_float(param_id_t id)
+float get_param_float(rosflight_t *rf, param_id_t id)
 {
-  return *(float *) &params.values[id];
+  return *(float *) &rf->params.values[id];
 }
 
-char *get_param_name(param_id_t id)
+char *get_param_name(rosflight_t *rf, param_id_t id)
 {
-  return params.names[id];
+  return rf->params.names[id];
 }
 
-param_type_t get_param_type(param_id_t id)
+param_type_t get_param_type(rosflight_t *rf, param_id_t id)
 {
-  return params.types[id];
+  return rf->params.types[id];
 }
 
-bool set_param_int(param_id_t id, int32_t value)
+bool set_param_int(rosflight_t *rf, param_id_t id, int32_t value)
 {
-  if (id < PARAMS_COUNT && value != params.values[id])
+  if (id < PARAMS_COUNT && value != rf->params.values[id])
   {
-    params.values[id] = value;
-    param_change_callback(id);
-    mavlink_send_param(id);
+    rf->params.values[id] = value;
+    param_change_callback(rf, id);
+    mavlink_send_param(rf, id);
     return true;
   }
   return false;
 }
 
-bool set_param_float(param_id_t id, float value)
+bool set_param_float(rosflight_t *rf, param_id_t id, float value)
 {
-  return set_param_int(id, *(int32_t *) &value);
+  return set_param_int(rf, id, *(int32_t *) &value);
 }
 
-bool set_param_by_name_int(const char name[PARAMS_NAME_LENGTH], int32_t value)
+bool set_param_by_name_int(rosflight_t *rf, const char name[PARAMS_NAME_LENGTH], int32_t value)
 {
-  param_id_t id = lookup_param_id(name);
-  return set_param_int(id, value);
+  param_id_t id = lookup_param_id(rf, name);
+  return set_param_int(rf, id, value);
 }
 
-bool set_param_by_name_float(const char name[PARAMS_NAME_LENGTH], float value)
+bool set_param_by_name_float(rosflight_t *rf, const char name[PARAMS_NAME_LENGTH], float value)
 {
-  return set_param_by_name_int(name, *(int32_t *) &value);
+  return set_param_by_name_int(rf, name, *(int32_t *) &value);
 }
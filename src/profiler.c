@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#include "board.h"
+#include "histogram.h"
+#include "rosflight.h"
+
+#include "profiler.h"
+
+// typedefs
+typedef struct
+{
+  const char *name;
+  uint32_t bucket_width_us;
+} profile_config_t;
+
+// local variable definitions
+// Bucket widths are chosen so the typical execution time falls in the middle of the histogram
+static const profile_config_t profile_configs[PROFILE_COUNT] =
+{
+  { .name = "imu",  .bucket_width_us = 20 },
+  { .name = "sens", .bucket_width_us = 20 },
+  { .name = "est",  .bucket_width_us = 16 },
+  { .name = "ctrl", .bucket_width_us = 16 },
+  { .name = "mix",  .bucket_width_us = 2 },
+  { .name = "strm", .bucket_width_us = 8 },
+  { .name = "recv", .bucket_width_us = 8 }
+};
+
+// function definitions
+void init_profiler(rosflight_t *rf)
+{
+  for (int i = 0; i < PROFILE_COUNT; i++)
+  {
+    histogram_init(&rf->profiler.profiles[i].hist, profile_configs[i].bucket_width_us * clock_cycles_per_us());
+  }
+}
+
+void profiler_start(rosflight_t *rf, profile_id_t id)
+{
+  rf->profiler.profiles[id].start_cycles = clock_cycles();
+}
+
+void profiler_stop(rosflight_t *rf, profile_id_t id)
+{
+  // unsigned subtraction handles the counter wrapping around
+  profile_t *profile = &rf->profiler.profiles[id];
+  histogram_add(&profile->hist, clock_cycles() - profile->start_cycles);
+}
+
+const char *profiler_get_name(profile_id_t id)
+{
+  return profile_configs[id].name;
+}
+
+const histogram_t *profiler_get_histogram(rosflight_t *rf, profile_id_t id)
+{
+  return &rf->profiler.profiles[id].hist;
+}
+
+void profiler_reset(rosflight_t *rf, profile_id_t id)
+{
+  histogram_reset(&rf->profiler.profiles[id].hist);
+}
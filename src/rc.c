@@ -38,150 +38,135 @@
 #include "rc.h"
 #include "mux.h"
 #include "mode.h"
+#include "rosflight.h"
 
 #include "mavlink_util.h"
 #include "mavlink_log.h"
 
-typedef struct
+static void init_sticks(rosflight_t *rf)
 {
-  uint8_t channel;
-  bool one_sided;
-} rc_stick_config_t;
+  rf->rc.sticks[RC_STICK_X].channel = get_param_int(rf, PARAM_RC_X_CHANNEL);
+  rf->rc.sticks[RC_STICK_X].one_sided = false;
 
-typedef struct
-{
-  uint8_t channel;
-  int8_t direction;
-  bool mapped;
-} rc_switch_config_t;
-
-static rc_stick_config_t sticks[RC_STICKS_COUNT];
-static rc_switch_config_t switches[RC_SWITCHES_COUNT];
-
-static float stick_values[RC_STICKS_COUNT];
-static bool switch_values[RC_SWITCHES_COUNT];
-
-void init_sticks(void)
-{
-  sticks[RC_STICK_X].channel = get_param_int(PARAM_RC_X_CHANNEL);
-  sticks[RC_STICK_X].one_sided = false;
-
-  sticks[RC_STICK_Y].channel = get_param_int(PARAM_RC_Y_CHANNEL);
-  sticks[RC_STICK_Y].one_sided = false;
+  rf->rc.sticks[RC_STICK_Y].channel = get_param_int(rf, PARAM_RC_Y_CHANNEL);
+  rf->rc.sticks[RC_STICK_Y].one_sided = false;
 
-  sticks[RC_STICK_Z].channel = get_param_int(PARAM_RC_Z_CHANNEL);
-  sticks[RC_STICK_Z].one_sided = false;
+  rf->rc.sticks[RC_STICK_Z].channel = get_param_int(rf, PARAM_RC_Z_CHANNEL);
+  rf->rc.sticks[RC_STICK_Z].one_sided = false;
 
-  sticks[RC_STICK_F].channel = get_param_int(PARAM_RC_F_CHANNEL);
-  sticks[RC_STICK_F].one_sided = true;
+  rf->rc.sticks[RC_STICK_F].channel = get_param_int(rf, PARAM_RC_F_CHANNEL);
+  rf->rc.sticks[RC_STICK_F].one_sided = true;
 }
 
-static void init_switches()
+static void init_switches(rosflight_t *rf)
 {
-  switches[RC_SWITCH_ARM].channel               = get_param_int(PARAM_RC_ARM_CHANNEL);
-  switches[RC_SWITCH_ATT_OVERRIDE].channel      = get_param_int(PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL);
-  switches[RC_SWITCH_THROTTLE_OVERRIDE].channel = get_param_int(PARAM_RC_THROTTLE_OVERRIDE_CHANNEL);
-  switches[RC_SWITCH_ATT_TYPE].channel          = get_param_int(PARAM_RC_ATT_CONTROL_TYPE_CHANNEL);
+  rf->rc.switches[RC_SWITCH_ARM].channel               = get_param_int(rf, PARAM_RC_ARM_CHANNEL);
+  rf->rc.switches[RC_SWITCH_ATT_OVERRIDE].channel      = get_param_int(rf, PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL);
+  rf->rc.switches[RC_SWITCH_THROTTLE_OVERRIDE].channel = get_param_int(rf, PARAM_RC_THROTTLE_OVERRIDE_CHANNEL);
+  rf->rc.switches[RC_SWITCH_ATT_TYPE].channel          = get_param_int(rf, PARAM_RC_ATT_CONTROL_TYPE_CHANNEL);
 
   for (rc_switch_t chan = RC_SWITCH_ARM; chan < RC_SWITCHES_COUNT; chan++)
   {
     //check for a valid stick mapping. Channels 0-3 are reserved for FXYZ
-    switches[chan].mapped = switches[chan].channel > 3 && switches[chan].channel < get_param_int(PARAM_RC_NUM_CHANNELS);
-    if (!switches[chan].mapped)
+    rf->rc.switches[chan].mapped = rf->rc.switches[chan].channel > 3 && rf->rc.switches[chan].channel < get_param_int(rf, PARAM_RC_NUM_CHANNELS);
+    if (!rf->rc.switches[chan].mapped)
     {
-      mavlink_log_error("invalid RC switch channel assignment: %d", switches[chan].channel); // TODO use parameter name
+      mavlink_log_error("invalid RC switch channel assignment: %d", rf->rc.switches[chan].channel); // TODO use parameter name
     }
 
     //get switch toggle direction from associated param
-    switches[chan].direction = 1;
-    switch (switches[chan].channel)
+    rf->rc.switches[chan].direction = 1;
+    switch (rf->rc.switches[chan].channel)
     {
     case 4:
-      switches[chan].direction = get_param_int(PARAM_RC_SWITCH_5_DIRECTION);
+      rf->rc.switches[chan].direction = get_param_int(rf, PARAM_RC_SWITCH_5_DIRECTION);
       break;
     case 5:
-      switches[chan].direction = get_param_int(PARAM_RC_SWITCH_6_DIRECTION);
+      rf->rc.switches[chan].direction = get_param_int(rf, PARAM_RC_SWITCH_6_DIRECTION);
       break;
     case 6:
-      switches[chan].direction = get_param_int(PARAM_RC_SWITCH_7_DIRECTION);
+      rf->rc.switches[chan].direction = get_param_int(rf, PARAM_RC_SWITCH_7_DIRECTION);
       break;
     case 7:
-      switches[chan].direction = get_param_int(PARAM_RC_SWITCH_8_DIRECTION);
+      rf->rc.switches[chan].direction = get_param_int(rf, PARAM_RC_SWITCH_8_DIRECTION);
       break;
     }
   }
 }
 
-void init_rc()
+void init_rc(rosflight_t *rf)
 {
-  init_sticks();
-  init_switches();
+  init_sticks(rf);
+  init_switches(rf);
 }
 
-float rc_stick(rc_stick_t channel)
+float rc_stick(rosflight_t *rf, rc_stick_t channel)
 {
-  return stick_values[channel];
+  return rf->rc.stick_values[channel];
 }
 
-bool rc_switch(rc_switch_t channel)
+#ifdef FIXED_POINT_CONTROL
+q16_t rc_stick_fixed(rosflight_t *rf, rc_stick_t channel)
 {
-  return switch_values[channel];
+  return rf->rc.stick_values_fixed[channel];
 }
+#endif
 
-bool rc_switch_mapped(rc_switch_t channel)
+bool rc_switch(rosflight_t *rf, rc_switch_t channel)
 {
-  return switches[channel].mapped;
+  return rf->rc.switch_values[channel];
 }
 
-bool receive_rc()
+bool rc_switch_mapped(rosflight_t *rf, rc_switch_t channel)
 {
-  static uint32_t last_rc_receive_time = 0;
-
-  uint32_t now = clock_millis();
-
-  // if it has been more than 20ms then look for new RC values and parse them
-  if (now - last_rc_receive_time < 20)
-  {
-    return false;
-  }
-  last_rc_receive_time = now;
+  return rf->rc.switches[channel].mapped;
+}
 
+bool receive_rc(rosflight_t *rf)
+{
+  // the scheduler decides how often we look for new RC values
   // read and normalize stick values
   for (rc_stick_t channel = 0; channel < RC_STICKS_COUNT; channel++)
   {
-    uint16_t pwm = pwm_read(sticks[channel].channel);
-    if (sticks[channel].one_sided) //generally only F is one_sided
+    uint16_t pwm = pwm_read(rf->rc.sticks[channel].channel);
+    if (rf->rc.sticks[channel].one_sided) //generally only F is one_sided
     {
-      stick_values[channel] = (float)(pwm - 1000) / (1000.0);
+      rf->rc.stick_values[channel] = (float)(pwm - 1000) / (1000.0);
+#ifdef FIXED_POINT_CONTROL
+      rf->rc.stick_values_fixed[channel] = ((int32_t) pwm - 1000) * Q16_ONE / 1000;
+#endif
     }
     else
     {
-      stick_values[channel] = (float)(2*(pwm - 1500) / (1000.0));
+      rf->rc.stick_values[channel] = (float)(2*(pwm - 1500) / (1000.0));
+#ifdef FIXED_POINT_CONTROL
+      rf->rc.stick_values_fixed[channel] = ((int32_t) pwm - 1500) * (2*Q16_ONE) / 1000;
+#endif
     }
   }
 
   // read and interpret switch values
   for (rc_switch_t channel = 0; channel < RC_SWITCHES_COUNT; channel++)
   {
-    if (switches[channel].mapped)
+    if (rf->rc.switches[channel].mapped)
     {
       //switch is on/off dependent on its default direction as set in the params/init_switches
-      if (switches[channel].direction <  0)
+      if (rf->rc.switches[channel].direction <  0)
       {
-        switch_values[channel] = pwm_read(switches[channel].channel) < 1250;
+        rf->rc.switch_values[channel] = pwm_read(rf->rc.switches[channel].channel) < 1250;
       }
       else
       {
-        switch_values[channel] = pwm_read(switches[channel].channel) >= 1750;
+        rf->rc.switch_values[channel] = pwm_read(rf->rc.switches[channel].channel) >= 1750;
       }
     }
     else
     {
-      switch_values[channel] = false;
+      rf->rc.switch_values[channel] = false;
     }
   }
 
   // Signal to the mux that we need to compute a new combined command
-  _new_command = true;
+  rf->mux.new_command = true;
   return true;
 }
@@ -32,95 +32,85 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <turbovec.h>
 
 #include "board.h"
 #include "estimator.h"
+#include "latency.h"
 #include "mavlink.h"
 #include "mavlink_param.h"
 #include "mavlink_receive.h"
 #include "mavlink_stream.h"
 #include "mavlink_util.h"
 #include "mode.h"
+#include "mux.h"
 #include "param.h"
 #include "sensors.h"
 #include "controller.h"
 #include "mixer.h"
+#include "profiler.h"
 #include "rc.h"
+#include "scheduler.h"
 
 #include "rosflight.h"
 
 // Initialization Routine
-void rosflight_init(void)
+void rosflight_init(rosflight_t *rf)
 {
+  memset(rf, 0, sizeof(*rf));
+
   init_board();
-  init_mode();
+  init_mode(rf);
+
+  // Set up the stream table before the params, whose change callbacks set the stream rates
+  init_mavlink_stream(rf);
 
   // Read EEPROM to get initial params
-  init_params();
+  init_params(rf);
 
   // Initialize MAVlink Communication
-  init_mavlink();
+  init_mavlink(rf);
 
   /***********************/
   /***  Hardware Setup ***/
   /***********************/
 
   // Initialize PWM and RC
-  init_PWM();
-  init_rc();
+  init_PWM(rf);
+  init_rc(rf);
+  init_mux(rf);
 
   // Initialize Sensors
-  init_sensors();
+  init_sensors(rf);
 
   /***********************/
   /***  Software Setup ***/
   /***********************/
 
   // Initialize Motor Mixing
-  init_mixing();
+  init_mixing(rf);
 
   // Initizlie Controller
-  init_controller();
+  init_controller(rf);
 
   // Initialize Estimator
-  init_estimator();
+  init_estimator(rf);
+
+  // Initialize the profiler and latency monitor
+  init_profiler(rf);
+  init_latency(rf);
+
+  // Initialize the task scheduler last, so that all tasks start on time
+  init_scheduler(rf);
 }
 
 
 // Main loop
-void rosflight_run()
+void rosflight_run(rosflight_t *rf)
 {
-  /*********************/
-  /***  Control Loop ***/
-  /*********************/
-  if (update_sensors()) // 595 | 591 | 590 us
-  {
-    // If I have new IMU data, then perform control
-    run_estimator(); //  212 | 195 us (acc and gyro only, not exp propagation no quadratic integration)
-    run_controller(); // 278 | 271
-    mix_output(); // 16 | 13 us
-
-    // Calculate loop time (from when IMU was captured to now)
-    _loop_time_us = clock_micros() - _current_state.now_us;
-  }
-
-  /*********************/
-  /***  Post-Process ***/
-  /*********************/
-  // internal timers figure out what and when to send
-  mavlink_stream(clock_micros()); // 165 | 27 | 2
-
-  // receive mavlink messages
-  mavlink_receive(); // 159 | 1 | 1
-
-  // update the armed_states, an internal timer runs this at a fixed rate
-  check_mode(); // 108 | 1 | 1
-
-  // get RC, an internal timer runs this every 20 ms (50 Hz)
-  receive_rc(); // 42 | 2 | 1
-
-  // update commands (internal logic tells whether or not we should do anything or not)
-  mux_inputs(); // 6 | 1 | 1
+  // the scheduler runs the control loop whenever new IMU data arrives, and
+  // fits everything else in around it
+  run_scheduler(rf);
 }
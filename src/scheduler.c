@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "controller.h"
+#include "estimator.h"
+#include "latency.h"
+#include "mavlink_receive.h"
+#include "mavlink_stream.h"
+#include "mixer.h"
+#include "mode.h"
+#include "mux.h"
+#include "profiler.h"
+#include "rc.h"
+#include "rosflight.h"
+#include "sensors.h"
+
+#include "scheduler.h"
+
+// Declarations of local function definitions
+static void task_control(rosflight_t *rf);
+static void task_sensors(rosflight_t *rf);
+static void task_mavlink_receive(rosflight_t *rf);
+static void task_check_mode(rosflight_t *rf);
+static void task_receive_rc(rosflight_t *rf);
+static void task_mux_inputs(rosflight_t *rf);
+static void task_mavlink_stream(rosflight_t *rf);
+
+// local variable definitions
+// Budgets leave some margin over the worst-case times measured on an F1 naze.
+// recv, mode and mux change the arming state, params and commands, so the control chain waits for them.
+static const task_t task_table[TASK_COUNT] =
+{
+  { .name = "ctrl", .priority = TASK_PRIORITY_CRITICAL, .period_us = 0,     .budget_us = 900, .atomic = false, .ready = new_imu_data_available, .function = task_control },
+  { .name = "sens", .priority = 3,                      .period_us = 2000,  .budget_us = 600, .atomic = false, .ready = NULL, .function = task_sensors },
+  { .name = "recv", .priority = 1,                      .period_us = 0,     .budget_us = 200, .atomic = true,  .ready = NULL, .function = task_mavlink_receive },
+  { .name = "mode", .priority = 2,                      .period_us = 20000, .budget_us = 150, .atomic = true,  .ready = NULL, .function = task_check_mode },
+  { .name = "rc",   .priority = 2,                      .period_us = 20000, .budget_us = 50,  .atomic = false, .ready = NULL, .function = task_receive_rc },
+  { .name = "mux",  .priority = 2,                      .period_us = 0,     .budget_us = 20,  .atomic = true,  .ready = NULL, .function = task_mux_inputs },
+  { .name = "strm", .priority = 4,                      .period_us = 0,     .budget_us = 200, .atomic = false, .ready = NULL, .function = task_mavlink_stream }
+};
+
+// local function definitions
+static void task_control(rosflight_t *rf)
+{
+  profiler_start(rf, PROFILE_IMU);
+  bool new_imu = update_imu(rf);
+  profiler_stop(rf, PROFILE_IMU);
+
+  if (new_imu)
+  {
+    // If I have new IMU data, then perform control
+    profiler_start(rf, PROFILE_ESTIMATOR);
+    run_estimator(rf);
+    profiler_stop(rf, PROFILE_ESTIMATOR);
+
+    profiler_start(rf, PROFILE_CONTROLLER);
+    run_controller(rf);
+    profiler_stop(rf, PROFILE_CONTROLLER);
+
+    profiler_start(rf, PROFILE_MIXER);
+    mix_output(rf);
+    profiler_stop(rf, PROFILE_MIXER);
+
+    // Calculate loop time (from when IMU was captured to the last PWM write)
+    latency_record(rf, clock_micros() - rf->estimator.state.now_us);
+  }
+}
+
+static void task_sensors(rosflight_t *rf)
+{
+  profiler_start(rf, PROFILE_SENSORS);
+  update_sensors(rf);
+  profiler_stop(rf, PROFILE_SENSORS);
+}
+
+static void task_mavlink_receive(rosflight_t *rf)
+{
+  profiler_start(rf, PROFILE_MAVLINK_RECEIVE);
+  mavlink_receive(rf);
+  profiler_stop(rf, PROFILE_MAVLINK_RECEIVE);
+}
+
+static void task_check_mode(rosflight_t *rf)
+{
+  // update the armed_states
+  check_mode(rf);
+}
+
+static void task_receive_rc(rosflight_t *rf)
+{
+  receive_rc(rf);
+}
+
+static void task_mux_inputs(rosflight_t *rf)
+{
+  // update commands (internal logic tells whether or not we should do anything or not)
+  mux_inputs(rf);
+}
+
+static void task_mavlink_stream(rosflight_t *rf)
+{
+  // internal timers figure out what and when to send
+  profiler_start(rf, PROFILE_MAVLINK_STREAM);
+  mavlink_stream(rf, clock_micros());
+  profiler_stop(rf, PROFILE_MAVLINK_STREAM);
+}
+
+static bool task_due(rosflight_t *rf, const task_t *task, uint64_t now_us)
+{
+  if (task->ready != NULL)
+    return task->ready(rf);
+  return now_us >= task->next_time_us;
+}
+
+static void run_task(rosflight_t *rf, task_t *task)
+{
+  if (task->atomic)
+    soft_interrupt_disable();
+
+  uint64_t start_us = clock_micros();
+  task->function(rf);
+  uint64_t end_us = clock_micros();
+
+  if (task->atomic)
+    soft_interrupt_enable();
+
+  uint32_t exec_us = end_us - start_us;
+  task->last_exec_us = exec_us;
+  if (exec_us > task->max_exec_us)
+    task->max_exec_us = exec_us;
+  if (exec_us > task->budget_us)
+    task->overruns++;
+  task->runs++;
+
+  // Keep a fixed rate, but don't try to catch up on missed periods
+  task->next_time_us += task->period_us;
+  if (task->next_time_us < start_us)
+    task->next_time_us = start_us + task->period_us;
+}
+
+// Runs in the soft interrupt, which the IMU transfer triggers when a sample arrives
+static void run_critical_tasks(void *arg)
+{
+  rosflight_t *rf = (rosflight_t *) arg;
+  scheduler_t *sched = &rf->scheduler;
+  for (int i = 0; i < TASK_COUNT && sched->tasks[sched->order[i]].priority == TASK_PRIORITY_CRITICAL; i++)
+  {
+    task_t *task = &sched->tasks[sched->order[i]];
+    if (task_due(rf, task, clock_micros()))
+      run_task(rf, task);
+  }
+}
+
+// function definitions
+void init_scheduler(rosflight_t *rf)
+{
+  scheduler_t *sched = &rf->scheduler;
+
+  // insertion sort, stable so that table order breaks ties
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    int j = i;
+    while (j > 0 && task_table[sched->order[j-1]].priority > task_table[i].priority)
+    {
+      sched->order[j] = sched->order[j-1];
+      j--;
+    }
+    sched->order[j] = (task_id_t) i;
+  }
+
+  uint64_t now_us = clock_micros();
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    sched->tasks[i] = task_table[i];
+    sched->tasks[i].next_time_us = now_us;
+    sched->tasks[i].last_exec_us = 0;
+    sched->tasks[i].max_exec_us = 0;
+    sched->tasks[i].runs = 0;
+    sched->tasks[i].overruns = 0;
+  }
+
+  // the control chain can only start once everything it uses has been initialized
+  soft_interrupt_register(&run_critical_tasks, rf);
+}
+
+void run_scheduler(rosflight_t *rf)
+{
+  scheduler_t *sched = &rf->scheduler;
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    task_t *task = &sched->tasks[sched->order[i]];
+    if (task->priority != TASK_PRIORITY_CRITICAL && task_due(rf, task, clock_micros()))
+      run_task(rf, task);
+  }
+}
+
+const task_t *scheduler_get_task(rosflight_t *rf, task_id_t id)
+{
+  return &rf->scheduler.tasks[id];
+}
+
+void scheduler_reset_max(rosflight_t *rf, task_id_t id)
+{
+  rf->scheduler.tasks[id].max_exec_us = 0;
+}
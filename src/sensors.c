@@ -35,6 +35,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "board.h"
 #include "mavlink_util.h"
@@ -43,90 +44,195 @@ extern "C" {
 #include "sensors.h"
 #include "estimator.h"
 #include "mode.h"
+#include "rosflight.h"
 
 #include "turbotrig/turbovec.h"
 
+#define MAG_PERIOD_US 13333 // the HMC5883L's fastest continuous output rate, 75 Hz
+
 //==================================================================
-// global variable definitions
+// local function declarations
+static void reset_accel_calibration(rosflight_t *rf);
+static void calibrate_accel(rosflight_t *rf);
+static void calibrate_gyro(rosflight_t *rf);
+static void correct_imu(rosflight_t *rf);
+static void correct_mag(rosflight_t *rf);
+static void imu_ISR(void *arg);
+static void imu_transfer_complete(bool success, void *arg);
+static int round_imu_rate(int rate);
+static void finish_gyro_calibration(rosflight_t *rf);
+static void finish_accel_calibration(rosflight_t *rf);
 
-// IMU
-vector_t _accel;
-vector_t _gyro;
-float _imu_temperature;
-uint64_t _imu_time;
-bool new_imu_data = false;
-bool _imu_sent = false;
 
-// Airspeed
-bool _diff_pressure_present = false;
-float _diff_pressure_velocity, _diff_pressure, _diff_pressure_temp;
+//==================================================================
+// function definitions
+void init_sensors(rosflight_t *rf)
+{
+  update_sensor_params(rf);
+  rf->sensors.new_imu_data = false;
+  rf->sensors.imu_transfer_pending = false;
+  rf->sensors.imu_samples_dropped = 0;
+  rf->sensors.imu_raw_count = 0;
+  rf->sensors.imu_samples_waiting = 0;
+  rf->sensors.imu_sent = false;
+  rf->sensors.last_imu_update_ms = 0;
+  rf->sensors.last_time_look_for_disarmed_sensors = 0;
+  rf->sensors.next_mag_read_us = 0;
+  rf->sensors.mag_count = 0;
+  rf->sensors.calibrating_acc_flag = false;
+  rf->sensors.calibrating_gyro_flag = false;
+  rf->sensors.gyro_cal_count = 0;
+  rf->sensors.gyro_cal_sum.x = 0.0f;
+  rf->sensors.gyro_cal_sum.y = 0.0f;
+  rf->sensors.gyro_cal_sum.z = 0.0f;
+  reset_accel_calibration(rf);
 
-// Barometer
-bool _baro_present = false;
-float _baro_altitude;
-float _baro_pressure;
-float _baro_temperature;
+  // clear the IMU read error
+  rf->mode.error_state &= ~(ERROR_IMU_NOT_RESPONDING);
+  sensors_init();
 
-// Sonar
-bool _sonar_present = false;
-float _sonar_range;
+  // Sample the gyro faster than the control loop runs and average the samples out of the FIFO
+  int oversample = get_param_int(rf, PARAM_CONTROL_RATE_DIV);
+  rf->sensors.imu_oversample = (oversample < 1) ? 1 : (oversample > IMU_MAX_SAMPLES/2) ? IMU_MAX_SAMPLES/2 : oversample;
+  int imu_rate = round_imu_rate(get_param_int(rf, PARAM_IMU_SAMPLE_RATE));
+  set_param_int(rf, PARAM_IMU_SAMPLE_RATE, imu_rate);
+  imu_configure(imu_rate, rf->sensors.imu_oversample > 1);
+  imu_register_callback(&imu_ISR, rf);
 
-// Magnetometer
-bool _mag_present = false;
-vector_t _mag;
+  // See if the IMU is uncalibrated, and throw an error if it is
+  if (get_param_float(rf, PARAM_ACC_X_BIAS) == 0.0 && get_param_float(rf, PARAM_ACC_Y_BIAS) == 0.0 &&
+      get_param_float(rf, PARAM_ACC_Z_BIAS) == 0.0 && get_param_float(rf, PARAM_GYRO_X_BIAS) == 0.0 &&
+      get_param_float(rf, PARAM_GYRO_Y_BIAS) == 0.0 && get_param_float(rf, PARAM_GYRO_Z_BIAS) == 0.0)
+  {
+    rf->mode.error_state |= ERROR_UNCALIBRATED_IMU;
+  }
+}
 
 
-//==================================================================
-// local variable definitions
+void update_sensor_params(rosflight_t *rf)
+{
+  sensors_params_t *params = &rf->sensors.params;
+  params->accel_scale = get_param_float(rf, PARAM_ACCEL_SCALE);
+
+  params->accel_bias.x = get_param_float(rf, PARAM_ACC_X_BIAS);
+  params->accel_bias.y = get_param_float(rf, PARAM_ACC_Y_BIAS);
+  params->accel_bias.z = get_param_float(rf, PARAM_ACC_Z_BIAS);
+  params->accel_temp_comp.x = get_param_float(rf, PARAM_ACC_X_TEMP_COMP);
+  params->accel_temp_comp.y = get_param_float(rf, PARAM_ACC_Y_TEMP_COMP);
+  params->accel_temp_comp.z = get_param_float(rf, PARAM_ACC_Z_TEMP_COMP);
+
+  params->gyro_bias.x = get_param_float(rf, PARAM_GYRO_X_BIAS);
+  params->gyro_bias.y = get_param_float(rf, PARAM_GYRO_Y_BIAS);
+  params->gyro_bias.z = get_param_float(rf, PARAM_GYRO_Z_BIAS);
+
+  params->mag_bias.x = get_param_float(rf, PARAM_MAG_X_BIAS);
+  params->mag_bias.y = get_param_float(rf, PARAM_MAG_Y_BIAS);
+  params->mag_bias.z = get_param_float(rf, PARAM_MAG_Z_BIAS);
+  params->mag_A[0][0] = get_param_float(rf, PARAM_MAG_A11_COMP);
+  params->mag_A[0][1] = get_param_float(rf, PARAM_MAG_A12_COMP);
+  params->mag_A[0][2] = get_param_float(rf, PARAM_MAG_A13_COMP);
+  params->mag_A[1][0] = get_param_float(rf, PARAM_MAG_A21_COMP);
+  params->mag_A[1][1] = get_param_float(rf, PARAM_MAG_A22_COMP);
+  params->mag_A[1][2] = get_param_float(rf, PARAM_MAG_A23_COMP);
+  params->mag_A[2][0] = get_param_float(rf, PARAM_MAG_A31_COMP);
+  params->mag_A[2][1] = get_param_float(rf, PARAM_MAG_A32_COMP);
+  params->mag_A[2][2] = get_param_float(rf, PARAM_MAG_A33_COMP);
+}
 
-// IMU stuff
-float accel[3];
-float gyro[3];
-static bool calibrating_acc_flag;
-static bool calibrating_gyro_flag;
-static void calibrate_accel(void);
-static void calibrate_gyro(void);
-static void correct_imu(void);
-static void correct_mag(void);
-static void imu_ISR(void);
-static bool update_imu(void);
 
+bool new_imu_data_available(rosflight_t *rf)
+{
+  return rf->sensors.new_imu_data;
+}
 
-//==================================================================
-// function definitions
-void init_sensors(void)
+
+bool update_imu(rosflight_t *rf)
 {
-  // clear the IMU read error
-  _error_state &= ~(ERROR_IMU_NOT_RESPONDING);
-  sensors_init();
-  imu_register_callback(&imu_ISR);
+  if (!rf->sensors.new_imu_data)
+    return false;
 
-  // See if the IMU is uncalibrated, and throw an error if it is
-  if (get_param_float(PARAM_ACC_X_BIAS) == 0.0 && get_param_float(PARAM_ACC_Y_BIAS) == 0.0 &&
-      get_param_float(PARAM_ACC_Z_BIAS) == 0.0 && get_param_float(PARAM_GYRO_X_BIAS) == 0.0 &&
-      get_param_float(PARAM_GYRO_Y_BIAS) == 0.0 && get_param_float(PARAM_GYRO_Z_BIAS) == 0.0)
+  rf->mode.error_state &= ~(ERROR_IMU_NOT_RESPONDING);
+  rf->sensors.last_imu_update_ms = clock_millis();
+  rf->estimator.state.now_us = rf->sensors.imu_time;
+  rf->sensors.imu_temperature = rf->sensors.imu_temperature_raw;
+
+  // Decimate the gyro to the control rate.  The average is a boxcar anti-alias filter, whose
+  // nulls fall on the multiples of the control rate that would otherwise alias to DC.  The
+  // accel is only sampled once per update, the bus can't carry it at the gyro rate.
+  float gyro[3] = {0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < rf->sensors.imu_raw_count; i++)
   {
-    _error_state |= ERROR_UNCALIBRATED_IMU;
+    for (int j = 0; j < 3; j++)
+      gyro[j] += rf->sensors.imu_gyro_raw[i][j];
   }
+  float scale = 1.0f / rf->sensors.imu_raw_count;
+
+  rf->sensors.accel.x = rf->sensors.imu_accel_raw[0] * rf->sensors.params.accel_scale;
+  rf->sensors.accel.y = rf->sensors.imu_accel_raw[1] * rf->sensors.params.accel_scale;
+  rf->sensors.accel.z = rf->sensors.imu_accel_raw[2] * rf->sensors.params.accel_scale;
+
+  rf->sensors.gyro.x = gyro[0] * scale;
+  rf->sensors.gyro.y = gyro[1] * scale;
+  rf->sensors.gyro.z = gyro[2] * scale;
+
+  // the data-ready interrupt can start the next transfer into the buffers now
+  rf->sensors.new_imu_data = false;
+
+  if (rf->sensors.calibrating_acc_flag == true)
+    calibrate_accel(rf);
+  if (rf->sensors.calibrating_gyro_flag)
+    calibrate_gyro(rf);
+
+
+  correct_imu(rf);
+  return true;
 }
 
 
-bool update_sensors()
+void update_sensors(rosflight_t *rf)
 {
-  // First, check for new IMU data
-  bool new_imu_data = update_imu();
+  // if we have lost 5 seconds of IMU messages then something is wrong
+  if (clock_millis() > rf->sensors.last_imu_update_ms + 5000)
+  {
+    mavlink_log_error("imu not responding");
+    // Tell the board to fix it
+    rf->sensors.last_imu_update_ms = clock_millis();
+
+    // Indicate an IMU error, and drop any transfer that never finished
+    soft_interrupt_disable();
+    rf->mode.error_state |= ERROR_IMU_NOT_RESPONDING;
+    rf->sensors.imu_transfer_pending = false;
+    soft_interrupt_enable();
+    imu_not_responding_error();
+    int imu_rate = get_param_int(rf, PARAM_IMU_SAMPLE_RATE);
+  imu_configure((imu_rate > IMU_RATE_MAX) ? IMU_RATE_MAX : imu_rate, rf->sensors.imu_oversample > 1);
+  }
+
+  // The control interrupt collects the calibration samples, but saving the result
+  // has to happen out here
+  if (rf->sensors.calibrating_gyro_flag && rf->sensors.gyro_cal_count > 100)
+  {
+    soft_interrupt_disable();
+    finish_gyro_calibration(rf);
+    soft_interrupt_enable();
+  }
+  if (rf->sensors.calibrating_acc_flag && rf->sensors.acc_cal_count > 1000)
+  {
+    soft_interrupt_disable();
+    finish_accel_calibration(rf);
+    soft_interrupt_enable();
+  }
 
   // Now, look for disabled sensors while disarmed (poll every 0.5 seconds)
   // These sensors need power to respond, so they might not have been
   // detected on startup, but will be detected whenever power is applied
   // to the 5V rail.
-  static uint32_t last_time_look_for_disarmed_sensors = 0;
-  if ((_armed_state & ARMED) == 0)
+  if ((rf->mode.armed_state & ARMED) == 0)
   {
     uint32_t now = clock_millis();
-    if (now > (last_time_look_for_disarmed_sensors + 500))
+    if (now > (rf->sensors.last_time_look_for_disarmed_sensors + 500))
     {
-      last_time_look_for_disarmed_sensors = now;
+      rf->sensors.last_time_look_for_disarmed_sensors = now;
       if (!sonar_present())
       {
 //        if(sonar_check())
@@ -154,61 +260,62 @@ bool update_sensors()
   // Update whatever sensos are available
   if (baro_present())
   {
-    baro_read(&_baro_altitude, &_baro_pressure, &_baro_temperature);
+    baro_read(&rf->sensors.baro_altitude, &rf->sensors.baro_pressure, &rf->sensors.baro_temperature);
   }
 
   if (diff_pressure_present())
   {
     if (baro_present())
     {
-      diff_pressure_set_atm(_baro_pressure);
+      diff_pressure_set_atm(rf->sensors.baro_pressure);
     }
-    diff_pressure_read(&_diff_pressure, &_diff_pressure_temp, &_diff_pressure_velocity);
+    diff_pressure_read(&rf->sensors.diff_pressure, &rf->sensors.diff_pressure_temp, &rf->sensors.diff_pressure_velocity);
   }
 
   if (sonar_present())
   {
-    _sonar_range = sonar_read();
+    rf->sensors.sonar_range = sonar_read();
   }
 
-  if (mag_present())
+  // Reading any faster than the magnetometer's output rate would only repeat measurements
+  uint64_t now_us = clock_micros();
+  if (mag_present() && now_us >= rf->sensors.next_mag_read_us)
   {
+    rf->sensors.next_mag_read_us = now_us + MAG_PERIOD_US;
     float mag[3];
     mag_read(mag);
-    _mag.x = mag[0];
-    _mag.y = mag[1];
-    _mag.z = mag[2];
-    correct_mag();
+    rf->sensors.mag.x = mag[0];
+    rf->sensors.mag.y = mag[1];
+    rf->sensors.mag.z = mag[2];
+    correct_mag(rf);
+    rf->sensors.mag_count++;
   }
-
-  // Return whether or not we got new IMU data
-  return new_imu_data;
 }
 
 
-bool start_imu_calibration(void)
+bool start_imu_calibration(rosflight_t *rf)
 {
-  start_gyro_calibration();
+  start_gyro_calibration(rf);
 
-  calibrating_acc_flag = true;
-  set_param_float(PARAM_ACC_X_BIAS, 0.0);
-  set_param_float(PARAM_ACC_Y_BIAS, 0.0);
-  set_param_float(PARAM_ACC_Z_BIAS, 0.0);
+  rf->sensors.calibrating_acc_flag = true;
+  set_param_float(rf, PARAM_ACC_X_BIAS, 0.0);
+  set_param_float(rf, PARAM_ACC_Y_BIAS, 0.0);
+  set_param_float(rf, PARAM_ACC_Z_BIAS, 0.0);
   return true;
 }
 
-bool start_gyro_calibration(void)
+bool start_gyro_calibration(rosflight_t *rf)
 {
-  calibrating_gyro_flag = true;
-  set_param_float(PARAM_GYRO_X_BIAS, 0.0);
-  set_param_float(PARAM_GYRO_Y_BIAS, 0.0);
-  set_param_float(PARAM_GYRO_Z_BIAS, 0.0);
+  rf->sensors.calibrating_gyro_flag = true;
+  set_param_float(rf, PARAM_GYRO_X_BIAS, 0.0);
+  set_param_float(rf, PARAM_GYRO_Y_BIAS, 0.0);
+  set_param_float(rf, PARAM_GYRO_Z_BIAS, 0.0);
   return true;
 }
 
-bool gyro_calibration_complete(void)
+bool gyro_calibration_complete(rosflight_t *rf)
 {
-  return !calibrating_gyro_flag;
+  return !rf->sensors.calibrating_gyro_flag;
 }
 
 
@@ -216,95 +323,115 @@ bool gyro_calibration_complete(void)
 
 //==================================================================
 // local function definitions
-void imu_ISR(void)
+// Data-ready interrupt.  Every imu_oversample interrupts, it starts a transfer of the
+// new samples.  The transfer waits if the control chain hasn't used the last one yet,
+// so the buffers never change while it reads them.
+static void imu_ISR(void *arg)
 {
-  _imu_time = clock_micros();
-  _imu_sent = false;
-  new_imu_data = true;
-}
+  rosflight_t *rf = (rosflight_t *) arg;
+  if (++rf->sensors.imu_samples_waiting < rf->sensors.imu_oversample)
+    return;
 
-
-static bool update_imu(void)
-{
-  static uint32_t last_imu_update_ms = 0;
-
-  if (new_imu_data)
+  if (rf->sensors.new_imu_data || rf->sensors.imu_transfer_pending)
   {
-    _error_state &= ~(ERROR_IMU_NOT_RESPONDING);
-    last_imu_update_ms = clock_millis();
-    _current_state.now_us = _imu_time;
-    if (!imu_read_all(accel, gyro, &_imu_temperature))
-      return false;
-    new_imu_data = false;
-
-    _accel.x = accel[0] * get_param_float(PARAM_ACCEL_SCALE);
-    _accel.y = accel[1] * get_param_float(PARAM_ACCEL_SCALE);
-    _accel.z = accel[2] * get_param_float(PARAM_ACCEL_SCALE);
-
-    _gyro.x = gyro[0];
-    _gyro.y = gyro[1];
-    _gyro.z = gyro[2];
-
-    if (calibrating_acc_flag == true)
-      calibrate_accel();
-    if (calibrating_gyro_flag)
-      calibrate_gyro();
+    // with the FIFO, the samples are still there for the next transfer
+    if (rf->sensors.imu_oversample == 1)
+    {
+      rf->sensors.imu_samples_waiting = 0;
+      rf->sensors.imu_samples_dropped++;
+    }
+    return;
+  }
 
+  rf->sensors.imu_samples_waiting = 0;
+  rf->sensors.imu_time = clock_micros();
+  rf->sensors.imu_transfer_pending = true;
 
-    correct_imu();
-    return true;
+  bool started;
+  if (rf->sensors.imu_oversample > 1)
+  {
+    started = imu_read_fifo_async(rf->sensors.imu_accel_raw, rf->sensors.imu_gyro_raw, &rf->sensors.imu_temperature_raw,
+                                  IMU_MAX_SAMPLES, &rf->sensors.imu_raw_count, &imu_transfer_complete, rf);
   }
   else
   {
-    // if we have lost 5 seconds of IMU messages then something is wrong
-    if (clock_millis() > last_imu_update_ms + 5000)
-    {
-      mavlink_log_error("imu not responding");
-      // Tell the board to fix it
-      last_imu_update_ms = clock_millis();
+    rf->sensors.imu_raw_count = 1;
+    started = imu_read_all_async(rf->sensors.imu_accel_raw, rf->sensors.imu_gyro_raw[0], &rf->sensors.imu_temperature_raw,
+                                 &imu_transfer_complete, rf);
+  }
+  if (!started)
+    rf->sensors.imu_transfer_pending = false;
+}
 
-      // Indicate an IMU error
-      _error_state |= ERROR_IMU_NOT_RESPONDING;
-      imu_not_responding_error();
-    }
-    return false;
+// The gyro samples at IMU_GYRO_RATE divided by a whole number, so of the rates up to
+// IMU_RATE_MAX only 1000, 1600 and 2000 Hz come out exact.  Picks the nearest of those.
+static int round_imu_rate(int rate)
+{
+  rate = (rate < 1000) ? 1000 : (rate > IMU_RATE_MAX) ? IMU_RATE_MAX : rate;
+  int best = IMU_GYRO_RATE / 1000;
+  for (int divider = IMU_GYRO_RATE / IMU_RATE_MAX; divider < IMU_GYRO_RATE / 1000; divider++)
+  {
+    if (IMU_GYRO_RATE % divider == 0 && abs(IMU_GYRO_RATE / divider - rate) < abs(IMU_GYRO_RATE / best - rate))
+      best = divider;
   }
+  return IMU_GYRO_RATE / best;
 }
 
+// Transfer-complete interrupt, hands the sample to the control chain
+static void imu_transfer_complete(bool success, void *arg)
+{
+  rosflight_t *rf = (rosflight_t *) arg;
+  rf->sensors.imu_transfer_pending = false;
+  if (!success)
+  {
+    // the count is then of the samples lost: the one read, or a whole overflowed FIFO
+    rf->sensors.imu_samples_dropped += rf->sensors.imu_raw_count;
+    return;
+  }
+  if (rf->sensors.imu_raw_count == 0)
+    return;
+
+  rf->sensors.imu_sent = false;
+  rf->sensors.new_imu_data = true;
+  soft_interrupt_trigger();
+}
 
-static void calibrate_gyro()
+
+static void calibrate_gyro(rosflight_t *rf)
 {
-  static uint16_t count = 0;
-  static vector_t gyro_sum  = { 0.0f, 0.0f, 0.0f };
-  gyro_sum = vector_add(gyro_sum, _gyro);
-  count++;
+  // stop once there are enough samples, update_sensors() finishes the calibration
+  if (rf->sensors.gyro_cal_count > 100)
+    return;
 
-  if (count > 100)
-  {
-    // Gyros are simple.  Just find the average during the calibration
-    vector_t gyro_bias = scalar_multiply(1.0/(float)count, gyro_sum);
+  rf->sensors.gyro_cal_sum = vector_add(rf->sensors.gyro_cal_sum, rf->sensors.gyro);
+  rf->sensors.gyro_cal_count++;
+}
 
-    if (norm(gyro_bias) < 1.0)
-    {
-      set_param_float(PARAM_GYRO_X_BIAS, gyro_bias.x);
-      set_param_float(PARAM_GYRO_Y_BIAS, gyro_bias.y);
-      set_param_float(PARAM_GYRO_Z_BIAS, gyro_bias.z);
+static void finish_gyro_calibration(rosflight_t *rf)
+{
+  // Gyros are simple.  Just find the average during the calibration
+  vector_t gyro_bias = scalar_multiply(1.0/(float)rf->sensors.gyro_cal_count, rf->sensors.gyro_cal_sum);
 
-      // Tell the estimator to reset it's bias estimate, because it should be zero now
-      reset_adaptive_bias();
-    }
-    else
-    {
-      mavlink_log_error("Too much movement for gyro cal", NULL);
-    }
+  if (norm(gyro_bias) < 1.0)
+  {
+    set_param_float(rf, PARAM_GYRO_X_BIAS, gyro_bias.x);
+    set_param_float(rf, PARAM_GYRO_Y_BIAS, gyro_bias.y);
+    set_param_float(rf, PARAM_GYRO_Z_BIAS, gyro_bias.z);
 
-    // reset calibration in case we do it again
-    calibrating_gyro_flag = false;
-    count = 0;
-    gyro_sum.x = 0.0f;
-    gyro_sum.y = 0.0f;
-    gyro_sum.z = 0.0f;
+    // Tell the estimator to reset it's bias estimate, because it should be zero now
+    reset_adaptive_bias(rf);
   }
+  else
+  {
+    mavlink_log_error("Too much movement for gyro cal", NULL);
+  }
+
+  // reset calibration in case we do it again
+  rf->sensors.calibrating_gyro_flag = false;
+  rf->sensors.gyro_cal_count = 0;
+  rf->sensors.gyro_cal_sum.x = 0.0f;
+  rf->sensors.gyro_cal_sum.y = 0.0f;
+  rf->sensors.gyro_cal_sum.z = 0.0f;
 }
 
 static vector_t vector_max(vector_t a, vector_t b)
@@ -326,130 +453,132 @@ static vector_t vector_min(vector_t a, vector_t b)
 }
 
 
-static void calibrate_accel(void)
+static void reset_accel_calibration(rosflight_t *rf)
+{
+  rf->sensors.acc_cal_count = 0;
+  rf->sensors.acc_cal_sum.x = 0.0f;
+  rf->sensors.acc_cal_sum.y = 0.0f;
+  rf->sensors.acc_cal_sum.z = 0.0f;
+  rf->sensors.acc_cal_temp_sum = 0.0f;
+  rf->sensors.acc_cal_max.x = -1000.0f;
+  rf->sensors.acc_cal_max.y = -1000.0f;
+  rf->sensors.acc_cal_max.z = -1000.0f;
+  rf->sensors.acc_cal_min.x = 1000.0f;
+  rf->sensors.acc_cal_min.y = 1000.0f;
+  rf->sensors.acc_cal_min.z = 1000.0f;
+}
+
+static void calibrate_accel(rosflight_t *rf)
 {
-  static uint16_t count = 0;
-  static vector_t acc_sum  = { 0.0f, 0.0f, 0.0f };
   static const vector_t gravity = {0.0f, 0.0f, 9.80665f};
-  static vector_t max = {-1000.0f, -1000.0f, -1000.0f};
-  static vector_t min = {1000.0f, 1000.0f, 1000.0f};
-  static float acc_temp_sum = 0.0f;
 
-  acc_sum = vector_add(vector_add(acc_sum, _accel), gravity);
-  acc_temp_sum += _imu_temperature;
-  max = vector_max(max, _accel);
-  min = vector_min(min, _accel);
-  count++;
+  // stop once there are enough samples, update_sensors() finishes the calibration
+  if (rf->sensors.acc_cal_count > 1000)
+    return;
+
+  rf->sensors.acc_cal_sum = vector_add(vector_add(rf->sensors.acc_cal_sum, rf->sensors.accel), gravity);
+  rf->sensors.acc_cal_temp_sum += rf->sensors.imu_temperature;
+  rf->sensors.acc_cal_max = vector_max(rf->sensors.acc_cal_max, rf->sensors.accel);
+  rf->sensors.acc_cal_min = vector_min(rf->sensors.acc_cal_min, rf->sensors.accel);
+  rf->sensors.acc_cal_count++;
+}
 
-  if (count > 1000)
+static void finish_accel_calibration(rosflight_t *rf)
+{
+  // The temperature bias is calculated using a least-squares regression.
+  // This is computationally intensive, so it is done by the onboard computer in
+  // fcu_io and shipped over to the flight controller.
+  vector_t accel_temp_bias =
   {
-    // The temperature bias is calculated using a least-squares regression.
-    // This is computationally intensive, so it is done by the onboard computer in
-    // fcu_io and shipped over to the flight controller.
-    vector_t accel_temp_bias =
-    {
-      get_param_float(PARAM_ACC_X_TEMP_COMP),
-      get_param_float(PARAM_ACC_Y_TEMP_COMP),
-      get_param_float(PARAM_ACC_Z_TEMP_COMP)
-    };
-
-    // Figure out the proper accel bias.
-    // We have to consider the contribution of temperature during the calibration,
-    // Which is why this line is so confusing. What we are doing, is first removing
-    // the contribution of temperature to the measurements during the calibration,
-    // Then we are dividing by the number of measurements.
-    vector_t accel_bias = scalar_multiply(1.0/(float)count,
-                                          vector_sub(acc_sum, scalar_multiply(acc_temp_sum, accel_temp_bias)));
-
-    // Sanity Check -
-    // If the accelerometer is upside down or being spun around during the calibration,
-    // then don't do anything
-    if (norm(vector_sub(max, min)) > 1.0)
+    get_param_float(rf, PARAM_ACC_X_TEMP_COMP),
+    get_param_float(rf, PARAM_ACC_Y_TEMP_COMP),
+    get_param_float(rf, PARAM_ACC_Z_TEMP_COMP)
+  };
+
+  // Figure out the proper accel bias.
+  // We have to consider the contribution of temperature during the calibration,
+  // Which is why this line is so confusing. What we are doing, is first removing
+  // the contribution of temperature to the measurements during the calibration,
+  // Then we are dividing by the number of measurements.
+  vector_t accel_bias = scalar_multiply(1.0/(float)rf->sensors.acc_cal_count,
+                                        vector_sub(rf->sensors.acc_cal_sum,
+                                                   scalar_multiply(rf->sensors.acc_cal_temp_sum, accel_temp_bias)));
+
+  // Sanity Check -
+  // If the accelerometer is upside down or being spun around during the calibration,
+  // then don't do anything
+  if (norm(vector_sub(rf->sensors.acc_cal_max, rf->sensors.acc_cal_min)) > 1.0)
+  {
+    mavlink_log_error("Too much movement for IMU cal", NULL);
+    rf->sensors.calibrating_acc_flag = false;
+  }
+  else
+  {
+    if (norm(accel_bias) < 3.0)
     {
-      mavlink_log_error("Too much movement for IMU cal", NULL);
-      calibrating_acc_flag = false;
+      set_param_float(rf, PARAM_ACC_X_BIAS, accel_bias.x);
+      set_param_float(rf, PARAM_ACC_Y_BIAS, accel_bias.y);
+      set_param_float(rf, PARAM_ACC_Z_BIAS, accel_bias.z);
+
+      // clear uncalibrated IMU flag
+      rf->mode.error_state &= ~(ERROR_UNCALIBRATED_IMU);
+
+      mavlink_log_info("IMU offsets captured", NULL);
+
+      // reset the estimated state
+      reset_state(rf);
+      rf->sensors.calibrating_acc_flag = false;
     }
     else
     {
-      if (norm(accel_bias) < 3.0)
+      // check for bad _accel_scale
+      if (norm(accel_bias) > 3.0 && norm(accel_bias) < 6.0)
       {
-        set_param_float(PARAM_ACC_X_BIAS, accel_bias.x);
-        set_param_float(PARAM_ACC_Y_BIAS, accel_bias.y);
-        set_param_float(PARAM_ACC_Z_BIAS, accel_bias.z);
-
-        // clear uncalibrated IMU flag
-        _error_state &= ~(ERROR_UNCALIBRATED_IMU);
-
-        mavlink_log_info("IMU offsets captured", NULL);
-
-        // reset the estimated state
-        reset_state();
-        calibrating_acc_flag = false;
+        mavlink_log_error("Detected bad IMU accel scale value", 0);
+        set_param_float(rf, PARAM_ACCEL_SCALE, 2.0 * get_param_float(rf, PARAM_ACCEL_SCALE));
+        write_params(rf);
+      }
+      else if (norm(accel_bias) > 6.0)
+      {
+        mavlink_log_error("Detected bad IMU accel scale value", 0);
+        set_param_float(rf, PARAM_ACCEL_SCALE, 0.5 * get_param_float(rf, PARAM_ACCEL_SCALE));
+        write_params(rf);
       }
       else
       {
-        // check for bad _accel_scale
-        if (norm(accel_bias) > 3.0 && norm(accel_bias) < 6.0)
-        {
-          mavlink_log_error("Detected bad IMU accel scale value", 0);
-          set_param_float(PARAM_ACCEL_SCALE, 2.0 * get_param_float(PARAM_ACCEL_SCALE));
-          write_params();
-        }
-        else if (norm(accel_bias) > 6.0)
-        {
-          mavlink_log_error("Detected bad IMU accel scale value", 0);
-          set_param_float(PARAM_ACCEL_SCALE, 0.5 * get_param_float(PARAM_ACCEL_SCALE));
-          write_params();
-        }
-        else
-        {
 
-        }
       }
     }
-
-    // reset calibration counters in case we do it again
-    count = 0;
-    acc_sum.x = 0.0f;
-    acc_sum.y = 0.0f;
-    acc_sum.z = 0.0f;
-    acc_temp_sum = 0.0f;
-    max.x = -1000.0f;
-    max.y = -1000.0f;
-    max.z = -1000.0f;
-    min.x = 1000.0f;
-    min.y = 1000.0f;
-    min.z = 1000.0f;
   }
+
+  // reset calibration counters in case we do it again
+  reset_accel_calibration(rf);
 }
 
 
-static void correct_imu(void)
+static void correct_imu(rosflight_t *rf)
 {
   // correct according to known biases and temperature compensation
-  _accel.x -= get_param_float(PARAM_ACC_X_TEMP_COMP)*_imu_temperature + get_param_float(PARAM_ACC_X_BIAS);
-  _accel.y -= get_param_float(PARAM_ACC_Y_TEMP_COMP)*_imu_temperature + get_param_float(PARAM_ACC_Y_BIAS);
-  _accel.z -= get_param_float(PARAM_ACC_Z_TEMP_COMP)*_imu_temperature + get_param_float(PARAM_ACC_Z_BIAS);
+  const sensors_params_t *params = &rf->sensors.params;
+  rf->sensors.accel.x -= params->accel_temp_comp.x*rf->sensors.imu_temperature + params->accel_bias.x;
+  rf->sensors.accel.y -= params->accel_temp_comp.y*rf->sensors.imu_temperature + params->accel_bias.y;
+  rf->sensors.accel.z -= params->accel_temp_comp.z*rf->sensors.imu_temperature + params->accel_bias.z;
 
-  _gyro.x -= get_param_float(PARAM_GYRO_X_BIAS);
-  _gyro.y -= get_param_float(PARAM_GYRO_Y_BIAS);
-  _gyro.z -= get_param_float(PARAM_GYRO_Z_BIAS);
+  rf->sensors.gyro = vector_sub(rf->sensors.gyro, params->gyro_bias);
 }
 
-static void correct_mag(void)
+static void correct_mag(rosflight_t *rf)
 {
   // correct according to known hard iron bias
-  float mag_hard_x = _mag.x - get_param_float(PARAM_MAG_X_BIAS);
-  float mag_hard_y = _mag.y - get_param_float(PARAM_MAG_Y_BIAS);
-  float mag_hard_z = _mag.z - get_param_float(PARAM_MAG_Z_BIAS);
+  const sensors_params_t *params = &rf->sensors.params;
+  float mag_hard_x = rf->sensors.mag.x - params->mag_bias.x;
+  float mag_hard_y = rf->sensors.mag.y - params->mag_bias.y;
+  float mag_hard_z = rf->sensors.mag.z - params->mag_bias.z;
 
   // correct according to known soft iron bias - converts to nT
-  _mag.x = get_param_float(PARAM_MAG_A11_COMP)*mag_hard_x + get_param_float(PARAM_MAG_A12_COMP)*mag_hard_y +
-           get_param_float(PARAM_MAG_A13_COMP)*mag_hard_z;
-  _mag.y = get_param_float(PARAM_MAG_A21_COMP)*mag_hard_x + get_param_float(PARAM_MAG_A22_COMP)*mag_hard_y +
-           get_param_float(PARAM_MAG_A23_COMP)*mag_hard_z;
-  _mag.z = get_param_float(PARAM_MAG_A31_COMP)*mag_hard_x + get_param_float(PARAM_MAG_A32_COMP)*mag_hard_y +
-           get_param_float(PARAM_MAG_A33_COMP)*mag_hard_z;
+  rf->sensors.mag.x = params->mag_A[0][0]*mag_hard_x + params->mag_A[0][1]*mag_hard_y + params->mag_A[0][2]*mag_hard_z;
+  rf->sensors.mag.y = params->mag_A[1][0]*mag_hard_x + params->mag_A[1][1]*mag_hard_y + params->mag_A[1][2]*mag_hard_z;
+  rf->sensors.mag.z = params->mag_A[2][0]*mag_hard_x + params->mag_A[2][1]*mag_hard_y + params->mag_A[2][2]*mag_hard_z;
 }
 
 